@@ -0,0 +1,556 @@
+/*
+ * memtrack_bench.c -- microbenchmarks comparing the tracked allocation paths of
+ *                     memtrack with the underlying C library
+ * version 0.9.3, June 15, 2025
+ *
+ * License: zlib License
+ *
+ * Copyright (c) 2025 Kazushi Yamasaki
+ *
+ * This software is provided ‘as-is’, without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source
+ * distribution.
+ *
+ *
+ *
+ * Usage:
+ *     memtrack_bench [-t max_threads] [-n ops_per_thread] [-w live_blocks] [-b benchmark]
+ *
+ * Every benchmark runs with 1, 2, 4, ... up to max_threads threads (default 4) and,
+ * where sizes matter, with each size distribution, once on the C library and once on
+ * memtrack. Each thread keeps live_blocks (default 256) blocks alive and replaces them
+ * in turn, so the tracking table is never empty. ns/op is the wall time multiplied by
+ * the number of threads and divided by the number of operations, that is the average
+ * time one thread spends per operation. -b runs only the benchmarks whose name
+ * contains the given text.
+ *
+ * The benchmark is built by "make bench" with the same LIB_MODE and LIB_FEATURES as the
+ * library, so the modes can be compared by rebuilding with different features.
+ */
+
+/* 比較のため、標準関数は置き換えずに memtrack の関数を明示的に呼び出す */
+#define MEMTRACK_DISABLE_REPLACE_STANDARD_FUNC
+#define MEMTRACK_AA_DISABLE_REPLACE_STANDARD_FUNC
+#define MEMTRACK_DISABLE_REPLACE_ANDA_FUNC
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifdef __GLIBC__
+	#include <malloc.h>
+#endif
+
+#include "memtrack_aligned_alloc/memtrack_aligned_alloc.h"
+#include "memtrack_alloc_nd_array/memtrack_alloc_nd_array.h"
+#include "memtrack.h"
+
+
+#if !defined (__STDC_VERSION__) || (__STDC_VERSION__ < 201112L)
+	#error "This program requires C11 or higher."
+#endif
+
+#ifdef MEMTRACK_DISABLE
+	#error "The benchmark measures the cost of tracking and cannot be built with MEMTRACK_DISABLE."
+#endif
+
+/* mallinfo2 は glibc 2.33 以降でのみ使える */
+#if defined (__GLIBC__) && ((__GLIBC__ > 2) || ((__GLIBC__ == 2) && (__GLIBC_MINOR__ >= 33)))
+	#define BENCH_HAVE_MALLINFO2
+#endif
+
+
+#define BENCH_SIZE_TABLE 4096  /* 各スレッドが順に使うサイズの表の要素数（2 の累乗） */
+#define BENCH_ALIGNMENT 64
+#define BENCH_OVERHEAD_BLOCKS 65536  /* 追跡のメモリ使用量を測る際に生存させるブロック数 */
+#define BENCH_MAX_THREADS 256
+
+
+typedef struct {
+	const char* name;
+	size_t min;
+	size_t max;  /* この範囲から対数一様に選ぶ */
+} BenchDistribution;
+
+static const BenchDistribution bench_distributions[] = {
+	{ "small", 8, 128 },
+	{ "medium", 256, 4096 },
+	{ "large", 16384, 262144 },
+	{ "mixed", 8, 65536 },
+};
+
+#define BENCH_DISTRIBUTION_COUNT (sizeof(bench_distributions) / sizeof(bench_distributions[0]))
+
+
+/* スレッドごとの作業内容 */
+typedef struct {
+	const size_t* sizes;
+	size_t offset;  /* サイズ表を読み始める位置、スレッドごとにずらす */
+	size_t ops;
+	size_t window;
+	void** slots;
+	pthread_barrier_t* barrier;
+	void (*run) (void* worker);
+	volatile unsigned char sink;
+} BenchWorker;
+
+
+typedef struct {
+	const char* name;
+	bool sized;  /* サイズの分布ごとに実行する */
+	void (*libc) (void* worker);
+	void (*memtrack) (void* worker);
+} Benchmark;
+
+
+static inline uint64_t bench_now (void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+
+static inline size_t bench_size (const BenchWorker* worker, size_t i) {
+	return worker->sizes[(worker->offset + i) & (BENCH_SIZE_TABLE - 1)];
+}
+
+
+/* 最適化で確保と解放の組が取り除かれないよう、確保したメモリに触れる */
+static inline void bench_touch (BenchWorker* worker, void* ptr) {
+	*(volatile unsigned char*)ptr = 1;
+	worker->sink ^= *(volatile unsigned char*)ptr;
+}
+
+
+/* 再現性のため固定のシードを用いる xorshift64* */
+static uint64_t bench_random (uint64_t* state) {
+	uint64_t x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+
+/* min から max の範囲で対数一様に分布するサイズの表を作る */
+static void bench_fill_sizes (size_t* sizes, const BenchDistribution* distribution) {
+	uint64_t state = 0x9E3779B97F4A7C15ULL;
+	unsigned int min_shift = 0;
+	unsigned int max_shift = 0;
+	while (((size_t)1 << (min_shift + 1)) <= distribution->min) min_shift++;
+	while (((size_t)1 << max_shift) < distribution->max) max_shift++;
+
+	for (size_t i = 0; i < BENCH_SIZE_TABLE; i++) {
+		unsigned int shift = min_shift + (unsigned int)(bench_random(&state) % (max_shift - min_shift + 1));
+		size_t base = (size_t)1 << shift;
+		size_t size = base + (size_t)(bench_random(&state) % base);  /* 2 の累乗ちょうどに偏らないようにする */
+		if (size < distribution->min) size = distribution->min;
+		if (size > distribution->max) size = distribution->max;
+		sizes[i] = size;
+	}
+}
+
+
+/* malloc と free: 生存中のブロックを 1 つずつ新しいサイズのブロックに入れ替える */
+static void bench_malloc_free_libc (void* arg) {
+	BenchWorker* worker = arg;
+	for (size_t i = 0; i < worker->ops; i++) {
+		void** slot = &worker->slots[i % worker->window];
+		free(*slot);
+		*slot = malloc(bench_size(worker, i));
+		bench_touch(worker, *slot);
+	}
+}
+
+static void bench_malloc_free_memtrack (void* arg) {
+	BenchWorker* worker = arg;
+	for (size_t i = 0; i < worker->ops; i++) {
+		void** slot = &worker->slots[i % worker->window];
+		memtrack_free(*slot, __FILE__, __LINE__);
+		*slot = memtrack_malloc(bench_size(worker, i), __FILE__, __LINE__);
+		bench_touch(worker, *slot);
+	}
+}
+
+
+/* realloc で 2 倍ずつ 64 KiB まで伸ばす（1 回の realloc を 1 操作と数える） */
+static void bench_realloc_double_libc (void* arg) {
+	BenchWorker* worker = arg;
+	void** slot = &worker->slots[0];
+	size_t size = 16;
+	for (size_t i = 0; i < worker->ops; i++) {
+		*slot = realloc(*slot, size);
+		bench_touch(worker, *slot);
+		size = (size >= 65536) ? 16 : size * 2;
+		if (size == 16) {
+			free(*slot);
+			*slot = NULL;
+		}
+	}
+}
+
+static void bench_realloc_double_memtrack (void* arg) {
+	BenchWorker* worker = arg;
+	void** slot = &worker->slots[0];
+	size_t size = 16;
+	for (size_t i = 0; i < worker->ops; i++) {
+		*slot = memtrack_realloc(*slot, size, __FILE__, __LINE__);
+		bench_touch(worker, *slot);
+		size = (size >= 65536) ? 16 : size * 2;
+		if (size == 16) {
+			memtrack_free(*slot, __FILE__, __LINE__);
+			*slot = NULL;
+		}
+	}
+}
+
+
+/* realloc で 16 バイトずつ 4 KiB まで伸ばす、文字列バッファなどに多い伸ばし方 */
+static void bench_realloc_step_libc (void* arg) {
+	BenchWorker* worker = arg;
+	void** slot = &worker->slots[0];
+	size_t size = 16;
+	for (size_t i = 0; i < worker->ops; i++) {
+		*slot = realloc(*slot, size);
+		bench_touch(worker, *slot);
+		size = (size >= 4096) ? 16 : size + 16;
+		if (size == 16) {
+			free(*slot);
+			*slot = NULL;
+		}
+	}
+}
+
+static void bench_realloc_step_memtrack (void* arg) {
+	BenchWorker* worker = arg;
+	void** slot = &worker->slots[0];
+	size_t size = 16;
+	for (size_t i = 0; i < worker->ops; i++) {
+		*slot = memtrack_realloc(*slot, size, __FILE__, __LINE__);
+		bench_touch(worker, *slot);
+		size = (size >= 4096) ? 16 : size + 16;
+		if (size == 16) {
+			memtrack_free(*slot, __FILE__, __LINE__);
+			*slot = NULL;
+		}
+	}
+}
+
+
+/* aligned_alloc と free: C11 の aligned_alloc に合わせてサイズをアライメントの倍数に切り上げる */
+static void bench_aligned_alloc_libc (void* arg) {
+	BenchWorker* worker = arg;
+	for (size_t i = 0; i < worker->ops; i++) {
+		void** slot = &worker->slots[i % worker->window];
+		free(*slot);
+		*slot = aligned_alloc(BENCH_ALIGNMENT, (bench_size(worker, i) + BENCH_ALIGNMENT - 1) & ~(size_t)(BENCH_ALIGNMENT - 1));
+		bench_touch(worker, *slot);
+	}
+}
+
+static void bench_aligned_alloc_memtrack (void* arg) {
+	BenchWorker* worker = arg;
+	for (size_t i = 0; i < worker->ops; i++) {
+		void** slot = &worker->slots[i % worker->window];
+		memtrack_free(*slot, __FILE__, __LINE__);
+		*slot = memtrack_aligned_alloc(BENCH_ALIGNMENT, (bench_size(worker, i) + BENCH_ALIGNMENT - 1) & ~(size_t)(BENCH_ALIGNMENT - 1), __FILE__, __LINE__);
+		bench_touch(worker, *slot);
+	}
+}
+
+
+/* 4 x 8 x 16 の double の 3 次元配列の確保と解放 */
+static const size_t bench_nd_sizes[] = { 4, 8, 16 };
+
+static void bench_nd_array_libc (void* arg) {
+	BenchWorker* worker = arg;
+	size_t size_ptrs, size_padding, total_elements;
+	if (!calculate_nd_array_size(bench_nd_sizes, 3, sizeof(double), &size_ptrs, &size_padding, &total_elements)) return;
+
+	for (size_t i = 0; i < worker->ops; i++) {
+		void** slot = &worker->slots[i % worker->window];
+		free(*slot);
+		*slot = allocate_and_initialize_nd_array(bench_nd_sizes, 3, sizeof(double), size_ptrs, size_padding, total_elements, malloc);
+		bench_touch(worker, *slot);
+	}
+}
+
+static void bench_nd_array_memtrack (void* arg) {
+	BenchWorker* worker = arg;
+	for (size_t i = 0; i < worker->ops; i++) {
+		void** slot = &worker->slots[i % worker->window];
+		if (*slot != NULL) memtrack_free_nd_array(*slot, __FILE__, __LINE__);
+		*slot = memtrack_alloc_nd_array(bench_nd_sizes, 3, sizeof(double), __FILE__, __LINE__);
+		bench_touch(worker, *slot);
+	}
+}
+
+
+/* 生存中のブロックのサイズを問い合わせる、比較対象は glibc の malloc_usable_size */
+static void bench_get_size_libc (void* arg) {
+	BenchWorker* worker = arg;
+	size_t total = 0;
+	for (size_t i = 0; i < worker->ops; i++) {
+#ifdef __GLIBC__
+		total += malloc_usable_size(worker->slots[(i * 7) % worker->window]);
+#else
+		total += (size_t)(worker->slots[(i * 7) % worker->window] != NULL);
+#endif
+	}
+	worker->sink ^= (unsigned char)total;
+}
+
+static void bench_get_size_memtrack (void* arg) {
+	BenchWorker* worker = arg;
+	size_t total = 0;
+	for (size_t i = 0; i < worker->ops; i++)
+		total += memtrack_get_size(worker->slots[(i * 7) % worker->window], __FILE__, __LINE__);
+	worker->sink ^= (unsigned char)total;
+}
+
+
+static const Benchmark bench_benchmarks[] = {
+	{ "malloc_free", true, bench_malloc_free_libc, bench_malloc_free_memtrack },
+	{ "realloc_double", false, bench_realloc_double_libc, bench_realloc_double_memtrack },
+	{ "realloc_step", false, bench_realloc_step_libc, bench_realloc_step_memtrack },
+	{ "aligned_alloc", true, bench_aligned_alloc_libc, bench_aligned_alloc_memtrack },
+	{ "nd_array", false, bench_nd_array_libc, bench_nd_array_memtrack },
+	{ "get_size", true, bench_get_size_libc, bench_get_size_memtrack },
+};
+
+#define BENCH_BENCHMARK_COUNT (sizeof(bench_benchmarks) / sizeof(bench_benchmarks[0]))
+
+
+/* get_size は生存中のブロックを問い合わせるため、計測の前に同じ方法で確保しておく */
+static void bench_prefill (BenchWorker* worker, bool tracked) {
+	for (size_t i = 0; i < worker->window; i++) {
+		size_t size = bench_size(worker, i);
+		worker->slots[i] = tracked ? memtrack_malloc(size, __FILE__, __LINE__) : malloc(size);
+	}
+}
+
+
+static void bench_release (BenchWorker* worker, bool tracked, bool nd_array) {
+	for (size_t i = 0; i < worker->window; i++) {
+		if (worker->slots[i] == NULL) continue;
+		if (!tracked)
+			free(worker->slots[i]);
+		else if (nd_array)
+			memtrack_free_nd_array(worker->slots[i], __FILE__, __LINE__);
+		else
+			memtrack_free(worker->slots[i], __FILE__, __LINE__);
+		worker->slots[i] = NULL;
+	}
+}
+
+
+static void* bench_thread (void* arg) {
+	BenchWorker* worker = arg;
+	pthread_barrier_wait(worker->barrier);
+	worker->run(worker);
+	return NULL;
+}
+
+
+/* threads 個のスレッドで run を実行し、開始から全スレッドの終了までの時間を返す */
+static uint64_t bench_run (const Benchmark* benchmark, bool tracked, const size_t* sizes, size_t threads, size_t ops, size_t window, BenchWorker* workers) {
+	pthread_t ids[BENCH_MAX_THREADS];
+	pthread_barrier_t barrier;
+	pthread_barrier_init(&barrier, NULL, (unsigned int)threads + 1);
+
+	bool prefill = (benchmark->libc == bench_get_size_libc);
+	for (size_t i = 0; i < threads; i++) {
+		BenchWorker* worker = &workers[i];
+		worker->sizes = sizes;
+		worker->offset = i * 977;
+		worker->ops = ops;
+		worker->window = window;
+		worker->barrier = &barrier;
+		worker->run = tracked ? benchmark->memtrack : benchmark->libc;
+		memset(worker->slots, 0, sizeof(void*) * window);
+		if (prefill) bench_prefill(worker, tracked);
+	}
+
+	size_t started = 0;
+	for (; started < threads; started++) {
+		if (pthread_create(&ids[started], NULL, bench_thread, &workers[started]) != 0) {
+			fprintf(stderr, "Failed to create a thread.\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	pthread_barrier_wait(&barrier);
+	uint64_t start = bench_now();
+	for (size_t i = 0; i < started; i++) pthread_join(ids[i], NULL);
+	uint64_t elapsed = bench_now() - start;
+
+	for (size_t i = 0; i < threads; i++)
+		bench_release(&workers[i], tracked, benchmark->libc == bench_nd_array_libc);
+
+	pthread_barrier_destroy(&barrier);
+	return elapsed;
+}
+
+
+static void bench_print (const Benchmark* benchmark, const char* distribution, size_t threads, size_t ops, uint64_t libc_ns, uint64_t memtrack_ns) {
+	unsigned long long total = (unsigned long long)ops * threads;
+	if (libc_ns == 0) libc_ns = 1;
+	if (memtrack_ns == 0) memtrack_ns = 1;
+
+	/* 浮動小数点数を避け、小数点以下 1 桁までを整数演算で求める */
+	unsigned long long libc_per_op = (unsigned long long)libc_ns * threads * 10 / total;
+	unsigned long long memtrack_per_op = (unsigned long long)memtrack_ns * threads * 10 / total;
+	unsigned long long ratio = (unsigned long long)memtrack_ns * 100 / libc_ns;
+	unsigned long long libc_kops = total * 1000000ULL / libc_ns;
+	unsigned long long memtrack_kops = total * 1000000ULL / memtrack_ns;
+
+	printf("%-15s %-7s %7zu %10llu.%llu %10llu.%llu %6llu.%02llux %12llu %12llu\n", benchmark->name, distribution, threads, libc_per_op / 10, libc_per_op % 10, memtrack_per_op / 10, memtrack_per_op % 10, ratio / 100, ratio % 100, libc_kops, memtrack_kops);
+}
+
+
+#ifdef BENCH_HAVE_MALLINFO2
+static long long bench_heap_in_use (void) {
+	struct mallinfo2 info = mallinfo2();
+	return (long long)info.uordblks + (long long)info.hblkhd;
+}
+#endif
+
+
+/* 同じ数と大きさのブロックを生存させた時のヒープ使用量の差から、1 ブロックあたりの追跡のコストを求める */
+static void bench_overhead (void) {
+#ifdef BENCH_HAVE_MALLINFO2
+	void** blocks = calloc(BENCH_OVERHEAD_BLOCKS, sizeof(void*));
+	if (blocks == NULL) {
+		fprintf(stderr, "Memory allocation failed.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	long long before = bench_heap_in_use();
+	for (size_t i = 0; i < BENCH_OVERHEAD_BLOCKS; i++) blocks[i] = malloc(64);
+	long long libc_bytes = bench_heap_in_use() - before;
+	for (size_t i = 0; i < BENCH_OVERHEAD_BLOCKS; i++) free(blocks[i]);
+
+	before = bench_heap_in_use();
+	for (size_t i = 0; i < BENCH_OVERHEAD_BLOCKS; i++) blocks[i] = memtrack_malloc(64, __FILE__, __LINE__);
+	long long memtrack_bytes = bench_heap_in_use() - before;
+	for (size_t i = 0; i < BENCH_OVERHEAD_BLOCKS; i++) memtrack_free(blocks[i], __FILE__, __LINE__);
+
+	free(blocks);
+	printf("Tracking memory overhead: %lld bytes per live block (%d live blocks of 64 bytes, heap in use %lld bytes with libc, %lld bytes with memtrack)\n", (memtrack_bytes - libc_bytes) / BENCH_OVERHEAD_BLOCKS, BENCH_OVERHEAD_BLOCKS, libc_bytes, memtrack_bytes);
+#else
+	printf("Tracking memory overhead: not available (requires glibc 2.33 or later)\n");
+#endif
+}
+
+
+static void bench_usage (const char* name) {
+	fprintf(stderr, "Usage: %s [-t max_threads] [-n ops_per_thread] [-w live_blocks] [-b benchmark]\n", name);
+}
+
+
+static bool bench_parse_size (const char* text, size_t* result) {
+	char* end;
+	unsigned long long value = strtoull(text, &end, 10);
+	if (end == text || *end != '\0' || value == 0 || value > SIZE_MAX) return false;
+	*result = (size_t)value;
+	return true;
+}
+
+
+int main (int argc, char** argv) {
+	size_t max_threads = 4;
+	size_t ops = 200000;
+	size_t window = 256;
+	const char* filter = NULL;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "t:n:w:b:")) != -1) {
+		switch (opt) {
+			case 't':
+				if (!bench_parse_size(optarg, &max_threads) || max_threads > BENCH_MAX_THREADS) {
+					fprintf(stderr, "The number of threads must be from 1 to %d.\n", BENCH_MAX_THREADS);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'n':
+				if (!bench_parse_size(optarg, &ops)) {
+					fprintf(stderr, "Invalid number of operations: %s\n", optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'w':
+				if (!bench_parse_size(optarg, &window)) {
+					fprintf(stderr, "Invalid number of live blocks: %s\n", optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'b':
+				filter = optarg;
+				break;
+			default:
+				bench_usage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	if (optind != argc) {
+		bench_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	static size_t sizes[BENCH_DISTRIBUTION_COUNT][BENCH_SIZE_TABLE];
+	for (size_t i = 0; i < BENCH_DISTRIBUTION_COUNT; i++) bench_fill_sizes(sizes[i], &bench_distributions[i]);
+
+	BenchWorker* workers = calloc(max_threads, sizeof(BenchWorker));
+	void** slots = calloc(max_threads * window, sizeof(void*));
+	if (workers == NULL || slots == NULL) {
+		fprintf(stderr, "Memory allocation failed.\n");
+		return EXIT_FAILURE;
+	}
+	for (size_t i = 0; i < max_threads; i++) workers[i].slots = &slots[i * window];
+
+	printf("%zu operations per thread, %zu live blocks per thread\n\n", ops, window);
+	printf("%-15s %-7s %7s %12s %12s %8s %12s %12s\n", "benchmark", "sizes", "threads", "libc ns/op", "memtrack", "ratio", "libc kops/s", "memtrack");
+
+	for (size_t b = 0; b < BENCH_BENCHMARK_COUNT; b++) {
+		const Benchmark* benchmark = &bench_benchmarks[b];
+		if (filter != NULL && strstr(benchmark->name, filter) == NULL) continue;
+
+		size_t distributions = benchmark->sized ? BENCH_DISTRIBUTION_COUNT : 1;
+		for (size_t d = 0; d < distributions; d++) {
+			const char* distribution = benchmark->sized ? bench_distributions[d].name : "-";
+			for (size_t threads = 1; threads <= max_threads; threads = (threads * 2 > max_threads && threads != max_threads) ? max_threads : threads * 2) {
+				uint64_t libc_ns = bench_run(benchmark, false, sizes[d], threads, ops, window, workers);
+				uint64_t memtrack_ns = bench_run(benchmark, true, sizes[d], threads, ops, window, workers);
+				bench_print(benchmark, distribution, threads, ops, libc_ns, memtrack_ns);
+			}
+		}
+	}
+
+	printf("\n");
+	bench_overhead();
+
+	free(slots);
+	free(workers);
+	return EXIT_SUCCESS;
+}
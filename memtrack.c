@@ -27,6 +27,11 @@
  * distribution.
  */
 
+/* バックトレースの表示に dladdr を使うため */
+#if defined (MEMTRACK_BACKTRACE) && !defined (_GNU_SOURCE)
+	#define _GNU_SOURCE
+#endif
+
 #include "memtrack.h"
 
 #include <stdio.h>
@@ -59,668 +64,6534 @@
 
 
 #include <string.h>
+#include <stdint.h>
 
 
-#undef malloc
-#undef calloc
-#undef realloc
-#undef free
+/* スレッドバッファモードはシャードモードの仕組みの上に構築される */
+#if defined (MEMTRACK_THREAD_BUFFER) && !defined (MEMTRACK_SHARDED)
+	#define MEMTRACK_SHARDED
+#endif
 
+#ifdef MEMTRACK_SHARDED
+	#if !defined (__STDC_VERSION__) || (__STDC_VERSION__ < 201112L)
+		#error "MEMTRACK_SHARDED requires C11 or higher."
+	#endif
 
-#define MEMTRACK_ENTRIES_COUNT 64
-#define MEMTRACK_ENTRIES_TRIAL 4
+	#ifndef THREAD_LOCAL
+		#error "MEMTRACK_SHARDED requires thread-local storage."
+	#endif
 
+	#include <stdint.h>
+	#include <stdatomic.h>
+	#include <pthread.h>
+#endif
 
-typedef struct {
-	void* ptr;
-	size_t size;
-#ifdef DEBUG
-	const char* alloc_file;
-	const char* last_realloc_file;
-	const char* free_file;
-	int alloc_line;
-	int last_realloc_line;
-	int free_line;
-	bool is_freed;
+#ifdef MEMTRACK_HEADER
+	#if !defined (__STDC_VERSION__) || (__STDC_VERSION__ < 201112L)
+		#error "MEMTRACK_HEADER requires C11 or higher."
+	#endif
+
+	#include <stdint.h>
 #endif
-} MemTrackEntry;  /* パディングの削減のため順序がわかりにくくなっているので注意 */
 
+#ifdef MEMTRACK_SAMPLING
+	#if !defined (__STDC_VERSION__) || (__STDC_VERSION__ < 201112L)
+		#error "MEMTRACK_SAMPLING requires C11 or higher."
+	#endif
 
-static HashTable* memtrack_entries = NULL;
+	#ifndef THREAD_LOCAL
+		#error "MEMTRACK_SAMPLING requires thread-local storage."
+	#endif
 
+	#if defined (MEMTRACK_THREAD_BUFFER) || defined (MEMTRACK_HEADER)
+		#error "MEMTRACK_SAMPLING cannot be combined with MEMTRACK_THREAD_BUFFER or MEMTRACK_HEADER."
+	#endif
 
-#define GLOBAL_LOCK_FUNC_NAME memtrack_lock
-#define GLOBAL_UNLOCK_FUNC_NAME memtrack_unlock
-#define GLOBAL_LOCK_FUNC_SCOPE 
+	#include <stdint.h>
+	#include <stdatomic.h>
+#endif
 
-#include "global_lock.h"
+#ifdef MEMTRACK_SITE_STATS
+	#if !defined (__STDC_VERSION__) || (__STDC_VERSION__ < 201112L)
+		#error "MEMTRACK_SITE_STATS requires C11 or higher."
+	#endif
 
+	#include <stdint.h>
+	#include <stdatomic.h>
+#endif
 
-static void quit (void);
+#ifdef MEMTRACK_CALL_SITE
+	#if !defined (__STDC_VERSION__) || (__STDC_VERSION__ < 201112L)
+		#error "MEMTRACK_CALL_SITE requires C11 or higher."
+	#endif
 
-/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
-static void init (void) {
-	for (size_t i = 0; i < MEMTRACK_ENTRIES_TRIAL; i++) {
-		memtrack_entries = ht_create(MEMTRACK_ENTRIES_COUNT);
-		if (LIKELY(memtrack_entries != NULL)) break;
-	}
-	if (UNLIKELY(memtrack_entries == NULL)) {
-		fprintf(stderr, "Failed to initialize memory tracking.\nFile: %s   Line: %d\n", __FILE__, __LINE__);
-		memtrack_unlock();
-		global_lock_quit();
-		exit(EXIT_FAILURE);
-	}
+	#include <stdint.h>
+	#include <stdatomic.h>
+#endif
 
-	atexit(quit);
-}
+#ifdef MEMTRACK_DEFERRED_DIAG
+	#if !defined (__STDC_VERSION__) || (__STDC_VERSION__ < 201112L)
+		#error "MEMTRACK_DEFERRED_DIAG requires C11 or higher."
+	#endif
 
+	#include <stdint.h>
+	#include <stdatomic.h>
+	#include <time.h>
+#endif
 
-void memtrack_entry_add (void* ptr, size_t size, const char* file, int line) {
-	if (ptr == NULL) {
-		fprintf(stderr, "ptr is null! Memory cannot be tracked!\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		memtrack_errfunc = "memtrack_entry_add";
-		return;
-	}
+#ifdef MEMTRACK_TRACE
+	#if !defined (__STDC_VERSION__) || (__STDC_VERSION__ < 201112L)
+		#error "MEMTRACK_TRACE requires C11 or higher."
+	#endif
 
-	if (UNLIKELY(memtrack_entries == NULL)) init();
+	#ifndef THREAD_LOCAL
+		#error "MEMTRACK_TRACE requires thread-local storage."
+	#endif
 
-	MemTrackEntry entry = {
-		.ptr = ptr,
-		.size = size
-#ifdef DEBUG
-		, 
-		.alloc_file = file,
-		.alloc_line = line,
-		.last_realloc_file = NULL,
-		.last_realloc_line = 0,
-		.is_freed = false,
-		.free_file = NULL,
-		.free_line = 0
+	#include "memtrack_trace.h"
+
+	#include <stdint.h>
+	#include <stdatomic.h>
+	#include <time.h>
+	#include <fcntl.h>
+	#include <sys/mman.h>
 #endif
-	};
 
-	if (UNLIKELY(!ht_set(memtrack_entries, (key_type)ptr, &entry, sizeof(MemTrackEntry)))) {
-		fprintf(stderr, "Failed to add entry to memory tracking.\nFile: %s   Line: %d\n", file, line);
-		memtrack_errfunc = "memtrack_entry_add";
-	}
-}
+#ifdef MEMTRACK_HISTOGRAM
+	#if !defined (__STDC_VERSION__) || (__STDC_VERSION__ < 201112L)
+		#error "MEMTRACK_HISTOGRAM requires C11 or higher."
+	#endif
 
+	#ifndef THREAD_LOCAL
+		#error "MEMTRACK_HISTOGRAM requires thread-local storage."
+	#endif
 
-void memtrack_entry_update (void* old_ptr, void* new_ptr, size_t new_size, const char* file, int line) {
-	if (old_ptr == NULL) {
-		memtrack_entry_add(new_ptr, new_size, file, line);
-		return;
-	}
+	#include <stdint.h>
+	#include <stdatomic.h>
+	#include <time.h>
+	#include <pthread.h>
+#endif
 
-	if (new_ptr == NULL) new_ptr = old_ptr;
+#ifdef MEMTRACK_REPORTER
+	#if !defined (__STDC_VERSION__) || (__STDC_VERSION__ < 201112L)
+		#error "MEMTRACK_REPORTER requires C11 or higher."
+	#endif
 
-	if (UNLIKELY(memtrack_entries == NULL)) {
-		init();
+	#ifndef MEMTRACK_SITE_STATS
+		#error "MEMTRACK_REPORTER requires MEMTRACK_SITE_STATS."
+	#endif
 
-		fprintf(stderr, "No entry found to update! The memory might not be tracked.\nFile: %s   Line: %d\n", file, line);
-		errno = EPERM;
+	#include <stdint.h>
+	#include <stdatomic.h>
+	#include <time.h>
+	#include <pthread.h>
+#endif
 
-		memtrack_entry_add(new_ptr, new_size, file, line);
+#ifdef MEMTRACK_USABLE_SIZE
+	#if !defined (__STDC_VERSION__) || (__STDC_VERSION__ < 201112L)
+		#error "MEMTRACK_USABLE_SIZE requires C11 or higher."
+	#endif
 
-		memtrack_errfunc = "memtrack_entry_update";
+	#ifndef MEMTRACK_SITE_STATS
+		#error "MEMTRACK_USABLE_SIZE requires MEMTRACK_SITE_STATS."
+	#endif
 
-		return;
-	}
+	#include <stdatomic.h>
+#endif
 
-	MemTrackEntry* old_entry = ht_get(memtrack_entries, (key_type)old_ptr);
-	if (UNLIKELY(old_entry == NULL)) {
-		fprintf(stderr, "No entry found to update! The memory might not be tracked.\nFile: %s   Line: %d\n", file, line);
-		memtrack_entry_add(new_ptr, new_size, file, line);
+#ifdef MEMTRACK_BUDGET
+	#if !defined (__STDC_VERSION__) || (__STDC_VERSION__ < 201112L)
+		#error "MEMTRACK_BUDGET requires C11 or higher."
+	#endif
 
-		memtrack_errfunc = "memtrack_entry_update";
+	#ifndef MEMTRACK_SITE_STATS
+		#error "MEMTRACK_BUDGET requires MEMTRACK_SITE_STATS."
+	#endif
 
-		return;
-	}
+	#ifdef MEMTRACK_SAMPLING
+		#error "MEMTRACK_BUDGET cannot be combined with MEMTRACK_SAMPLING."
+	#endif
 
-	if (old_ptr == new_ptr) {  /* 同じエントリを使える場合は処理を分けることで無駄な処理を減らす */
-		old_entry->size = new_size;
-#ifdef DEBUG
-		old_entry->last_realloc_file = file;
-		old_entry->last_realloc_line = line;
+	#include <stdatomic.h>
 #endif
-		return;
-	}
 
-	MemTrackEntry new_entry = {
-		.ptr = new_ptr,
-		.size = new_size
-#ifdef DEBUG
-		, 
-		.last_realloc_file = file,
-		.last_realloc_line = line,  /* 更新はここまで、以下は旧エントリのコピー */
-		.alloc_file = old_entry->alloc_file,
-		.alloc_line = old_entry->alloc_line,
-		.is_freed = old_entry->is_freed,
-		.free_file = old_entry->free_file,
-		.free_line = old_entry->free_line
+#ifdef MEMTRACK_THREAD_STATS
+	#if !defined (__STDC_VERSION__) || (__STDC_VERSION__ < 201112L)
+		#error "MEMTRACK_THREAD_STATS requires C11 or higher."
+	#endif
+
+	#ifndef MEMTRACK_SITE_STATS
+		#error "MEMTRACK_THREAD_STATS requires MEMTRACK_SITE_STATS."
+	#endif
+
+	#ifndef THREAD_LOCAL
+		#error "MEMTRACK_THREAD_STATS requires thread-local storage."
+	#endif
+
+	#include <stdint.h>
+	#include <stdatomic.h>
 #endif
-	};
 
-	if (UNLIKELY(!ht_set(memtrack_entries, (key_type)new_ptr, &new_entry, sizeof(MemTrackEntry)))) {
-		fprintf(stderr, "Failed to add new entry to memory tracking.\nFile: %s   Line: %d\n", file, line);
-		memtrack_errfunc = "memtrack_entry_update";
-	}
+#ifdef MEMTRACK_TAGS
+	#if !defined (__STDC_VERSION__) || (__STDC_VERSION__ < 201112L)
+		#error "MEMTRACK_TAGS requires C11 or higher."
+	#endif
 
-	if (!ht_delete(memtrack_entries, (key_type)old_ptr)) {
-		fprintf(stderr, "Failed to delete old entry from memory tracking.\nFile: %s   Line: %d\n", file, line);
-		memtrack_errfunc = "memtrack_entry_update";
-	}
-}
+	#ifndef MEMTRACK_SITE_STATS
+		#error "MEMTRACK_TAGS requires MEMTRACK_SITE_STATS."
+	#endif
 
+	#ifndef THREAD_LOCAL
+		#error "MEMTRACK_TAGS requires thread-local storage."
+	#endif
 
-void memtrack_entry_free (void* ptr, const char* file, int line) {
-	if (ptr == NULL) return;
+	#include <stdint.h>
+	#include <stdatomic.h>
+#endif
 
-	if (UNLIKELY(memtrack_entries == NULL)) {
-		init();
+#ifdef MEMTRACK_BACKTRACE
+	#if !defined (__STDC_VERSION__) || (__STDC_VERSION__ < 201112L)
+		#error "MEMTRACK_BACKTRACE requires C11 or higher."
+	#endif
 
-		fprintf(stderr, "No entry found to free! The memory might not be tracked.\nFile: %s   Line: %d\n", file, line);
-		errno = EPERM;
-		memtrack_errfunc = "memtrack_entry_free";
+	#if !defined (__GNUC__) && !defined (__clang__)
+		#error "MEMTRACK_BACKTRACE requires GCC or Clang (_Unwind_Backtrace)."
+	#endif
 
-		return;
-	}
+	#ifndef THREAD_LOCAL
+		#error "MEMTRACK_BACKTRACE requires thread-local storage."
+	#endif
 
-	MemTrackEntry* entry = ht_get(memtrack_entries, (key_type)ptr);
-	if (entry == NULL) {
-		fprintf(stderr, "No entry found to free! The memory might not be tracked.\nFile: %s   Line: %d\n", file, line);
-		memtrack_errfunc = "memtrack_entry_free";
-		return;
-	}
+	#include <stdint.h>
+	#include <stdatomic.h>
+	#include <unwind.h>
 
-#ifndef DEBUG
-	if (!ht_delete(memtrack_entries, (key_type)ptr)) {
-		fprintf(stderr, "Failed to delete entry from memory tracking.\nFile: %s   Line: %d\n", file, line);
-		memtrack_errfunc = "memtrack_entry_free";
-	}
-#else
-	entry->is_freed = true;
-	entry->free_file = file;
-	entry->free_line = line;
+	#if defined (__GLIBC__) || defined (__APPLE__) || defined (__FreeBSD__) || defined (__NetBSD__) || defined (__OpenBSD__)
+		#include <dlfcn.h>
+		#define MEMTRACK_BACKTRACE_DLADDR
+	#endif
 #endif
-}
 
+#ifdef MEMTRACK_PRELOAD
+	#if !defined (__STDC_VERSION__) || (__STDC_VERSION__ < 201112L)
+		#error "MEMTRACK_PRELOAD requires C11 or higher."
+	#endif
 
-void* memtrack_malloc_without_lock (size_t size, const char* file, int line) {
-	if (size == 0) {
-		fprintf(stderr, "No processing was done because the size is zero.\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		memtrack_errfunc = "memtrack_malloc";
-		return NULL;
-	}
+	#ifndef MEMTRACK_SHARDED
+		#error "MEMTRACK_PRELOAD requires MEMTRACK_SHARDED."
+	#endif
 
-	void* ptr = malloc(size);
-	if (UNLIKELY(ptr == NULL)) {
-		fprintf(stderr, "Memory allocation failed.\nFile: %s   Line: %d\n", file, line);
-		errno = ENOMEM;
-		memtrack_errfunc = "memtrack_malloc";
-	} else {
-#ifdef MAYBE_ERRNO_THREAD_LOCAL
-		int tmp_errno = errno;
+	#ifdef MEMTRACK_HEADER
+		#error "MEMTRACK_PRELOAD cannot be combined with MEMTRACK_HEADER."
+	#endif
+
+	#include "preload/memtrack_preload.h"
 #endif
-		errno = 0;
 
-		memtrack_entry_add(ptr, size, file, line);
+#ifdef MEMTRACK_FORK_SAFE
+	#if !defined (__STDC_VERSION__) || (__STDC_VERSION__ < 201112L)
+		#error "MEMTRACK_FORK_SAFE requires C11 or higher."
+	#endif
 
-		if (UNLIKELY(errno != 0)) memtrack_errfunc = "memtrack_malloc";
-#ifdef MAYBE_ERRNO_THREAD_LOCAL
-		else errno = tmp_errno;
+	#if !defined (_POSIX_VERSION)
+		#error "MEMTRACK_FORK_SAFE requires POSIX (pthread_atfork)."
+	#endif
+
+	#include <stdatomic.h>
+	#include <pthread.h>
 #endif
-	}
-	return ptr;
-}
 
+/* 呼び出し元の登録表を使い、エントリからは番号で参照する */
+#if defined (MEMTRACK_SITE_STATS) || (defined (MEMTRACK_CALL_SITE) && defined (DEBUG)) || defined (MEMTRACK_TRACE)
+	#define MEMTRACK_SITE_TABLE
+#endif
 
-void* memtrack_malloc (size_t size, const char* file, int line) {
-	memtrack_lock();
-	void* ptr = memtrack_malloc_without_lock(size, file, line);
-	memtrack_unlock();
-	return ptr;
-}
+/* realloc の前にエントリを取り外し、成功後に付け直す方式を使う */
+#if defined (MEMTRACK_SHARDED) || defined (MEMTRACK_SAMPLING)
+	#define MEMTRACK_REALLOC_DETACH
+#endif
 
+/* エントリから確保した呼び出し元がわかり、終了時に呼び出し元ごとの要約を出力できる */
+#if defined (DEBUG) || defined (MEMTRACK_SITE_STATS)
+	#define MEMTRACK_LEAK_SITES
+#endif
 
-void* memtrack_calloc_without_lock (size_t count, size_t size, const char* file, int line) {
-	if (count == 0) {
-		fprintf(stderr, "No processing was done because the count is zero.\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		memtrack_errfunc = "memtrack_calloc";
-		return NULL;
-	} else if (size == 0) {
-		fprintf(stderr, "No processing was done because the size is zero.\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		memtrack_errfunc = "memtrack_calloc";
-		return NULL;
-	} else if (size > (SIZE_MAX / count)) {
-		fprintf(stderr, "Memory allocation overflow.\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		memtrack_errfunc = "memtrack_calloc";
-		return NULL;
-	}
 
-	void* ptr = calloc(count, size);
-	if (UNLIKELY(ptr == NULL)) {
-		fprintf(stderr, "Memory allocation failed.\nFile: %s   Line: %d\n", file, line);
-		errno = ENOMEM;
-		memtrack_errfunc = "memtrack_calloc";
-	} else {
-#ifdef MAYBE_ERRNO_THREAD_LOCAL
-		int tmp_errno = errno;
+#undef malloc
+#undef calloc
+#undef realloc
+#undef free
+
+
+#if defined (MEMTRACK_SAMPLING) && defined (__GLIBC__)
+	#include <malloc.h>  /* 記録していないブロックのサイズを malloc_usable_size で求める */
 #endif
-		errno = 0;
 
-		memtrack_entry_add(ptr, size * count, file, line);
+/* 確保したブロックで実際に使用できるバイト数を求める関数 */
+#ifdef MEMTRACK_USABLE_SIZE
+	#if defined (__APPLE__)
+		#include <malloc/malloc.h>
+		#define MEMTRACK_MALLOC_USABLE_SIZE(ptr) malloc_size(ptr)
+	#elif defined (_WIN32)
+		#include <malloc.h>
+		#define MEMTRACK_MALLOC_USABLE_SIZE(ptr) _msize(ptr)
+	#elif defined (__FreeBSD__)
+		#include <malloc_np.h>
+		#define MEMTRACK_MALLOC_USABLE_SIZE(ptr) malloc_usable_size(ptr)
+	#elif defined (__GLIBC__) || defined (__linux__)
+		#include <malloc.h>
+		#define MEMTRACK_MALLOC_USABLE_SIZE(ptr) malloc_usable_size(ptr)
+	#else
+		#error "MEMTRACK_USABLE_SIZE requires malloc_usable_size, malloc_size, or _msize."
+	#endif
+#endif
 
-		if (UNLIKELY(errno != 0)) memtrack_errfunc = "memtrack_calloc";
-#ifdef MAYBE_ERRNO_THREAD_LOCAL
-		else errno = tmp_errno;
+/* LD_PRELOAD で標準関数を置き換える場合、ライブラリ自身の領域と記録するブロックは置き換える前の関数で確保する */
+#ifdef MEMTRACK_PRELOAD
+	#define malloc memtrack_preload_real_malloc
+	#define calloc memtrack_preload_real_calloc
+	#define realloc memtrack_preload_real_realloc
+	#define free memtrack_preload_real_free
+
+	/* 置き換えた関数を経由せずに呼び出される終了処理とスレッドでは、その間の確保を記録しない */
+	#define MEMTRACK_PRELOAD_ENTER() memtrack_preload_enter()
+	#define MEMTRACK_PRELOAD_LEAVE() memtrack_preload_leave()
+#else
+	#define MEMTRACK_PRELOAD_ENTER() ((void)0)
+	#define MEMTRACK_PRELOAD_LEAVE() ((void)0)
 #endif
-	}
-	return ptr;
-}
 
 
-void* memtrack_calloc (size_t count, size_t size, const char* file, int line) {
-	memtrack_lock();
-	void* ptr = memtrack_calloc_without_lock(count, size, file, line);
-	memtrack_unlock();
-	return ptr;
-}
+/* エントリテーブルの索引の初期容量（シャードモードではシャードごと）、負荷率が 3/4 を超えると 2 倍に広げる */
+#ifndef MEMTRACK_ENTRIES_COUNT
+	#define MEMTRACK_ENTRIES_COUNT 1024
+#endif
+
+#if (MEMTRACK_ENTRIES_COUNT < 16) || ((MEMTRACK_ENTRIES_COUNT & (MEMTRACK_ENTRIES_COUNT - 1)) != 0)
+	#error "MEMTRACK_ENTRIES_COUNT must be a power of 2 not less than 16."
+#endif
 
+#define MEMTRACK_ENTRIES_TRIAL 4
 
-void* memtrack_realloc_without_lock (void* ptr, size_t size, const char* file, int line) {
-	if (size == 0) {
-		fprintf(stderr, "Undefined behavior because the size is zero, do not use anymore. The memory block will be freed and NULL will be returned.\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		memtrack_errfunc = "memtrack_realloc";
+#define MEMTRACK_STORE_PAGE_SIZE 256  /* エントリの置き場の 1 ページに置くエントリの数 */
 
-		memtrack_free_without_lock(ptr, file, line);
-		return NULL;
-	}
+#define MEMTRACK_SNAPSHOT_BATCH 4096  /* スナップショットで 1 回のロック中に写すエントリの最大数 */
 
-	void* new_ptr = realloc(ptr, size);
-	if (UNLIKELY(new_ptr == NULL)) {
-		fprintf(stderr, "Memory allocation failed.\nFile: %s   Line: %d\n", file, line);
-		errno = ENOMEM;
-		memtrack_errfunc = "memtrack_realloc";
+#ifdef MEMTRACK_LEAK_SITES
+	#define MEMTRACK_LEAK_SITES_COUNT 256  /* 終了時の要約に使う表の初期の大きさ（2 の累乗） */
+#endif
 
-	} else {
-#ifdef MAYBE_ERRNO_THREAD_LOCAL
-		int tmp_errno = errno;
+#ifdef MEMTRACK_SHARDED
+	#ifndef MEMTRACK_SHARD_COUNT
+		#define MEMTRACK_SHARD_COUNT 16
+	#endif
+
+	#if (MEMTRACK_SHARD_COUNT < 1) || ((MEMTRACK_SHARD_COUNT & (MEMTRACK_SHARD_COUNT - 1)) != 0)
+		#error "MEMTRACK_SHARD_COUNT must be a power of 2."
+	#endif
 #endif
-		errno = 0;
 
-#if defined (__GNUC__) && !defined (__clang__)
-	#pragma GCC diagnostic push
-	#pragma GCC diagnostic ignored "-Wuse-after-free"  /* memtrack自体のデバッグを行う際は必ず外すこと */
+#ifdef MEMTRACK_THREAD_BUFFER
+	#ifndef MEMTRACK_THREAD_BUFFER_SIZE
+		#define MEMTRACK_THREAD_BUFFER_SIZE 64
+	#endif
+
+	#if MEMTRACK_THREAD_BUFFER_SIZE < 1
+		#error "MEMTRACK_THREAD_BUFFER_SIZE must be greater than 0."
+	#endif
 #endif
 
-		memtrack_entry_update(ptr, new_ptr, size, file, line);
+#ifdef MEMTRACK_SAMPLING
+	/* 平均してこのバイト数の確保ごとに 1 件を記録する（実行時に変更可能） */
+	#ifndef MEMTRACK_SAMPLE_INTERVAL
+		#define MEMTRACK_SAMPLE_INTERVAL 524288
+	#endif
 
-#if defined (__GNUC__) && !defined (__clang__)
-	#pragma GCC diagnostic pop
+	/* 記録済みのポインタを数えるフィルタの要素数 */
+	#ifndef MEMTRACK_SAMPLE_FILTER_SIZE
+		#define MEMTRACK_SAMPLE_FILTER_SIZE 16384
+	#endif
+
+	#if (MEMTRACK_SAMPLE_FILTER_SIZE < 1) || ((MEMTRACK_SAMPLE_FILTER_SIZE & (MEMTRACK_SAMPLE_FILTER_SIZE - 1)) != 0)
+		#error "MEMTRACK_SAMPLE_FILTER_SIZE must be a power of 2."
+	#endif
 #endif
 
-		if (UNLIKELY(errno != 0)) memtrack_errfunc = "memtrack_realloc";
-#ifdef MAYBE_ERRNO_THREAD_LOCAL
-		else errno = tmp_errno;
+#ifdef MEMTRACK_SITE_TABLE
+	/* 呼び出し元 (file:line) の登録表の要素数、登録しきれなかった呼び出し元は 1 つにまとめて扱う */
+	#ifndef MEMTRACK_SITE_COUNT
+		#define MEMTRACK_SITE_COUNT 4096
+	#endif
+
+	#if (MEMTRACK_SITE_COUNT < 1) || (MEMTRACK_SITE_COUNT > 0x40000000) || ((MEMTRACK_SITE_COUNT & (MEMTRACK_SITE_COUNT - 1)) != 0)
+		#error "MEMTRACK_SITE_COUNT must be a power of 2 not greater than 2^30."
+	#endif
 #endif
-	}
-	return new_ptr;
-}
 
+#ifdef MEMTRACK_THREAD_STATS
+	/* 個別に集計するスレッドの数、それ以降に番号を割り当てたスレッドは 1 つにまとめて扱う */
+	#ifndef MEMTRACK_THREAD_COUNT
+		#define MEMTRACK_THREAD_COUNT 256
+	#endif
 
-void* memtrack_realloc (void* ptr, size_t size, const char* file, int line) {
-	memtrack_lock();
-	void* new_ptr = memtrack_realloc_without_lock(ptr, size, file, line);
-	memtrack_unlock();
-	return new_ptr;
-}
+	#if (MEMTRACK_THREAD_COUNT < 1) || (MEMTRACK_THREAD_COUNT > 65534)
+		#error "MEMTRACK_THREAD_COUNT must be between 1 and 65534."
+	#endif
+#endif
 
+#ifdef MEMTRACK_TAGS
+	/* 登録できるタグの数 */
+	#ifndef MEMTRACK_TAG_COUNT
+		#define MEMTRACK_TAG_COUNT 64
+	#endif
 
-void memtrack_free_without_lock (void* ptr, const char* file, int line) {
-	if (ptr == NULL) return;
+	#if (MEMTRACK_TAG_COUNT < 1) || (MEMTRACK_TAG_COUNT > 255)
+		#error "MEMTRACK_TAG_COUNT must be between 1 and 255."
+	#endif
+
+	/* スレッドごとのタグのスタックの深さ、これより深く積んだタグは対応する memtrack_pop_tag まで無視する */
+	#ifndef MEMTRACK_TAG_DEPTH
+		#define MEMTRACK_TAG_DEPTH 16
+	#endif
+
+	#if (MEMTRACK_TAG_DEPTH < 1) || (MEMTRACK_TAG_DEPTH > 1024)
+		#error "MEMTRACK_TAG_DEPTH must be between 1 and 1024."
+	#endif
+#endif
+
+#ifdef MEMTRACK_DEFERRED_DIAG
+	/* 出力待ちの診断メッセージを保持するリングの要素数 */
+	#ifndef MEMTRACK_DIAG_RING_SIZE
+		#define MEMTRACK_DIAG_RING_SIZE 256
+	#endif
+
+	#if (MEMTRACK_DIAG_RING_SIZE < 1) || ((MEMTRACK_DIAG_RING_SIZE & (MEMTRACK_DIAG_RING_SIZE - 1)) != 0)
+		#error "MEMTRACK_DIAG_RING_SIZE must be a power of 2."
+	#endif
+
+	/* 同じ呼び出し元から 1 秒間に受け付ける診断メッセージの上限 */
+	#ifndef MEMTRACK_DIAG_RATE_LIMIT
+		#define MEMTRACK_DIAG_RATE_LIMIT 16
+	#endif
+
+	#if MEMTRACK_DIAG_RATE_LIMIT < 1
+		#error "MEMTRACK_DIAG_RATE_LIMIT must be greater than 0."
+	#endif
+#endif
+
+#ifdef MEMTRACK_TRACE
+	/* memtrack_trace_start で 0 を指定した場合のトレースファイルの記録数 */
+	#ifndef MEMTRACK_TRACE_RECORD_COUNT
+		#define MEMTRACK_TRACE_RECORD_COUNT 65536
+	#endif
+
+	#if (MEMTRACK_TRACE_RECORD_COUNT < 1) || ((MEMTRACK_TRACE_RECORD_COUNT & (MEMTRACK_TRACE_RECORD_COUNT - 1)) != 0)
+		#error "MEMTRACK_TRACE_RECORD_COUNT must be a power of 2."
+	#endif
+#endif
+
+#ifdef MEMTRACK_REPORTER
+	/* 報告に含める呼び出し元の数（生存中のバイト数の多い順） */
+	#ifndef MEMTRACK_REPORTER_TOP_SITES
+		#define MEMTRACK_REPORTER_TOP_SITES 10
+	#endif
+
+	#if MEMTRACK_REPORTER_TOP_SITES < 1
+		#error "MEMTRACK_REPORTER_TOP_SITES must be greater than 0."
+	#endif
+#endif
+
+#ifdef MEMTRACK_BACKTRACE
+	/* 1 つのバックトレースに記録するフレームの最大数 */
+	#ifndef MEMTRACK_BACKTRACE_DEPTH
+		#define MEMTRACK_BACKTRACE_DEPTH 16
+	#endif
+
+	#if (MEMTRACK_BACKTRACE_DEPTH < 1) || (MEMTRACK_BACKTRACE_DEPTH > 64)
+		#error "MEMTRACK_BACKTRACE_DEPTH must be between 1 and 64."
+	#endif
+
+	/* ライブラリ自身のフレームを除いた後に、さらに捨てる呼び出し元に近い側のフレームの数 */
+	#ifndef MEMTRACK_BACKTRACE_SKIP
+		#define MEMTRACK_BACKTRACE_SKIP 0
+	#endif
+
+	#if MEMTRACK_BACKTRACE_SKIP < 0
+		#error "MEMTRACK_BACKTRACE_SKIP must not be negative."
+	#endif
+
+	/* 異なるバックトレースを登録できる数、登録しきれなかったバックトレースは 1 つにまとめて扱う */
+	#ifndef MEMTRACK_BACKTRACE_COUNT
+		#define MEMTRACK_BACKTRACE_COUNT 4096
+	#endif
+
+	#if (MEMTRACK_BACKTRACE_COUNT < 1) || (MEMTRACK_BACKTRACE_COUNT > 0x40000000) || ((MEMTRACK_BACKTRACE_COUNT & (MEMTRACK_BACKTRACE_COUNT - 1)) != 0)
+		#error "MEMTRACK_BACKTRACE_COUNT must be a power of 2 not greater than 2^30."
+	#endif
+#endif
 
 #ifdef DEBUG
-	if (UNLIKELY(memtrack_entries == NULL)) {
-		init();
+	/* 二重解放の検出用に残す解放済みエントリの数（シャードモードではシャードごと） */
+	#ifndef MEMTRACK_QUARANTINE_SIZE
+		#define MEMTRACK_QUARANTINE_SIZE 1024
+	#endif
+
+	#if MEMTRACK_QUARANTINE_SIZE < 1
+		#error "MEMTRACK_QUARANTINE_SIZE must be greater than 0."
+	#endif
+#endif
 
-		fprintf(stderr, "No entry found to free! The memory might not be tracked.\nFile: %s   Line: %d\n", file, line);
-		errno = EPERM;
-		memtrack_errfunc = "memtrack_free";
+#ifdef MEMTRACK_HEADER
+	/* ヘッダーの末尾にユーザー領域のアドレスと混ぜて格納し、ヘッダーを持たないポインタと区別する */
+	#define MEMTRACK_HEADER_MAGIC ((uintptr_t)0x6D656D747261636BULL)
+
+	/* ヘッダーを持たないポインタでも直前の 1 ワードを読むため、AddressSanitizer の検査対象から外す */
+	#if defined (__GNUC__) || defined (__clang__)
+		#define MEMTRACK_NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+	#else
+		#define MEMTRACK_NO_SANITIZE_ADDRESS
+	#endif
+#endif
+
+
+#ifdef MEMTRACK_SITE_TABLE
+/* 呼び出し元の登録表の要素、state が登録済みになった後は file と line は変化しない */
+typedef struct {
+	atomic_int state;
+	int line;
+	const char* file;
+#ifdef MEMTRACK_SITE_STATS
+	atomic_size_t live_bytes;
+	atomic_size_t live_count;
+	atomic_size_t total_count;
+	atomic_size_t total_bytes;
+	atomic_size_t peak_bytes;
+#endif
+#ifdef MEMTRACK_USABLE_SIZE
+	atomic_size_t live_slack;  /* 生存中のブロックの使用できるサイズと要求サイズの差の合計 */
+#endif
+#ifdef MEMTRACK_THREAD_STATS
+	atomic_size_t cross_thread_frees;  /* ここで確保したブロックを、確保したスレッド以外が解放した回数 */
+#endif
+#ifdef MEMTRACK_BUDGET
+	atomic_size_t limit;  /* live_bytes の上限、0 は上限なし */
+#endif
+} MemTrackSite;
+
+typedef uint32_t MemTrackSiteId;  /* 登録表の位置 + 1、0 は呼び出し元なしを表す */
+#endif
+
+
+#ifdef MEMTRACK_THREAD_STATS
+/* スレッドごとの集計、偽共有を避けるためキャッシュライン境界に揃える */
+typedef struct {
+	_Alignas(64) atomic_size_t live_bytes;
+	atomic_size_t live_count;
+	atomic_size_t peak_bytes;
+	atomic_size_t total_count;
+	atomic_size_t total_bytes;
+	atomic_size_t freed_by_others;  /* このスレッドが確保し、他のスレッドが解放したブロックの数 */
+	atomic_size_t frees_of_others;  /* このスレッドが解放した、他のスレッドが確保したブロックの数 */
+} MemTrackThread;
+
+typedef uint16_t MemTrackThreadId;  /* 集計表の位置 + 1、0 はスレッドの記録なしを表す */
+#endif
+
+
+#ifdef MEMTRACK_TAGS
+/* タグごとの集計、偽共有を避けるためキャッシュライン境界に揃える */
+typedef struct {
+	_Alignas(64) _Atomic(const char*) name;  /* NULL は未登録（0 番のタグなしの分も NULL のまま） */
+	atomic_size_t live_bytes;
+	atomic_size_t live_count;
+	atomic_size_t peak_bytes;
+	atomic_size_t total_count;
+	atomic_size_t total_bytes;
+#ifdef MEMTRACK_BUDGET
+	atomic_size_t limit;  /* live_bytes の上限、0 は上限なし */
+#endif
+} MemTrackTag;
+
+typedef uint8_t MemTrackTagId;  /* 登録表の位置、0 はタグなしを表す */
+#endif
+
+
+#ifdef MEMTRACK_BACKTRACE
+/* バックトレースの登録表の要素、state が登録済みになった後は他のメンバは変化しない */
+typedef struct {
+	atomic_int state;
+	uint32_t depth;
+	uint64_t hash;
+	void* frames[MEMTRACK_BACKTRACE_DEPTH];
+} MemTrackBacktrace;
+
+typedef uint32_t MemTrackBacktraceId;  /* 登録表の位置 + 1、0 はバックトレースなしを表す */
+#endif
+
+
+typedef struct {
+	void* ptr;
+	size_t size;
+#ifdef MEMTRACK_SAMPLING
+	size_t weight;  /* このサンプルが代表する推定バイト数 */
+#endif
+#ifdef MEMTRACK_USABLE_SIZE
+	size_t usable;  /* 呼び出し元に加算したときに実際に使用できたバイト数 */
+#endif
+#ifdef MEMTRACK_HISTOGRAM
+	uint64_t birth;  /* 確保した時刻（CLOCK_MONOTONIC のナノ秒）、realloc では引き継ぐ */
+#endif
+#ifdef DEBUG
+#ifndef MEMTRACK_CALL_SITE
+	const char* alloc_file;
+	const char* last_realloc_file;
+	const char* free_file;
+#endif
+	size_t free_seq;  /* 解放時に隔離リングへ登録した通し番号 */
+#ifndef MEMTRACK_CALL_SITE
+	int alloc_line;
+	int last_realloc_line;
+	int free_line;
+#else
+	MemTrackSiteId alloc_site;
+	MemTrackSiteId last_realloc_site;
+	MemTrackSiteId free_site;
+#endif
+#endif
+#ifdef MEMTRACK_SITE_STATS
+	MemTrackSiteId site;  /* 確保（または最後の realloc）した呼び出し元、集計から外した後は 0 */
+#endif
+#ifdef MEMTRACK_BACKTRACE
+	MemTrackBacktraceId backtrace;  /* 確保したときのバックトレース、realloc では引き継ぐ */
+#endif
+#ifdef MEMTRACK_THREAD_STATS
+	MemTrackThreadId thread;  /* 確保（または最後の realloc）したスレッド */
+#ifdef DEBUG
+	MemTrackThreadId free_thread;  /* 解放したスレッド */
+#endif
+#endif
+#ifdef MEMTRACK_TAGS
+	MemTrackTagId tag;  /* 確保したときのスレッドのタグ、realloc では引き継ぐ */
+#endif
+#ifdef MEMTRACK_FORK_SAFE
+	unsigned int generation;  /* 作成したときの世代、realloc では引き継ぐ */
+#endif
+#ifdef DEBUG
+	bool is_freed;
+#endif
+} MemTrackEntry;  /* パディングの削減のため順序がわかりにくくなっているので注意 */
+
+
+#ifdef MEMTRACK_FORK_SAFE
+/* 現在の世代、これと異なる世代のエントリは fork した親プロセスなどから引き継いだものとして報告から外す */
+static atomic_uint memtrack_generation = 0;
+#endif
+
+/* 報告と終了処理から外すエントリなら true、解放や realloc は通常どおり受け付ける */
+static inline bool memtrack_entry_is_inherited (const MemTrackEntry* entry) {
+#ifdef MEMTRACK_FORK_SAFE
+	return entry->generation != atomic_load_explicit(&memtrack_generation, memory_order_relaxed);
+#else
+	(void)entry;
+	return false;
+#endif
+}
+
+
+/* エントリの置き場の 1 要素、空きスロットは ptr を NULL にして次の空きスロットを指す */
+typedef union MemTrackSlot {
+	MemTrackEntry entry;
+	struct {
+		void* ptr;  /* entry.ptr と共通の先頭メンバで、空きスロットでは常に NULL */
+		union MemTrackSlot* next;
+	} free;
+} MemTrackSlot;
+
+
+/*
+ * エントリテーブル、エントリはページに置いて索引にはそのアドレスだけを登録する
+ * ページは移動しないため、エントリのアドレスは取り除くまで変わらず、確保をせずに全エントリを走査できる
+ * 索引はポインタをキーとする線形探索の開番地法の表で、探索で読むキーだけを 1 つの配列に詰めて置く
+ */
+typedef struct {
+	void** keys;  /* NULL は空き */
+	MemTrackEntry** values;  /* keys と同じ位置にエントリのアドレスを置く */
+	size_t capacity;  /* 索引の要素数、2 の累乗 */
+	size_t count;  /* 索引に登録したキーの数 */
+	unsigned int shift;  /* 64 - log2(capacity)、ハッシュ値の上位ビットを位置に使う */
+	MemTrackSlot** pages;
+	MemTrackSlot* last_page;  /* 最後に確保したページ */
+	size_t page_count;
+	size_t page_capacity;
+	size_t used;  /* 一度でも使ったスロットの数、走査はここまでで足りる */
+	MemTrackSlot* free;  /* 空きスロットの連結リスト */
+	size_t free_count;  /* free の長さ */
+} MemTrackStore;
+
+
+#ifdef DEBUG
+/*
+ * 解放済みエントリを古い順に追い出すための FIFO リング
+ * count 番目に登録したポインタは ptrs[count % MEMTRACK_QUARANTINE_SIZE] に置かれる
+ */
+typedef struct {
+	void* ptrs[MEMTRACK_QUARANTINE_SIZE];
+	size_t count;
+} MemTrackQuarantine;
+#endif
+
+
+#ifdef MEMTRACK_HEADER
+/*
+ * memtrack_malloc などで確保したブロックの先頭に置くヘッダー
+ * ユーザー領域の直前に magic が来るよう、末尾にパディングが生じない並びにしている
+ */
+typedef struct MemTrackHeader {
+	struct MemTrackHeader* prev;
+	struct MemTrackHeader* next;
+	size_t prefix;  /* ブロックの先頭からユーザー領域までのバイト数 */
+	MemTrackEntry entry;
+	uintptr_t magic;
+} MemTrackHeader;
+#endif
+
+
+#ifdef MEMTRACK_DEFERRED_DIAG
+
+
+/*
+ * 診断メッセージを出力せずに溜めておくリング（有界 MPMC キュー）
+ * seq には「位置 - 要素番号」を格納し、ゼロ初期化のままで全要素が空きとなるようにしている
+ */
+typedef struct {
+	atomic_size_t seq;
+	const char* message;
+	const void* ptr;
+	const char* file;
+	const char* prev_file;  /* 二重解放の場合に以前解放した位置、それ以外では NULL */
+	int line;
+	int prev_line;
+} MemTrackDiag;
+
+static MemTrackDiag memtrack_diag_ring[MEMTRACK_DIAG_RING_SIZE];
+static atomic_size_t memtrack_diag_enqueue_pos = 0;
+static atomic_size_t memtrack_diag_dequeue_pos = 0;
+static atomic_size_t memtrack_diag_dropped = 0;  /* 上限かリングの満杯で捨てたメッセージの数 */
+static atomic_size_t memtrack_diag_dropped_reported = 0;  /* memtrack_diag_flush で出力済みの破棄数 */
+
+/* 呼び出し元のハッシュごとに、上位 32 ビットに秒、下位 32 ビットにその秒に受け付けた件数を持つ */
+static _Atomic uint64_t memtrack_diag_rate[MEMTRACK_DIAG_RING_SIZE];
+
+
+static inline size_t memtrack_diag_rate_index (const char* file, int line) {
+	uint64_t key = (uint64_t)(uintptr_t)file ^ ((uint64_t)(unsigned int)line << 32);
+	key ^= key >> 29;
+	key *= 0x9E3779B97F4A7C15ULL;
+	return (size_t)(key >> 40) & (MEMTRACK_DIAG_RING_SIZE - 1);
+}
+
+
+/* 呼び出し元ごとの毎秒の上限を超えていなければ true を返す（ハッシュが衝突した呼び出し元は上限を共有する） */
+static bool memtrack_diag_admit (const char* file, int line) {
+	_Atomic uint64_t* rate = &memtrack_diag_rate[memtrack_diag_rate_index(file, line)];
+	uint64_t now = (uint64_t)time(NULL) & 0xFFFFFFFFULL;
+
+	uint64_t old = atomic_load_explicit(rate, memory_order_relaxed);
+	for (;;) {
+		uint64_t next;
+		if ((old >> 32) == now) {
+			if ((old & 0xFFFFFFFFULL) >= MEMTRACK_DIAG_RATE_LIMIT) return false;
+			next = old + 1;
+		} else {
+			next = (now << 32) | 1;
+		}
+		if (atomic_compare_exchange_weak_explicit(rate, &old, next, memory_order_relaxed, memory_order_relaxed)) return true;
+	}
+}
+
+
+static void memtrack_diag_push (const char* message, const void* ptr, const char* file, int line, const char* prev_file, int prev_line) {
+	if (!memtrack_diag_admit(file, line)) {
+		atomic_fetch_add_explicit(&memtrack_diag_dropped, 1, memory_order_relaxed);
+		return;
+	}
+
+	MemTrackDiag* diag;
+	size_t pos = atomic_load_explicit(&memtrack_diag_enqueue_pos, memory_order_relaxed);
+	for (;;) {
+		size_t index = pos & (MEMTRACK_DIAG_RING_SIZE - 1);
+		diag = &memtrack_diag_ring[index];
+		size_t seq = atomic_load_explicit(&diag->seq, memory_order_acquire) + index;
+
+		if (seq == pos) {
+			if (atomic_compare_exchange_weak_explicit(&memtrack_diag_enqueue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) break;
+		} else if ((ptrdiff_t)(seq - pos) < 0) {  /* 満杯 */
+			atomic_fetch_add_explicit(&memtrack_diag_dropped, 1, memory_order_relaxed);
+			return;
+		} else {
+			pos = atomic_load_explicit(&memtrack_diag_enqueue_pos, memory_order_relaxed);
+		}
+	}
+
+	diag->message = message;
+	diag->ptr = ptr;
+	diag->file = file;
+	diag->line = line;
+	diag->prev_file = prev_file;
+	diag->prev_line = prev_line;
+	atomic_store_explicit(&diag->seq, pos + 1 - (pos & (MEMTRACK_DIAG_RING_SIZE - 1)), memory_order_release);
+}
+
+
+static bool memtrack_diag_pop (MemTrackDiag* out) {
+	MemTrackDiag* diag;
+	size_t pos = atomic_load_explicit(&memtrack_diag_dequeue_pos, memory_order_relaxed);
+	for (;;) {
+		size_t index = pos & (MEMTRACK_DIAG_RING_SIZE - 1);
+		diag = &memtrack_diag_ring[index];
+		size_t seq = atomic_load_explicit(&diag->seq, memory_order_acquire) + index;
+
+		if (seq == pos + 1) {
+			if (atomic_compare_exchange_weak_explicit(&memtrack_diag_dequeue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) break;
+		} else if ((ptrdiff_t)(seq - (pos + 1)) < 0) {  /* 空 */
+			return false;
+		} else {
+			pos = atomic_load_explicit(&memtrack_diag_dequeue_pos, memory_order_relaxed);
+		}
+	}
+
+	out->message = diag->message;
+	out->ptr = diag->ptr;
+	out->file = diag->file;
+	out->line = diag->line;
+	out->prev_file = diag->prev_file;
+	out->prev_line = diag->prev_line;
+	atomic_store_explicit(&diag->seq, pos + MEMTRACK_DIAG_RING_SIZE - (pos & (MEMTRACK_DIAG_RING_SIZE - 1)), memory_order_release);
+	return true;
+}
+
+
+/* 溜まっているメッセージを全て出力する */
+static void memtrack_diag_print (void) {
+	MemTrackDiag diag;
+	while (memtrack_diag_pop(&diag)) {
+		if (diag.prev_file != NULL || diag.prev_line != 0)
+			fprintf(stderr, "%s\nrefree File: %s   Line: %d\nfree File: %s   Line: %d\n", diag.message, diag.file, diag.line, diag.prev_file, diag.prev_line);
+		else
+			fprintf(stderr, "%s\nFile: %s   Line: %d\n", diag.message, diag.file, diag.line);
+
+		if (diag.ptr != NULL)  /* 出力が発生時より遅れるため、対象のポインタも示す */
+			fprintf(stderr, "Pointer: %p\n", diag.ptr);
+	}
+}
+
+
+void memtrack_diag_flush (void) {
+	memtrack_diag_print();
+
+	/* 破棄数の累計は memtrack_diag_dropped_count のために残し、前回の出力からの増分のみを示す */
+	size_t dropped = atomic_load_explicit(&memtrack_diag_dropped, memory_order_relaxed);
+	size_t reported = atomic_exchange_explicit(&memtrack_diag_dropped_reported, dropped, memory_order_relaxed);
+	if (dropped > reported)
+		fprintf(stderr, "%zu diagnostic messages were dropped.\n", dropped - reported);
+}
+
+
+size_t memtrack_diag_dropped_count (void) {
+	return atomic_load_explicit(&memtrack_diag_dropped, memory_order_relaxed);
+}
+
+
+/* ロックを解放した後に呼び出し、溜まっているメッセージがあれば出力する (破棄数の集計は memtrack_diag_flush と終了時に任せる) */
+static inline void memtrack_diag_drain (void) {
+	if (atomic_load_explicit(&memtrack_diag_enqueue_pos, memory_order_relaxed) != atomic_load_explicit(&memtrack_diag_dequeue_pos, memory_order_relaxed))
+		memtrack_diag_print();
+}
+
+
+#endif
+
+
+void memtrack_report (const char* message, const void* ptr, const char* file, int line) {
+#ifndef MEMTRACK_DEFERRED_DIAG
+	(void)ptr;
+	fprintf(stderr, "%s\nFile: %s   Line: %d\n", message, file, line);
+#else
+	memtrack_diag_push(message, ptr, file, line, NULL, 0);
+#endif
+}
+
+
+#ifdef DEBUG
+static void memtrack_report_double_free (const void* ptr, const char* file, int line, const char* free_file, int free_line) {
+#ifndef MEMTRACK_DEFERRED_DIAG
+	(void)ptr;
+	fprintf(stderr, "Memory already freed!\nrefree File: %s   Line: %d\nfree File: %s   Line: %d\n", file, line, free_file, free_line);
+#else
+	memtrack_diag_push("Memory already freed!", ptr, file, line, free_file, free_line);
+#endif
+}
+#endif
+
+
+/* malloc の返すポインタは 16 バイト境界に揃っているため、下位 4 ビットを捨ててから掛け算で混ぜる */
+static inline size_t memtrack_store_hash (const MemTrackStore* store, const void* ptr) {
+	return (size_t)((((uint64_t)(uintptr_t)ptr >> 4) * 0x9E3779B97F4A7C15ULL) >> store->shift);
+}
+
+
+/* ptr のキーの位置を返す、登録されていなければ ptr を置くべき空きの位置を返す */
+static inline size_t memtrack_store_find (const MemTrackStore* store, const void* ptr) {
+	size_t mask = store->capacity - 1;
+	size_t index = memtrack_store_hash(store, ptr);
+	while (store->keys[index] != NULL && store->keys[index] != ptr)
+		index = (index + 1) & mask;
+	return index;
+}
+
+
+/* 索引を capacity 要素（2 の累乗）で作り直す、失敗した場合は元の索引のまま */
+static bool memtrack_store_rehash (MemTrackStore* store, size_t capacity) {
+	void** keys = calloc(capacity, sizeof(void*));
+	MemTrackEntry** values = malloc(capacity * sizeof(MemTrackEntry*));
+	if (keys == NULL || values == NULL) {
+		free(keys);
+		free(values);
+		return false;
+	}
+
+	void** old_keys = store->keys;
+	MemTrackEntry** old_values = store->values;
+	size_t old_capacity = store->capacity;
+
+	unsigned int shift = 64;
+	for (size_t i = capacity; i > 1; i >>= 1)
+		shift--;
+
+	store->keys = keys;
+	store->values = values;
+	store->capacity = capacity;
+	store->shift = shift;
+
+	for (size_t i = 0; i < old_capacity; i++) {
+		if (old_keys[i] == NULL) continue;
+
+		size_t index = memtrack_store_find(store, old_keys[i]);
+		keys[index] = old_keys[i];
+		values[index] = old_values[i];
+	}
+
+	free(old_keys);
+	free(old_values);
+	return true;
+}
+
+
+/* count 個のキーを登録しても負荷率が 3/4 を超えない容量を返す、表せなければ 0 */
+static inline size_t memtrack_store_capacity_for (size_t capacity, size_t count) {
+	while (count > capacity / 4 * 3) {
+		if (capacity > SIZE_MAX / 2 / sizeof(void*)) return 0;
+		capacity *= 2;
+	}
+	return capacity;
+}
+
+
+static MemTrackStore* memtrack_store_create (void) {
+	MemTrackStore* store = calloc(1, sizeof(MemTrackStore));
+	if (store == NULL) return NULL;
+
+	if (!memtrack_store_rehash(store, MEMTRACK_ENTRIES_COUNT)) {
+		free(store);
+		return NULL;
+	}
+	return store;
+}
+
+
+static void memtrack_store_destroy (MemTrackStore* store) {
+	free(store->keys);
+	free(store->values);
+
+	for (size_t i = 0; i < store->page_count; i++)
+		free(store->pages[i]);
+	free(store->pages);
+	free(store);
+}
+
+
+static inline MemTrackEntry* memtrack_store_get (MemTrackStore* store, const void* ptr) {
+	size_t index = memtrack_store_find(store, ptr);
+	return (store->keys[index] != NULL) ? store->values[index] : NULL;
+}
+
+
+/* position 番目のスロットのエントリを返す、空きスロットなら NULL */
+static inline MemTrackEntry* memtrack_store_at (MemTrackStore* store, size_t position) {
+	MemTrackSlot* slot = &store->pages[position / MEMTRACK_STORE_PAGE_SIZE][position % MEMTRACK_STORE_PAGE_SIZE];
+	return (slot->entry.ptr != NULL) ? &slot->entry : NULL;
+}
+
+
+/*
+ * ページを 1 枚確保して last_page とページ表に置く、ページ表に空きがあることを確かめてから呼び出す
+ * 確保したページは必ず store のメンバ経由で受け取る、ページ表の要素だけに置くと -fanalyzer がページの所有者を追えずリークと誤検知する
+ */
+static bool memtrack_store_page_add (MemTrackStore* store) {
+	MemTrackSlot* page = malloc(MEMTRACK_STORE_PAGE_SIZE * sizeof(MemTrackSlot));
+	if (page == NULL) return false;
+	store->last_page = page;
+	store->pages[store->page_count++] = page;
+	return true;
+}
+
+
+static MemTrackSlot* memtrack_store_slot_alloc (MemTrackStore* store) {
+	MemTrackSlot* slot = store->free;
+	if (slot != NULL) {
+		store->free = slot->free.next;
+		store->free_count--;
+		return slot;
+	}
+
+	if (store->used == store->page_count * MEMTRACK_STORE_PAGE_SIZE) {
+		if (store->page_count == store->page_capacity) {
+			size_t capacity = (store->page_capacity == 0) ? 16 : store->page_capacity * 2;
+			MemTrackSlot** pages = realloc(store->pages, capacity * sizeof(MemTrackSlot*));
+			if (pages == NULL) return NULL;
+			store->pages = pages;
+			store->page_capacity = capacity;
+		}
+
+		if (!memtrack_store_page_add(store)) return NULL;
+		store->used++;
+		return store->last_page;
+	}
+
+	size_t position = store->used++;
+	return &store->pages[position / MEMTRACK_STORE_PAGE_SIZE][position % MEMTRACK_STORE_PAGE_SIZE];
+}
+
+
+static inline void memtrack_store_slot_free (MemTrackStore* store, MemTrackSlot* slot) {
+	slot->free.ptr = NULL;
+	slot->free.next = store->free;
+	store->free = slot;
+	store->free_count++;
+}
+
+
+/* 続けて count 個のエントリを登録しても索引の作り直しとページの確保をせずに済むようにしておく、確保できなければ登録時に確保し直すだけ */
+static void memtrack_store_reserve (MemTrackStore* store, size_t count) {
+	size_t index_capacity = (count <= SIZE_MAX - store->count) ? memtrack_store_capacity_for(store->capacity, store->count + count) : 0;
+	if (index_capacity == 0) return;
+	if (index_capacity > store->capacity && !memtrack_store_rehash(store, index_capacity)) return;
+
+	size_t available = store->free_count + (store->page_count * MEMTRACK_STORE_PAGE_SIZE - store->used);
+	if (count <= available) return;
+
+	size_t pages = (count - available) / MEMTRACK_STORE_PAGE_SIZE + ((count - available) % MEMTRACK_STORE_PAGE_SIZE != 0);
+	if (pages > store->page_capacity - store->page_count) {
+		size_t capacity = (store->page_capacity == 0) ? 16 : store->page_capacity;
+		while (capacity - store->page_count < pages && capacity <= SIZE_MAX / 2 / sizeof(MemTrackSlot*))
+			capacity *= 2;
+		if (capacity - store->page_count < pages) return;
+
+		MemTrackSlot** new_pages = realloc(store->pages, capacity * sizeof(MemTrackSlot*));
+		if (new_pages == NULL) return;
+		store->pages = new_pages;
+		store->page_capacity = capacity;
+	}
+
+	for (size_t i = 0; i < pages; i++) {
+		if (!memtrack_store_page_add(store)) return;
+	}
+}
+
+
+/* entry をコピーして登録する、同じポインタのエントリがあれば上書きする */
+static bool memtrack_store_set (MemTrackStore* store, const MemTrackEntry* entry) {
+	size_t index = memtrack_store_find(store, entry->ptr);
+	if (store->keys[index] != NULL) {
+		*store->values[index] = *entry;
+		return true;
+	}
+
+	if (store->count + 1 > store->capacity / 4 * 3) {
+		if (store->capacity > SIZE_MAX / 2 / sizeof(void*) || !memtrack_store_rehash(store, store->capacity * 2)) return false;
+		index = memtrack_store_find(store, entry->ptr);
+	}
+
+	MemTrackSlot* slot = memtrack_store_slot_alloc(store);
+	if (slot == NULL) return false;
+	slot->entry = *entry;
+
+	store->keys[index] = entry->ptr;
+	store->values[index] = &slot->entry;
+	store->count++;
+	return true;
+}
+
+
+/* entry には memtrack_store_get などで得た store 内のエントリを渡す */
+static bool memtrack_store_remove (MemTrackStore* store, MemTrackEntry* entry) {
+	size_t mask = store->capacity - 1;
+	size_t hole = memtrack_store_find(store, entry->ptr);
+	if (store->keys[hole] == NULL) return false;
+
+	/* 墓標を残さず、後ろに続くキーのうち本来の位置から見て穴を越えた位置にあるものを穴に詰める */
+	for (size_t index = (hole + 1) & mask; store->keys[index] != NULL; index = (index + 1) & mask) {
+		size_t home = memtrack_store_hash(store, store->keys[index]);
+		if (((index - home) & mask) >= ((index - hole) & mask)) {
+			store->keys[hole] = store->keys[index];
+			store->values[hole] = store->values[index];
+			hole = index;
+		}
+	}
+	store->keys[hole] = NULL;
+	store->count--;
+
+	memtrack_store_slot_free(store, (MemTrackSlot*)(void*)entry);
+	return true;
+}
+
+
+#ifdef MEMTRACK_FORK_SAFE
+static void memtrack_fork_register (void);
+#endif
+
+
+#ifdef MEMTRACK_BACKTRACE
+/* 公開ラッパー関数の戻り先、バックトレースはこのアドレスのフレームから記録してライブラリ自身のフレームを含めない */
+static THREAD_LOCAL void* memtrack_backtrace_caller = NULL;
+#endif
+
+
+#ifndef MEMTRACK_SHARDED
+
+
+static MemTrackStore* memtrack_entries = NULL;
+
+#ifdef DEBUG
+static MemTrackQuarantine memtrack_quarantine;
+#endif
+
+#ifdef MEMTRACK_HEADER
+static MemTrackHeader* memtrack_headers = NULL;  /* ヘッダー付きで確保した生存中のブロックの一覧 */
+#endif
+
+
+#ifndef MEMTRACK_DEFERRED_DIAG
+	#define GLOBAL_LOCK_FUNC_NAME memtrack_lock
+	#define GLOBAL_UNLOCK_FUNC_NAME memtrack_unlock
+	#define GLOBAL_LOCK_FUNC_SCOPE
+#else
+	#define GLOBAL_LOCK_FUNC_NAME memtrack_global_lock
+	#define GLOBAL_UNLOCK_FUNC_NAME memtrack_global_unlock
+	#define GLOBAL_LOCK_FUNC_SCOPE static
+#endif
+
+#include "global_lock.h"
+
+
+#ifdef MEMTRACK_DEFERRED_DIAG
+void memtrack_lock (void) {
+	memtrack_global_lock();
+}
+
+
+/* ロックの解放後に溜まった診断メッセージを出力する */
+void memtrack_unlock (void) {
+	memtrack_global_unlock();
+	memtrack_diag_drain();
+}
+#endif
+
+
+static void quit (void);
+
+/* 重要: この関数は必ずロックした後に呼び出す必要があります！ */
+static void init (void) {
+	for (size_t i = 0; i < MEMTRACK_ENTRIES_TRIAL; i++) {
+		memtrack_entries = memtrack_store_create();
+		if (LIKELY(memtrack_entries != NULL)) break;
+	}
+	if (UNLIKELY(memtrack_entries == NULL)) {
+		fprintf(stderr, "Failed to initialize memory tracking.\nFile: %s   Line: %d\n", __FILE__, __LINE__);
+		memtrack_unlock();
+		global_lock_quit();
+		exit(EXIT_FAILURE);
+	}
+
+	atexit(quit);
+#ifdef MEMTRACK_FORK_SAFE
+	memtrack_fork_register();
+#endif
+}
+
+
+static inline MemTrackStore* memtrack_table_of (const void* ptr) {
+	(void)ptr;
+	return memtrack_entries;
+}
+
+
+#ifdef DEBUG
+static inline MemTrackQuarantine* memtrack_quarantine_of (const void* ptr) {
+	(void)ptr;
+	return &memtrack_quarantine;
+}
+#endif
+
+
+/* 非シャードモードではラッパー関数がグローバルロックを保持しているため、シャード単位のロックは何もしない */
+static inline void memtrack_shard_lock (const void* ptr) {
+	(void)ptr;
+}
+
+static inline void memtrack_shard_unlock (const void* ptr) {
+	(void)ptr;
+}
+
+static inline void memtrack_shard_lock_pair (const void* ptr1, const void* ptr2) {
+	(void)ptr1;
+	(void)ptr2;
+}
+
+static inline void memtrack_shard_unlock_pair (const void* ptr1, const void* ptr2) {
+	(void)ptr1;
+	(void)ptr2;
+}
+
+
+/* 公開ラッパー関数は呼び出し全体をグローバルロックで保護する、__builtin_return_address が公開ラッパー関数の戻り先を返すよう必ずインライン化する */
+__attribute__((always_inline)) static inline void memtrack_wrapper_lock (void) {
+#ifdef MEMTRACK_BACKTRACE
+	memtrack_backtrace_caller = __builtin_return_address(0);
+#endif
+	memtrack_lock();
+}
+
+static inline void memtrack_wrapper_unlock (void) {
+#ifdef MEMTRACK_BACKTRACE
+	memtrack_backtrace_caller = NULL;
+#endif
+	memtrack_unlock();
+}
+
+
+#else  /* defined MEMTRACK_SHARDED */
+
+
+/* エントリテーブルの分割単位、偽共有を避けるためキャッシュライン境界に揃える */
+typedef struct {
+	_Alignas(64) pthread_mutex_t lock;
+	MemTrackStore* entries;
+#ifdef MEMTRACK_HEADER
+	MemTrackHeader* headers;  /* ヘッダー付きで確保した生存中のブロックの一覧 */
+#endif
+} MemTrackShard;
+
+static MemTrackShard memtrack_shards[MEMTRACK_SHARD_COUNT];
+
+#ifdef DEBUG
+/*
+ * シャードごとの隔離リング、同じ添字のシャードのロックで保護する
+ * memtrack_shards の外に置き、添字の定まらないリングへの書き込みで -fanalyzer がシャードの entries を見失わないようにする
+ */
+static MemTrackQuarantine memtrack_quarantines[MEMTRACK_SHARD_COUNT];
+#endif
+
+static atomic_bool memtrack_initialized = false;
+static pthread_mutex_t memtrack_init_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* このスレッドが memtrack_lock で全シャードのロックを保持している間は true */
+static THREAD_LOCAL bool memtrack_lock_held = false;
+
+
+#ifdef MEMTRACK_THREAD_BUFFER
+/*
+ * テーブルに反映される前のエントリを保持するスレッドごとのバッファ
+ * ロックの順序は必ず「バッファ一覧 → 各バッファ → シャード」としなければならない
+ */
+typedef struct MemTrackBuffer {
+	pthread_mutex_t lock;
+	struct MemTrackBuffer* prev;
+	struct MemTrackBuffer* next;
+	size_t count;
+	MemTrackEntry entries[MEMTRACK_THREAD_BUFFER_SIZE];
+} MemTrackBuffer;
+
+static pthread_mutex_t memtrack_buffers_lock = PTHREAD_MUTEX_INITIALIZER;
+static MemTrackBuffer* memtrack_buffers = NULL;
+
+static pthread_key_t memtrack_buffer_key;
+static THREAD_LOCAL MemTrackBuffer* memtrack_buffer = NULL;
+
+static void memtrack_buffer_destroy (void* arg);
+#endif
+
+
+/* グローバルロックは memtrack_lock 同士の直列化にのみ使用する */
+#define GLOBAL_LOCK_FUNC_NAME memtrack_global_lock
+#define GLOBAL_UNLOCK_FUNC_NAME memtrack_global_unlock
+#define GLOBAL_LOCK_FUNC_SCOPE static
+
+#include "global_lock.h"
+
+
+static void quit (void);
+
+static void init_once (void) {
+#ifdef MEMTRACK_THREAD_BUFFER
+	if (UNLIKELY(pthread_key_create(&memtrack_buffer_key, memtrack_buffer_destroy) != 0)) {
+		fprintf(stderr, "Failed to initialize memory tracking.\nFile: %s   Line: %d\n", __FILE__, __LINE__);
+		exit(EXIT_FAILURE);
+	}
+#endif
+
+	for (size_t i = 0; i < MEMTRACK_SHARD_COUNT; i++) {
+		if (UNLIKELY(pthread_mutex_init(&memtrack_shards[i].lock, NULL) != 0)) {
+			fprintf(stderr, "Failed to initialize memory tracking.\nFile: %s   Line: %d\n", __FILE__, __LINE__);
+			exit(EXIT_FAILURE);
+		}
+
+		for (size_t j = 0; j < MEMTRACK_ENTRIES_TRIAL; j++) {
+			memtrack_shards[i].entries = memtrack_store_create();
+			if (LIKELY(memtrack_shards[i].entries != NULL)) break;
+		}
+		if (UNLIKELY(memtrack_shards[i].entries == NULL)) {
+			fprintf(stderr, "Failed to initialize memory tracking.\nFile: %s   Line: %d\n", __FILE__, __LINE__);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	atexit(quit);
+#ifdef MEMTRACK_FORK_SAFE
+	memtrack_fork_register();
+#endif
+
+	atomic_store_explicit(&memtrack_initialized, true, memory_order_release);
+}
+
+
+/*
+ * シャードモードでは何度呼び出しても安全で、ロックの有無も問わない
+ * pthread_once を使うと -fanalyzer が init_once で作ったテーブルを追えなくなるため、専用のロックで一度だけ呼び出す
+ */
+static inline void init (void) {
+	if (UNLIKELY(!atomic_load_explicit(&memtrack_initialized, memory_order_acquire))) {
+		pthread_mutex_lock(&memtrack_init_lock);
+		if (!atomic_load_explicit(&memtrack_initialized, memory_order_relaxed)) init_once();
+		pthread_mutex_unlock(&memtrack_init_lock);
+	}
+}
+
+
+/* 16 バイト境界に揃ったポインタでも偏らないよう、下位ビットを捨てページ番号を混ぜる */
+static inline size_t memtrack_shard_index (const void* ptr) {
+	uintptr_t key = (uintptr_t)ptr;
+	key ^= key >> 12;
+	return (size_t)((key >> 4) & (MEMTRACK_SHARD_COUNT - 1));
+}
+
+
+static inline MemTrackStore* memtrack_table_of (const void* ptr) {
+	return memtrack_shards[memtrack_shard_index(ptr)].entries;
+}
+
+
+#ifdef DEBUG
+static inline MemTrackQuarantine* memtrack_quarantine_of (const void* ptr) {
+	return &memtrack_quarantines[memtrack_shard_index(ptr)];
+}
+#endif
+
+
+static inline void memtrack_shard_lock_index (size_t index) {
+	if (!memtrack_lock_held) {
+		init();
+		pthread_mutex_lock(&memtrack_shards[index].lock);
+	}
+}
+
+static inline void memtrack_shard_unlock_index (size_t index) {
+	if (!memtrack_lock_held)
+		pthread_mutex_unlock(&memtrack_shards[index].lock);
+}
+
+
+static inline void memtrack_shard_lock (const void* ptr) {
+	memtrack_shard_lock_index(memtrack_shard_index(ptr));
+}
+
+static inline void memtrack_shard_unlock (const void* ptr) {
+	memtrack_shard_unlock_index(memtrack_shard_index(ptr));
+}
+
+
+/* デッドロックを避けるため、2 つのシャードは必ず添字の小さい順にロックする */
+static inline void memtrack_shard_lock_pair (const void* ptr1, const void* ptr2) {
+	if (memtrack_lock_held) return;
+
+	init();
+
+	size_t index1 = memtrack_shard_index(ptr1);
+	size_t index2 = memtrack_shard_index(ptr2);
+
+	if (index1 == index2) {
+		pthread_mutex_lock(&memtrack_shards[index1].lock);
+	} else if (index1 < index2) {
+		pthread_mutex_lock(&memtrack_shards[index1].lock);
+		pthread_mutex_lock(&memtrack_shards[index2].lock);
+	} else {
+		pthread_mutex_lock(&memtrack_shards[index2].lock);
+		pthread_mutex_lock(&memtrack_shards[index1].lock);
+	}
+}
+
+static inline void memtrack_shard_unlock_pair (const void* ptr1, const void* ptr2) {
+	if (memtrack_lock_held) return;
+
+	size_t index1 = memtrack_shard_index(ptr1);
+	size_t index2 = memtrack_shard_index(ptr2);
+
+	pthread_mutex_unlock(&memtrack_shards[index1].lock);
+	if (index1 != index2)
+		pthread_mutex_unlock(&memtrack_shards[index2].lock);
+}
+
+
+void memtrack_lock (void) {
+	init();
+
+	memtrack_global_lock();
+
+#ifdef MEMTRACK_THREAD_BUFFER
+	/* ロック中は全スレッドのバッファを直接操作できるよう、全バッファもロックする */
+	pthread_mutex_lock(&memtrack_buffers_lock);
+	for (MemTrackBuffer* buffer = memtrack_buffers; buffer != NULL; buffer = buffer->next)
+		pthread_mutex_lock(&buffer->lock);
+#endif
+
+	for (size_t i = 0; i < MEMTRACK_SHARD_COUNT; i++)
+		pthread_mutex_lock(&memtrack_shards[i].lock);
+
+	memtrack_lock_held = true;
+}
+
+
+void memtrack_unlock (void) {
+	memtrack_lock_held = false;
+
+	for (size_t i = MEMTRACK_SHARD_COUNT; i > 0; i--)
+		pthread_mutex_unlock(&memtrack_shards[i - 1].lock);
+
+#ifdef MEMTRACK_THREAD_BUFFER
+	for (MemTrackBuffer* buffer = memtrack_buffers; buffer != NULL; buffer = buffer->next)
+		pthread_mutex_unlock(&buffer->lock);
+	pthread_mutex_unlock(&memtrack_buffers_lock);
+#endif
+
+	memtrack_global_unlock();
+
+#ifdef MEMTRACK_DEFERRED_DIAG
+	memtrack_diag_drain();
+#endif
+}
+
+
+/*
+ * 公開ラッパー関数はグローバルロックを取らず、エントリテーブルを操作する箇所でのみ
+ * 該当するシャードをロックする（実際のメモリ確保や解放はロックの外で行われる）
+ * __builtin_return_address が公開ラッパー関数の戻り先を返すよう必ずインライン化する
+ */
+__attribute__((always_inline)) static inline void memtrack_wrapper_lock (void) {
+#ifdef MEMTRACK_BACKTRACE
+	memtrack_backtrace_caller = __builtin_return_address(0);
+#endif
+	init();
+}
+
+static inline void memtrack_wrapper_unlock (void) {
+#ifdef MEMTRACK_BACKTRACE
+	memtrack_backtrace_caller = NULL;
+#endif
+#ifdef MEMTRACK_DEFERRED_DIAG
+	if (!memtrack_lock_held) memtrack_diag_drain();
+#endif
+}
+
+
+#endif
+
+
+#ifdef MEMTRACK_SAMPLING
+
+
+/* 浮動小数点リテラルを避けるため整数の比で表した ln 2 */
+#define MEMTRACK_LN2 ((double)6931471805599453ULL / 10000000000000000ULL)
+
+
+static atomic_size_t memtrack_sample_interval = MEMTRACK_SAMPLE_INTERVAL;
+
+/* 記録済みのポインタをハッシュごとに数える、0 であればそのポインタは記録されていない */
+static atomic_uint memtrack_sample_filter[MEMTRACK_SAMPLE_FILTER_SIZE];
+
+static THREAD_LOCAL size_t memtrack_sample_bytes_left = 0;  /* 次に記録するまでの残りバイト数 */
+static THREAD_LOCAL uint64_t memtrack_sample_rng = 0;  /* 0 の間はこのスレッドで一度も確保していない */
+
+
+static inline size_t memtrack_sample_filter_index (const void* ptr) {
+	uint64_t key = (uint64_t)(uintptr_t)ptr;
+	key ^= key >> 29;
+	key *= 0x9E3779B97F4A7C15ULL;
+	return (size_t)(key >> 40) & (MEMTRACK_SAMPLE_FILTER_SIZE - 1);
+}
+
+
+/* ptr が記録されている可能性があれば true を返す（false であればテーブルを見る必要はない） */
+static inline bool memtrack_sample_maybe_tracked (const void* ptr) {
+	return atomic_load_explicit(&memtrack_sample_filter[memtrack_sample_filter_index(ptr)], memory_order_relaxed) != 0;
+}
+
+static inline void memtrack_sample_filter_inc (const void* ptr) {
+	atomic_fetch_add_explicit(&memtrack_sample_filter[memtrack_sample_filter_index(ptr)], 1, memory_order_relaxed);
+}
+
+static inline void memtrack_sample_filter_dec (const void* ptr) {
+	atomic_fetch_sub_explicit(&memtrack_sample_filter[memtrack_sample_filter_index(ptr)], 1, memory_order_relaxed);
+}
+
+
+/* xorshift64* */
+static uint64_t memtrack_sample_random (void) {
+	uint64_t x = memtrack_sample_rng;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	memtrack_sample_rng = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+
+/*
+ * 平均 interval の指数分布に従う、次に記録するまでのバイト数を返す
+ * libm に依存しないよう、-ln(u) は u = m * 2^msb (1 <= m < 2) と分けて ln(m) を級数で求める
+ * 仮数部を線形近似すると平均が interval より 4% ほど長くなり、memtrack_sample_weight の推定が小さく偏る
+ */
+static size_t memtrack_sample_next_interval (size_t interval) {
+	uint32_t u = (uint32_t)(memtrack_sample_random() >> 32) | 1u;
+
+	unsigned int msb = 31;
+	while ((u >> msb) == 0) msb--;
+
+	/* ln(m) = 2 * atanh(s)、s = (m - 1) / (m + 1) <= 1/3 なので s^9 の項までで誤差は 1e-6 未満になる */
+	double m = (double)u / (double)(1u << msb);
+	double s = (m - 1) / (m + 1);
+	double s2 = s * s;
+	double term = s;
+	double ln_m = 0;
+	for (int k = 1; k <= 9; k += 2) {
+		ln_m += 2 * term / k;
+		term *= s2;
+	}
+
+	double bytes = ((double)(32 - msb) * MEMTRACK_LN2 - ln_m) * (double)interval;
+	if (bytes >= (double)SIZE_MAX) return SIZE_MAX;
+	return (size_t)bytes + 1;
+}
+
+
+/* size バイトのブロックが記録される確率 1 - exp(-size / interval) の逆数を重みとして返す */
+static size_t memtrack_sample_weight (size_t size, size_t interval) {
+	if (interval <= 1) return size;
+
+	double x = (double)size / (double)interval;
+	if (x >= 32) return size;
+
+	double y = x / 64;
+	double e = 1 - y + y * y / 2 - y * y * y / 6;  /* exp(-x / 64) */
+	for (int i = 0; i < 6; i++) e *= e;  /* exp(-x) */
+
+	double weight = (double)size / (1 - e);
+	if (weight >= (double)SIZE_MAX) return SIZE_MAX;
+	return (size_t)weight;
+}
+
+
+static bool memtrack_sample_take_slow (size_t size, size_t* weight) {
+	size_t interval = atomic_load_explicit(&memtrack_sample_interval, memory_order_relaxed);
+	if (interval <= 1) {  /* 全ての確保を記録する */
+		*weight = size;
+		return true;
+	}
+
+	if (UNLIKELY(memtrack_sample_rng == 0)) {  /* 最初の確保が必ず記録されることのないよう、残りバイト数を決めてから数える */
+		memtrack_sample_rng = ((uint64_t)(uintptr_t)&memtrack_sample_bytes_left ^ 0x9E3779B97F4A7C15ULL) | 1u;
+		memtrack_sample_bytes_left = memtrack_sample_next_interval(interval);
+		if (memtrack_sample_bytes_left > size) {
+			memtrack_sample_bytes_left -= size;
+			return false;
+		}
+	}
+
+	memtrack_sample_bytes_left = memtrack_sample_next_interval(interval);
+	*weight = memtrack_sample_weight(size, interval);
+	return true;
+}
+
+
+/* size バイトの確保を記録する場合は true を返し、weight に重みを設定する */
+static inline bool memtrack_sample_take (size_t size, size_t* weight) {
+	if (LIKELY(memtrack_sample_bytes_left > size)) {
+		memtrack_sample_bytes_left -= size;
+		return false;
+	}
+	return memtrack_sample_take_slow(size, weight);
+}
+
+
+void memtrack_set_sample_interval (size_t interval) {
+	atomic_store_explicit(&memtrack_sample_interval, interval, memory_order_relaxed);
+}
+
+
+size_t memtrack_get_sample_interval (void) {
+	return atomic_load_explicit(&memtrack_sample_interval, memory_order_relaxed);
+}
+
+
+#endif
+
+
+#ifdef MEMTRACK_SITE_TABLE
+
+
+#define MEMTRACK_SITE_EMPTY 0
+#define MEMTRACK_SITE_CLAIMED 1  /* file と line を書き込み中 */
+#define MEMTRACK_SITE_READY 2
+
+
+/*
+ * 登録は一度きりで削除しないため、ロックを使わずに検索と追加ができる
+ * 末尾の要素は表が埋まった後の呼び出し元をまとめて扱うためのもので、検索の対象にはならない
+ */
+static MemTrackSite memtrack_sites[MEMTRACK_SITE_COUNT + 1];
+
+#define MEMTRACK_SITE_OVERFLOW ((MemTrackSiteId)MEMTRACK_SITE_COUNT + 1)
+
+
+#ifdef MEMTRACK_TRACE
+static void memtrack_trace_site (MemTrackSiteId id, const char* file, int line);
+#endif
+
+
+static inline size_t memtrack_site_index (const char* file, int line) {
+	uint64_t key = (uint64_t)(uintptr_t)file ^ ((uint64_t)(unsigned int)line << 32);
+	key ^= key >> 29;
+	key *= 0x9E3779B97F4A7C15ULL;
+	return (size_t)(key >> 40) & (MEMTRACK_SITE_COUNT - 1);
+}
+
+
+/*
+ * file と line に対応する呼び出し元の番号を返す（なければ登録する）
+ * file は文字列の内容ではなくアドレスで比較するため、__FILE__ を渡すのが前提となる
+ */
+static MemTrackSiteId memtrack_site_id (const char* file, int line) {
+	size_t index = memtrack_site_index(file, line);
+	for (size_t i = 0; i < MEMTRACK_SITE_COUNT; i++) {
+		size_t slot = (index + i) & (MEMTRACK_SITE_COUNT - 1);
+		MemTrackSite* site = &memtrack_sites[slot];
+
+		int state = atomic_load_explicit(&site->state, memory_order_acquire);
+		if (state == MEMTRACK_SITE_EMPTY) {
+			if (atomic_compare_exchange_strong_explicit(&site->state, &state, MEMTRACK_SITE_CLAIMED, memory_order_acquire, memory_order_acquire)) {
+				site->file = file;
+				site->line = line;
+#ifndef MEMTRACK_TRACE
+				atomic_store_explicit(&site->state, MEMTRACK_SITE_READY, memory_order_release);
+#else
+				atomic_store_explicit(&site->state, MEMTRACK_SITE_READY, memory_order_seq_cst);
+				memtrack_trace_site((MemTrackSiteId)slot + 1, file, line);
+#endif
+				return (MemTrackSiteId)slot + 1;
+			}
+		}
+
+		while (state == MEMTRACK_SITE_CLAIMED)  /* 他スレッドの登録はすぐに終わる */
+			state = atomic_load_explicit(&site->state, memory_order_acquire);
+
+		if (site->file == file && site->line == line) return (MemTrackSiteId)slot + 1;
+	}
+	return MEMTRACK_SITE_OVERFLOW;
+}
+
+
+static inline MemTrackSite* memtrack_site_at (MemTrackSiteId id) {
+	return &memtrack_sites[id - 1];
+}
+
+
+#ifdef MEMTRACK_CALL_SITE
+/* 表示用、番号が 0 の場合と登録しきれなかった呼び出し元の場合は NULL と 0 を返す */
+static inline const char* memtrack_site_file (MemTrackSiteId id) {
+	return (id == 0) ? NULL : memtrack_site_at(id)->file;
+}
+
+static inline int memtrack_site_line (MemTrackSiteId id) {
+	return (id == 0) ? 0 : memtrack_site_at(id)->line;
+}
+#endif
+
+
+#endif
+
+
+#ifdef MEMTRACK_TRACE
+
+
+static _Atomic(MemTrackTraceHeader*) memtrack_trace = NULL;  /* 記録中のトレースファイルの先頭、記録していなければ NULL */
+static atomic_bool memtrack_trace_started = false;
+static atomic_uint memtrack_trace_threads = 0;  /* 最後に割り当てたスレッド番号 */
+static THREAD_LOCAL uint32_t memtrack_trace_thread = 0;  /* 0 の間はこのスレッドで一度も記録していない */
+
+
+static inline uint64_t memtrack_trace_now (clockid_t clock) {
+	struct timespec ts;
+	clock_gettime(clock, &ts);  /* 主要な環境では vDSO で処理されシステムコールにならない */
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+
+static inline MemTrackTraceSite* memtrack_trace_sites (MemTrackTraceHeader* header) {
+	return (MemTrackTraceSite*)(void*)((char*)header + header->site_offset);
+}
+
+static inline MemTrackTraceRecord* memtrack_trace_records (MemTrackTraceHeader* header) {
+	return (MemTrackTraceRecord*)(void*)((char*)header + header->record_offset);
+}
+
+
+/* 呼び出し元の名前をファイルに書き込む、既に書き込まれている（または書き込み中の）場合は何もしない */
+static void memtrack_trace_site_write (MemTrackTraceHeader* header, MemTrackSiteId id, const char* file, int line) {
+	MemTrackTraceSite* site = &memtrack_trace_sites(header)[id - 1];
+	uint32_t state = MEMTRACK_TRACE_SITE_EMPTY;
+	if (!atomic_compare_exchange_strong_explicit(&site->state, &state, MEMTRACK_TRACE_SITE_WRITING, memory_order_relaxed, memory_order_relaxed)) return;
+
+	/* 収まらない場合はディレクトリ側を切り詰める */
+	size_t length = (file == NULL) ? 0 : strlen(file);
+	if (length > MEMTRACK_TRACE_FILE_SIZE - 1) {
+		file += length - (MEMTRACK_TRACE_FILE_SIZE - 1);
+		length = MEMTRACK_TRACE_FILE_SIZE - 1;
+	}
+	if (length != 0) memcpy(site->file, file, length);
+	site->file[length] = '\0';
+	site->line = (int32_t)line;
+
+	atomic_store_explicit(&site->state, MEMTRACK_TRACE_SITE_READY, memory_order_release);
+}
+
+
+/* memtrack_site_id が呼び出し元を登録した直後に呼ばれる */
+static void memtrack_trace_site (MemTrackSiteId id, const char* file, int line) {
+	/* 登録済みの状態の書き込みと合わせて seq_cst にし、memtrack_trace_start の走査と行き違いにならないようにする */
+	MemTrackTraceHeader* header = atomic_load_explicit(&memtrack_trace, memory_order_seq_cst);
+	if (header != NULL) memtrack_trace_site_write(header, id, file, line);
+}
+
+
+/*
+ * リングの 1 件分を予約して時刻だけを書き込み、予約番号（位置 + 1）を返す、トレースを開始していなければ 0
+ * realloc のように記録する操作の途中で他スレッドが同じアドレスを再取得し得る場合は、操作の前に予約して後から埋めることで順序を保つ
+ */
+static uint64_t memtrack_trace_reserve (void) {
+	MemTrackTraceHeader* header = atomic_load_explicit(&memtrack_trace, memory_order_acquire);
+	if (LIKELY(header == NULL)) return 0;
+
+	uint64_t pos = atomic_fetch_add_explicit(&header->next, 1, memory_order_relaxed);
+	MemTrackTraceRecord* record = &memtrack_trace_records(header)[pos & (header->record_count - 1)];
+
+	/* 書き込み途中の記録が前の周回の完成した記録に見えないよう、先に seq を消しておく */
+	atomic_store_explicit(&record->seq, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	record->time = memtrack_trace_now(CLOCK_MONOTONIC);
+	return pos + 1;
+}
+
+
+/* memtrack_trace_reserve で予約した記録を埋めて完成させる、予約していない場合は何もしない */
+static void memtrack_trace_fill (uint64_t slot, uint32_t op, void* ptr, void* old_ptr, size_t size, const char* file, int line) {
+	if (LIKELY(slot == 0)) return;
+
+	/* 終了処理で記録を止めた後もマッピングは残るため、予約時のヘッダーを読み直せる */
+	MemTrackTraceHeader* header = atomic_load_explicit(&memtrack_trace, memory_order_acquire);
+	if (UNLIKELY(header == NULL)) return;
+
+	uint64_t pos = slot - 1;
+	if (UNLIKELY(atomic_load_explicit(&header->next, memory_order_relaxed) - pos > header->record_count)) return;  /* 予約している間にリングが一周して上書きされた */
+
+	if (UNLIKELY(memtrack_trace_thread == 0))
+		memtrack_trace_thread = atomic_fetch_add_explicit(&memtrack_trace_threads, 1, memory_order_relaxed) + 1;
+
+	MemTrackTraceRecord* record = &memtrack_trace_records(header)[pos & (header->record_count - 1)];
+	record->ptr = (uint64_t)(uintptr_t)ptr;
+	record->old_ptr = (uint64_t)(uintptr_t)old_ptr;
+	record->size = (uint64_t)size;
+	record->thread = memtrack_trace_thread;
+	record->site = memtrack_site_id(file, line);
+	record->op = op;
+	record->reserved = 0;
+
+	atomic_store_explicit(&record->seq, slot, memory_order_release);
+}
+
+
+/* 1 件の記録をリングに書き込む、トレースを開始していなければ何もしない */
+static inline void memtrack_trace_record (uint32_t op, void* ptr, void* old_ptr, size_t size, const char* file, int line) {
+	memtrack_trace_fill(memtrack_trace_reserve(), op, ptr, old_ptr, size, file, line);
+}
+
+
+static inline void memtrack_trace_add (void* ptr, size_t size, const char* file, int line) {
+	memtrack_trace_record(MEMTRACK_TRACE_ADD, ptr, NULL, size, file, line);
+}
+
+static inline void memtrack_trace_update (void* old_ptr, void* new_ptr, size_t new_size, const char* file, int line) {
+	memtrack_trace_record(MEMTRACK_TRACE_UPDATE, new_ptr, old_ptr, new_size, file, line);
+}
+
+/* realloc の前に予約した slot に更新を記録する、realloc に失敗した場合は new_ptr に old_ptr を渡して変化のない更新として埋める */
+static inline void memtrack_trace_update_at (uint64_t slot, void* old_ptr, void* new_ptr, size_t new_size, const char* file, int line) {
+	memtrack_trace_fill(slot, MEMTRACK_TRACE_UPDATE, new_ptr, old_ptr, new_size, file, line);
+}
+
+static inline void memtrack_trace_free (void* ptr, const char* file, int line) {
+	memtrack_trace_record(MEMTRACK_TRACE_FREE, ptr, NULL, 0, file, line);
+}
+
+
+/* 終了処理による解放を記録に含めないよう、終了処理の開始時に記録を止める */
+static void memtrack_trace_quit (void) {
+	MemTrackTraceHeader* header = atomic_exchange_explicit(&memtrack_trace, NULL, memory_order_acq_rel);
+	if (header != NULL) atomic_fetch_or_explicit(&header->flags, MEMTRACK_TRACE_EXITED, memory_order_release);
+}
+
+
+bool memtrack_trace_start (const char* path, size_t record_count) {
+	if (path == NULL) {
+		memtrack_report("path is null! No trace can be recorded!", NULL, __FILE__, __LINE__);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_trace_start";
+		return false;
+	}
+
+	if (record_count == 0) record_count = MEMTRACK_TRACE_RECORD_COUNT;
+
+	size_t site_offset = (sizeof(MemTrackTraceHeader) + 63) & ~(size_t)63;
+	size_t record_offset = site_offset + sizeof(MemTrackTraceSite) * (MEMTRACK_SITE_COUNT + 1);
+	size_t max_count = (SIZE_MAX - record_offset) / sizeof(MemTrackTraceRecord);
+
+	size_t count = 1;
+	while (count < record_count && count <= max_count / 2) count <<= 1;
+	if (count < record_count) {
+		memtrack_report("The trace file would be too large.", NULL, __FILE__, __LINE__);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_trace_start";
+		return false;
+	}
+	size_t length = record_offset + sizeof(MemTrackTraceRecord) * count;
+
+	if (atomic_exchange_explicit(&memtrack_trace_started, true, memory_order_acq_rel)) {
+		memtrack_report("The trace has already been started.", NULL, __FILE__, __LINE__);
+		errno = EBUSY;
+		memtrack_errfunc = "memtrack_trace_start";
+		return false;
+	}
+
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (UNLIKELY(fd == -1)) {
+		memtrack_report("Failed to open the trace file.", NULL, __FILE__, __LINE__);
+		memtrack_errfunc = "memtrack_trace_start";
+		atomic_store_explicit(&memtrack_trace_started, false, memory_order_release);
+		return false;
+	}
+
+	/* ftruncate で伸ばした部分はゼロで埋められるため、記録と呼び出し元は空の状態から始まる */
+	void* map = MAP_FAILED;
+	if (LIKELY(ftruncate(fd, (off_t)length) == 0))
+		map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	int tmp_errno = errno;
+	close(fd);  /* マッピングは閉じた後も有効 */
+
+	if (UNLIKELY(map == MAP_FAILED)) {
+		memtrack_report("Failed to map the trace file.", NULL, __FILE__, __LINE__);
+		errno = tmp_errno;
+		memtrack_errfunc = "memtrack_trace_start";
+		atomic_store_explicit(&memtrack_trace_started, false, memory_order_release);
+		return false;
+	}
+
+	MemTrackTraceHeader* header = (MemTrackTraceHeader*)map;
+	header->magic = MEMTRACK_TRACE_MAGIC;
+	header->version = MEMTRACK_TRACE_VERSION;
+	header->record_size = (uint32_t)sizeof(MemTrackTraceRecord);
+	header->site_size = (uint32_t)sizeof(MemTrackTraceSite);
+	header->record_count = (uint64_t)count;
+	header->site_count = (uint64_t)MEMTRACK_SITE_COUNT + 1;
+	header->site_offset = (uint64_t)site_offset;
+	header->record_offset = (uint64_t)record_offset;
+	header->start_realtime = memtrack_trace_now(CLOCK_REALTIME);
+	header->start_monotonic = memtrack_trace_now(CLOCK_MONOTONIC);
+	memtrack_trace_site_write(header, MEMTRACK_SITE_OVERFLOW, "(other sites)", 0);
+
+	atomic_store_explicit(&memtrack_trace, header, memory_order_seq_cst);
+	atexit(memtrack_trace_quit);  /* init がまだ終了処理を登録していない場合に備える */
+
+	/* 開始前に登録された呼び出し元を書き込む、並行して登録されたものは memtrack_trace_site が書き込む */
+	for (size_t i = 0; i < MEMTRACK_SITE_COUNT; i++) {
+		MemTrackSite* site = &memtrack_sites[i];
+		if (atomic_load_explicit(&site->state, memory_order_seq_cst) == MEMTRACK_SITE_READY)
+			memtrack_trace_site_write(header, (MemTrackSiteId)i + 1, site->file, site->line);
+	}
+	return true;
+}
+
+
+#else
+
+
+static inline void memtrack_trace_add (void* ptr, size_t size, const char* file, int line) {
+	(void)ptr;
+	(void)size;
+	(void)file;
+	(void)line;
+}
+
+static inline void memtrack_trace_update (void* old_ptr, void* new_ptr, size_t new_size, const char* file, int line) {
+	(void)old_ptr;
+	(void)new_ptr;
+	(void)new_size;
+	(void)file;
+	(void)line;
+}
+
+static inline uint64_t memtrack_trace_reserve (void) {
+	return 0;
+}
+
+static inline void memtrack_trace_update_at (uint64_t slot, void* old_ptr, void* new_ptr, size_t new_size, const char* file, int line) {
+	(void)slot;
+	(void)old_ptr;
+	(void)new_ptr;
+	(void)new_size;
+	(void)file;
+	(void)line;
+}
+
+static inline void memtrack_trace_free (void* ptr, const char* file, int line) {
+	(void)ptr;
+	(void)file;
+	(void)line;
+}
+
+
+#endif
+
+
+static inline size_t memtrack_entry_bytes_of (const MemTrackEntry* entry) {
+#ifdef MEMTRACK_SAMPLING
+	return entry->weight;
+#else
+	return entry->size;
+#endif
+}
+
+
+static inline size_t memtrack_entry_count_of (const MemTrackEntry* entry) {
+#ifdef MEMTRACK_SAMPLING
+	if (entry->size != 0 && entry->weight > entry->size) return entry->weight / entry->size;  /* 代表する推定件数 */
+#else
+	(void)entry;
+#endif
+	return 1;
+}
+
+
+#ifdef MEMTRACK_USABLE_SIZE
+static size_t memtrack_usable_size (void* ptr);
+#endif
+
+
+#ifdef MEMTRACK_SITE_STATS
+
+
+#ifdef MEMTRACK_THREAD_STATS
+
+
+static MemTrackThread memtrack_threads[MEMTRACK_THREAD_COUNT + 1];  /* 末尾の要素は番号を割り当てきれなかったスレッドの分 */
+static atomic_uint memtrack_thread_last = 0;  /* 最後に割り当てたスレッド番号 */
+static THREAD_LOCAL unsigned int memtrack_thread_number = 0;  /* 0 の間はこのスレッドで一度も記録していない */
+
+
+/* 番号は使い回さないため、終了したスレッドの集計も残る */
+static inline unsigned int memtrack_thread_self (void) {
+	if (UNLIKELY(memtrack_thread_number == 0))
+		memtrack_thread_number = atomic_fetch_add_explicit(&memtrack_thread_last, 1, memory_order_relaxed) + 1;
+	return memtrack_thread_number;
+}
+
+
+static inline MemTrackThreadId memtrack_thread_id_of (unsigned int number) {
+	return (MemTrackThreadId)((number - 1 < MEMTRACK_THREAD_COUNT) ? number : MEMTRACK_THREAD_COUNT + 1);  /* 番号が一周して 0 になった場合もまとめて扱う */
+}
+
+
+static inline MemTrackThread* memtrack_thread_at (MemTrackThreadId id) {
+	return &memtrack_threads[id - 1];
+}
+
+
+static void memtrack_thread_record (MemTrackEntry* entry, size_t bytes, size_t count) {
+	entry->thread = memtrack_thread_id_of(memtrack_thread_self());
+	MemTrackThread* thread = memtrack_thread_at(entry->thread);
+
+	atomic_fetch_add_explicit(&thread->total_count, count, memory_order_relaxed);
+	atomic_fetch_add_explicit(&thread->total_bytes, bytes, memory_order_relaxed);
+	atomic_fetch_add_explicit(&thread->live_count, count, memory_order_relaxed);
+	size_t live = atomic_fetch_add_explicit(&thread->live_bytes, bytes, memory_order_relaxed) + bytes;
+
+	size_t peak = atomic_load_explicit(&thread->peak_bytes, memory_order_relaxed);
+	while (live > peak && !atomic_compare_exchange_weak_explicit(&thread->peak_bytes, &peak, live, memory_order_relaxed, memory_order_relaxed));
+}
+
+
+/* 確保したスレッドと異なるスレッドが集計から外した場合は、呼び出し元と両方のスレッドに数える */
+static void memtrack_thread_release (MemTrackEntry* entry, MemTrackSite* site) {
+	MemTrackThread* thread = memtrack_thread_at(entry->thread);
+	atomic_fetch_sub_explicit(&thread->live_count, memtrack_entry_count_of(entry), memory_order_relaxed);
+	atomic_fetch_sub_explicit(&thread->live_bytes, memtrack_entry_bytes_of(entry), memory_order_relaxed);
+
+	MemTrackThreadId self = memtrack_thread_id_of(memtrack_thread_self());
+	if (self != entry->thread) {  /* まとめて扱うスレッド同士の解放は区別できないため数えない */
+		size_t count = memtrack_entry_count_of(entry);
+		atomic_fetch_add_explicit(&site->cross_thread_frees, count, memory_order_relaxed);
+		atomic_fetch_add_explicit(&thread->freed_by_others, count, memory_order_relaxed);
+		atomic_fetch_add_explicit(&memtrack_thread_at(self)->frees_of_others, count, memory_order_relaxed);
+	}
+}
+
+
+#endif
+
+
+#ifdef MEMTRACK_TAGS
+
+
+static MemTrackTag memtrack_tags[MEMTRACK_TAG_COUNT + 1];  /* 先頭の要素はタグなしの分 */
+static atomic_uint memtrack_tag_last = 0;  /* 最後に登録したタグ */
+
+static THREAD_LOCAL MemTrackTagId memtrack_tag_current = 0;
+static THREAD_LOCAL MemTrackTagId memtrack_tag_stack[MEMTRACK_TAG_DEPTH];  /* memtrack_push_tag の前の memtrack_tag_current */
+static THREAD_LOCAL unsigned int memtrack_tag_depth = 0;  /* MEMTRACK_TAG_DEPTH を超えて積んだ分も数える */
+
+
+static void memtrack_tag_record (const MemTrackEntry* entry, size_t bytes, size_t count) {
+	MemTrackTag* tag = &memtrack_tags[entry->tag];
+
+	atomic_fetch_add_explicit(&tag->total_count, count, memory_order_relaxed);
+	atomic_fetch_add_explicit(&tag->total_bytes, bytes, memory_order_relaxed);
+	atomic_fetch_add_explicit(&tag->live_count, count, memory_order_relaxed);
+	size_t live = atomic_fetch_add_explicit(&tag->live_bytes, bytes, memory_order_relaxed) + bytes;
+
+	size_t peak = atomic_load_explicit(&tag->peak_bytes, memory_order_relaxed);
+	while (live > peak && !atomic_compare_exchange_weak_explicit(&tag->peak_bytes, &peak, live, memory_order_relaxed, memory_order_relaxed));
+}
+
+
+static void memtrack_tag_release (const MemTrackEntry* entry) {
+	MemTrackTag* tag = &memtrack_tags[entry->tag];
+	atomic_fetch_sub_explicit(&tag->live_count, memtrack_entry_count_of(entry), memory_order_relaxed);
+	atomic_fetch_sub_explicit(&tag->live_bytes, memtrack_entry_bytes_of(entry), memory_order_relaxed);
+}
+
+
+#endif
+
+
+#ifdef MEMTRACK_BUDGET
+
+
+static atomic_size_t memtrack_budget_live = 0;  /* 呼び出し元に加算中の全ブロックのバイト数 */
+static atomic_size_t memtrack_budget_limit = 0;  /* memtrack_budget_live の上限、0 は上限なし */
+static atomic_bool memtrack_budget_site_limited = false;  /* 呼び出し元ごとの上限を一度でも設定した */
+#ifdef MEMTRACK_TAGS
+static atomic_bool memtrack_budget_tag_limited = false;  /* タグごとの上限を一度でも設定した */
+#endif
+
+static _Atomic(MemTrackPressureFunc) memtrack_pressure_func = NULL;
+static _Atomic(void*) memtrack_pressure_arg = NULL;
+
+/* 圧迫時の関数の中での確保から、もう一度呼び出さないようにする */
+#ifdef THREAD_LOCAL
+static THREAD_LOCAL bool memtrack_pressure_running = false;
+#else
+static bool memtrack_pressure_running = false;
+#endif
+
+
+/* live バイトのうち old_size を解放して size を確保しても limit 以下に収まるか */
+static inline bool memtrack_budget_within (size_t limit, size_t live, size_t old_size, size_t size) {
+	size_t base = (live > old_size) ? live - old_size : 0;
+	return size <= limit && base <= limit - size;
+}
+
+
+/* 加算中の old のブロック（新しい確保では NULL）を、file と line での size バイトの確保に置き換えても上限に収まるか */
+static bool memtrack_budget_fits (size_t size, const MemTrackEntry* old, const char* file, int line) {
+	size_t old_size = (old != NULL && old->site != 0) ? memtrack_entry_bytes_of(old) : 0;
+
+	size_t limit = atomic_load_explicit(&memtrack_budget_limit, memory_order_relaxed);
+	if (limit != 0 && !memtrack_budget_within(limit, atomic_load_explicit(&memtrack_budget_live, memory_order_relaxed), old_size, size)) return false;
+
+#ifdef MEMTRACK_TAGS
+	/* realloc してもタグは変わらない */
+	if (UNLIKELY(atomic_load_explicit(&memtrack_budget_tag_limited, memory_order_relaxed))) {
+		const MemTrackTag* tag = &memtrack_tags[(old != NULL) ? old->tag : memtrack_tag_current];
+		size_t tag_limit = atomic_load_explicit(&tag->limit, memory_order_relaxed);
+		if (tag_limit != 0 && !memtrack_budget_within(tag_limit, atomic_load_explicit(&tag->live_bytes, memory_order_relaxed), old_size, size)) return false;
+	}
+#endif
+
+	if (LIKELY(!atomic_load_explicit(&memtrack_budget_site_limited, memory_order_relaxed))) return true;
+
+	MemTrackSiteId id = memtrack_site_id(file, line);
+	MemTrackSite* site = memtrack_site_at(id);
+	size_t site_limit = atomic_load_explicit(&site->limit, memory_order_relaxed);
+	if (site_limit == 0) return true;
+
+	return memtrack_budget_within(site_limit, atomic_load_explicit(&site->live_bytes, memory_order_relaxed), (old != NULL && id == old->site) ? old_size : 0, size);
+}
+
+
+/* 上限を超える場合は圧迫時の関数を一度だけ呼び出して確かめ直し、それでも超えるなら表示して ENOMEM にする */
+static bool memtrack_budget_admit_resize (size_t size, const MemTrackEntry* old, const char* file, int line) {
+	if (LIKELY(memtrack_budget_fits(size, old, file, line))) return true;
+
+	MemTrackPressureFunc func = atomic_load_explicit(&memtrack_pressure_func, memory_order_acquire);
+	if (func != NULL && !memtrack_pressure_running) {
+		memtrack_pressure_running = true;
+		func(size, file, line, atomic_load_explicit(&memtrack_pressure_arg, memory_order_relaxed));
+		memtrack_pressure_running = false;
+
+		if (memtrack_budget_fits(size, old, file, line)) return true;
+	}
+
+	memtrack_report("Memory budget exceeded.", NULL, file, line);
+	errno = ENOMEM;
+	return false;
+}
+
+
+bool memtrack_budget_admit (size_t size, const char* file, int line) {
+	if (memtrack_budget_admit_resize(size, NULL, file, line)) return true;
+
+	memtrack_errfunc = "memtrack_budget_admit";
+	return false;
+}
+
+
+void memtrack_set_budget (size_t limit) {
+	atomic_store_explicit(&memtrack_budget_limit, limit, memory_order_relaxed);
+}
+
+
+bool memtrack_set_site_budget (const char* file, int line, size_t limit) {
+	MemTrackSiteId id = memtrack_site_id(file, line);
+	if (UNLIKELY(id == MEMTRACK_SITE_OVERFLOW)) {
+		memtrack_report("Cannot set the budget because the site table is full.", NULL, file, line);
+		errno = ENOSPC;
+		memtrack_errfunc = "memtrack_set_site_budget";
+		return false;
+	}
+
+	atomic_store_explicit(&memtrack_site_at(id)->limit, limit, memory_order_relaxed);
+	if (limit != 0) atomic_store_explicit(&memtrack_budget_site_limited, true, memory_order_relaxed);
+	return true;
+}
+
+
+#ifdef MEMTRACK_TAGS
+bool memtrack_set_tag_budget (unsigned int tag, size_t limit) {
+	if (UNLIKELY(tag > atomic_load_explicit(&memtrack_tag_last, memory_order_acquire))) {
+		memtrack_report("Cannot set the budget because the tag is not registered.", NULL, __FILE__, __LINE__);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_set_tag_budget";
+		return false;
+	}
+
+	atomic_store_explicit(&memtrack_tags[tag].limit, limit, memory_order_relaxed);
+	if (limit != 0) atomic_store_explicit(&memtrack_budget_tag_limited, true, memory_order_relaxed);
+	return true;
+}
+#endif
+
+
+void memtrack_set_pressure_func (MemTrackPressureFunc func, void* arg) {
+	atomic_store_explicit(&memtrack_pressure_arg, arg, memory_order_relaxed);
+	atomic_store_explicit(&memtrack_pressure_func, func, memory_order_release);
+}
+
+
+size_t memtrack_budget_used (void) {
+	return atomic_load_explicit(&memtrack_budget_live, memory_order_relaxed);
+}
+
+
+#endif
+
+
+/* entry を file と line の呼び出し元に加算する、size（サンプリングモードでは weight）は設定済みである必要がある */
+static void memtrack_site_record (MemTrackEntry* entry, const char* file, int line) {
+#ifdef DEBUG
+	if (entry->is_freed) {
+		entry->site = 0;
+		return;
+	}
+#endif
+
+	MemTrackSiteId id = memtrack_site_id(file, line);
+	MemTrackSite* site = memtrack_site_at(id);
+	size_t bytes = memtrack_entry_bytes_of(entry);
+	size_t count = memtrack_entry_count_of(entry);
+	entry->site = id;
+
+	atomic_fetch_add_explicit(&site->total_count, count, memory_order_relaxed);
+	atomic_fetch_add_explicit(&site->total_bytes, bytes, memory_order_relaxed);
+	atomic_fetch_add_explicit(&site->live_count, count, memory_order_relaxed);
+	size_t live = atomic_fetch_add_explicit(&site->live_bytes, bytes, memory_order_relaxed) + bytes;
+
+	size_t peak = atomic_load_explicit(&site->peak_bytes, memory_order_relaxed);
+	while (live > peak && !atomic_compare_exchange_weak_explicit(&site->peak_bytes, &peak, live, memory_order_relaxed, memory_order_relaxed));
+
+#ifdef MEMTRACK_USABLE_SIZE
+	/* ptr と size の変わる箇所では必ず加算し直すため、ここで測れば常に現在のブロックの値になる */
+	entry->usable = memtrack_usable_size(entry->ptr);
+	if (entry->usable < entry->size) entry->usable = entry->size;  /* memtrack_entry_add に実際より大きなサイズが渡された場合 */
+	atomic_fetch_add_explicit(&site->live_slack, (entry->usable - entry->size) * count, memory_order_relaxed);
+#endif
+#ifdef MEMTRACK_THREAD_STATS
+	memtrack_thread_record(entry, bytes, count);
+#endif
+#ifdef MEMTRACK_TAGS
+	memtrack_tag_record(entry, bytes, count);
+#endif
+#ifdef MEMTRACK_BUDGET
+	atomic_fetch_add_explicit(&memtrack_budget_live, bytes, memory_order_relaxed);
+#endif
+}
+
+
+/* entry を呼び出し元の生存中の集計から外す（size と weight は加算時のままである必要がある） */
+static void memtrack_site_release (MemTrackEntry* entry) {
+	if (entry->site == 0) return;
+
+	MemTrackSite* site = memtrack_site_at(entry->site);
+	atomic_fetch_sub_explicit(&site->live_count, memtrack_entry_count_of(entry), memory_order_relaxed);
+	atomic_fetch_sub_explicit(&site->live_bytes, memtrack_entry_bytes_of(entry), memory_order_relaxed);
+#ifdef MEMTRACK_USABLE_SIZE
+	atomic_fetch_sub_explicit(&site->live_slack, (entry->usable - entry->size) * memtrack_entry_count_of(entry), memory_order_relaxed);
+#endif
+#ifdef MEMTRACK_THREAD_STATS
+	memtrack_thread_release(entry, site);
+#endif
+#ifdef MEMTRACK_TAGS
+	memtrack_tag_release(entry);
+#endif
+#ifdef MEMTRACK_BUDGET
+	atomic_fetch_sub_explicit(&memtrack_budget_live, memtrack_entry_bytes_of(entry), memory_order_relaxed);
+#endif
+	entry->site = 0;
+}
+
+
+static bool memtrack_site_load (const MemTrackSite* site, MemTrackSiteStats* stats) {
+	stats->total_count = atomic_load_explicit(&site->total_count, memory_order_relaxed);
+	if (stats->total_count == 0) return false;
+
+	stats->file = site->file;
+	stats->line = site->line;
+	stats->total_bytes = atomic_load_explicit(&site->total_bytes, memory_order_relaxed);
+	stats->live_count = atomic_load_explicit(&site->live_count, memory_order_relaxed);
+	stats->live_bytes = atomic_load_explicit(&site->live_bytes, memory_order_relaxed);
+	stats->peak_bytes = atomic_load_explicit(&site->peak_bytes, memory_order_relaxed);
+#ifdef MEMTRACK_USABLE_SIZE
+	stats->slack_bytes = atomic_load_explicit(&site->live_slack, memory_order_relaxed);
+#else
+	stats->slack_bytes = 0;
+#endif
+#ifdef MEMTRACK_THREAD_STATS
+	stats->cross_thread_frees = atomic_load_explicit(&site->cross_thread_frees, memory_order_relaxed);
+#else
+	stats->cross_thread_frees = 0;
+#endif
+	return true;
+}
+
+
+size_t memtrack_site_snapshot (MemTrackSiteStats* stats, size_t capacity) {
+	if (stats == NULL && capacity != 0) {
+		memtrack_report("stats is null! No site statistics can be stored!", NULL, __FILE__, __LINE__);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_site_snapshot";
+		return 0;
+	}
+
+	size_t count = 0;
+	MemTrackSiteStats tmp;
+	for (size_t i = 0; i <= MEMTRACK_SITE_COUNT; i++) {  /* 末尾の要素は file が NULL のまま */
+		const MemTrackSite* site = &memtrack_sites[i];
+		if (i < MEMTRACK_SITE_COUNT && atomic_load_explicit(&site->state, memory_order_acquire) != MEMTRACK_SITE_READY) continue;
+
+		if (memtrack_site_load(site, (count < capacity) ? &stats[count] : &tmp)) count++;
+	}
+	return count;
+}
+
+
+#ifdef MEMTRACK_THREAD_STATS
+unsigned int memtrack_thread_id (void) {
+	return memtrack_thread_id_of(memtrack_thread_self());
+}
+
+
+size_t memtrack_thread_snapshot (MemTrackThreadStats* stats, size_t capacity) {
+	if (stats == NULL && capacity != 0) {
+		memtrack_report("stats is null! No thread statistics can be stored!", NULL, __FILE__, __LINE__);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_thread_snapshot";
+		return 0;
+	}
+
+	size_t count = 0;
+	for (size_t i = 0; i <= MEMTRACK_THREAD_COUNT; i++) {
+		const MemTrackThread* thread = &memtrack_threads[i];
+		size_t total_count = atomic_load_explicit(&thread->total_count, memory_order_relaxed);
+		if (total_count == 0 && atomic_load_explicit(&thread->frees_of_others, memory_order_relaxed) == 0) continue;
+
+		if (count < capacity) {
+			stats[count] = (MemTrackThreadStats){
+				.thread = (unsigned int)i + 1,
+				.live_bytes = atomic_load_explicit(&thread->live_bytes, memory_order_relaxed),
+				.live_count = atomic_load_explicit(&thread->live_count, memory_order_relaxed),
+				.peak_bytes = atomic_load_explicit(&thread->peak_bytes, memory_order_relaxed),
+				.total_count = total_count,
+				.total_bytes = atomic_load_explicit(&thread->total_bytes, memory_order_relaxed),
+				.freed_by_others = atomic_load_explicit(&thread->freed_by_others, memory_order_relaxed),
+				.frees_of_others = atomic_load_explicit(&thread->frees_of_others, memory_order_relaxed)
+			};
+		}
+		count++;
+	}
+	return count;
+}
+
+
+static void memtrack_thread_print (FILE* stream) {
+	fprintf(stream, "\nThreads\n");
+
+	for (size_t i = 0; i <= MEMTRACK_THREAD_COUNT; i++) {
+		const MemTrackThread* thread = &memtrack_threads[i];
+		size_t total_count = atomic_load_explicit(&thread->total_count, memory_order_relaxed);
+		size_t frees_of_others = atomic_load_explicit(&thread->frees_of_others, memory_order_relaxed);
+		if (total_count == 0 && frees_of_others == 0) continue;
+
+		fprintf(stream, "Thread: %zu   Live Bytes: %zu   Live Blocks: %zu   Peak Bytes: %zu   Freed by others: %zu   Frees of others: %zu\n", i + 1, atomic_load_explicit(&thread->live_bytes, memory_order_relaxed), atomic_load_explicit(&thread->live_count, memory_order_relaxed), atomic_load_explicit(&thread->peak_bytes, memory_order_relaxed), atomic_load_explicit(&thread->freed_by_others, memory_order_relaxed), frees_of_others);
+	}
+
+	for (size_t i = 0; i <= MEMTRACK_SITE_COUNT; i++) {  /* 末尾の要素は file が NULL のまま */
+		const MemTrackSite* site = &memtrack_sites[i];
+		if (i < MEMTRACK_SITE_COUNT && atomic_load_explicit(&site->state, memory_order_acquire) != MEMTRACK_SITE_READY) continue;
+
+		size_t cross = atomic_load_explicit(&site->cross_thread_frees, memory_order_relaxed);
+		if (cross != 0)
+			fprintf(stream, "File: %s   Line: %d   Cross-thread Frees: %zu\n", (site->file != NULL) ? site->file : "(other sites)", site->line, cross);
+	}
+}
+#endif
+
+
+#ifdef MEMTRACK_TAGS
+/* 同じ名前を同時に登録した場合は別々のタグになることがある */
+unsigned int memtrack_tag_register (const char* name) {
+	if (UNLIKELY(name == NULL)) {
+		memtrack_report("name is null! The tag cannot be registered!", NULL, __FILE__, __LINE__);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_tag_register";
+		return 0;
+	}
+
+	unsigned int last = atomic_load_explicit(&memtrack_tag_last, memory_order_acquire);
+	for (unsigned int i = 1; i <= last; i++) {
+		const char* registered = atomic_load_explicit(&memtrack_tags[i].name, memory_order_acquire);
+		if (registered != NULL && strcmp(registered, name) == 0) return i;
+	}
+
+	do {
+		if (UNLIKELY(last >= MEMTRACK_TAG_COUNT)) {
+			memtrack_report("Cannot register the tag because the tag table is full.", NULL, __FILE__, __LINE__);
+			errno = ENOSPC;
+			memtrack_errfunc = "memtrack_tag_register";
+			return 0;
+		}
+	} while (!atomic_compare_exchange_weak_explicit(&memtrack_tag_last, &last, last + 1, memory_order_acq_rel, memory_order_acquire));
+
+	atomic_store_explicit(&memtrack_tags[last + 1].name, name, memory_order_release);
+	return last + 1;
+}
+
+
+void memtrack_push_tag (unsigned int tag) {
+	if (UNLIKELY(tag > atomic_load_explicit(&memtrack_tag_last, memory_order_relaxed))) {
+		memtrack_report("The tag is not registered. The current tag is kept.", NULL, __FILE__, __LINE__);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_push_tag";
+		tag = memtrack_tag_current;
+	}
+
+	/* 溢れた場合も深さは数え、対応する memtrack_pop_tag までは今のタグのままにする */
+	if (LIKELY(memtrack_tag_depth < MEMTRACK_TAG_DEPTH)) {
+		memtrack_tag_stack[memtrack_tag_depth] = memtrack_tag_current;
+		memtrack_tag_current = (MemTrackTagId)tag;
+	} else {
+		memtrack_report("Tag stack overflow. The tag is ignored until the matching pop.", NULL, __FILE__, __LINE__);
+		errno = ENOSPC;
+		memtrack_errfunc = "memtrack_push_tag";
+	}
+	memtrack_tag_depth++;
+}
+
+
+void memtrack_pop_tag (void) {
+	if (UNLIKELY(memtrack_tag_depth == 0)) {
+		memtrack_report("No tag to pop.", NULL, __FILE__, __LINE__);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_pop_tag";
+		return;
+	}
+
+	memtrack_tag_depth--;
+	if (LIKELY(memtrack_tag_depth < MEMTRACK_TAG_DEPTH))
+		memtrack_tag_current = memtrack_tag_stack[memtrack_tag_depth];
+}
+
+
+unsigned int memtrack_current_tag (void) {
+	return memtrack_tag_current;
+}
+
+
+size_t memtrack_tag_snapshot (MemTrackTagStats* stats, size_t capacity) {
+	if (stats == NULL && capacity != 0) {
+		memtrack_report("stats is null! No tag statistics can be stored!", NULL, __FILE__, __LINE__);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_tag_snapshot";
+		return 0;
+	}
+
+	size_t count = 0;
+	unsigned int last = atomic_load_explicit(&memtrack_tag_last, memory_order_acquire);
+	for (unsigned int i = 0; i <= last; i++) {
+		const MemTrackTag* tag = &memtrack_tags[i];
+		size_t total_count = atomic_load_explicit(&tag->total_count, memory_order_relaxed);
+		if (i == 0 && total_count == 0) continue;  /* タグなしの分は確保があった場合だけ返す */
+
+		if (count < capacity) {
+			stats[count] = (MemTrackTagStats){
+				.tag = i,
+				.name = atomic_load_explicit(&tag->name, memory_order_acquire),
+				.live_bytes = atomic_load_explicit(&tag->live_bytes, memory_order_relaxed),
+				.live_count = atomic_load_explicit(&tag->live_count, memory_order_relaxed),
+				.peak_bytes = atomic_load_explicit(&tag->peak_bytes, memory_order_relaxed),
+				.total_count = total_count,
+				.total_bytes = atomic_load_explicit(&tag->total_bytes, memory_order_relaxed)
+			};
+		}
+		count++;
+	}
+	return count;
+}
+
+
+static void memtrack_tag_print (FILE* stream) {
+	fprintf(stream, "\nTags\n");
+
+	unsigned int last = atomic_load_explicit(&memtrack_tag_last, memory_order_acquire);
+	for (unsigned int i = 0; i <= last; i++) {
+		const MemTrackTag* tag = &memtrack_tags[i];
+		size_t total_count = atomic_load_explicit(&tag->total_count, memory_order_relaxed);
+		if (total_count == 0) continue;
+
+		const char* name = atomic_load_explicit(&tag->name, memory_order_acquire);
+		fprintf(stream, "Tag: %s   Live Bytes: %zu   Live Blocks: %zu   Peak Bytes: %zu   Total Blocks: %zu   Total Bytes: %zu\n", (name != NULL) ? name : "(untagged)", atomic_load_explicit(&tag->live_bytes, memory_order_relaxed), atomic_load_explicit(&tag->live_count, memory_order_relaxed), atomic_load_explicit(&tag->peak_bytes, memory_order_relaxed), total_count, atomic_load_explicit(&tag->total_bytes, memory_order_relaxed));
+	}
+}
+#endif
+
+
+#ifdef MEMTRACK_USABLE_SIZE
+size_t memtrack_slack_bytes (void) {
+	size_t slack = 0;
+	for (size_t i = 0; i <= MEMTRACK_SITE_COUNT; i++)  /* 未登録の要素は 0 のまま */
+		slack += atomic_load_explicit(&memtrack_sites[i].live_slack, memory_order_relaxed);
+	return slack;
+}
+
+
+static void memtrack_slack_print (FILE* stream) {
+	fprintf(stream, "\nSlack (usable size minus requested size, bytes)\n");
+
+	size_t total = 0;
+	for (size_t i = 0; i <= MEMTRACK_SITE_COUNT; i++) {  /* 末尾の要素は file が NULL のまま */
+		const MemTrackSite* site = &memtrack_sites[i];
+		if (i < MEMTRACK_SITE_COUNT && atomic_load_explicit(&site->state, memory_order_acquire) != MEMTRACK_SITE_READY) continue;
+
+		size_t slack = atomic_load_explicit(&site->live_slack, memory_order_relaxed);
+		if (slack == 0) continue;
+
+		fprintf(stream, "File: %s   Line: %d   Slack: %zu\n", (site->file != NULL) ? site->file : "(other sites)", site->line, slack);
+		total += slack;
+	}
+	fprintf(stream, "Total Slack: %zu\n", total);
+}
+#endif
+
+
+#ifdef MEMTRACK_REPORTER
+
+
+/* 以下の状態は memtrack_reporter_lock で保護する、報告スレッドの動作中は設定を書き換えない */
+static pthread_mutex_t memtrack_reporter_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t memtrack_reporter_cond;
+static pthread_t memtrack_reporter_thread;
+static bool memtrack_reporter_running = false;
+static bool memtrack_reporter_stopping = false;
+static bool memtrack_reporter_registered = false;  /* 終了処理を登録済み */
+
+static char* memtrack_reporter_path = NULL;
+static char* memtrack_reporter_tmp_path = NULL;
+static MemTrackReportFunc memtrack_reporter_func = NULL;
+static void* memtrack_reporter_arg = NULL;
+static unsigned int memtrack_reporter_interval_ms = 0;
+
+
+typedef struct {
+	size_t live_bytes;
+	size_t live_count;
+	size_t total_count;
+	size_t total_bytes;
+#ifdef MEMTRACK_USABLE_SIZE
+	size_t slack_bytes;
+#endif
+	size_t top_count;
+	MemTrackSiteStats top[MEMTRACK_REPORTER_TOP_SITES];  /* live_bytes の多い順 */
+} MemTrackReport;
+
+
+static inline uint64_t memtrack_reporter_now_ms (void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+
+/* 全呼び出し元の原子的なカウンタを合計する、表は固定長で削除もないためロックは不要 */
+static void memtrack_reporter_collect (MemTrackReport* report) {
+	*report = (MemTrackReport){ 0 };
+
+	MemTrackSiteStats stats;
+	for (size_t i = 0; i <= MEMTRACK_SITE_COUNT; i++) {  /* 末尾の要素は file が NULL のまま */
+		const MemTrackSite* site = &memtrack_sites[i];
+		if (i < MEMTRACK_SITE_COUNT && atomic_load_explicit(&site->state, memory_order_acquire) != MEMTRACK_SITE_READY) continue;
+		if (!memtrack_site_load(site, &stats)) continue;
+
+		report->live_bytes += stats.live_bytes;
+		report->live_count += stats.live_count;
+		report->total_count += stats.total_count;
+		report->total_bytes += stats.total_bytes;
+#ifdef MEMTRACK_USABLE_SIZE
+		report->slack_bytes += stats.slack_bytes;
+#endif
+		if (stats.live_count == 0) continue;
+
+		/* 上位の数は小さいため挿入で並べる */
+		size_t pos = report->top_count;
+		if (pos == MEMTRACK_REPORTER_TOP_SITES) {
+			if (report->top[pos - 1].live_bytes >= stats.live_bytes) continue;
+			pos--;
+		} else {
+			report->top_count++;
+		}
+		while (pos > 0 && report->top[pos - 1].live_bytes < stats.live_bytes) {
+			report->top[pos] = report->top[pos - 1];
+			pos--;
+		}
+		report->top[pos] = stats;
+	}
+}
+
+
+/* ラベルの値として file を書き込む、\ と " と改行をエスケープする */
+static void memtrack_reporter_print_label (FILE* stream, const char* file) {
+	if (file == NULL) file = "(other sites)";
+
+	for (const char* c = file; *c != '\0'; c++) {
+		if (*c == '\\' || *c == '"') {
+			fputc('\\', stream);
+			fputc(*c, stream);
+		} else if (*c == '\n') {
+			fputs("\\n", stream);
+		} else {
+			fputc(*c, stream);
+		}
+	}
+}
+
+
+static void memtrack_reporter_print_metric (FILE* stream, const char* name, const char* type, const char* help, size_t value) {
+	fprintf(stream, "# HELP %s %s\n# TYPE %s %s\n%s %zu\n", name, help, name, type, name, value);
+}
+
+
+static void memtrack_reporter_print (FILE* stream, const MemTrackReport* report, size_t count_rate, size_t bytes_rate) {
+	memtrack_reporter_print_metric(stream, "memtrack_live_bytes", "gauge", "Bytes in the tracked blocks that are alive.", report->live_bytes);
+	memtrack_reporter_print_metric(stream, "memtrack_live_blocks", "gauge", "Number of tracked blocks that are alive.", report->live_count);
+	memtrack_reporter_print_metric(stream, "memtrack_allocations_total", "counter", "Number of allocations tracked.", report->total_count);
+	memtrack_reporter_print_metric(stream, "memtrack_allocated_bytes_total", "counter", "Bytes allocated in the tracked allocations.", report->total_bytes);
+	memtrack_reporter_print_metric(stream, "memtrack_allocations_per_second", "gauge", "Allocations per second over the last interval.", count_rate);
+	memtrack_reporter_print_metric(stream, "memtrack_allocated_bytes_per_second", "gauge", "Bytes allocated per second over the last interval.", bytes_rate);
+#ifdef MEMTRACK_USABLE_SIZE
+	memtrack_reporter_print_metric(stream, "memtrack_slack_bytes", "gauge", "Bytes the allocator reserved beyond the requested sizes of the tracked blocks that are alive.", report->slack_bytes);
+#endif
+
+	fputs("# HELP memtrack_site_live_bytes Bytes alive per call site, for the sites holding the most.\n# TYPE memtrack_site_live_bytes gauge\n", stream);
+	for (size_t i = 0; i < report->top_count; i++) {
+		fputs("memtrack_site_live_bytes{file=\"", stream);
+		memtrack_reporter_print_label(stream, report->top[i].file);
+		fprintf(stream, "\",line=\"%d\"} %zu\n", report->top[i].line, report->top[i].live_bytes);
+	}
+
+	fputs("# HELP memtrack_site_live_blocks Blocks alive per call site, for the sites holding the most bytes.\n# TYPE memtrack_site_live_blocks gauge\n", stream);
+	for (size_t i = 0; i < report->top_count; i++) {
+		fputs("memtrack_site_live_blocks{file=\"", stream);
+		memtrack_reporter_print_label(stream, report->top[i].file);
+		fprintf(stream, "\",line=\"%d\"} %zu\n", report->top[i].line, report->top[i].live_count);
+	}
+}
+
+
+/* 一時ファイルに書き込んでから置き換え、読み手が書きかけの内容を見ないようにする */
+static bool memtrack_reporter_write_file (const char* text, size_t length) {
+	FILE* fp = fopen(memtrack_reporter_tmp_path, "w");
+	if (UNLIKELY(fp == NULL)) return false;
+
+	bool written = (fwrite(text, 1, length, fp) == length);
+	if (UNLIKELY(fclose(fp) != 0)) written = false;
+	if (UNLIKELY(!written)) {
+		remove(memtrack_reporter_tmp_path);
+		return false;
+	}
+	return rename(memtrack_reporter_tmp_path, memtrack_reporter_path) == 0;
+}
+
+
+/* 報告スレッドには errno を見る呼び出し元がいないため、失敗は続いている間に一度だけ表示する */
+static void memtrack_reporter_publish (const MemTrackReport* report, size_t count_rate, size_t bytes_rate, bool* failed) {
+	char* text = NULL;
+	size_t length = 0;
+	FILE* stream = open_memstream(&text, &length);
+	bool ok = (stream != NULL);
+	if (LIKELY(ok)) {
+		memtrack_reporter_print(stream, report, count_rate, bytes_rate);
+		ok = (fclose(stream) == 0);
+	}
+
+	if (LIKELY(ok)) {
+		if (memtrack_reporter_path != NULL)
+			ok = memtrack_reporter_write_file(text, length);
+		if (memtrack_reporter_func != NULL)
+			memtrack_reporter_func(text, length, memtrack_reporter_arg);
+	}
+	free(text);
+
+	if (UNLIKELY(!ok && !*failed))
+		memtrack_report("Failed to publish the memory metrics.", NULL, __FILE__, __LINE__);
+	*failed = !ok;
+}
+
+
+static void* memtrack_reporter_main (void* arg) {
+	(void)arg;
+	MEMTRACK_PRELOAD_ENTER();
+
+	MemTrackReport report;
+	memtrack_reporter_collect(&report);
+	size_t last_count = report.total_count;
+	size_t last_bytes = report.total_bytes;
+	uint64_t last_ms = memtrack_reporter_now_ms();
+	bool failed = false;
+
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+	pthread_mutex_lock(&memtrack_reporter_lock);
+	while (!memtrack_reporter_stopping) {
+		uint64_t nsec = (uint64_t)deadline.tv_nsec + (uint64_t)memtrack_reporter_interval_ms % 1000 * 1000000;
+		deadline.tv_sec += (time_t)(memtrack_reporter_interval_ms / 1000 + nsec / 1000000000);
+		deadline.tv_nsec = (long)(nsec % 1000000000);
+
+		int result = 0;
+		while (!memtrack_reporter_stopping && result != ETIMEDOUT)
+			result = pthread_cond_timedwait(&memtrack_reporter_cond, &memtrack_reporter_lock, &deadline);
+		if (memtrack_reporter_stopping) break;
+		pthread_mutex_unlock(&memtrack_reporter_lock);
+
+		memtrack_reporter_collect(&report);
+		uint64_t now_ms = memtrack_reporter_now_ms();
+		uint64_t elapsed_ms = (now_ms > last_ms) ? now_ms - last_ms : 1;
+		size_t count_rate = (size_t)((uint64_t)(report.total_count - last_count) * 1000 / elapsed_ms);
+		size_t bytes_rate = (size_t)((uint64_t)(report.total_bytes - last_bytes) * 1000 / elapsed_ms);
+		last_count = report.total_count;
+		last_bytes = report.total_bytes;
+		last_ms = now_ms;
+
+		memtrack_reporter_publish(&report, count_rate, bytes_rate, &failed);
+
+		pthread_mutex_lock(&memtrack_reporter_lock);
+	}
+	pthread_mutex_unlock(&memtrack_reporter_lock);
+
+	MEMTRACK_PRELOAD_LEAVE();
+	return NULL;
+}
+
+
+static void memtrack_reporter_clear (void) {
+	free(memtrack_reporter_path);
+	free(memtrack_reporter_tmp_path);
+	memtrack_reporter_path = NULL;
+	memtrack_reporter_tmp_path = NULL;
+	memtrack_reporter_func = NULL;
+	memtrack_reporter_arg = NULL;
+}
+
+
+void memtrack_reporter_stop (void) {
+	pthread_mutex_lock(&memtrack_reporter_lock);
+	if (!memtrack_reporter_running || memtrack_reporter_stopping) {
+		pthread_mutex_unlock(&memtrack_reporter_lock);
+		return;
+	}
+	memtrack_reporter_stopping = true;
+	pthread_cond_signal(&memtrack_reporter_cond);
+	pthread_mutex_unlock(&memtrack_reporter_lock);
+
+	pthread_join(memtrack_reporter_thread, NULL);
+
+	pthread_mutex_lock(&memtrack_reporter_lock);
+	pthread_cond_destroy(&memtrack_reporter_cond);
+	memtrack_reporter_clear();
+	memtrack_reporter_running = false;
+	memtrack_reporter_stopping = false;
+	pthread_mutex_unlock(&memtrack_reporter_lock);
+}
+
+
+bool memtrack_reporter_start (const char* path, MemTrackReportFunc func, void* arg, unsigned int interval_ms) {
+	if (path == NULL && func == NULL) {
+		memtrack_report("path and func are null! No metrics can be published!", NULL, __FILE__, __LINE__);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_reporter_start";
+		return false;
+	}
+
+	if (interval_ms == 0) {
+		memtrack_report("interval_ms is 0!", NULL, __FILE__, __LINE__);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_reporter_start";
+		return false;
+	}
+
+	pthread_mutex_lock(&memtrack_reporter_lock);
+	if (memtrack_reporter_running) {
+		pthread_mutex_unlock(&memtrack_reporter_lock);
+		memtrack_report("The reporter is already running.", NULL, __FILE__, __LINE__);
+		errno = EBUSY;
+		memtrack_errfunc = "memtrack_reporter_start";
+		return false;
+	}
+
+	if (path != NULL) {
+		size_t length = strlen(path);
+		memtrack_reporter_path = malloc(length + 1);
+		memtrack_reporter_tmp_path = malloc(length + sizeof(".tmp"));
+		if (UNLIKELY(memtrack_reporter_path == NULL || memtrack_reporter_tmp_path == NULL)) {
+			memtrack_reporter_clear();
+			pthread_mutex_unlock(&memtrack_reporter_lock);
+			memtrack_report("Failed to allocate memory for the path of the metrics file.", NULL, __FILE__, __LINE__);
+			errno = ENOMEM;
+			memtrack_errfunc = "memtrack_reporter_start";
+			return false;
+		}
+		memcpy(memtrack_reporter_path, path, length + 1);
+		memcpy(memtrack_reporter_tmp_path, path, length);
+		memcpy(memtrack_reporter_tmp_path + length, ".tmp", sizeof(".tmp"));
+	}
+	memtrack_reporter_func = func;
+	memtrack_reporter_arg = arg;
+	memtrack_reporter_interval_ms = interval_ms;
+
+	/* 時刻の変更に影響されないよう、待機には CLOCK_MONOTONIC を使う */
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	int result = pthread_cond_init(&memtrack_reporter_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	if (LIKELY(result == 0)) {
+		result = pthread_create(&memtrack_reporter_thread, NULL, memtrack_reporter_main, NULL);
+		if (UNLIKELY(result != 0)) pthread_cond_destroy(&memtrack_reporter_cond);
+	}
+	if (UNLIKELY(result != 0)) {
+		memtrack_reporter_clear();
+		pthread_mutex_unlock(&memtrack_reporter_lock);
+		memtrack_report("Failed to start the reporter thread.", NULL, __FILE__, __LINE__);
+		errno = result;
+		memtrack_errfunc = "memtrack_reporter_start";
+		return false;
+	}
+
+	memtrack_reporter_running = true;
+	bool registered = memtrack_reporter_registered;
+	memtrack_reporter_registered = true;
+	pthread_mutex_unlock(&memtrack_reporter_lock);
+
+	if (!registered) atexit(memtrack_reporter_stop);  /* init がまだ終了処理を登録していない場合に備える */
+	return true;
+}
+
+
+#endif
+
+
+#else
+static inline void memtrack_site_record (MemTrackEntry* entry, const char* file, int line) {
+	(void)entry;
+	(void)file;
+	(void)line;
+}
+
+static inline void memtrack_site_release (MemTrackEntry* entry) {
+	(void)entry;
+}
+#endif
+
+
+#ifdef MEMTRACK_HISTOGRAM
+
+
+/* スレッドごとのカウンタ、書き込むのは持ち主のスレッドだけだが読み取りと合算のために原子的に扱う */
+typedef struct MemTrackHistogramCounters {
+	atomic_size_t sizes[MEMTRACK_HISTOGRAM_BUCKETS];
+	atomic_size_t lifetimes[MEMTRACK_HISTOGRAM_BUCKETS];
+	struct MemTrackHistogramCounters* prev;
+	struct MemTrackHistogramCounters* next;
+} MemTrackHistogramCounters;
+
+static pthread_mutex_t memtrack_histogram_lock = PTHREAD_MUTEX_INITIALIZER;
+static MemTrackHistogramCounters* memtrack_histogram_threads = NULL;  /* 生存中のスレッドのカウンタの一覧 */
+
+/* 終了したスレッドの合計、スレッドごとのカウンタを確保できなかったスレッドもここに加算する */
+static MemTrackHistogramCounters memtrack_histogram_shared;
+
+static pthread_once_t memtrack_histogram_once = PTHREAD_ONCE_INIT;
+static pthread_key_t memtrack_histogram_key;
+static bool memtrack_histogram_key_created = false;
+static THREAD_LOCAL MemTrackHistogramCounters* memtrack_histogram_local = NULL;
+
+
+static inline uint64_t memtrack_histogram_now (void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+
+/* 0 は 0 番、それ以外は [2^(i-1), 2^i) を i 番に数える */
+static inline size_t memtrack_histogram_bucket (uint64_t value) {
+	if (value == 0) return 0;
+#if defined (__GNUC__) || defined (__clang__)
+	return (size_t)(64 - __builtin_clzll((unsigned long long)value));
+#else
+	size_t bucket = 0;
+	while (value != 0) {
+		value >>= 1;
+		bucket++;
+	}
+	return bucket;
+#endif
+}
+
+
+/* スレッドの終了時に呼び出され、カウンタを共有の合計に移してから破棄する */
+static void memtrack_histogram_destroy (void* arg) {
+	MemTrackHistogramCounters* counters = arg;
+	memtrack_histogram_local = NULL;
+
+	pthread_mutex_lock(&memtrack_histogram_lock);
+	for (size_t i = 0; i < MEMTRACK_HISTOGRAM_BUCKETS; i++) {
+		atomic_fetch_add_explicit(&memtrack_histogram_shared.sizes[i], atomic_load_explicit(&counters->sizes[i], memory_order_relaxed), memory_order_relaxed);
+		atomic_fetch_add_explicit(&memtrack_histogram_shared.lifetimes[i], atomic_load_explicit(&counters->lifetimes[i], memory_order_relaxed), memory_order_relaxed);
+	}
+
+	if (counters->prev != NULL)
+		counters->prev->next = counters->next;
+	else
+		memtrack_histogram_threads = counters->next;
+	if (counters->next != NULL)
+		counters->next->prev = counters->prev;
+	pthread_mutex_unlock(&memtrack_histogram_lock);
+
+	free(counters);
+}
+
+
+static void memtrack_histogram_init_once (void) {
+	memtrack_histogram_key_created = (pthread_key_create(&memtrack_histogram_key, memtrack_histogram_destroy) == 0);
+}
+
+
+/* 自スレッドのカウンタを返す、初めて呼び出された場合は作成して登録する（失敗した場合は共有の合計を返す） */
+static MemTrackHistogramCounters* memtrack_histogram_counters (void) {
+	if (LIKELY(memtrack_histogram_local != NULL)) return memtrack_histogram_local;
+
+	pthread_once(&memtrack_histogram_once, memtrack_histogram_init_once);
+	if (UNLIKELY(!memtrack_histogram_key_created)) return &memtrack_histogram_shared;
+
+	MemTrackHistogramCounters* counters = calloc(1, sizeof(MemTrackHistogramCounters));
+	if (UNLIKELY(counters == NULL)) return &memtrack_histogram_shared;
+
+	pthread_mutex_lock(&memtrack_histogram_lock);
+	counters->next = memtrack_histogram_threads;
+	if (memtrack_histogram_threads != NULL) memtrack_histogram_threads->prev = counters;
+	memtrack_histogram_threads = counters;
+	pthread_mutex_unlock(&memtrack_histogram_lock);
+
+	if (UNLIKELY(pthread_setspecific(memtrack_histogram_key, counters) != 0)) {
+		memtrack_histogram_destroy(counters);
+		return &memtrack_histogram_shared;
+	}
+
+	memtrack_histogram_local = counters;
+	return counters;
+}
+
+
+/* 共有の合計にも加算しうるため、持ち主しか書き込まないカウンタでも加算は原子的に行う（競合しないため安価） */
+static inline void memtrack_histogram_add (atomic_size_t* counter, size_t count) {
+	atomic_fetch_add_explicit(counter, count, memory_order_relaxed);
+}
+
+
+/* entry の要求サイズを数える、確保と realloc のたびに呼び出す */
+static inline void memtrack_histogram_record (const MemTrackEntry* entry) {
+#ifdef DEBUG
+	if (entry->is_freed) return;
+#endif
+	MemTrackHistogramCounters* counters = memtrack_histogram_counters();
+	memtrack_histogram_add(&counters->sizes[memtrack_histogram_bucket((uint64_t)entry->size)], memtrack_entry_count_of(entry));
+}
+
+
+/* entry の確保から解放までの時間を数える、解放するときにだけ呼び出す（realloc では確保時刻を引き継ぐ） */
+static inline void memtrack_histogram_release (const MemTrackEntry* entry) {
+#ifdef DEBUG
+	if (entry->is_freed) return;
+#endif
+	uint64_t now = memtrack_histogram_now();
+	uint64_t lifetime = (now > entry->birth) ? now - entry->birth : 0;
+	MemTrackHistogramCounters* counters = memtrack_histogram_counters();
+	memtrack_histogram_add(&counters->lifetimes[memtrack_histogram_bucket(lifetime)], memtrack_entry_count_of(entry));
+}
+
+
+void memtrack_histogram_get (MemTrackHistogram* histogram) {
+	if (UNLIKELY(histogram == NULL)) {
+		memtrack_report("histogram is null!", NULL, __FILE__, __LINE__);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_histogram_get";
+		return;
+	}
+
+	pthread_mutex_lock(&memtrack_histogram_lock);
+	for (size_t i = 0; i < MEMTRACK_HISTOGRAM_BUCKETS; i++) {
+		histogram->sizes[i] = atomic_load_explicit(&memtrack_histogram_shared.sizes[i], memory_order_relaxed);
+		histogram->lifetimes[i] = atomic_load_explicit(&memtrack_histogram_shared.lifetimes[i], memory_order_relaxed);
+	}
+	for (const MemTrackHistogramCounters* counters = memtrack_histogram_threads; counters != NULL; counters = counters->next) {
+		for (size_t i = 0; i < MEMTRACK_HISTOGRAM_BUCKETS; i++) {
+			histogram->sizes[i] += atomic_load_explicit(&counters->sizes[i], memory_order_relaxed);
+			histogram->lifetimes[i] += atomic_load_explicit(&counters->lifetimes[i], memory_order_relaxed);
+		}
+	}
+	pthread_mutex_unlock(&memtrack_histogram_lock);
+}
+
+
+static void memtrack_histogram_print_buckets (FILE* stream, const size_t* buckets) {
+	for (size_t i = 0; i < MEMTRACK_HISTOGRAM_BUCKETS; i++) {
+		if (buckets[i] == 0) continue;
+
+		unsigned long long low = (i == 0) ? 0 : 1ULL << (i - 1);
+		unsigned long long high = (i == 0) ? 0 : (i == 64) ? ~0ULL : (1ULL << i) - 1;
+		fprintf(stream, "Range: %llu - %llu   Count: %zu\n", low, high, buckets[i]);
+	}
+}
+
+
+static void memtrack_histogram_print (FILE* stream) {
+	MemTrackHistogram histogram;
+	memtrack_histogram_get(&histogram);
+
+	fprintf(stream, "\nSize Histogram (bytes)\n");
+	memtrack_histogram_print_buckets(stream, histogram.sizes);
+	fprintf(stream, "\nLifetime Histogram (nanoseconds)\n");
+	memtrack_histogram_print_buckets(stream, histogram.lifetimes);
+}
+
+
+#else
+static inline void memtrack_histogram_record (const MemTrackEntry* entry) {
+	(void)entry;
+}
+
+static inline void memtrack_histogram_release (const MemTrackEntry* entry) {
+	(void)entry;
+}
+#endif
+
+
+#ifdef MEMTRACK_BACKTRACE
+
+
+#define MEMTRACK_BACKTRACE_EMPTY 0
+#define MEMTRACK_BACKTRACE_CLAIMED 1  /* フレームを書き込み中 */
+#define MEMTRACK_BACKTRACE_READY 2
+
+
+/*
+ * 同じバックトレースは一度だけ登録し（ハッシュコンシング）、エントリには番号だけを持たせる
+ * 呼び出し元の登録表と同じく削除しないため、ロックを使わずに検索と追加ができる
+ * 末尾の要素は表が埋まった後のバックトレースをまとめて扱うためのもので、検索の対象にはならない
+ */
+static MemTrackBacktrace memtrack_backtraces[MEMTRACK_BACKTRACE_COUNT + 1];
+
+#define MEMTRACK_BACKTRACE_OVERFLOW ((MemTrackBacktraceId)MEMTRACK_BACKTRACE_COUNT + 1)
+
+
+/* 公開ラッパー関数の戻り先を探す、呼び出し元に近い側のフレームの数 */
+#define MEMTRACK_BACKTRACE_SEARCH 32
+
+
+typedef struct {
+	void** frames;
+	uint32_t depth;
+	uint32_t capacity;
+	uint32_t skip;  /* まだ捨てるフレームの数 */
+} MemTrackBacktraceCapture;
+
+
+static _Unwind_Reason_Code memtrack_backtrace_frame (struct _Unwind_Context* context, void* arg) {
+	MemTrackBacktraceCapture* capture = arg;
+	uintptr_t ip = (uintptr_t)_Unwind_GetIP(context);
+	if (ip == 0) return _URC_END_OF_STACK;
+
+	if (capture->skip != 0) {
+		capture->skip--;
+		return _URC_NO_REASON;
+	}
+
+	capture->frames[capture->depth++] = (void*)ip;
+	return (capture->depth < capture->capacity) ? _URC_NO_REASON : _URC_END_OF_STACK;
+}
+
+
+static inline uint64_t memtrack_backtrace_hash (void* const* frames, uint32_t depth) {
+	uint64_t hash = depth;
+	for (uint32_t i = 0; i < depth; i++) {
+		hash ^= (uint64_t)(uintptr_t)frames[i];
+		hash *= 0x9E3779B97F4A7C15ULL;
+		hash ^= hash >> 29;
+	}
+	return hash;
+}
+
+
+/* frames と同じバックトレースの番号を返す（なければ登録する） */
+static MemTrackBacktraceId memtrack_backtrace_id (void* const* frames, uint32_t depth) {
+	uint64_t hash = memtrack_backtrace_hash(frames, depth);
+	size_t index = (size_t)(hash >> 40) & (MEMTRACK_BACKTRACE_COUNT - 1);
+	for (size_t i = 0; i < MEMTRACK_BACKTRACE_COUNT; i++) {
+		size_t slot = (index + i) & (MEMTRACK_BACKTRACE_COUNT - 1);
+		MemTrackBacktrace* backtrace = &memtrack_backtraces[slot];
+
+		int state = atomic_load_explicit(&backtrace->state, memory_order_acquire);
+		if (state == MEMTRACK_BACKTRACE_EMPTY) {
+			if (atomic_compare_exchange_strong_explicit(&backtrace->state, &state, MEMTRACK_BACKTRACE_CLAIMED, memory_order_acquire, memory_order_acquire)) {
+				backtrace->hash = hash;
+				backtrace->depth = depth;
+				memcpy(backtrace->frames, frames, depth * sizeof(void*));
+				atomic_store_explicit(&backtrace->state, MEMTRACK_BACKTRACE_READY, memory_order_release);
+				return (MemTrackBacktraceId)slot + 1;
+			}
+		}
+
+		while (state == MEMTRACK_BACKTRACE_CLAIMED)  /* 他スレッドの登録はすぐに終わる */
+			state = atomic_load_explicit(&backtrace->state, memory_order_acquire);
+
+		if (backtrace->hash == hash && backtrace->depth == depth && memcmp(backtrace->frames, frames, depth * sizeof(void*)) == 0)
+			return (MemTrackBacktraceId)slot + 1;
+	}
+	return MEMTRACK_BACKTRACE_OVERFLOW;
+}
+
+
+/*
+ * 呼び出し元のバックトレースを取得して番号を返す、インライン化されるとこの関数自身のフレームがなくなるため禁止する
+ * ライブラリ内の関数のインライン化の具合で深さが変わらないよう、公開ラッパー関数の戻り先のフレームから記録する
+ * 公開ラッパー関数を経由しない呼び出し（memtrack_entry_add など）では、この関数の呼び出し元から記録する
+ */
+__attribute__((noinline)) static MemTrackBacktraceId memtrack_backtrace_capture (void) {
+	void* frames[MEMTRACK_BACKTRACE_SEARCH + MEMTRACK_BACKTRACE_SKIP + MEMTRACK_BACKTRACE_DEPTH];
+	void* caller = memtrack_backtrace_caller;
+	uint32_t capacity = (caller != NULL) ? (uint32_t)sizeof(frames) / sizeof(void*) : (uint32_t)MEMTRACK_BACKTRACE_SKIP + MEMTRACK_BACKTRACE_DEPTH;
+	MemTrackBacktraceCapture capture = { frames, 0, capacity, 1 };  /* この関数自身のフレームは捨てる */
+	_Unwind_Backtrace(memtrack_backtrace_frame, &capture);
+
+	uint32_t start = 0;
+	for (uint32_t i = 0; caller != NULL && i < capture.depth && i < MEMTRACK_BACKTRACE_SEARCH; i++) {
+		if (frames[i] == caller) {
+			start = i;
+			break;
+		}
+	}
+
+	start += MEMTRACK_BACKTRACE_SKIP;
+	if (start >= capture.depth) return 0;
+
+	uint32_t depth = capture.depth - start;
+	if (depth > MEMTRACK_BACKTRACE_DEPTH) depth = MEMTRACK_BACKTRACE_DEPTH;
+	return memtrack_backtrace_id(frames + start, depth);
+}
+
+
+static void memtrack_backtrace_print (FILE* stream, MemTrackBacktraceId id) {
+	if (id == 0 || id == MEMTRACK_BACKTRACE_OVERFLOW) {
+		fprintf(stream, "    (unknown)\n");
+		return;
+	}
+
+	const MemTrackBacktrace* backtrace = &memtrack_backtraces[id - 1];
+	for (uint32_t i = 0; i < backtrace->depth; i++) {
+		void* frame = backtrace->frames[i];
+#ifdef MEMTRACK_BACKTRACE_DLADDR
+		Dl_info info;
+		if (dladdr(frame, &info) != 0 && info.dli_sname != NULL) {
+			fprintf(stream, "    #%u %p %s+0x%zx (%s)\n", i, frame, info.dli_sname, (size_t)((uintptr_t)frame - (uintptr_t)info.dli_saddr), info.dli_fname);
+			continue;
+		}
+		if (dladdr(frame, &info) != 0 && info.dli_fname != NULL) {
+			fprintf(stream, "    #%u %p (%s+0x%zx)\n", i, frame, info.dli_fname, (size_t)((uintptr_t)frame - (uintptr_t)info.dli_fbase));
+			continue;
+		}
+#endif
+		fprintf(stream, "    #%u %p\n", i, frame);
+	}
+}
+
+
+/* バックトレースごとの集計の 1 行、番号 - 1 の位置に置く（番号 0 は末尾の要素にまとめる） */
+typedef struct {
+	MemTrackBacktraceId id;
+	size_t count;
+	size_t bytes;
+} MemTrackBacktraceUsage;
+
+
+static MemTrackBacktraceUsage* memtrack_backtrace_usage_create (const char* errfunc) {
+	MemTrackBacktraceUsage* usage = calloc(MEMTRACK_BACKTRACE_COUNT + 1, sizeof(MemTrackBacktraceUsage));
+	if (UNLIKELY(usage == NULL)) {
+		memtrack_report("Failed to allocate memory for the summary by backtrace.", NULL, __FILE__, __LINE__);
+		errno = ENOMEM;
+		memtrack_errfunc = errfunc;
+	}
+	return usage;
+}
+
+
+static inline void memtrack_backtrace_usage_add (MemTrackBacktraceUsage* usage, const MemTrackEntry* entry) {
+	if (usage == NULL) return;
+
+	MemTrackBacktraceUsage* row = &usage[(entry->backtrace != 0) ? entry->backtrace - 1 : MEMTRACK_BACKTRACE_COUNT];
+	row->count++;
+	row->bytes += entry->size;
+}
+
+
+static int memtrack_backtrace_usage_compare (const void* a, const void* b) {
+	const MemTrackBacktraceUsage* usage_a = a;
+	const MemTrackBacktraceUsage* usage_b = b;
+	if (usage_a->bytes != usage_b->bytes) return (usage_a->bytes < usage_b->bytes) ? 1 : -1;  /* バイト数の多い順 */
+	return (usage_a->count < usage_b->count) - (usage_a->count > usage_b->count);
+}
+
+
+/* バイト数の多い順に出力して usage を解放する */
+static void memtrack_backtrace_usage_print (FILE* stream, MemTrackBacktraceUsage* usage) {
+	if (usage == NULL) return;
+
+	size_t used = 0;
+	for (size_t i = 0; i <= MEMTRACK_BACKTRACE_COUNT; i++) {
+		if (usage[i].count == 0) continue;
+
+		usage[i].id = (MemTrackBacktraceId)i + 1;
+		usage[used++] = usage[i];
+	}
+	qsort(usage, used, sizeof(MemTrackBacktraceUsage), memtrack_backtrace_usage_compare);
+
+	for (size_t i = 0; i < used; i++) {
+		fprintf(stream, "Blocks: %zu   Bytes: %zu   Backtrace: %u\n", usage[i].count, usage[i].bytes, usage[i].id);
+		memtrack_backtrace_print(stream, usage[i].id);
+	}
+
+	free(usage);
+}
+
+
+#endif
+
+
+#ifdef DEBUG
+
+
+/* 以下の 3 つの関数はエントリに確保、realloc、解放を行った呼び出し元を記録する */
+
+static inline void memtrack_entry_mark_alloc (MemTrackEntry* entry, const char* file, int line) {
+#ifndef MEMTRACK_CALL_SITE
+	entry->alloc_file = file;
+	entry->alloc_line = line;
+#else
+	entry->alloc_site = memtrack_site_id(file, line);
+#endif
+}
+
+static inline void memtrack_entry_mark_realloc (MemTrackEntry* entry, const char* file, int line) {
+#ifndef MEMTRACK_CALL_SITE
+	entry->last_realloc_file = file;
+	entry->last_realloc_line = line;
+#else
+	entry->last_realloc_site = memtrack_site_id(file, line);
+#endif
+}
+
+static inline void memtrack_entry_mark_free (MemTrackEntry* entry, const char* file, int line) {
+	entry->is_freed = true;
+#ifdef MEMTRACK_THREAD_STATS
+	entry->free_thread = memtrack_thread_id_of(memtrack_thread_self());
+#endif
+#ifndef MEMTRACK_CALL_SITE
+	entry->free_file = file;
+	entry->free_line = line;
+#else
+	entry->free_site = memtrack_site_id(file, line);
+#endif
+}
+
+
+static inline bool memtrack_entry_is_realloced (const MemTrackEntry* entry) {
+#ifndef MEMTRACK_CALL_SITE
+	return entry->last_realloc_file != NULL;
+#else
+	return entry->last_realloc_site != 0;
+#endif
+}
+
+
+/* printf の引数として、entry の kind（alloc、last_realloc、free のいずれか）の呼び出し元のファイル名と行番号に展開する */
+#ifndef MEMTRACK_CALL_SITE
+	#define MEMTRACK_ENTRY_FILE_LINE(entry, kind) (entry)->kind##_file, (entry)->kind##_line
+#else
+	#define MEMTRACK_ENTRY_FILE_LINE(entry, kind) memtrack_site_file((entry)->kind##_site), memtrack_site_line((entry)->kind##_site)
+#endif
+
+
+#endif
+
+
+/* 新しく確保したブロックのエントリを作る */
+static inline MemTrackEntry memtrack_entry_make (void* ptr, size_t size, const char* file, int line) {
+	MemTrackEntry entry = {
+		.ptr = ptr,
+		.size = size
+#ifdef MEMTRACK_SAMPLING
+		,
+		.weight = size
+#endif
+#ifdef MEMTRACK_HISTOGRAM
+		,
+		.birth = memtrack_histogram_now()
+#endif
+#ifdef MEMTRACK_BACKTRACE
+		,
+		.backtrace = memtrack_backtrace_capture()
+#endif
+#ifdef MEMTRACK_TAGS
+		,
+		.tag = memtrack_tag_current
+#endif
+#ifdef MEMTRACK_FORK_SAFE
+		,
+		.generation = atomic_load_explicit(&memtrack_generation, memory_order_relaxed)
+#endif
+	};
+
+#ifdef DEBUG
+	memtrack_entry_mark_alloc(&entry, file, line);
+#else
+	(void)file;
+	(void)line;
+#endif
+	return entry;
+}
+
+
+#ifdef MEMTRACK_THREAD_BUFFER
+static void memtrack_buffers_flush_all (void);
+
+/*
+ * 他スレッドのバッファに残っているエントリの可能性があるため、保持中のシャードのロックを
+ * 一時的に外して全バッファをテーブルへ反映してから再検索する
+ */
+static MemTrackEntry* memtrack_table_lookup_slow (const void* ptr, const void* locked1, const void* locked2) {
+	memtrack_shard_unlock_pair(locked1, locked2);
+	memtrack_buffers_flush_all();
+	memtrack_shard_lock_pair(locked1, locked2);
+
+	MemTrackStore* table = memtrack_table_of(ptr);
+	if (UNLIKELY(table == NULL)) return NULL;
+	return memtrack_store_get(table, ptr);
+}
+#endif
+
+
+/* locked1 と locked2 には呼び出し元がロックしているシャードのポインタを渡す */
+static inline MemTrackEntry* memtrack_table_lookup (const void* ptr, const void* locked1, const void* locked2) {
+	MemTrackEntry* entry = memtrack_store_get(memtrack_table_of(ptr), ptr);
+#ifdef MEMTRACK_THREAD_BUFFER
+#ifndef DEBUG
+	if (UNLIKELY(entry == NULL))
+#else
+	if (UNLIKELY(entry == NULL || entry->is_freed))  /* 他スレッドのバッファに新しいエントリがある可能性がある */
+#endif
+		entry = memtrack_table_lookup_slow(ptr, locked1, locked2);
+#else
+	(void)locked1;
+	(void)locked2;
+#endif
+	return entry;
+}
+
+
+#ifdef DEBUG
+/*
+ * 重要: ptr のシャードをロックした後に呼び出す必要があります！
+ * ptr を隔離リングに登録し、解放済みエントリの free_seq に設定する番号を返す
+ * リングが一周していれば最も古い解放済みエントリをテーブルから削除する
+ * （その後同じアドレスが再確保されていれば番号が一致しないため削除しない）
+ */
+static size_t memtrack_quarantine_push (void* ptr) {
+	MemTrackQuarantine* quarantine = memtrack_quarantine_of(ptr);
+	size_t seq = quarantine->count++;
+	size_t slot = seq % MEMTRACK_QUARANTINE_SIZE;
+
+	if (seq >= MEMTRACK_QUARANTINE_SIZE) {
+		void* evicted = quarantine->ptrs[slot];
+		MemTrackStore* table = memtrack_table_of(evicted);
+		MemTrackEntry* entry = (table != NULL) ? memtrack_store_get(table, evicted) : NULL;
+		if (entry != NULL && entry->is_freed && entry->free_seq == seq - MEMTRACK_QUARANTINE_SIZE) {
+			if (UNLIKELY(!memtrack_store_remove(table, entry))) {
+				memtrack_report("Failed to delete entry from memory tracking.", evicted, __FILE__, __LINE__);
+				memtrack_errfunc = "memtrack_entry_free";
+			}
+		}
+	}
+
+	quarantine->ptrs[slot] = ptr;
+	return seq;
+}
+#endif
+
+
+/* 重要: 以下の memtrack_table_ で始まる関数は必ず ptr のシャードをロックした後に呼び出す必要があります！ */
+
+/* new_entry には memtrack_entry_make で作ったエントリを渡す、バックトレースの取得などに時間がかかるためロックの前に作っておく */
+static void memtrack_table_add (const MemTrackEntry* new_entry, const char* file, int line) {
+	void* ptr = new_entry->ptr;
+	if (UNLIKELY(memtrack_table_of(ptr) == NULL)) init();
+
+	MemTrackEntry entry = *new_entry;
+	memtrack_site_record(&entry, file, line);
+	memtrack_histogram_record(&entry);
+
+	MemTrackStore* table = memtrack_table_of(ptr);
+	if (UNLIKELY(table == NULL || !memtrack_store_set(table, &entry))) {
+		memtrack_report("Failed to add entry to memory tracking.", ptr, file, line);
+		memtrack_errfunc = "memtrack_entry_add";
+		memtrack_site_release(&entry);
+	}
+}
+
+
+/*
+ * 重要: old_entry のアドレスと new_ptr の両方のシャードをロックした後に呼び出す必要があります！
+ * old_entry には memtrack_table_lookup などで得たテーブル内のエントリを渡す
+ */
+static void memtrack_table_update_entry (MemTrackEntry* old_entry, void* new_ptr, size_t new_size, const char* file, int line) {
+	void* old_ptr = old_entry->ptr;
+	memtrack_site_release(old_entry);  /* realloc は呼び出し元での新しい確保として数え直す */
+
+	if (old_ptr == new_ptr) {  /* 同じエントリを使える場合は処理を分けることで無駄な処理を減らす */
+		old_entry->size = new_size;
+#ifdef DEBUG
+		memtrack_entry_mark_realloc(old_entry, file, line);
+#endif
+		memtrack_site_record(old_entry, file, line);
+		memtrack_histogram_record(old_entry);
+		return;
+	}
+
+	MemTrackEntry new_entry = *old_entry;  /* 確保時と解放時の情報は旧エントリのものを引き継ぐ */
+	new_entry.ptr = new_ptr;
+	new_entry.size = new_size;
+#ifdef DEBUG
+	memtrack_entry_mark_realloc(&new_entry, file, line);
+#endif
+	memtrack_site_record(&new_entry, file, line);
+	memtrack_histogram_record(&new_entry);
+
+	MemTrackStore* new_table = memtrack_table_of(new_ptr);
+	if (UNLIKELY(new_table == NULL || !memtrack_store_set(new_table, &new_entry))) {
+		memtrack_report("Failed to add new entry to memory tracking.", new_ptr, file, line);
+		memtrack_errfunc = "memtrack_entry_update";
+		memtrack_site_release(&new_entry);
+	}
+
+	if (!memtrack_store_remove(memtrack_table_of(old_ptr), old_entry)) {
+		memtrack_report("Failed to delete old entry from memory tracking.", old_ptr, file, line);
+		memtrack_errfunc = "memtrack_entry_update";
+	}
+}
+
+
+/* 更新する元のエントリが見つからなかったブロックを新しく登録する、エラー時にしか通らないためロック中にエントリを作る */
+static void memtrack_table_add_untracked (void* ptr, size_t size, const char* file, int line) {
+	MemTrackEntry entry = memtrack_entry_make(ptr, size, file, line);
+	memtrack_table_add(&entry, file, line);
+}
+
+
+/* 重要: old_ptr と new_ptr の両方のシャードをロックした後に呼び出す必要があります！ */
+static void memtrack_table_update (void* old_ptr, void* new_ptr, size_t new_size, const char* file, int line) {
+	if (UNLIKELY(memtrack_table_of(old_ptr) == NULL)) {
+		init();
+
+		memtrack_report("No entry found to update! The memory might not be tracked.", old_ptr, file, line);
+		errno = EPERM;
+
+		memtrack_table_add_untracked(new_ptr, new_size, file, line);
+
+		memtrack_errfunc = "memtrack_entry_update";
+
+		return;
+	}
+
+	MemTrackEntry* old_entry = memtrack_table_lookup(old_ptr, old_ptr, new_ptr);
+	if (UNLIKELY(old_entry == NULL)) {
+		memtrack_report("No entry found to update! The memory might not be tracked.", old_ptr, file, line);
+		memtrack_table_add_untracked(new_ptr, new_size, file, line);
+
+		memtrack_errfunc = "memtrack_entry_update";
+
+		return;
+	}
+
+	memtrack_table_update_entry(old_entry, new_ptr, new_size, file, line);
+}
+
+
+static void memtrack_table_free (void* ptr, const char* file, int line) {
+	if (UNLIKELY(memtrack_table_of(ptr) == NULL)) {
+		init();
+
+		memtrack_report("No entry found to free! The memory might not be tracked.", ptr, file, line);
+		errno = EPERM;
+		memtrack_errfunc = "memtrack_entry_free";
+
+		return;
+	}
+
+	MemTrackEntry* entry = memtrack_table_lookup(ptr, ptr, ptr);
+	if (entry == NULL) {
+		memtrack_report("No entry found to free! The memory might not be tracked.", ptr, file, line);
+		memtrack_errfunc = "memtrack_entry_free";
+		return;
+	}
+
+	memtrack_histogram_release(entry);
+	memtrack_site_release(entry);
+
+#ifndef DEBUG
+	if (!memtrack_store_remove(memtrack_table_of(ptr), entry)) {
+		memtrack_report("Failed to delete entry from memory tracking.", ptr, file, line);
+		memtrack_errfunc = "memtrack_entry_free";
+	}
+#else
+	size_t seq = memtrack_quarantine_push(ptr);
+
+	entry = memtrack_store_get(memtrack_table_of(ptr), ptr);  /* 解放済みエントリを再度解放した場合は、追い出しで自身が削除されている可能性がある */
+	if (UNLIKELY(entry == NULL)) return;
+	memtrack_entry_mark_free(entry, file, line);
+	entry->free_seq = seq;
+#endif
+}
+
+
+/*
+ * エントリを解放済みとして処理し、実際に free してよいかどうかを返す
+ * 解放前にエントリを取り除くことで、シャードモードで他スレッドが同じアドレスを再取得しても競合しない
+ */
+static bool memtrack_table_release (void* ptr, const char* file, int line) {
+#ifdef DEBUG
+	if (UNLIKELY(memtrack_table_of(ptr) == NULL)) {
+		init();
+
+		memtrack_report("No entry found to free! The memory might not be tracked.", ptr, file, line);
+		errno = EPERM;
+		memtrack_errfunc = "memtrack_free";
+
+		return true;
+	}
+
+	MemTrackEntry* entry = memtrack_table_lookup(ptr, ptr, ptr);
+	if (entry == NULL) {
+		memtrack_report("No entry found to free! The memory might not be tracked.", ptr, file, line);
+		memtrack_errfunc = "memtrack_free";
+
+		return true;
+	}
+
+	if (entry->is_freed) {
+		memtrack_report_double_free(ptr, file, line, MEMTRACK_ENTRY_FILE_LINE(entry, free));
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_free";
+		return false;
+	}
+#endif
+
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+	int tmp_errno = errno;
+#endif
+	errno = 0;
+
+	memtrack_table_free(ptr, file, line);
+
+	if (UNLIKELY(errno != 0)) memtrack_errfunc = "memtrack_free";
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+	else errno = tmp_errno;
+#endif
+
+	return true;
+}
+
+
+#ifdef MEMTRACK_REALLOC_DETACH
+/*
+ * realloc の前にエントリをテーブルから取り外す
+ * realloc が旧アドレスを解放した直後に他スレッドが同じアドレスを取得しても、エントリが衝突しない
+ */
+static bool memtrack_table_detach (void* ptr, MemTrackEntry* out_entry) {
+	MemTrackStore* table = memtrack_table_of(ptr);
+	if (UNLIKELY(table == NULL)) return false;
+
+	MemTrackEntry* entry = memtrack_table_lookup(ptr, ptr, ptr);
+	if (entry == NULL) return false;
+#if defined (MEMTRACK_SAMPLING) && defined (DEBUG)
+	if (entry->is_freed) return false;  /* 解放済みエントリはフィルタで数えていない */
+#endif
+
+	*out_entry = *entry;
+
+	if (UNLIKELY(!memtrack_store_remove(table, entry))) {
+		memtrack_report("Failed to delete old entry from memory tracking.", ptr, __FILE__, __LINE__);
+		memtrack_errfunc = "memtrack_realloc";
+	}
+	return true;
+}
+
+
+static bool memtrack_table_attach (const MemTrackEntry* entry, const char* file, int line) {
+	MemTrackStore* table = memtrack_table_of(entry->ptr);
+	if (UNLIKELY(table == NULL || !memtrack_store_set(table, entry))) {
+		memtrack_report("Failed to add new entry to memory tracking.", entry->ptr, file, line);
+		memtrack_errfunc = "memtrack_entry_update";
+		return false;
+	}
+	return true;
+}
+#endif
+
+
+#ifdef MEMTRACK_SAMPLING
+/* ptr のエントリが記録中であればそれを返す（記録されていないのは正常なので何も表示しない） */
+static MemTrackEntry* memtrack_table_find_sampled (const void* ptr) {
+	MemTrackStore* table = memtrack_table_of(ptr);
+	if (UNLIKELY(table == NULL)) return NULL;
+
+	MemTrackEntry* entry = memtrack_store_get(table, ptr);
+#ifdef DEBUG
+	if (entry != NULL && entry->is_freed) return NULL;
+#endif
+	return entry;
+}
+#endif
+
+
+#ifdef MEMTRACK_THREAD_BUFFER
+
+
+#ifdef DEBUG
+/* 解放済みエントリは、同じアドレスに対する新しいエントリがテーブルにある場合は反映しない */
+static void memtrack_table_merge (const MemTrackEntry* entry) {
+	if (entry->is_freed) {
+		MemTrackStore* table = memtrack_table_of(entry->ptr);
+		MemTrackEntry* existing = (table != NULL) ? memtrack_store_get(table, entry->ptr) : NULL;
+		if (existing != NULL && !existing->is_freed) return;
+
+		MemTrackEntry freed_entry = *entry;
+		freed_entry.free_seq = memtrack_quarantine_push(entry->ptr);
+		memtrack_table_attach(&freed_entry, __FILE__, __LINE__);
+		return;
+	}
+	memtrack_table_attach(entry, __FILE__, __LINE__);
+}
+#else
+static inline void memtrack_table_merge (const MemTrackEntry* entry) {
+	memtrack_table_attach(entry, __FILE__, __LINE__);
+}
+#endif
+
+
+/* 重要: バッファのロックを取得した後に呼び出す必要があります！ */
+static void memtrack_buffer_flush_locked (MemTrackBuffer* buffer) {
+	/* シャードごとにまとめて反映し、ロックの取得回数を抑える */
+	size_t remaining = buffer->count;
+	for (size_t shard = 0; shard < MEMTRACK_SHARD_COUNT && remaining > 0; shard++) {
+		bool locked = false;
+		for (size_t i = 0; i < buffer->count; i++) {
+			if (memtrack_shard_index(buffer->entries[i].ptr) != shard) continue;
+
+			if (!locked) {
+				memtrack_shard_lock_index(shard);
+				locked = true;
+			}
+			memtrack_table_merge(&buffer->entries[i]);
+			remaining--;
+		}
+		if (locked) memtrack_shard_unlock_index(shard);
+	}
+	buffer->count = 0;
+}
+
+
+/* 重要: この関数はシャードのロックを保持していない状態で呼び出す必要があります！ */
+static void memtrack_buffers_flush_all (void) {
+	if (memtrack_lock_held) {  /* memtrack_lock によって全バッファのロックを保持済み */
+		for (MemTrackBuffer* buffer = memtrack_buffers; buffer != NULL; buffer = buffer->next)
+			memtrack_buffer_flush_locked(buffer);
+		return;
+	}
+
+	pthread_mutex_lock(&memtrack_buffers_lock);
+	for (MemTrackBuffer* buffer = memtrack_buffers; buffer != NULL; buffer = buffer->next) {
+		pthread_mutex_lock(&buffer->lock);
+		memtrack_buffer_flush_locked(buffer);
+		pthread_mutex_unlock(&buffer->lock);
+	}
+	pthread_mutex_unlock(&memtrack_buffers_lock);
+}
+
+
+/* 重要: この関数はシャードのロックを保持していない状態で呼び出す必要があります！ 自スレッドのバッファだけを反映する */
+static void memtrack_buffer_flush_own (void) {
+	MemTrackBuffer* buffer = memtrack_buffer;
+	if (buffer == NULL) return;
+
+	if (memtrack_lock_held) {  /* memtrack_lock によって全バッファのロックを保持済み */
+		memtrack_buffer_flush_locked(buffer);
+		return;
+	}
+
+	pthread_mutex_lock(&buffer->lock);
+	memtrack_buffer_flush_locked(buffer);
+	pthread_mutex_unlock(&buffer->lock);
+}
+
+
+static void memtrack_buffer_unregister (MemTrackBuffer* buffer) {
+	if (buffer->prev != NULL)
+		buffer->prev->next = buffer->next;
+	else
+		memtrack_buffers = buffer->next;
+
+	if (buffer->next != NULL)
+		buffer->next->prev = buffer->prev;
+}
+
+
+/* スレッドの終了時に呼び出され、残っているエントリを反映してからバッファを破棄する */
+static void memtrack_buffer_destroy (void* arg) {
+	MemTrackBuffer* buffer = arg;
+	memtrack_buffer = NULL;
+	MEMTRACK_PRELOAD_ENTER();
+
+	pthread_mutex_lock(&memtrack_buffers_lock);
+
+	pthread_mutex_lock(&buffer->lock);
+	memtrack_buffer_flush_locked(buffer);
+	pthread_mutex_unlock(&buffer->lock);
+
+	memtrack_buffer_unregister(buffer);
+
+	pthread_mutex_unlock(&memtrack_buffers_lock);
+
+	pthread_mutex_destroy(&buffer->lock);
+	free(buffer);
+	MEMTRACK_PRELOAD_LEAVE();
+}
+
+
+/* 自スレッドのバッファを返す、初めて呼び出された場合は作成して登録する */
+static MemTrackBuffer* memtrack_buffer_get (void) {
+	if (LIKELY(memtrack_buffer != NULL)) return memtrack_buffer;
+
+	init();
+
+	MemTrackBuffer* buffer = calloc(1, sizeof(MemTrackBuffer));
+	if (UNLIKELY(buffer == NULL)) return NULL;
+
+	if (UNLIKELY(pthread_mutex_init(&buffer->lock, NULL) != 0)) {
+		free(buffer);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&memtrack_buffers_lock);
+	buffer->next = memtrack_buffers;
+	if (memtrack_buffers != NULL) memtrack_buffers->prev = buffer;
+	memtrack_buffers = buffer;
+	pthread_mutex_unlock(&memtrack_buffers_lock);
+
+	if (UNLIKELY(pthread_setspecific(memtrack_buffer_key, buffer) != 0)) {
+		memtrack_buffer_destroy(buffer);
+		return NULL;
+	}
+
+	memtrack_buffer = buffer;
+	return buffer;
+}
+
+
+/* 重要: バッファのロックを取得した後に呼び出す必要があります！ 短命なエントリほど末尾にあるため末尾から探す */
+static inline size_t memtrack_buffer_find (const MemTrackBuffer* buffer, const void* ptr) {
+	for (size_t i = buffer->count; i > 0; i--) {
+		if (buffer->entries[i - 1].ptr == ptr) return i - 1;
+	}
+	return SIZE_MAX;
+}
+
+
+/* 重要: バッファのロックを取得した後に呼び出す必要があります！ */
+static inline void memtrack_buffer_remove (MemTrackBuffer* buffer, size_t index) {
+	buffer->count--;
+	buffer->entries[index] = buffer->entries[buffer->count];
+}
+
+
+/*
+ * 以下の memtrack_buffer_ で始まる関数は自スレッドのバッファだけで処理できた場合に true を返す
+ * memtrack_lock の保持中は全エントリをテーブルで扱うため、常に false を返す
+ */
+
+static bool memtrack_buffer_add (const MemTrackEntry* entry) {
+	if (memtrack_lock_held) return false;
+
+	MemTrackBuffer* buffer = memtrack_buffer_get();
+	if (UNLIKELY(buffer == NULL)) return false;
+
+	pthread_mutex_lock(&buffer->lock);
+
+#ifdef DEBUG
+	/* 同じアドレスの解放済みエントリが残っている場合は上書きする */
+	size_t index = memtrack_buffer_find(buffer, entry->ptr);
+	if (index != SIZE_MAX) {
+		buffer->entries[index] = *entry;
+		pthread_mutex_unlock(&buffer->lock);
+		return true;
+	}
+#endif
+
+	if (buffer->count == MEMTRACK_THREAD_BUFFER_SIZE)
+		memtrack_buffer_flush_locked(buffer);
+
+	buffer->entries[buffer->count++] = *entry;
+
+	pthread_mutex_unlock(&buffer->lock);
+	return true;
+}
+
+
+static bool memtrack_buffer_update (void* old_ptr, void* new_ptr, size_t new_size, const char* file, int line) {
+	MemTrackBuffer* buffer = memtrack_buffer;
+	if (memtrack_lock_held || buffer == NULL) return false;
+
+	pthread_mutex_lock(&buffer->lock);
+
+	size_t index = memtrack_buffer_find(buffer, old_ptr);
+	if (index == SIZE_MAX) {
+		pthread_mutex_unlock(&buffer->lock);
+		return false;
+	}
+
+#ifdef DEBUG
+	if (old_ptr != new_ptr) {  /* 新しいアドレスの解放済みエントリが残っている場合は取り除く */
+		size_t stale = memtrack_buffer_find(buffer, new_ptr);
+		if (stale != SIZE_MAX) {
+			memtrack_buffer_remove(buffer, stale);
+			if (index == buffer->count) index = stale;  /* 末尾の要素が移動した場合 */
+		}
+	}
+#endif
+
+	MemTrackEntry* entry = &buffer->entries[index];
+	memtrack_site_release(entry);
+	entry->ptr = new_ptr;
+	entry->size = new_size;
+#ifdef DEBUG
+	memtrack_entry_mark_realloc(entry, file, line);
+#endif
+	memtrack_site_record(entry, file, line);
+	memtrack_histogram_record(entry);
+
+	pthread_mutex_unlock(&buffer->lock);
+	return true;
+}
+
+
+static bool memtrack_buffer_free (void* ptr, const char* file, int line) {
+	MemTrackBuffer* buffer = memtrack_buffer;
+	if (memtrack_lock_held || buffer == NULL) return false;
+
+	pthread_mutex_lock(&buffer->lock);
+
+	size_t index = memtrack_buffer_find(buffer, ptr);
+	if (index == SIZE_MAX) {
+		pthread_mutex_unlock(&buffer->lock);
+		return false;
+	}
+
+	memtrack_histogram_release(&buffer->entries[index]);
+	memtrack_site_release(&buffer->entries[index]);
+
+#ifndef DEBUG
+	(void)file;
+	(void)line;
+	memtrack_buffer_remove(buffer, index);  /* 確保と解放がバッファ内で打ち消し合い、テーブルには一切触れない */
+#else
+	memtrack_entry_mark_free(&buffer->entries[index], file, line);
+#endif
+
+	pthread_mutex_unlock(&buffer->lock);
+	return true;
+}
+
+
+/* 実際に free してよいかどうかを release に格納する */
+static bool memtrack_buffer_release (void* ptr, const char* file, int line, bool* release) {
+	MemTrackBuffer* buffer = memtrack_buffer;
+	if (memtrack_lock_held || buffer == NULL) return false;
+
+	pthread_mutex_lock(&buffer->lock);
+
+	size_t index = memtrack_buffer_find(buffer, ptr);
+	if (index == SIZE_MAX) {
+		pthread_mutex_unlock(&buffer->lock);
+		return false;
+	}
+
+#ifndef DEBUG
+	(void)file;
+	(void)line;
+	memtrack_histogram_release(&buffer->entries[index]);
+	memtrack_site_release(&buffer->entries[index]);
+	memtrack_buffer_remove(buffer, index);
+	*release = true;
+#else
+	MemTrackEntry* entry = &buffer->entries[index];
+	if (entry->is_freed) {
+		memtrack_report_double_free(ptr, file, line, MEMTRACK_ENTRY_FILE_LINE(entry, free));
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_free";
+		*release = false;
+	} else {
+		memtrack_histogram_release(entry);
+		memtrack_site_release(entry);
+		memtrack_entry_mark_free(entry, file, line);
+		*release = true;
+	}
+#endif
+
+	pthread_mutex_unlock(&buffer->lock);
+	return true;
+}
+
+
+static bool memtrack_buffer_get_size (void* ptr, size_t* size) {
+	MemTrackBuffer* buffer = memtrack_buffer;
+	if (memtrack_lock_held || buffer == NULL) return false;
+
+	pthread_mutex_lock(&buffer->lock);
+
+	size_t index = memtrack_buffer_find(buffer, ptr);
+	if (index != SIZE_MAX)
+		*size = buffer->entries[index].size;
+
+	pthread_mutex_unlock(&buffer->lock);
+	return index != SIZE_MAX;
+}
+
+
+static bool memtrack_buffer_detach (void* ptr, MemTrackEntry* out_entry) {
+	MemTrackBuffer* buffer = memtrack_buffer;
+	if (memtrack_lock_held || buffer == NULL) return false;
+
+	pthread_mutex_lock(&buffer->lock);
+
+	size_t index = memtrack_buffer_find(buffer, ptr);
+	if (index != SIZE_MAX) {
+		*out_entry = buffer->entries[index];
+		memtrack_buffer_remove(buffer, index);
+	}
+
+	pthread_mutex_unlock(&buffer->lock);
+	return index != SIZE_MAX;
+}
+
+
+#endif
+
+
+#ifdef MEMTRACK_REALLOC_DETACH
+/* 自スレッドのバッファを優先してエントリを取り外す */
+static bool memtrack_entry_detach (void* ptr, MemTrackEntry* out_entry) {
+#ifdef MEMTRACK_THREAD_BUFFER
+	if (memtrack_buffer_detach(ptr, out_entry)) return true;
+#endif
+
+#ifdef MEMTRACK_SAMPLING
+	if (LIKELY(!memtrack_sample_maybe_tracked(ptr))) return false;
+#endif
+
+	memtrack_shard_lock(ptr);
+	bool detached = memtrack_table_detach(ptr, out_entry);
+	memtrack_shard_unlock(ptr);
+
+#ifdef MEMTRACK_SAMPLING
+	if (detached) memtrack_sample_filter_dec(ptr);
+#endif
+	return detached;
+}
+
+
+static void memtrack_entry_attach (const MemTrackEntry* entry, const char* file, int line) {
+#ifdef MEMTRACK_THREAD_BUFFER
+	if (memtrack_buffer_add(entry)) return;
+#endif
+
+	memtrack_shard_lock(entry->ptr);
+	memtrack_table_attach(entry, file, line);
+	memtrack_shard_unlock(entry->ptr);
+
+#ifdef MEMTRACK_SAMPLING
+	memtrack_sample_filter_inc(entry->ptr);
+#endif
+}
+
+
+/* 取り外したエントリを realloc 後のブロックのものに書き換えて付け直す（確保時の情報は引き継ぐ） */
+static void memtrack_entry_reattach (MemTrackEntry* entry, void* new_ptr, size_t new_size, const char* file, int line) {
+	memtrack_site_release(entry);
+	entry->ptr = new_ptr;
+	entry->size = new_size;
+#ifdef MEMTRACK_SAMPLING
+	entry->weight = memtrack_sample_weight(new_size, memtrack_get_sample_interval());
+#endif
+#ifdef DEBUG
+	memtrack_entry_mark_realloc(entry, file, line);
+#endif
+	memtrack_site_record(entry, file, line);
+	memtrack_histogram_record(entry);
+	memtrack_entry_attach(entry, file, line);
+}
+#endif
+
+
+#ifdef MEMTRACK_HEADER
+
+
+static inline uintptr_t memtrack_header_magic (const void* ptr) {
+	return MEMTRACK_HEADER_MAGIC ^ (uintptr_t)ptr;
+}
+
+
+static inline MemTrackHeader* memtrack_header_at (void* ptr) {
+	return (MemTrackHeader*)(void*)((char*)ptr - sizeof(MemTrackHeader));
+}
+
+
+/* ptr がヘッダー付きで確保されたブロックであればそのヘッダーを、そうでなければ NULL を返す */
+MEMTRACK_NO_SANITIZE_ADDRESS static inline MemTrackHeader* memtrack_header_of (void* ptr) {
+	MemTrackHeader* header = memtrack_header_at(ptr);
+	if (LIKELY(header->magic == memtrack_header_magic(ptr))) return header;
+	return NULL;
+}
+
+
+static inline MemTrackHeader** memtrack_header_list_of (const void* ptr) {
+#ifndef MEMTRACK_SHARDED
+	(void)ptr;
+	return &memtrack_headers;
+#else
+	return &memtrack_shards[memtrack_shard_index(ptr)].headers;
+#endif
+}
+
+
+/* 重要: 以下の 2 つの関数は必ず ptr のシャードをロックした後に呼び出す必要があります！ */
+
+static inline void memtrack_header_link (MemTrackHeader* header, const void* ptr) {
+	MemTrackHeader** list = memtrack_header_list_of(ptr);
+	header->prev = NULL;
+	header->next = *list;
+	if (*list != NULL) (*list)->prev = header;
+	*list = header;
+}
+
+static inline void memtrack_header_unlink (MemTrackHeader* header, const void* ptr) {
+	if (header->prev != NULL)
+		header->prev->next = header->next;
+	else
+		*memtrack_header_list_of(ptr) = header->next;
+	if (header->next != NULL) header->next->prev = header->prev;
+}
+
+
+size_t memtrack_header_prefix (size_t alignment) {
+	if (alignment < _Alignof(max_align_t)) alignment = _Alignof(max_align_t);
+	return (sizeof(MemTrackHeader) + alignment - 1) & ~(alignment - 1);
+}
+
+
+/* base のヘッダーを初期化してユーザー領域のアドレスを返す、一覧への登録は呼び出し元で行う */
+static void* memtrack_header_init (void* base, size_t prefix, size_t size, const char* file, int line) {
+	void* ptr = (char*)base + prefix;
+	MemTrackHeader* header = memtrack_header_at(ptr);
+	header->prefix = prefix;
+	header->entry = memtrack_entry_make(ptr, size, file, line);
+	header->magic = memtrack_header_magic(ptr);
+	memtrack_site_record(&header->entry, file, line);
+	memtrack_histogram_record(&header->entry);
+	return ptr;
+}
+
+
+/* トレースに記録せずに base のヘッダーを初期化して一覧に登録する */
+static void* memtrack_header_bind (void* base, size_t prefix, size_t size, const char* file, int line) {
+	if (base == NULL) {
+		memtrack_report("base is null! Memory cannot be tracked!", NULL, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_header_attach";
+		return NULL;
+	}
+
+	void* ptr = memtrack_header_init(base, prefix, size, file, line);
+
+	memtrack_shard_lock(ptr);
+	if (UNLIKELY(memtrack_table_of(ptr) == NULL)) init();  /* 終了時の解放処理を登録するため */
+	memtrack_header_link(memtrack_header_at(ptr), ptr);
+	memtrack_shard_unlock(ptr);
+
+	return ptr;
+}
+
+
+void* memtrack_header_attach (void* base, size_t prefix, size_t size, const char* file, int line) {
+	void* ptr = memtrack_header_bind(base, prefix, size, file, line);
+	if (ptr != NULL) memtrack_trace_add(ptr, size, file, line);
+	return ptr;
+}
+
+
+/* ヘッダーごと realloc し、一覧の繋ぎ替えまで行う */
+static void* memtrack_header_realloc (void* ptr, MemTrackHeader* header, size_t size, const char* file, int line) {
+	size_t prefix = header->prefix;
+	if (UNLIKELY(size > (SIZE_MAX - prefix))) {
+		memtrack_report("Memory allocation overflow.", ptr, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_realloc";
+		return NULL;
+	}
+
+	/* realloc でヘッダーが移動すると前後のリンクが壊れるため、先に一覧から外しておく */
+	memtrack_shard_lock(ptr);
+	memtrack_header_unlink(header, ptr);
+	memtrack_shard_unlock(ptr);
+
+	/* 解放された旧アドレスを他スレッドが再取得して記録するより先になるよう、realloc の前に記録を予約する */
+	uint64_t trace = memtrack_trace_reserve();
+
+	void* new_base = realloc((char*)ptr - prefix, prefix + size);
+	if (UNLIKELY(new_base == NULL)) {
+		memtrack_report("Memory allocation failed.", ptr, file, line);
+		errno = ENOMEM;
+		memtrack_errfunc = "memtrack_realloc";
+
+		memtrack_trace_update_at(trace, ptr, ptr, header->entry.size, file, line);
+		memtrack_shard_lock(ptr);
+		memtrack_header_link(header, ptr);
+		memtrack_shard_unlock(ptr);
+		return NULL;
+	}
+
+	void* new_ptr = (char*)new_base + prefix;
+	MemTrackHeader* new_header = memtrack_header_at(new_ptr);
+	memtrack_site_release(&new_header->entry);
+	new_header->entry.ptr = new_ptr;
+	new_header->entry.size = size;
+#ifdef DEBUG
+	memtrack_entry_mark_realloc(&new_header->entry, file, line);
+#endif
+	new_header->magic = memtrack_header_magic(new_ptr);
+	memtrack_site_record(&new_header->entry, file, line);
+	memtrack_histogram_record(&new_header->entry);
+
+	memtrack_shard_lock(new_ptr);
+	memtrack_header_link(new_header, new_ptr);
+	memtrack_shard_unlock(new_ptr);
+
+#if defined (__GNUC__) && !defined (__clang__)
+	#pragma GCC diagnostic push
+	#pragma GCC diagnostic ignored "-Wuse-after-free"  /* memtrack自体のデバッグを行う際は必ず外すこと */
+#endif
+
+	memtrack_trace_update_at(trace, ptr, new_ptr, size, file, line);
+
+#if defined (__GNUC__) && !defined (__clang__)
+	#pragma GCC diagnostic pop
+#endif
+
+	return new_ptr;
+}
+
+
+/* 一覧から外してブロック全体を解放する */
+static void memtrack_header_discard (void* ptr, MemTrackHeader* header) {
+	memtrack_shard_lock(ptr);
+	memtrack_header_unlink(header, ptr);
+	memtrack_shard_unlock(ptr);
+
+	header->magic = 0;
+	free((char*)ptr - header->prefix);
+}
+
+
+/*
+ * 重要: ptr のシャードをロックした後に呼び出す必要があります！
+ * 集計から除いて一覧から外し、free に渡すブロックの先頭を返す
+ */
+static void* memtrack_header_release_locked (void* ptr, MemTrackHeader* header, const char* file, int line) {
+	memtrack_histogram_release(&header->entry);
+	memtrack_site_release(&header->entry);
+
+#ifdef DEBUG
+	/* 二重解放を検出できるよう、解放済みエントリとしてテーブルに残す（アドレスが再利用される前に行う） */
+	MemTrackEntry entry = header->entry;
+	memtrack_entry_mark_free(&entry, file, line);
+
+	entry.free_seq = memtrack_quarantine_push(ptr);
+	MemTrackStore* table = memtrack_table_of(ptr);
+	if (UNLIKELY(table == NULL || !memtrack_store_set(table, &entry))) {
+		memtrack_report("Failed to add entry to memory tracking.", ptr, file, line);
+		memtrack_errfunc = "memtrack_free";
+	}
+#else
+	(void)file;
+	(void)line;
+#endif
+
+	memtrack_header_unlink(header, ptr);
+	header->magic = 0;
+	return (char*)ptr - header->prefix;
+}
+
+
+static void memtrack_header_release (void* ptr, MemTrackHeader* header, const char* file, int line) {
+	memtrack_shard_lock(ptr);
+	void* base = memtrack_header_release_locked(ptr, header, file, line);
+	memtrack_shard_unlock(ptr);
+
+	free(base);
+}
+
+
+static void memtrack_free_block (void* ptr, const char* file, int line);
+
+void* memtrack_header_transfer (void* old_ptr, void* new_base, size_t prefix, size_t size, const char* file, int line) {
+	MemTrackHeader* old_header = memtrack_header_of(old_ptr);
+	if (UNLIKELY(old_header == NULL)) {  /* テーブルで管理されているブロックからの移行 */
+		void* new_ptr = memtrack_header_bind(new_base, prefix, size, file, line);
+		if (new_ptr != NULL) {
+			memtrack_trace_update(old_ptr, new_ptr, size, file, line);
+			memtrack_free_block(old_ptr, file, line);
+		}
+		return new_ptr;
+	}
+
+	void* new_ptr = memtrack_header_bind(new_base, prefix, size, file, line);
+	if (UNLIKELY(new_ptr == NULL)) return NULL;
+	memtrack_trace_update(old_ptr, new_ptr, size, file, line);
+
+#ifdef DEBUG
+	MemTrackHeader* new_header = memtrack_header_at(new_ptr);
+#ifndef MEMTRACK_CALL_SITE
+	new_header->entry.alloc_file = old_header->entry.alloc_file;
+	new_header->entry.alloc_line = old_header->entry.alloc_line;
+#else
+	new_header->entry.alloc_site = old_header->entry.alloc_site;
+#endif
+	memtrack_entry_mark_realloc(&new_header->entry, file, line);
+#endif
+#ifdef MEMTRACK_HISTOGRAM
+	memtrack_header_at(new_ptr)->entry.birth = old_header->entry.birth;
+#endif
+#ifdef MEMTRACK_BACKTRACE
+	memtrack_header_at(new_ptr)->entry.backtrace = old_header->entry.backtrace;
+#endif
+#ifdef MEMTRACK_TAGS
+	memtrack_header_at(new_ptr)->entry.tag = old_header->entry.tag;
+#endif
+#ifdef MEMTRACK_FORK_SAFE
+	memtrack_header_at(new_ptr)->entry.generation = old_header->entry.generation;
+#endif
+
+	memtrack_site_release(&old_header->entry);
+	memtrack_header_discard(old_ptr, old_header);
+	return new_ptr;
+}
+
+
+#endif
+
+
+#ifdef MEMTRACK_USABLE_SIZE
+/* ptr から実際に使用できるバイト数、ヘッダー付きのブロックではヘッダーの分を除く */
+static size_t memtrack_usable_size (void* ptr) {
+#ifdef MEMTRACK_HEADER
+	const MemTrackHeader* header = memtrack_header_of(ptr);
+	if (header != NULL) return MEMTRACK_MALLOC_USABLE_SIZE((char*)ptr - header->prefix) - header->prefix;
+#endif
+	return MEMTRACK_MALLOC_USABLE_SIZE(ptr);
+}
+#endif
+
+
+/* トレースに記録せずにエントリを追加する */
+static void memtrack_entry_insert (void* ptr, size_t size, const char* file, int line) {
+	if (ptr == NULL) {
+		memtrack_report("ptr is null! Memory cannot be tracked!", NULL, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_entry_add";
+		return;
+	}
+
+#ifdef MEMTRACK_SAMPLING
+	size_t weight;
+	if (LIKELY(!memtrack_sample_take(size, &weight))) return;  /* 記録しない確保は残りバイト数を減らすだけ */
+#endif
+
+#if defined (MEMTRACK_THREAD_BUFFER) || defined (MEMTRACK_SAMPLING)
+	MemTrackEntry entry = memtrack_entry_make(ptr, size, file, line);
+#ifdef MEMTRACK_SAMPLING
+	entry.weight = weight;
+#endif
+	memtrack_site_record(&entry, file, line);
+	memtrack_histogram_record(&entry);
+
+#ifdef MEMTRACK_THREAD_BUFFER
+	if (LIKELY(memtrack_buffer_add(&entry))) return;
+#endif
+
+	memtrack_shard_lock(ptr);
+	if (UNLIKELY(memtrack_table_of(ptr) == NULL)) init();
+	bool added = memtrack_table_attach(&entry, file, line);
+	memtrack_shard_unlock(ptr);
+
+	if (UNLIKELY(!added)) {
+		memtrack_errfunc = "memtrack_entry_add";
+		memtrack_site_release(&entry);
+		return;
+	}
+#ifdef MEMTRACK_SAMPLING
+	memtrack_sample_filter_inc(ptr);
+#endif
+#else
+	MemTrackEntry entry = memtrack_entry_make(ptr, size, file, line);  /* バックトレースの取得をシャードのロックの外で済ませる */
+	memtrack_shard_lock(ptr);
+	memtrack_table_add(&entry, file, line);
+	memtrack_shard_unlock(ptr);
+#endif
+}
+
+
+void memtrack_entry_add (void* ptr, size_t size, const char* file, int line) {
+	if (ptr != NULL) memtrack_trace_add(ptr, size, file, line);
+	memtrack_entry_insert(ptr, size, file, line);
+}
+
+
+void memtrack_entry_update (void* old_ptr, void* new_ptr, size_t new_size, const char* file, int line) {
+	if (old_ptr == NULL) {
+		memtrack_entry_add(new_ptr, new_size, file, line);
+		return;
+	}
+
+	if (new_ptr == NULL) new_ptr = old_ptr;
+
+	memtrack_trace_update(old_ptr, new_ptr, new_size, file, line);
+
+#ifdef MEMTRACK_SAMPLING
+	/* 記録していないブロックは、新しい確保として記録するかどうかを決め直す */
+	MemTrackEntry entry;
+	if (LIKELY(!memtrack_entry_detach(old_ptr, &entry))) {
+		memtrack_entry_insert(new_ptr, new_size, file, line);
+		return;
+	}
+
+	memtrack_entry_reattach(&entry, new_ptr, new_size, file, line);
+	return;
+#endif
+
+#ifdef MEMTRACK_THREAD_BUFFER
+	if (memtrack_buffer_update(old_ptr, new_ptr, new_size, file, line)) return;
+#endif
+
+	memtrack_shard_lock_pair(old_ptr, new_ptr);
+	memtrack_table_update(old_ptr, new_ptr, new_size, file, line);
+	memtrack_shard_unlock_pair(old_ptr, new_ptr);
+}
+
+
+void memtrack_entry_free (void* ptr, const char* file, int line) {
+	if (ptr == NULL) return;
+
+	memtrack_trace_free(ptr, file, line);
+
+#ifdef MEMTRACK_SAMPLING
+	if (LIKELY(!memtrack_sample_maybe_tracked(ptr))) return;
+
+	memtrack_shard_lock(ptr);
+	bool tracked = (memtrack_table_find_sampled(ptr) != NULL);
+	if (tracked) memtrack_table_free(ptr, file, line);
+	memtrack_shard_unlock(ptr);
+
+	if (tracked) memtrack_sample_filter_dec(ptr);
+	return;
+#endif
+
+#ifdef MEMTRACK_THREAD_BUFFER
+	if (memtrack_buffer_free(ptr, file, line)) return;
+#endif
+
+	memtrack_shard_lock(ptr);
+	memtrack_table_free(ptr, file, line);
+	memtrack_shard_unlock(ptr);
+}
+
+
+/* MemTrackEntryHandle の state の値 */
+#define MEMTRACK_HANDLE_NONE 0        /* 記録されていない、commit では新しい確保として記録する */
+#ifndef MEMTRACK_REALLOC_DETACH
+	#define MEMTRACK_HANDLE_TABLE 1     /* entry はテーブル内のエントリ（ラッパー関数のグローバルロック中のみ有効） */
+#else
+	#define MEMTRACK_HANDLE_DETACHED 2  /* テーブルから取り外したエントリを storage に写してある */
+
+	_Static_assert(sizeof(MemTrackEntry) <= sizeof(((MemTrackEntryHandle*)NULL)->storage), "MemTrackEntryHandle.storage is too small.");
+#endif
+#ifdef MEMTRACK_HEADER
+	#define MEMTRACK_HANDLE_HEADER 3    /* entry はブロックのヘッダー内のエントリ */
+#endif
+
+
+static inline void memtrack_handle_reset (MemTrackEntryHandle* handle, void* ptr) {
+	handle->ptr = ptr;
+	handle->size = 0;
+	handle->entry = NULL;
+	handle->state = MEMTRACK_HANDLE_NONE;
+}
+
+
+#ifdef MEMTRACK_USABLE_SIZE
+/* handle のエントリに記録した使用できるバイト数、エントリがなければ 0 */
+static inline size_t memtrack_handle_usable (const MemTrackEntryHandle* handle) {
+	if (handle->state == MEMTRACK_HANDLE_NONE) return 0;
+#ifdef MEMTRACK_REALLOC_DETACH
+	if (handle->state == MEMTRACK_HANDLE_DETACHED) {
+		MemTrackEntry entry;
+		memcpy(&entry, handle->storage, sizeof(MemTrackEntry));
+		return entry.usable;
+	}
+#endif
+	return ((const MemTrackEntry*)handle->entry)->usable;
+}
+#endif
+
+
+#ifdef MEMTRACK_BUDGET
+/* handle のブロックを size バイトに realloc しても上限に収まるか */
+static bool memtrack_handle_admit (const MemTrackEntryHandle* handle, size_t size, const char* file, int line) {
+	if (handle->state == MEMTRACK_HANDLE_NONE) return memtrack_budget_admit_resize(size, NULL, file, line);
+#ifdef MEMTRACK_REALLOC_DETACH
+	if (handle->state == MEMTRACK_HANDLE_DETACHED) {
+		MemTrackEntry entry;
+		memcpy(&entry, handle->storage, sizeof(MemTrackEntry));
+		return memtrack_budget_admit_resize(size, &entry, file, line);
+	}
+#endif
+	return memtrack_budget_admit_resize(size, handle->entry, file, line);
+}
+#endif
+
+
+/*
+ * ptr のエントリを一度だけ探し、以後の更新で探し直さずに済むよう handle に保持する
+ * シャードモードとサンプリングモードでは、realloc で解放された旧アドレスを他スレッドが再取得しても
+ * 衝突しないよう、エントリをテーブルから取り外して handle に写す
+ */
+bool memtrack_entry_acquire_without_lock (void* ptr, MemTrackEntryHandle* handle, const char* file, int line) {
+	if (UNLIKELY(handle == NULL)) {
+		memtrack_report("handle is null!", ptr, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_entry_acquire";
+		return false;
+	}
+
+	memtrack_handle_reset(handle, ptr);
+
+	if (ptr == NULL) {
+		memtrack_report("Cannot acquire an entry because ptr is NULL.", NULL, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_entry_acquire";
+		return false;
+	}
+
+#ifdef MEMTRACK_HEADER
+	MemTrackHeader* header = memtrack_header_of(ptr);
+	if (LIKELY(header != NULL)) {
+		handle->size = header->entry.size;
+		handle->entry = &header->entry;
+		handle->state = MEMTRACK_HANDLE_HEADER;
+		return true;
+	}
+#endif
+
+#ifdef MEMTRACK_REALLOC_DETACH
+	MemTrackEntry entry;
+	if (LIKELY(memtrack_entry_detach(ptr, &entry))) {
+		memcpy(handle->storage, &entry, sizeof(MemTrackEntry));
+		handle->size = entry.size;
+		handle->state = MEMTRACK_HANDLE_DETACHED;
+		return true;
+	}
+
+#ifdef MEMTRACK_SAMPLING
+#ifdef __GLIBC__
+	handle->size = malloc_usable_size(ptr);  /* 記録していないブロックは実際に使用できるサイズを返す */
+	return true;
+#else
+	memtrack_report("Cannot get the size of a memory block that was not sampled.", ptr, file, line);
+	errno = EPERM;
+	memtrack_errfunc = "memtrack_entry_acquire";
+	return false;
+#endif
+#else
+	memtrack_report("No entry found to update! The memory might not be tracked.", ptr, file, line);
+	memtrack_errfunc = "memtrack_entry_acquire";
+	return false;
+#endif
+
+#else
+	if (UNLIKELY(memtrack_table_of(ptr) == NULL)) {
+		init();
+
+		memtrack_report("No entry found to update! The memory might not be tracked.", ptr, file, line);
+		errno = EPERM;
+		memtrack_errfunc = "memtrack_entry_acquire";
+
+		return false;
+	}
+
+	MemTrackEntry* entry = memtrack_table_lookup(ptr, ptr, ptr);
+	if (UNLIKELY(entry == NULL)) {
+		memtrack_report("No entry found to update! The memory might not be tracked.", ptr, file, line);
+		memtrack_errfunc = "memtrack_entry_acquire";
+		return false;
+	}
+
+	handle->size = entry->size;
+	handle->entry = entry;
+	handle->state = MEMTRACK_HANDLE_TABLE;
+	return true;
+#endif
+}
+
+
+/* handle のエントリを new_ptr に付け直し、予約済みの trace に更新を記録する、handle->ptr が NULL でないことは呼び出し元が確認する */
+static void memtrack_handle_commit (MemTrackEntryHandle* handle, void* new_ptr, size_t new_size, uint64_t trace, const char* file, int line) {
+	void* old_ptr = handle->ptr;
+	memtrack_trace_update_at(trace, old_ptr, new_ptr, new_size, file, line);
+
+	int state = handle->state;
+	MemTrackEntry* entry = handle->entry;
+	memtrack_handle_reset(handle, NULL);  /* 付け直した後のエントリは保持しない */
+
+	if (state == MEMTRACK_HANDLE_NONE) {
+		memtrack_entry_insert(new_ptr, new_size, file, line);
+#ifdef MEMTRACK_REALLOC_DETACH
+	} else if (state == MEMTRACK_HANDLE_DETACHED) {
+		MemTrackEntry detached;
+		memcpy(&detached, handle->storage, sizeof(MemTrackEntry));
+		memtrack_entry_reattach(&detached, new_ptr, new_size, file, line);
+#else
+	} else if (state == MEMTRACK_HANDLE_TABLE) {
+		memtrack_table_update_entry(entry, new_ptr, new_size, file, line);  /* 非シャードモードのシャード単位のロックは何もしない */
+#endif
+#ifdef MEMTRACK_HEADER
+	} else if (state == MEMTRACK_HANDLE_HEADER) {
+		memtrack_site_release(entry);
+		entry->size = new_size;
+#ifdef DEBUG
+		memtrack_entry_mark_realloc(entry, file, line);
+#endif
+		memtrack_site_record(entry, file, line);
+		memtrack_histogram_record(entry);
+#endif
+	}
+	(void)entry;
+}
+
+
+void memtrack_entry_commit_without_lock (MemTrackEntryHandle* handle, void* new_ptr, size_t new_size, const char* file, int line) {
+	if (UNLIKELY(handle == NULL)) {
+		memtrack_report("handle is null!", new_ptr, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_entry_commit";
+		return;
+	}
+
+	void* old_ptr = handle->ptr;
+	if (old_ptr == NULL) {
+		memtrack_entry_add(new_ptr, new_size, file, line);
+		return;
+	}
+
+	if (new_ptr == NULL) new_ptr = old_ptr;
+
+#ifdef MEMTRACK_HEADER
+	if (handle->state == MEMTRACK_HANDLE_HEADER && new_ptr != old_ptr) {  /* ヘッダーはブロックと一緒にしか動かせない */
+		memtrack_report("The entry in a header cannot be moved to another block. Use memtrack_header_transfer instead.", old_ptr, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_entry_commit";
+		return;
+	}
+#endif
+
+	memtrack_handle_commit(handle, new_ptr, new_size, memtrack_trace_reserve(), file, line);
+}
+
+
+void memtrack_entry_release_without_lock (MemTrackEntryHandle* handle, const char* file, int line) {
+	if (handle == NULL) return;
+
+#ifdef MEMTRACK_REALLOC_DETACH
+	if (handle->state == MEMTRACK_HANDLE_DETACHED) {  /* 取り外したエントリをそのまま戻す */
+		MemTrackEntry detached;
+		memcpy(&detached, handle->storage, sizeof(MemTrackEntry));
+		memtrack_entry_attach(&detached, file, line);
+	}
+#else
+	(void)file;
+	(void)line;
+#endif
+
+	memtrack_handle_reset(handle, NULL);
+}
+
+
+bool memtrack_entry_handle_recorded (const MemTrackEntryHandle* handle) {
+	return (handle != NULL) && (handle->state != MEMTRACK_HANDLE_NONE);
+}
+
+
+/* handle で取得済みのブロックを realloc し、同じ handle でエントリを付け直す */
+void* memtrack_realloc_entry_without_lock (MemTrackEntryHandle* handle, size_t size, const char* file, int line) {
+	if (UNLIKELY(handle == NULL)) {
+		memtrack_report("handle is null!", NULL, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_realloc_entry";
+		return NULL;
+	}
+
+	void* ptr = handle->ptr;
+	if (ptr == NULL) {
+		void* new_ptr = memtrack_malloc_without_lock(size, file, line);
+		if (new_ptr == NULL)
+			memtrack_errfunc = "memtrack_realloc_entry";
+		return new_ptr;
+	}
+
+	if (size == 0) {
+		memtrack_report("Undefined behavior because the size is zero, do not use anymore. The memory block will be freed and NULL will be returned.", ptr, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_realloc_entry";
+
+		memtrack_entry_release_without_lock(handle, file, line);
+		memtrack_free_without_lock(ptr, file, line);
+		return NULL;
+	}
+
+#ifdef MEMTRACK_BUDGET
+	if (UNLIKELY(!memtrack_handle_admit(handle, size, file, line))) {
+		memtrack_errfunc = "memtrack_realloc";
+
+		memtrack_entry_release_without_lock(handle, file, line);  /* 元のメモリブロックは有効なままなので、エントリも元に戻す */
+		return NULL;
+	}
+#endif
+
+#ifdef MEMTRACK_USABLE_SIZE
+	/* 記録済みのブロックを使用できる領域に収まる範囲で大きくする場合は realloc を呼び出さずにサイズだけを更新する、縮める場合は領域を返せるよう realloc に任せる */
+	if (handle->size < size && size <= memtrack_handle_usable(handle)) {
+		memtrack_entry_commit_without_lock(handle, ptr, size, file, line);
+		return ptr;
+	}
+#endif
+
+#ifdef MEMTRACK_HEADER
+	if (handle->state == MEMTRACK_HANDLE_HEADER) {
+		memtrack_handle_reset(handle, NULL);
+		return memtrack_header_realloc(ptr, memtrack_header_at(ptr), size, file, line);
+	}
+#endif
+
+	/* 解放された旧アドレスを他スレッドが再取得して記録するより先になるよう、free と同様に realloc の前に記録を予約する */
+	uint64_t trace = memtrack_trace_reserve();
+
+	void* new_ptr = realloc(ptr, size);
+	if (UNLIKELY(new_ptr == NULL)) {
+#if defined (__GNUC__) && !defined (__clang__)
+	#pragma GCC diagnostic push
+	#pragma GCC diagnostic ignored "-Wuse-after-free"  /* realloc に失敗した場合は ptr が有効なまま */
+#endif
+
+		memtrack_report("Memory allocation failed.", ptr, file, line);
+		memtrack_trace_update_at(trace, ptr, ptr, handle->size, file, line);  /* 予約した記録を変化のない更新として埋める */
+
+#if defined (__GNUC__) && !defined (__clang__)
+	#pragma GCC diagnostic pop
+#endif
+		errno = ENOMEM;
+		memtrack_errfunc = "memtrack_realloc";
+
+		memtrack_entry_release_without_lock(handle, file, line);  /* 元のメモリブロックは有効なままなので、エントリも元に戻す */
+		return NULL;
+	}
+
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+	int tmp_errno = errno;
+#endif
+	errno = 0;
+
+#if defined (__GNUC__) && !defined (__clang__)
+	#pragma GCC diagnostic push
+	#pragma GCC diagnostic ignored "-Wuse-after-free"  /* memtrack自体のデバッグを行う際は必ず外すこと */
+#endif
+
+	memtrack_handle_commit(handle, new_ptr, size, trace, file, line);
+
+#if defined (__GNUC__) && !defined (__clang__)
+	#pragma GCC diagnostic pop
+#endif
+
+	if (UNLIKELY(errno != 0)) memtrack_errfunc = "memtrack_realloc";
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+	else errno = tmp_errno;
+#endif
+	return new_ptr;
+}
+
+
+void* memtrack_malloc_without_lock (size_t size, const char* file, int line) {
+	if (size == 0) {
+		memtrack_report("No processing was done because the size is zero.", NULL, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_malloc";
+		return NULL;
+	}
+
+#ifdef MEMTRACK_BUDGET
+	if (UNLIKELY(!memtrack_budget_admit_resize(size, NULL, file, line))) {
+		memtrack_errfunc = "memtrack_malloc";
+		return NULL;
+	}
+#endif
+
+#ifdef MEMTRACK_HEADER
+	size_t prefix = memtrack_header_prefix(0);
+	if (UNLIKELY(size > (SIZE_MAX - prefix))) {
+		memtrack_report("Memory allocation overflow.", NULL, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_malloc";
+		return NULL;
+	}
+
+	void* base = malloc(prefix + size);
+	if (UNLIKELY(base == NULL)) {
+		memtrack_report("Memory allocation failed.", NULL, file, line);
+		errno = ENOMEM;
+		memtrack_errfunc = "memtrack_malloc";
+		return NULL;
+	}
+	return memtrack_header_attach(base, prefix, size, file, line);
+#endif
+
+	void* ptr = malloc(size);
+	if (UNLIKELY(ptr == NULL)) {
+		memtrack_report("Memory allocation failed.", NULL, file, line);
+		errno = ENOMEM;
+		memtrack_errfunc = "memtrack_malloc";
+	} else {
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+		int tmp_errno = errno;
+#endif
+		errno = 0;
+
+		memtrack_entry_add(ptr, size, file, line);
+
+		if (UNLIKELY(errno != 0)) memtrack_errfunc = "memtrack_malloc";
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+		else errno = tmp_errno;
+#endif
+	}
+	return ptr;
+}
+
+
+void* memtrack_malloc (size_t size, const char* file, int line) {
+	memtrack_wrapper_lock();
+	void* ptr = memtrack_malloc_without_lock(size, file, line);
+	memtrack_wrapper_unlock();
+	return ptr;
+}
+
+
+void* memtrack_calloc_without_lock (size_t count, size_t size, const char* file, int line) {
+	if (count == 0) {
+		memtrack_report("No processing was done because the count is zero.", NULL, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_calloc";
+		return NULL;
+	} else if (size == 0) {
+		memtrack_report("No processing was done because the size is zero.", NULL, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_calloc";
+		return NULL;
+	} else if (size > (SIZE_MAX / count)) {
+		memtrack_report("Memory allocation overflow.", NULL, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_calloc";
+		return NULL;
+	}
+
+#ifdef MEMTRACK_BUDGET
+	if (UNLIKELY(!memtrack_budget_admit_resize(size * count, NULL, file, line))) {
+		memtrack_errfunc = "memtrack_calloc";
+		return NULL;
+	}
+#endif
+
+#ifdef MEMTRACK_HEADER
+	size_t prefix = memtrack_header_prefix(0);
+	if (UNLIKELY((size * count) > (SIZE_MAX - prefix))) {
+		memtrack_report("Memory allocation overflow.", NULL, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_calloc";
+		return NULL;
+	}
+
+	void* base = calloc(1, prefix + size * count);
+	if (UNLIKELY(base == NULL)) {
+		memtrack_report("Memory allocation failed.", NULL, file, line);
+		errno = ENOMEM;
+		memtrack_errfunc = "memtrack_calloc";
+		return NULL;
+	}
+	return memtrack_header_attach(base, prefix, size * count, file, line);
+#endif
+
+	void* ptr = calloc(count, size);
+	if (UNLIKELY(ptr == NULL)) {
+		memtrack_report("Memory allocation failed.", NULL, file, line);
+		errno = ENOMEM;
+		memtrack_errfunc = "memtrack_calloc";
+	} else {
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+		int tmp_errno = errno;
+#endif
+		errno = 0;
+
+		memtrack_entry_add(ptr, size * count, file, line);
+
+		if (UNLIKELY(errno != 0)) memtrack_errfunc = "memtrack_calloc";
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+		else errno = tmp_errno;
+#endif
+	}
+	return ptr;
+}
+
+
+void* memtrack_calloc (size_t count, size_t size, const char* file, int line) {
+	memtrack_wrapper_lock();
+	void* ptr = memtrack_calloc_without_lock(count, size, file, line);
+	memtrack_wrapper_unlock();
+	return ptr;
+}
+
+
+void* memtrack_realloc_without_lock (void* ptr, size_t size, const char* file, int line) {
+	if (size == 0) {
+		memtrack_report("Undefined behavior because the size is zero, do not use anymore. The memory block will be freed and NULL will be returned.", ptr, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_realloc";
+
+		memtrack_free_without_lock(ptr, file, line);
+		return NULL;
+	}
+
+	if (ptr == NULL) {
+		void* new_ptr = memtrack_malloc_without_lock(size, file, line);
+		if (new_ptr == NULL)
+			memtrack_errfunc = "memtrack_realloc";
+		return new_ptr;
+	}
+
+	/* 見つからなければ acquire が表示し、realloc 後のブロックを新しい確保として記録する */
+	MemTrackEntryHandle handle;
+	memtrack_entry_acquire_without_lock(ptr, &handle, file, line);
+	return memtrack_realloc_entry_without_lock(&handle, size, file, line);
+}
+
+
+void* memtrack_realloc (void* ptr, size_t size, const char* file, int line) {
+	memtrack_wrapper_lock();
+	void* new_ptr = memtrack_realloc_without_lock(ptr, size, file, line);
+	memtrack_wrapper_unlock();
+	return new_ptr;
+}
+
+
+/* トレースに記録せずに解放する */
+static void memtrack_free_block (void* ptr, const char* file, int line) {
+#ifdef MEMTRACK_SAMPLING
+	if (LIKELY(!memtrack_sample_maybe_tracked(ptr))) {
+		free(ptr);
+		return;
+	}
+
+	bool sampled_release = true;
+	memtrack_shard_lock(ptr);
+	bool tracked = (memtrack_table_find_sampled(ptr) != NULL);
+	if (tracked) sampled_release = memtrack_table_release(ptr, file, line);
+	memtrack_shard_unlock(ptr);
+
+	if (tracked) memtrack_sample_filter_dec(ptr);
+	if (sampled_release) free(ptr);
+	return;
+#endif
+
+#ifdef MEMTRACK_HEADER
+	MemTrackHeader* header = memtrack_header_of(ptr);
+	if (LIKELY(header != NULL)) {
+		memtrack_header_release(ptr, header, file, line);
+		return;
+	}
+#endif
+
+	bool release = false;
+#ifdef MEMTRACK_THREAD_BUFFER
+	bool handled = memtrack_buffer_release(ptr, file, line, &release);
+#else
+	bool handled = false;
+#endif
+
+	if (!handled) {
+		memtrack_shard_lock(ptr);
+		release = memtrack_table_release(ptr, file, line);
+		memtrack_shard_unlock(ptr);
+	}
+
+	if (release) free(ptr);
+}
+
+
+void memtrack_free_without_lock (void* ptr, const char* file, int line) {
+	if (ptr == NULL) return;
+
+	memtrack_trace_free(ptr, file, line);
+	memtrack_free_block(ptr, file, line);
+}
+
+
+void memtrack_free (void* ptr, const char* file, int line) {
+	memtrack_wrapper_lock();
+	memtrack_free_without_lock(ptr, file, line);
+	memtrack_wrapper_unlock();
+}
+
+
+#ifndef MEMTRACK_SAMPLING
+/*
+ * 重要: ptr のシャードをロックした後に呼び出す必要があります！ memtrack_malloc_batch で確保したブロックを一覧かテーブルに登録する
+ * batch_entry には memtrack_batch_add がロックの前に作った、ブロックのアドレスとサイズ以外を共有するエントリを渡す
+ */
+static inline void memtrack_batch_link (void* ptr, size_t size, const MemTrackEntry* batch_entry, const char* file, int line) {
+#ifdef MEMTRACK_HEADER
+	(void)size;
+	(void)batch_entry;
+	(void)file;
+	(void)line;
+	memtrack_header_link(memtrack_header_at(ptr), ptr);
+#else
+	MemTrackEntry entry = *batch_entry;
+	entry.ptr = ptr;
+	entry.size = size;
+	memtrack_table_add(&entry, file, line);
+#endif
+}
+
+
+/*
+ * 重要: ptr のシャードをロックした後に呼び出す必要があります！
+ * トレースに記録せずに解放する、スレッドバッファのエントリは反映済みであること
+ */
+static void memtrack_batch_free_block (void* ptr, const char* file, int line) {
+#ifdef MEMTRACK_HEADER
+	MemTrackHeader* header = memtrack_header_of(ptr);
+	if (LIKELY(header != NULL)) {
+		free(memtrack_header_release_locked(ptr, header, file, line));
+		return;
+	}
+#endif
+
+	if (memtrack_table_release(ptr, file, line)) free(ptr);
+}
+#endif
+
+
+/* 確保済みのブロックをまとめて記録する、ヘッダーモードでは ptrs にブロックの先頭を渡し、ユーザー領域のアドレスに置き換える */
+static void memtrack_batch_add (void* ptrs[], const size_t sizes[], size_t count, const char* file, int line) {
+	for (size_t i = 0; i < count; i++) {
+#ifdef MEMTRACK_HEADER
+		ptrs[i] = memtrack_header_init(ptrs[i], memtrack_header_prefix(0), sizes[i], file, line);
+#endif
+		memtrack_trace_add(ptrs[i], sizes[i], file, line);
+	}
+
+#ifdef MEMTRACK_SAMPLING
+	/* 記録するのは一部だけなので、1 つずつ登録してもロックはほとんど取得しない */
+	for (size_t i = 0; i < count; i++)
+		memtrack_entry_insert(ptrs[i], sizes[i], file, line);
+#else
+#if defined (MEMTRACK_THREAD_BUFFER) && defined (DEBUG)
+	memtrack_buffer_flush_own();  /* 同じアドレスの解放済みエントリがバッファに残っていると、テーブルへの登録が隠れてしまうため */
+#endif
+
+#ifndef MEMTRACK_HEADER
+	/* 呼び出し元やバックトレースはどのブロックでも同じため、ロックの前に一度だけ取得する */
+	MemTrackEntry entry = memtrack_entry_make(NULL, 0, file, line);
+	const MemTrackEntry* batch_entry = &entry;
+#else
+	const MemTrackEntry* batch_entry = NULL;  /* ヘッダー内のエントリは memtrack_header_init で作成済み */
+#endif
+
+#ifndef MEMTRACK_SHARDED
+	if (UNLIKELY(memtrack_table_of(ptrs[0]) == NULL)) init();
+#ifndef MEMTRACK_HEADER
+	if (LIKELY(memtrack_table_of(ptrs[0]) != NULL)) memtrack_store_reserve(memtrack_table_of(ptrs[0]), count);
+#endif
+
+	for (size_t i = 0; i < count; i++)
+		memtrack_batch_link(ptrs[i], sizes[i], batch_entry, file, line);
+#else
+	/* シャードごとにロックを 1 回だけ取得し、そのシャードに入る数だけ先に置き場を広げてから登録する */
+	init();
+	size_t remaining = count;
+	for (size_t shard = 0; shard < MEMTRACK_SHARD_COUNT && remaining > 0; shard++) {
+		size_t in_shard = 0;
+		for (size_t i = 0; i < count; i++) {
+			if (memtrack_shard_index(ptrs[i]) == shard) in_shard++;
+		}
+		if (in_shard == 0) continue;
+
+		memtrack_shard_lock_index(shard);
+#ifndef MEMTRACK_HEADER
+		if (LIKELY(memtrack_shards[shard].entries != NULL)) memtrack_store_reserve(memtrack_shards[shard].entries, in_shard);
+#endif
+		for (size_t i = 0; i < count; i++) {
+			if (memtrack_shard_index(ptrs[i]) == shard)
+				memtrack_batch_link(ptrs[i], sizes[i], batch_entry, file, line);
+		}
+		memtrack_shard_unlock_index(shard);
+		remaining -= in_shard;
+	}
+#endif
+#endif
+}
+
+
+bool memtrack_malloc_batch_without_lock (size_t count, const size_t sizes[], void* ptrs[], const char* file, int line) {
+	if (count == 0) {
+		memtrack_report("No processing was done because the count is zero.", NULL, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_malloc_batch";
+		return false;
+	} else if (sizes == NULL || ptrs == NULL) {
+		memtrack_report("sizes or ptrs is null!", NULL, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_malloc_batch";
+		return false;
+	}
+
+	for (size_t i = 0; i < count; i++)
+		ptrs[i] = NULL;
+
+#ifdef MEMTRACK_HEADER
+	size_t prefix = memtrack_header_prefix(0);
+#endif
+	for (size_t i = 0; i < count; i++) {
+		if (sizes[i] == 0) {
+			memtrack_report("No processing was done because the size is zero.", NULL, file, line);
+			errno = EINVAL;
+			memtrack_errfunc = "memtrack_malloc_batch";
+			return false;
+		}
+#ifdef MEMTRACK_HEADER
+		if (UNLIKELY(sizes[i] > (SIZE_MAX - prefix))) {
+			memtrack_report("Memory allocation overflow.", NULL, file, line);
+			errno = EINVAL;
+			memtrack_errfunc = "memtrack_malloc_batch";
+			return false;
+		}
+#endif
+	}
+
+#ifdef MEMTRACK_BUDGET
+	/* すべて同じ呼び出し元に加算するため、合計で一度だけ確かめる */
+	size_t total = 0;
+	for (size_t i = 0; i < count; i++)
+		total = (sizes[i] <= SIZE_MAX - total) ? total + sizes[i] : SIZE_MAX;
+	if (UNLIKELY(!memtrack_budget_admit_resize(total, NULL, file, line))) {
+		memtrack_errfunc = "memtrack_malloc_batch";
+		return false;
+	}
+#endif
+
+	/* 1 つでも確保できなければ、何も記録しないうちにすべて解放する */
+	for (size_t i = 0; i < count; i++) {
+#ifdef MEMTRACK_HEADER
+		ptrs[i] = malloc(prefix + sizes[i]);
+#else
+		ptrs[i] = malloc(sizes[i]);
+#endif
+		if (UNLIKELY(ptrs[i] == NULL)) {
+			memtrack_report("Memory allocation failed.", NULL, file, line);
+			errno = ENOMEM;
+			memtrack_errfunc = "memtrack_malloc_batch";
+
+			for (size_t j = 0; j < i; j++) {
+				free(ptrs[j]);
+				ptrs[j] = NULL;
+			}
+			return false;
+		}
+	}
+
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+	int tmp_errno = errno;
+#endif
+	errno = 0;
+
+	memtrack_batch_add(ptrs, sizes, count, file, line);
+
+	if (UNLIKELY(errno != 0)) memtrack_errfunc = "memtrack_malloc_batch";
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+	else errno = tmp_errno;
+#endif
+	return true;
+}
+
+
+bool memtrack_malloc_batch (size_t count, const size_t sizes[], void* ptrs[], const char* file, int line) {
+	memtrack_wrapper_lock();
+	bool result = memtrack_malloc_batch_without_lock(count, sizes, ptrs, file, line);
+	memtrack_wrapper_unlock();
+	return result;
+}
+
+
+void memtrack_free_batch_without_lock (void* ptrs[], size_t count, const char* file, int line) {
+	if (count == 0) return;
+
+	if (UNLIKELY(ptrs == NULL)) {
+		memtrack_report("ptrs is null!", NULL, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_free_batch";
+		return;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		if (ptrs[i] != NULL) memtrack_trace_free(ptrs[i], file, line);
+	}
+
+#ifdef MEMTRACK_SAMPLING
+	/* 記録していないブロックはロックせずに解放できるため、1 つずつ処理する */
+	for (size_t i = 0; i < count; i++) {
+		if (ptrs[i] != NULL) memtrack_free_block(ptrs[i], file, line);
+	}
+#else
+#ifdef MEMTRACK_THREAD_BUFFER
+	memtrack_buffer_flush_own();  /* テーブルだけを見れば済むようにしておく */
+#endif
+
+#ifndef MEMTRACK_SHARDED
+	for (size_t i = 0; i < count; i++) {
+		if (ptrs[i] != NULL) memtrack_batch_free_block(ptrs[i], file, line);
+	}
+#else
+	/* シャードごとにまとめて取り除き、ロックの取得回数を抑える */
+	size_t remaining = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (ptrs[i] != NULL) remaining++;
+	}
+
+	for (size_t shard = 0; shard < MEMTRACK_SHARD_COUNT && remaining > 0; shard++) {
+		bool locked = false;
+		for (size_t i = 0; i < count; i++) {
+			if (ptrs[i] == NULL || memtrack_shard_index(ptrs[i]) != shard) continue;
+
+			if (!locked) {
+				memtrack_shard_lock_index(shard);
+				locked = true;
+			}
+			memtrack_batch_free_block(ptrs[i], file, line);
+			remaining--;
+		}
+		if (locked) memtrack_shard_unlock_index(shard);
+	}
+#endif
+#endif
+}
+
+
+void memtrack_free_batch (void* ptrs[], size_t count, const char* file, int line) {
+	memtrack_wrapper_lock();
+	memtrack_free_batch_without_lock(ptrs, count, file, line);
+	memtrack_wrapper_unlock();
+}
+
+
+void memtrack_reserve (size_t count) {
+	if (count == 0) return;
+
+#ifndef MEMTRACK_SHARDED
+	memtrack_lock();
+	if (UNLIKELY(memtrack_entries == NULL)) init();
+	memtrack_store_reserve(memtrack_entries, count);
+	memtrack_unlock();
+#else
+	init();
+
+	/* ポインタはシャードにほぼ均等に分かれるため、各シャードに等分して広げる */
+	size_t in_shard = count / MEMTRACK_SHARD_COUNT + (count % MEMTRACK_SHARD_COUNT != 0);
+	for (size_t i = 0; i < MEMTRACK_SHARD_COUNT; i++) {
+		memtrack_shard_lock_index(i);
+		memtrack_store_reserve(memtrack_shards[i].entries, in_shard);
+		memtrack_shard_unlock_index(i);
+	}
+#endif
+}
+
+
+#ifdef MEMTRACK_CALL_SITE
+void* memtrack_malloc_at (size_t size, const MemTrackCallSite* site) {
+	return memtrack_malloc(size, site->file, site->line);
+}
+
+
+void* memtrack_calloc_at (size_t count, size_t size, const MemTrackCallSite* site) {
+	return memtrack_calloc(count, size, site->file, site->line);
+}
+
+
+void* memtrack_realloc_at (void* ptr, size_t size, const MemTrackCallSite* site) {
+	return memtrack_realloc(ptr, size, site->file, site->line);
+}
+
+
+void memtrack_free_at (void* ptr, const MemTrackCallSite* site) {
+	memtrack_free(ptr, site->file, site->line);
+}
+#endif
+
+
+void* memtrack_recalloc_without_lock (void* ptr, size_t count, size_t size, const char* file, int line) {
+	if (ptr == NULL)
+		return memtrack_calloc_without_lock(count, size, file, line);
+
+	if (count == 0)
+		memtrack_report("Undefined behavior because the count is zero, do not use anymore. The memory block will be freed and NULL will be returned.", ptr, file, line);
+
+	if (size == 0)
+		memtrack_report("Undefined behavior because the size is zero, do not use anymore. The memory block will be freed and NULL will be returned.", ptr, file, line);
+
+	if (count == 0 || size == 0) {
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_recalloc";
+
+		memtrack_free_without_lock(ptr, file, line);
+		return NULL;
+	}
+
+	if (size > (SIZE_MAX / count)) {
+		memtrack_report("Memory allocation overflow.", ptr, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_recalloc";
+		return NULL;
+	}
+
+	/* 元のサイズの取得とエントリの付け直しに同じハンドルを使い、エントリを探すのを 1 回で済ませる */
+	MemTrackEntryHandle handle;
+	memtrack_entry_acquire_without_lock(ptr, &handle, file, line);
+	size_t old_size = handle.size;  /* 記録されていないブロックでは 0 となり、全体を 0 で埋める */
+
+#ifdef MEMTRACK_SAMPLING
+	/* 記録していないブロックの handle.size は実際に使用できるサイズで、要求されたサイズより大きいことがあるため、元のブロックを残して失敗する */
+	if (UNLIKELY(!memtrack_entry_handle_recorded(&handle))) {
+		if (old_size != 0) {  /* サイズが取得できなかった場合は memtrack_entry_acquire で報告済み */
+			memtrack_report("Cannot zero-fill a memory block that was not sampled.", ptr, file, line);
+			errno = EPERM;
+		}
+		memtrack_entry_release_without_lock(&handle, file, line);
+		memtrack_errfunc = "memtrack_recalloc";
+		return NULL;
+	}
+#endif
+
+	void* new_ptr = memtrack_realloc_entry_without_lock(&handle, count * size, file, line);
+	if (new_ptr == NULL) {
+		memtrack_errfunc = "memtrack_recalloc";
+		return NULL;
+	}
+
+	size_t new_size = count * size;
+	if (old_size < new_size)
+		memset((char*)new_ptr + old_size, 0, new_size - old_size);
+
+	return new_ptr;
+}
+
+
+void* memtrack_recalloc (void* ptr, size_t count, size_t size, const char* file, int line) {
+	memtrack_wrapper_lock();
+	void* new_ptr = memtrack_recalloc_without_lock(ptr, count, size, file, line);
+	memtrack_wrapper_unlock();
+	return new_ptr;
+}
+
+
+void* memtrack_malloc_array_without_lock (size_t count, size_t size, const char* file, int line) {
+	if (count == 0) {
+		memtrack_report("No processing was done because the count is zero.", NULL, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_malloc_array";
+		return NULL;
+	} else if (size > (SIZE_MAX / count)) {
+		memtrack_report("Memory allocation overflow.", NULL, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_malloc_array";
+		return NULL;
+	}
+
+	void* ptr = memtrack_malloc_without_lock(count * size, file, line);
+	if (ptr == NULL)
+		memtrack_errfunc = "memtrack_malloc_array";
+	return ptr;
+}
+
+
+void* memtrack_malloc_array (size_t count, size_t size, const char* file, int line) {
+	memtrack_wrapper_lock();
+	void* ptr = memtrack_malloc_array_without_lock(count, size, file, line);
+	memtrack_wrapper_unlock();
+	return ptr;
+}
+
+
+void* memtrack_calloc_array (size_t count, size_t size, const char* file, int line) {
+	return memtrack_calloc(count, size, file, line);
+}
+
+
+void* memtrack_realloc_array_without_lock (void* ptr, size_t count, size_t size, const char* file, int line) {
+	if (count == 0) {
+		memtrack_report("Undefined behavior because the count is zero, do not use anymore. The memory block will be freed and NULL will be returned.", ptr, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_realloc_array";
+
+		memtrack_free_without_lock(ptr, file, line);
+		return NULL;
+	} else if (size > (SIZE_MAX / count)) {
+		memtrack_report("Memory allocation overflow.", ptr, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_realloc_array";
+		return NULL;
+	}
+
+	void* new_ptr = memtrack_realloc_without_lock(ptr, count * size, file, line);
+	if (new_ptr == NULL)
+		memtrack_errfunc = "memtrack_realloc_array";
+	return new_ptr;
+}
+
+
+void* memtrack_realloc_array (void* ptr, size_t count, size_t size, const char* file, int line) {
+	memtrack_wrapper_lock();
+	void* new_ptr = memtrack_realloc_array_without_lock(ptr, count, size, file, line);
+	memtrack_wrapper_unlock();
+	return new_ptr;
+}
+
+
+void* memtrack_recalloc_array (void* ptr, size_t count, size_t size, const char* file, int line) {
+	return memtrack_recalloc(ptr, count, size, file, line);
+}
+
+
+size_t memtrack_get_size_without_lock (void* ptr, const char* file, int line) {
+	if (ptr == NULL) {
+		memtrack_report("Cannot return value because ptr is NULL.", NULL, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_get_size";
+		return 0;
+	}
+
+#ifdef MEMTRACK_HEADER
+	MemTrackHeader* header = memtrack_header_of(ptr);
+	if (LIKELY(header != NULL)) return header->entry.size;
+#endif
+
+#ifdef MEMTRACK_SAMPLING
+	if (memtrack_sample_maybe_tracked(ptr)) {
+		memtrack_shard_lock(ptr);
+		MemTrackEntry* sampled = memtrack_table_find_sampled(ptr);
+		size_t sampled_size = (sampled != NULL) ? sampled->size : 0;
+		memtrack_shard_unlock(ptr);
+
+		if (sampled != NULL) return sampled_size;
+	}
+
+#ifdef __GLIBC__
+	return malloc_usable_size(ptr);  /* 記録していないブロックは実際に使用できるサイズを返す */
+#else
+	memtrack_report("Cannot get the size of a memory block that was not sampled.", ptr, file, line);
+	errno = EPERM;
+	memtrack_errfunc = "memtrack_get_size";
+	return 0;
+#endif
+#endif
+
+#ifdef MEMTRACK_THREAD_BUFFER
+	size_t buffered_size;
+	if (memtrack_buffer_get_size(ptr, &buffered_size)) return buffered_size;
+#endif
+
+	if (UNLIKELY(memtrack_table_of(ptr) == NULL)) {
+		init();
+
+		memtrack_report("No entry found to get size! The memory might not be tracked.", ptr, file, line);
+		errno = EPERM;
+		memtrack_errfunc = "memtrack_get_size";
+
+		return 0;
+	}
+
+	memtrack_shard_lock(ptr);
+
+	size_t size = 0;
+	MemTrackEntry* entry = memtrack_table_lookup(ptr, ptr, ptr);
+	if (entry != NULL)
+		size = entry->size;
+
+	memtrack_shard_unlock(ptr);
+
+	if (entry == NULL) {
+		memtrack_report("No entry found to get size! The memory might not be tracked.", ptr, file, line);
+		memtrack_errfunc = "memtrack_get_size";
+		return 0;
+	}
+
+	return size;
+}
+
+
+size_t memtrack_get_size (void* ptr, const char* file, int line) {
+#ifdef MEMTRACK_HEADER
+	/* ヘッダーの読み取りだけで済むため、ロックを取らない */
+	MemTrackHeader* header = (ptr != NULL) ? memtrack_header_of(ptr) : NULL;
+	if (LIKELY(header != NULL)) return header->entry.size;
+#endif
+
+	memtrack_wrapper_lock();
+	size_t size = memtrack_get_size_without_lock(ptr, file, line);
+	memtrack_wrapper_unlock();
+	return size;
+}
+
+
+static void memtrack_entry_print (FILE* stream, const MemTrackEntry* entry) {
+#ifndef DEBUG
+	fprintf(stream, "\nAlready Freed: false\nPointer: %p   Size: %zu\nPlease use debug mode if you need more detailed information.\n", entry->ptr, entry->size);
+#else
+	if (entry->is_freed) {
+		if (memtrack_entry_is_realloced(entry))
+			fprintf(stream, "\nAlready Freed: true\nPointer: %p   Size: %zu\nfree File: %s   Line: %d\nalloc File: %s   Line: %d\nLast realloc File: %s   Line: %d\n", entry->ptr, entry->size, MEMTRACK_ENTRY_FILE_LINE(entry, free), MEMTRACK_ENTRY_FILE_LINE(entry, alloc), MEMTRACK_ENTRY_FILE_LINE(entry, last_realloc));
+		else
+			fprintf(stream, "\nAlready Freed: true\nPointer: %p   Size: %zu\nfree File: %s   Line: %d\nalloc File: %s   Line: %d\n", entry->ptr, entry->size, MEMTRACK_ENTRY_FILE_LINE(entry, free), MEMTRACK_ENTRY_FILE_LINE(entry, alloc));
+	} else {
+		if (memtrack_entry_is_realloced(entry))
+			fprintf(stream, "\nAlready Freed: false\nPointer: %p   Size: %zu\nalloc File: %s   Line: %d\nLast realloc File: %s   Line: %d\n", entry->ptr, entry->size, MEMTRACK_ENTRY_FILE_LINE(entry, alloc), MEMTRACK_ENTRY_FILE_LINE(entry, last_realloc));
+		else
+			fprintf(stream, "\nAlready Freed: false\nPointer: %p   Size: %zu\nalloc File: %s   Line: %d\n", entry->ptr, entry->size, MEMTRACK_ENTRY_FILE_LINE(entry, alloc));
+	}
+#endif
+#ifdef MEMTRACK_SAMPLING
+	fprintf(stream, "Sample Weight: %zu\n", entry->weight);
+#endif
+#ifdef MEMTRACK_USABLE_SIZE
+	fprintf(stream, "Usable Size: %zu\n", entry->usable);
+#endif
+#ifdef MEMTRACK_BACKTRACE
+	fprintf(stream, "Backtrace: %u\n", entry->backtrace);
+#endif
+#ifdef MEMTRACK_THREAD_STATS
+#ifdef DEBUG
+	if (entry->is_freed)
+		fprintf(stream, "alloc Thread: %u   free Thread: %u\n", (unsigned int)entry->thread, (unsigned int)entry->free_thread);
+	else
+#endif
+		fprintf(stream, "alloc Thread: %u\n", (unsigned int)entry->thread);
+#endif
+#ifdef MEMTRACK_TAGS
+	if (entry->tag != 0)
+		fprintf(stream, "Tag: %s\n", atomic_load_explicit(&memtrack_tags[entry->tag].name, memory_order_acquire));
+#endif
+}
+
+
+#ifdef DEBUG
+static void memtrack_entry_report_leak (const MemTrackEntry* entry) {
+	fprintf(stderr, "\nMemory not freed!\nPointer: %p   Size: %zu\nalloc File: %s   Line: %d\nLast realloc File: %s   Line: %d\n", entry->ptr, entry->size, MEMTRACK_ENTRY_FILE_LINE(entry, alloc), MEMTRACK_ENTRY_FILE_LINE(entry, last_realloc));
+}
+#endif
+
+
+static void memtrack_table_check (FILE* stream, MemTrackStore* table) {
+	for (size_t i = 0; i < table->used; i++) {
+		const MemTrackEntry* entry = memtrack_store_at(table, i);
+		if (entry != NULL && !memtrack_entry_is_inherited(entry)) memtrack_entry_print(stream, entry);
+	}
+}
+
+
+#ifdef MEMTRACK_BACKTRACE
+static void memtrack_table_backtraces (MemTrackStore* table, MemTrackBacktraceUsage* usage) {
+	for (size_t i = 0; i < table->used; i++) {
+		const MemTrackEntry* entry = memtrack_store_at(table, i);
+		if (entry == NULL || memtrack_entry_is_inherited(entry)) continue;
+#ifdef DEBUG
+		if (entry->is_freed) continue;
+#endif
+		memtrack_backtrace_usage_add(usage, entry);
+	}
+}
+
+
+#ifdef MEMTRACK_HEADER
+static void memtrack_header_backtraces (const MemTrackHeader* list, MemTrackBacktraceUsage* usage) {
+	for (const MemTrackHeader* header = list; header != NULL; header = header->next) {
+		if (!memtrack_entry_is_inherited(&header->entry))
+			memtrack_backtrace_usage_add(usage, &header->entry);
+	}
+}
+#endif
+#endif
+
+
+#ifdef MEMTRACK_HEADER
+static void memtrack_header_check (FILE* stream, const MemTrackHeader* list) {
+	for (const MemTrackHeader* header = list; header != NULL; header = header->next) {
+		if (!memtrack_entry_is_inherited(&header->entry))
+			memtrack_entry_print(stream, &header->entry);
+	}
+}
+
+
+/* 終了処理ではロックを取らずに一覧のブロックをすべて解放する（引き継いだブロックはページの複製を避けるため触れない） */
+static void memtrack_header_quit (MemTrackHeader* list) {
+	MemTrackHeader* header = list;
+	while (header != NULL) {
+		MemTrackHeader* next = header->next;
+		if (memtrack_entry_is_inherited(&header->entry)) {
+			header = next;
+			continue;
+		}
+#ifdef DEBUG
+		memtrack_entry_report_leak(&header->entry);
+		errno = EPERM;
+		memtrack_errfunc = "quit";
+#endif
+		header->magic = 0;
+		free((char*)header->entry.ptr - header->prefix);
+		header = next;
+	}
+}
+#endif
+
+
+void memtrack_all_check_to (FILE* stream) {
+	if (UNLIKELY(stream == NULL)) {
+		memtrack_report("stream is null!", NULL, __FILE__, __LINE__);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_all_check_to";
+		return;
+	}
+
+	fprintf(stream, "\n");
+
+#ifdef MEMTRACK_BACKTRACE
+	MemTrackBacktraceUsage* usage = memtrack_backtrace_usage_create("memtrack_all_check_to");
+#endif
+
+#ifndef MEMTRACK_SHARDED
+#ifdef MEMTRACK_HEADER
+	memtrack_header_check(stream, memtrack_headers);
+#ifdef MEMTRACK_BACKTRACE
+	memtrack_header_backtraces(memtrack_headers, usage);
+#endif
+#endif
+	if (memtrack_entries != NULL) {
+		memtrack_table_check(stream, memtrack_entries);
+#ifdef MEMTRACK_BACKTRACE
+		memtrack_table_backtraces(memtrack_entries, usage);
+#endif
+	}
+#else
+	init();
+
+#ifdef MEMTRACK_THREAD_BUFFER
+	memtrack_buffers_flush_all();
+#endif
+
+	for (size_t i = 0; i < MEMTRACK_SHARD_COUNT; i++) {
+		memtrack_shard_lock_index(i);
+#ifdef MEMTRACK_HEADER
+		memtrack_header_check(stream, memtrack_shards[i].headers);
+#ifdef MEMTRACK_BACKTRACE
+		memtrack_header_backtraces(memtrack_shards[i].headers, usage);
+#endif
+#endif
+		memtrack_table_check(stream, memtrack_shards[i].entries);
+#ifdef MEMTRACK_BACKTRACE
+		memtrack_table_backtraces(memtrack_shards[i].entries, usage);
+#endif
+		memtrack_shard_unlock_index(i);
+	}
+#endif
+
+#ifdef MEMTRACK_HISTOGRAM
+	memtrack_histogram_print(stream);
+#endif
+#ifdef MEMTRACK_USABLE_SIZE
+	memtrack_slack_print(stream);
+#endif
+#ifdef MEMTRACK_THREAD_STATS
+	memtrack_thread_print(stream);
+#endif
+#ifdef MEMTRACK_TAGS
+	memtrack_tag_print(stream);
+#endif
+#ifdef MEMTRACK_BACKTRACE
+	if (usage != NULL) {
+		fprintf(stream, "\nLive blocks by backtrace\n");
+		memtrack_backtrace_usage_print(stream, usage);
+	}
+#endif
+
+	fprintf(stream, "\n\n");
+}
+
+
+void memtrack_all_check (void) {
+	memtrack_all_check_to(stdout);
+}
+
+
+#ifndef MEMTRACK_SHARDED
+	#define MEMTRACK_TABLE_COUNT 1
+#else
+	#define MEMTRACK_TABLE_COUNT MEMTRACK_SHARD_COUNT
+#endif
+
+
+static inline MemTrackStore* memtrack_cursor_store (size_t table) {
+#ifndef MEMTRACK_SHARDED
+	(void)table;
+	return memtrack_entries;
+#else
+	return memtrack_shards[table].entries;
+#endif
+}
+
+
+#ifdef MEMTRACK_HEADER
+static inline const MemTrackHeader* memtrack_cursor_headers (size_t table) {
+#ifndef MEMTRACK_SHARDED
+	(void)table;
+	return memtrack_headers;
+#else
+	return memtrack_shards[table].headers;
+#endif
+}
+#endif
+
+
+static void memtrack_entry_info (const MemTrackEntry* entry, MemTrackEntryInfo* info) {
+	info->ptr = entry->ptr;
+	info->size = entry->size;
+#ifdef MEMTRACK_SAMPLING
+	info->weight = entry->weight;
+#else
+	info->weight = entry->size;
+#endif
+
+#ifndef DEBUG
+	info->alloc_file = NULL;
+	info->last_realloc_file = NULL;
+	info->free_file = NULL;
+	info->alloc_line = 0;
+	info->last_realloc_line = 0;
+	info->free_line = 0;
+	info->is_freed = false;
+#else
+#ifndef MEMTRACK_CALL_SITE
+	info->alloc_file = entry->alloc_file;
+	info->last_realloc_file = entry->last_realloc_file;
+	info->free_file = entry->free_file;
+	info->alloc_line = entry->alloc_line;
+	info->last_realloc_line = entry->last_realloc_line;
+	info->free_line = entry->free_line;
+#else
+	info->alloc_file = memtrack_site_file(entry->alloc_site);
+	info->last_realloc_file = memtrack_site_file(entry->last_realloc_site);
+	info->free_file = memtrack_site_file(entry->free_site);
+	info->alloc_line = memtrack_site_line(entry->alloc_site);
+	info->last_realloc_line = memtrack_site_line(entry->last_realloc_site);
+	info->free_line = memtrack_site_line(entry->free_site);
+#endif
+	info->is_freed = entry->is_freed;
+#endif
+}
+
+
+/* 確保した呼び出し元、わからないエントリは NULL と 0 */
+static inline void memtrack_entry_alloc_site (const MemTrackEntry* entry, const char** file, int* line) {
+#ifndef MEMTRACK_LEAK_SITES
+	(void)entry;
+	*file = NULL;
+	*line = 0;
+#elif defined (DEBUG)
+#ifndef MEMTRACK_CALL_SITE
+	*file = entry->alloc_file;
+	*line = entry->alloc_line;
+#else
+	*file = memtrack_site_file(entry->alloc_site);
+	*line = memtrack_site_line(entry->alloc_site);
+#endif
+#else
+	*file = (entry->site == 0) ? NULL : memtrack_site_at(entry->site)->file;
+	*line = (entry->site == 0) ? 0 : memtrack_site_at(entry->site)->line;
+#endif
+}
+
+
+void memtrack_cursor_init (MemTrackCursor* cursor) {
+	if (UNLIKELY(cursor == NULL)) {
+		memtrack_report("cursor is null!", NULL, __FILE__, __LINE__);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_cursor_init";
+		return;
+	}
+
+	cursor->table = 0;
+	cursor->position = 0;
+	cursor->header = NULL;
+	cursor->started = false;
+}
+
+
+/* ヘッダー一覧、エントリテーブルの順にシャードごとに走査し、エントリのアドレスは保持しない */
+size_t memtrack_cursor_next_without_lock (MemTrackCursor* cursor, MemTrackEntryInfo* infos, size_t capacity) {
+	if (UNLIKELY(cursor == NULL || (infos == NULL && capacity != 0))) {
+		memtrack_report("cursor or infos is null!", NULL, __FILE__, __LINE__);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_cursor_next_without_lock";
+		return 0;
+	}
+
+	if (!cursor->started) {
+		cursor->started = true;
+#ifdef MEMTRACK_THREAD_BUFFER
+		memtrack_buffers_flush_all();  /* memtrack_lock によって全バッファのロックを保持済み */
+#endif
+#ifdef MEMTRACK_HEADER
+		cursor->header = memtrack_cursor_headers(0);
+#endif
+	}
+
+	size_t count = 0;
+	while (count < capacity && cursor->table < MEMTRACK_TABLE_COUNT) {
+#ifdef MEMTRACK_HEADER
+		if (cursor->header != NULL) {
+			const MemTrackHeader* header = cursor->header;
+			if (!memtrack_entry_is_inherited(&header->entry)) memtrack_entry_info(&header->entry, &infos[count++]);
+			cursor->header = header->next;
+			continue;
+		}
+#endif
+
+		MemTrackStore* store = memtrack_cursor_store(cursor->table);
+		if (store != NULL && cursor->position < store->used) {
+			const MemTrackEntry* entry = memtrack_store_at(store, cursor->position++);
+			if (entry != NULL && !memtrack_entry_is_inherited(entry)) memtrack_entry_info(entry, &infos[count++]);
+			continue;
+		}
+
+		cursor->table++;
+		cursor->position = 0;
+#ifdef MEMTRACK_HEADER
+		if (cursor->table < MEMTRACK_TABLE_COUNT)
+			cursor->header = memtrack_cursor_headers(cursor->table);
+#endif
+	}
+	return count;
+}
+
+
+static inline void memtrack_table_lock (size_t table) {
+#ifndef MEMTRACK_SHARDED
+	(void)table;
+	memtrack_lock();
+#else
+	memtrack_shard_lock_index(table);
+#endif
+}
+
+static inline void memtrack_table_unlock (size_t table) {
+#ifndef MEMTRACK_SHARDED
+	(void)table;
+	memtrack_unlock();
+#else
+	memtrack_shard_unlock_index(table);
+#endif
+}
+
+
+/* 配列を少なくとも needed 要素に広げる、ロック中には呼び出さない */
+static bool memtrack_snapshot_reserve (MemTrackSnapshot* snapshot, size_t* capacity, size_t needed) {
+	if (needed <= *capacity) return true;
+
+	size_t new_capacity = (*capacity < MEMTRACK_SNAPSHOT_BATCH) ? MEMTRACK_SNAPSHOT_BATCH : *capacity;
+	while (new_capacity < needed && new_capacity <= SIZE_MAX / 2) new_capacity *= 2;
+
+	MemTrackSnapshotEntry* entries = NULL;
+	if (new_capacity >= needed && new_capacity <= SIZE_MAX / sizeof(MemTrackSnapshotEntry))
+		entries = realloc(snapshot->entries, new_capacity * sizeof(MemTrackSnapshotEntry));
+	if (UNLIKELY(entries == NULL)) return false;
+
+	snapshot->entries = entries;
+	*capacity = new_capacity;
+	return true;
+}
+
+
+static void memtrack_snapshot_add (MemTrackSnapshot* snapshot, const MemTrackEntry* entry) {
+#ifdef DEBUG
+	if (entry->is_freed) return;
+#endif
+	MemTrackSnapshotEntry* copy = &snapshot->entries[snapshot->count++];
+	copy->ptr = entry->ptr;
+	copy->size = entry->size;
+	memtrack_entry_alloc_site(entry, &copy->file, &copy->line);
+}
+
+
+/*
+ * エントリの置き場の位置は解放されても動かないため、ロックを外した後も続きの位置から写せる
+ * ヘッダー一覧はロックを外すと次の要素が解放されうるため、1 回のロック中にまとめて写す
+ */
+static bool memtrack_snapshot_table (MemTrackSnapshot* snapshot, size_t* capacity, size_t table) {
+#ifdef MEMTRACK_HEADER
+	for (;;) {
+		memtrack_table_lock(table);
+		size_t count = 0;
+		for (const MemTrackHeader* header = memtrack_cursor_headers(table); header != NULL; header = header->next)
+			count++;
+
+		if (count > *capacity - snapshot->count) {
+			memtrack_table_unlock(table);
+			if (UNLIKELY(!memtrack_snapshot_reserve(snapshot, capacity, snapshot->count + count + count / 8)))
+				return false;
+			continue;
+		}
+
+		for (const MemTrackHeader* header = memtrack_cursor_headers(table); header != NULL; header = header->next)
+			memtrack_snapshot_add(snapshot, &header->entry);
+		memtrack_table_unlock(table);
+		break;
+	}
+#endif
+
+	size_t position = 0;
+	for (;;) {
+		memtrack_table_lock(table);
+		MemTrackStore* store = memtrack_cursor_store(table);
+		size_t end = (store == NULL) ? 0 : store->used;
+		if (position >= end) {
+			memtrack_table_unlock(table);
+			return true;
+		}
+		if (end - position > MEMTRACK_SNAPSHOT_BATCH) end = position + MEMTRACK_SNAPSHOT_BATCH;
+
+		if (end - position > *capacity - snapshot->count) {
+			memtrack_table_unlock(table);
+			if (UNLIKELY(!memtrack_snapshot_reserve(snapshot, capacity, snapshot->count + (end - position))))
+				return false;
+			continue;
+		}
+
+		for (; position < end; position++) {
+			const MemTrackEntry* entry = memtrack_store_at(store, position);
+			if (entry != NULL) memtrack_snapshot_add(snapshot, entry);
+		}
+		memtrack_table_unlock(table);
+	}
+}
+
+
+static int memtrack_snapshot_entry_compare (const void* a, const void* b) {
+	uintptr_t ptr_a = (uintptr_t)((const MemTrackSnapshotEntry*)a)->ptr;
+	uintptr_t ptr_b = (uintptr_t)((const MemTrackSnapshotEntry*)b)->ptr;
+	return (ptr_a > ptr_b) - (ptr_a < ptr_b);
+}
+
+
+MemTrackSnapshot* memtrack_snapshot (void) {
+	MemTrackSnapshot* snapshot = calloc(1, sizeof(MemTrackSnapshot));
+	size_t capacity = 0;
+
+	/* 最初の 1 回分を先に確保しておき、写す側で entries が NULL のまま使われないようにする */
+	if (LIKELY(snapshot != NULL) && UNLIKELY(!memtrack_snapshot_reserve(snapshot, &capacity, MEMTRACK_SNAPSHOT_BATCH))) {
+		free(snapshot);
+		snapshot = NULL;
+	}
+
+	if (LIKELY(snapshot != NULL)) {
+#ifdef MEMTRACK_THREAD_BUFFER
+		init();
+		memtrack_buffers_flush_all();
+#endif
+		for (size_t i = 0; i < MEMTRACK_TABLE_COUNT; i++) {
+			if (UNLIKELY(!memtrack_snapshot_table(snapshot, &capacity, i))) {
+				memtrack_snapshot_free(snapshot);
+				snapshot = NULL;
+				break;
+			}
+		}
+	}
+
+	if (UNLIKELY(snapshot == NULL)) {
+		memtrack_report("Failed to allocate memory for the snapshot.", NULL, __FILE__, __LINE__);
+		errno = ENOMEM;
+		memtrack_errfunc = "memtrack_snapshot";
+		return NULL;
+	}
+
+	if (snapshot->count > 1)
+		qsort(snapshot->entries, snapshot->count, sizeof(MemTrackSnapshotEntry), memtrack_snapshot_entry_compare);
+
+	/* 写す間に解放と再確保が起きると同じアドレスが 2 回現れうる、どちらも写した時点では生きていたので 1 つだけ残す */
+	size_t count = 0;
+	for (size_t i = 0; i < snapshot->count; i++) {
+		if (count == 0 || snapshot->entries[count - 1].ptr != snapshot->entries[i].ptr)
+			snapshot->entries[count++] = snapshot->entries[i];
+	}
+	snapshot->count = count;
+
+	return snapshot;
+}
+
+
+void memtrack_snapshot_free (MemTrackSnapshot* snapshot) {
+	if (snapshot == NULL) return;
+
+	free(snapshot->entries);
+	free(snapshot);
+}
+
+
+static inline MemTrackSiteDelta* memtrack_site_delta_add (MemTrackSiteDelta* deltas, size_t* count, const MemTrackSnapshotEntry* entry) {
+	MemTrackSiteDelta* delta = &deltas[(*count)++];
+	*delta = (MemTrackSiteDelta){ .file = entry->file, .line = entry->line };
+	return delta;
+}
+
+
+/* file はアドレスで比較する（呼び出し元の登録表と同じ） */
+static int memtrack_site_delta_site_compare (const void* a, const void* b) {
+	const MemTrackSiteDelta* delta_a = a;
+	const MemTrackSiteDelta* delta_b = b;
+	if (delta_a->file != delta_b->file)
+		return ((uintptr_t)delta_a->file > (uintptr_t)delta_b->file) ? 1 : -1;
+	return (delta_a->line > delta_b->line) - (delta_a->line < delta_b->line);
+}
+
+
+/* 正味の増加量の多い順、増加と減少を両辺に分けて符号なしのまま比べる */
+static int memtrack_site_delta_growth_compare (const void* a, const void* b) {
+	const MemTrackSiteDelta* delta_a = a;
+	const MemTrackSiteDelta* delta_b = b;
+	size_t side_a = delta_a->new_bytes + delta_a->grown_bytes + delta_b->freed_bytes + delta_b->shrunk_bytes;
+	size_t side_b = delta_b->new_bytes + delta_b->grown_bytes + delta_a->freed_bytes + delta_a->shrunk_bytes;
+	if (side_a != side_b) return (side_a < side_b) ? 1 : -1;
+	return (delta_a->new_count < delta_b->new_count) - (delta_a->new_count > delta_b->new_count);
+}
+
+
+/* 両方のスナップショットをアドレス順に一度だけ突き合わせ、変化を呼び出し元ごとにまとめる */
+size_t memtrack_snapshot_diff (const MemTrackSnapshot* before, const MemTrackSnapshot* after, MemTrackSiteDelta* deltas, size_t capacity) {
+	if (UNLIKELY(before == NULL || after == NULL || (deltas == NULL && capacity != 0))) {
+		memtrack_report("before, after, or deltas is null!", NULL, __FILE__, __LINE__);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_snapshot_diff";
+		return 0;
+	}
+
+	/* 各要素が生む変化は高々 1 つ */
+	size_t total = before->count + after->count;
+	if (total == 0) return 0;
+
+	MemTrackSiteDelta* changes = (total >= before->count) ? calloc(total, sizeof(MemTrackSiteDelta)) : NULL;
+	if (UNLIKELY(changes == NULL)) {
+		memtrack_report("Failed to allocate memory for the snapshot diff.", NULL, __FILE__, __LINE__);
+		errno = ENOMEM;
+		memtrack_errfunc = "memtrack_snapshot_diff";
+		return 0;
+	}
+
+	size_t count = 0;
+	size_t i = 0;
+	size_t j = 0;
+	while (i < before->count || j < after->count) {
+		bool has_old = (i < before->count);
+		bool has_new = (j < after->count);
+		const MemTrackSnapshotEntry* old_entry = &before->entries[has_old ? i : 0];
+		const MemTrackSnapshotEntry* new_entry = &after->entries[has_new ? j : 0];
+
+		if (!has_new || (has_old && (uintptr_t)old_entry->ptr < (uintptr_t)new_entry->ptr)) {
+			MemTrackSiteDelta* delta = memtrack_site_delta_add(changes, &count, old_entry);
+			delta->freed_count = 1;
+			delta->freed_bytes = old_entry->size;
+			i++;
+		} else if (!has_old || (uintptr_t)new_entry->ptr < (uintptr_t)old_entry->ptr) {
+			MemTrackSiteDelta* delta = memtrack_site_delta_add(changes, &count, new_entry);
+			delta->new_count = 1;
+			delta->new_bytes = new_entry->size;
+			j++;
+		} else {
+			if (old_entry->file != new_entry->file || old_entry->line != new_entry->line) {
+				MemTrackSiteDelta* delta = memtrack_site_delta_add(changes, &count, old_entry);
+				delta->freed_count = 1;
+				delta->freed_bytes = old_entry->size;
+				delta = memtrack_site_delta_add(changes, &count, new_entry);
+				delta->new_count = 1;
+				delta->new_bytes = new_entry->size;
+			} else if (new_entry->size > old_entry->size) {
+				memtrack_site_delta_add(changes, &count, new_entry)->grown_bytes = new_entry->size - old_entry->size;
+			} else if (new_entry->size < old_entry->size) {
+				memtrack_site_delta_add(changes, &count, new_entry)->shrunk_bytes = old_entry->size - new_entry->size;
+			}
+			i++;
+			j++;
+		}
+	}
+
+	/* 同じ呼び出し元の変化を隣り合わせて畳む */
+	qsort(changes, count, sizeof(MemTrackSiteDelta), memtrack_site_delta_site_compare);
+
+	size_t sites = 0;
+	for (size_t k = 0; k < count; k++) {
+		if (sites != 0 && memtrack_site_delta_site_compare(&changes[sites - 1], &changes[k]) == 0) {
+			MemTrackSiteDelta* site = &changes[sites - 1];
+			site->new_count += changes[k].new_count;
+			site->new_bytes += changes[k].new_bytes;
+			site->freed_count += changes[k].freed_count;
+			site->freed_bytes += changes[k].freed_bytes;
+			site->grown_bytes += changes[k].grown_bytes;
+			site->shrunk_bytes += changes[k].shrunk_bytes;
+		} else {
+			changes[sites++] = changes[k];
+		}
+	}
+
+	qsort(changes, sites, sizeof(MemTrackSiteDelta), memtrack_site_delta_growth_compare);
+
+	size_t copied = (sites < capacity) ? sites : capacity;
+	if (copied != 0) memcpy(deltas, changes, copied * sizeof(MemTrackSiteDelta));
+
+	free(changes);
+	return sites;
+}
+
+
+#ifdef MEMTRACK_SAMPLING
+static size_t memtrack_table_weight (MemTrackStore* table) {
+	size_t weight = 0;
+	for (size_t i = 0; i < table->used; i++) {
+		const MemTrackEntry* entry = memtrack_store_at(table, i);
+		if (entry == NULL) continue;
+#ifdef DEBUG
+		if (entry->is_freed) continue;
+#endif
+		weight += entry->weight;
+	}
+	return weight;
+}
+
+
+size_t memtrack_sampled_bytes (void) {
+	size_t weight = 0;
+
+#ifndef MEMTRACK_SHARDED
+	memtrack_lock();
+	if (memtrack_entries != NULL)
+		weight = memtrack_table_weight(memtrack_entries);
+	memtrack_unlock();
+#else
+	init();
+
+	for (size_t i = 0; i < MEMTRACK_SHARD_COUNT; i++) {
+		memtrack_shard_lock_index(i);
+		weight += memtrack_table_weight(memtrack_shards[i].entries);
+		memtrack_shard_unlock_index(i);
+	}
+#endif
+
+	return weight;
+}
+#endif
 
-		free(ptr);
-		return;
-	}
 
-	MemTrackEntry* entry = ht_get(memtrack_entries, (key_type)ptr);
-	if (entry == NULL) {
-		fprintf(stderr, "No entry found to free! The memory might not be tracked.\nFile: %s   Line: %d\n", file, line);
-		memtrack_errfunc = "memtrack_free";
+static int memtrack_quit_mode = MEMTRACK_QUIT_FREE;  /* 終了処理の方法、変更はロック中に行う */
 
-		free(ptr);
-		return;
-	}
 
-	if (entry->is_freed) {
-		fprintf(stderr, "Memory already freed!\nrefree File: %s   Line: %d\nfree File: %s   Line: %d\n", file, line, entry->free_file, entry->free_line);
+void memtrack_set_quit_mode (int mode) {
+	if (UNLIKELY(mode != MEMTRACK_QUIT_FREE && mode != MEMTRACK_QUIT_FAST && mode != MEMTRACK_QUIT_SUMMARY)) {
+		memtrack_report("Invalid quit mode!", NULL, __FILE__, __LINE__);
 		errno = EINVAL;
-		memtrack_errfunc = "memtrack_free";
+		memtrack_errfunc = "memtrack_set_quit_mode";
 		return;
 	}
-#endif
 
-	free(ptr);
+	memtrack_lock();
+	memtrack_quit_mode = mode;
+	memtrack_unlock();
+}
 
-#ifdef MAYBE_ERRNO_THREAD_LOCAL
-		int tmp_errno = errno;
-#endif
-		errno = 0;
 
-#if defined (__GNUC__) && !defined (__clang__)
-	#pragma GCC diagnostic push
-	#pragma GCC diagnostic ignored "-Wuse-after-free"  /* memtrack自体のデバッグを行う際は必ず外すこと */
-#endif
+#ifdef MEMTRACK_FORK_SAFE
 
-	memtrack_entry_free(ptr, file, line);
 
-#if defined (__GNUC__) && !defined (__clang__)
-	#pragma GCC diagnostic pop
+static atomic_bool memtrack_fork_discard = true;  /* 子プロセスで新しい世代を始めて、親プロセスのエントリを報告から外す */
+static bool memtrack_fork_registered = false;  /* 初期化は非シャードモードではロック中に、シャードモードでは一度だけ行われる */
+
+
+/*
+ * fork の直前に全てのロックを取り、子プロセスに一貫した状態が複製されるようにする
+ * ロックの順序は「報告スレッドの状態 → memtrack_lock → ヒストグラム」で、通常の経路で取る順序と同じにしなければならない
+ */
+static void memtrack_fork_prepare (void) {
+#ifdef MEMTRACK_REPORTER
+	pthread_mutex_lock(&memtrack_reporter_lock);
 #endif
+	memtrack_lock();
+#ifdef MEMTRACK_HISTOGRAM
+	pthread_mutex_lock(&memtrack_histogram_lock);
+#endif
+}
 
-		if (UNLIKELY(errno != 0)) memtrack_errfunc = "memtrack_free";
-#ifdef MAYBE_ERRNO_THREAD_LOCAL
-		else errno = tmp_errno;
+
+static void memtrack_fork_parent (void) {
+#ifdef MEMTRACK_HISTOGRAM
+	pthread_mutex_unlock(&memtrack_histogram_lock);
+#endif
+	memtrack_unlock();
+#ifdef MEMTRACK_REPORTER
+	pthread_mutex_unlock(&memtrack_reporter_lock);
 #endif
 }
 
 
-void memtrack_free (void* ptr, const char* file, int line) {
-	memtrack_lock();
-	memtrack_free_without_lock(ptr, file, line);
+/* 子プロセスには fork を呼び出したスレッドしかいないため、他のスレッドに属する状態を片付けてからロックを解放する */
+static void memtrack_fork_child (void) {
+#ifdef MEMTRACK_DEFERRED_DIAG
+	/* 溜まっているメッセージは親プロセスが出力するため、子プロセスでは出力せずに捨てる */
+	MemTrackDiag diag;
+	while (memtrack_diag_pop(&diag)) {}
+#endif
+#ifdef MEMTRACK_TRACE
+	/* トレースファイルは親プロセスと共有の写像なので、記録が混ざらないよう子プロセスでは記録を止める */
+	atomic_store_explicit(&memtrack_trace, NULL, memory_order_release);
+#endif
+
+	/* エントリを 1 つずつ削除すると共有しているページが全て複製されるため、世代を進めるだけにする */
+	if (atomic_load_explicit(&memtrack_fork_discard, memory_order_relaxed))
+		atomic_fetch_add_explicit(&memtrack_generation, 1, memory_order_relaxed);
+
+#ifdef MEMTRACK_HISTOGRAM
+	pthread_mutex_unlock(&memtrack_histogram_lock);
+#endif
 	memtrack_unlock();
+#ifdef MEMTRACK_REPORTER
+	/* 報告スレッドは子プロセスに複製されないため、停止したものとして扱う */
+	if (memtrack_reporter_running) {
+		memtrack_reporter_clear();
+		memtrack_reporter_running = false;
+		memtrack_reporter_stopping = false;
+	}
+	pthread_mutex_unlock(&memtrack_reporter_lock);
+#endif
 }
 
 
-void* memtrack_recalloc_without_lock (void* ptr, size_t count, size_t size, const char* file, int line) {
-	if (ptr == NULL)
-		return memtrack_calloc_without_lock(count, size, file, line);
+static void memtrack_fork_register (void) {
+	if (memtrack_fork_registered) return;
+	memtrack_fork_registered = true;
 
-	if (count == 0)
-		fprintf(stderr, "Undefined behavior because the count is zero, do not use anymore. The memory block will be freed and NULL will be returned.\nFile: %s   Line: %d\n", file, line);
+	if (UNLIKELY(pthread_atfork(memtrack_fork_prepare, memtrack_fork_parent, memtrack_fork_child) != 0))
+		fprintf(stderr, "Failed to register the fork handlers of memory tracking.\nFile: %s   Line: %d\n", __FILE__, __LINE__);
+}
 
-	if (size == 0)
-		fprintf(stderr, "Undefined behavior because the size is zero, do not use anymore. The memory block will be freed and NULL will be returned.\nFile: %s   Line: %d\n", file, line);
 
-	if (count == 0 || size == 0) {
-		errno = EINVAL;
-		memtrack_errfunc = "memtrack_recalloc";
+void memtrack_set_fork_discard (bool discard) {
+	atomic_store_explicit(&memtrack_fork_discard, discard, memory_order_relaxed);
+}
 
-		memtrack_free_without_lock(ptr, file, line);
-		return NULL;
-	}
 
-	size_t old_size = 0;
+unsigned int memtrack_new_generation (void) {
+	memtrack_lock();  /* ロック中に走査しているスレッドから見て、途中で世代が変わらないようにする */
+	unsigned int generation = atomic_fetch_add_explicit(&memtrack_generation, 1, memory_order_relaxed) + 1;
+	memtrack_unlock();
+	return generation;
+}
 
-	if (UNLIKELY(memtrack_entries == NULL)) {
-		init();
 
-		fprintf(stderr, "No entry found to recalloc! The memory might not be tracked.\nFile: %s   Line: %d\n", file, line);
-		errno = EPERM;
-		memtrack_errfunc = "memtrack_recalloc";
+unsigned int memtrack_get_generation (void) {
+	return atomic_load_explicit(&memtrack_generation, memory_order_relaxed);
+}
+
 
-	} else {
-		old_size = memtrack_get_size_without_lock(ptr, __FILE__, __LINE__);
-		if (old_size == 0) {
-#ifdef MAYBE_ERRNO_THREAD_LOCAL
-			int tmp_errno = errno;
 #endif
-			errno = 0;
 
-			memtrack_entry_free(ptr, file, line);
 
-			if (UNLIKELY(errno != 0)) memtrack_errfunc = "memtrack_recalloc";
-#ifdef MAYBE_ERRNO_THREAD_LOCAL
-			else errno = tmp_errno;
+#ifdef MEMTRACK_LEAK_SITES
+/* 終了時の要約の 1 行、count が 0 の要素は空き */
+typedef struct {
+	const char* file;
+	int line;
+	size_t count;
+	size_t bytes;
+} MemTrackLeakSite;
 #endif
 
-			void* new_ptr = memtrack_calloc_without_lock(count, size, file, line);
-			if (new_ptr == NULL)
-				memtrack_errfunc = "memtrack_recalloc";
-			return new_ptr;
-		}
-	}
 
-	void* new_ptr = memtrack_realloc_array_without_lock(ptr, count, size, file, line);
-	if (new_ptr == NULL) {
-		memtrack_errfunc = "memtrack_recalloc";
-		return NULL;
-	}
+/* 終了時に解放されていなかったブロックの集計 */
+typedef struct {
+	size_t count;
+	size_t bytes;
+	bool summary;  /* true なら呼び出し元ごとに集計し、ブロックごとには出力しない */
+#ifdef MEMTRACK_LEAK_SITES
+	MemTrackLeakSite* sites;  /* 呼び出し元をキーとする開番地法の表、要約しない場合と確保に失敗した場合は NULL */
+	size_t capacity;
+	size_t used;
+#endif
+#ifdef MEMTRACK_BACKTRACE
+	MemTrackBacktraceUsage* backtraces;  /* バックトレースごとの集計、要約しない場合と確保に失敗した場合は NULL */
+#endif
+} MemTrackLeaks;
 
-	size_t new_size = count * size;
-	if (old_size < new_size)
-		memset((char*)new_ptr + old_size, 0, new_size - old_size);
 
-	return new_ptr;
+#ifdef MEMTRACK_LEAK_SITES
+static inline size_t memtrack_leak_site_index (const char* file, int line, size_t capacity) {
+	uint64_t key = (uint64_t)(uintptr_t)file ^ ((uint64_t)(unsigned int)line << 32);
+	key ^= key >> 29;
+	key *= 0x9E3779B97F4A7C15ULL;
+	return (size_t)(key >> 32) & (capacity - 1);
 }
 
 
-void* memtrack_recalloc (void* ptr, size_t count, size_t size, const char* file, int line) {
-	memtrack_lock();
-	void* new_ptr = memtrack_recalloc_without_lock(ptr, count, size, file, line);
-	memtrack_unlock();
-	return new_ptr;
+/* file はアドレスで比較する（呼び出し元の登録表と同じ） */
+static MemTrackLeakSite* memtrack_leak_site_slot (MemTrackLeakSite* sites, size_t capacity, const char* file, int line) {
+	size_t index = memtrack_leak_site_index(file, line, capacity);
+	while (sites[index].count != 0 && (sites[index].file != file || sites[index].line != line))
+		index = (index + 1) & (capacity - 1);
+	return &sites[index];
 }
 
 
-void* memtrack_malloc_array_without_lock (size_t count, size_t size, const char* file, int line) {
-	if (count == 0) {
-		fprintf(stderr, "No processing was done because the count is zero.\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		memtrack_errfunc = "memtrack_malloc_array";
-		return NULL;
-	} else if (size > (SIZE_MAX / count)) {
-		fprintf(stderr, "Memory allocation overflow.\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		memtrack_errfunc = "memtrack_malloc_array";
-		return NULL;
-	}
+/* 表を確保するか 2 倍に広げる、失敗した場合は要約をやめて合計だけを数える */
+static bool memtrack_leaks_grow (MemTrackLeaks* leaks) {
+	size_t capacity = (leaks->capacity == 0) ? MEMTRACK_LEAK_SITES_COUNT : leaks->capacity * 2;
+	MemTrackLeakSite* sites = (capacity > leaks->capacity) ? calloc(capacity, sizeof(MemTrackLeakSite)) : NULL;
+	if (UNLIKELY(sites == NULL)) {
+		memtrack_report("Failed to allocate memory for the summary of memory not freed.", NULL, __FILE__, __LINE__);
+		errno = ENOMEM;
+		memtrack_errfunc = "quit";
 
-	void* ptr = memtrack_malloc_without_lock(count * size, file, line);
-	if (ptr == NULL)
-		memtrack_errfunc = "memtrack_malloc_array";
-	return ptr;
-}
+		free(leaks->sites);
+		leaks->sites = NULL;
+		return false;
+	}
 
+	for (size_t i = 0; i < leaks->capacity; i++) {
+		if (leaks->sites[i].count != 0)
+			*memtrack_leak_site_slot(sites, capacity, leaks->sites[i].file, leaks->sites[i].line) = leaks->sites[i];
+	}
 
-void* memtrack_malloc_array (size_t count, size_t size, const char* file, int line) {
-	memtrack_lock();
-	void* ptr = memtrack_malloc_array_without_lock(count, size, file, line);
-	memtrack_unlock();
-	return ptr;
+	free(leaks->sites);
+	leaks->sites = sites;
+	leaks->capacity = capacity;
+	return true;
 }
 
 
-void* memtrack_calloc_array (size_t count, size_t size, const char* file, int line) {
-	return memtrack_calloc(count, size, file, line);
+static int memtrack_leak_site_compare (const void* a, const void* b) {
+	const MemTrackLeakSite* site_a = a;
+	const MemTrackLeakSite* site_b = b;
+	if (site_a->bytes != site_b->bytes) return (site_a->bytes < site_b->bytes) ? 1 : -1;  /* バイト数の多い順 */
+	return (site_a->count < site_b->count) - (site_a->count > site_b->count);
 }
+#endif
 
 
-void* memtrack_realloc_array_without_lock (void* ptr, size_t count, size_t size, const char* file, int line) {
-	if (count == 0) {
-		fprintf(stderr, "Undefined behavior because the count is zero, do not use anymore. The memory block will be freed and NULL will be returned.\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		memtrack_errfunc = "memtrack_realloc_array";
+static void memtrack_leaks_add (MemTrackLeaks* leaks, const MemTrackEntry* entry) {
+	leaks->count++;
+	leaks->bytes += entry->size;
 
-		memtrack_free_without_lock(ptr, file, line);
-		return NULL;
-	} else if (size > (SIZE_MAX / count)) {
-		fprintf(stderr, "Memory allocation overflow.\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		memtrack_errfunc = "memtrack_realloc_array";
-		return NULL;
+#ifdef DEBUG
+	if (!leaks->summary) {
+		memtrack_entry_report_leak(entry);
+		return;
 	}
+#endif
 
-	void* ptr = memtrack_realloc_without_lock(ptr, count * size, file, line);
-	if (ptr == NULL)
-		memtrack_errfunc = "memtrack_realloc_array";
-	return ptr;
-}
-
+#ifdef MEMTRACK_BACKTRACE
+	memtrack_backtrace_usage_add(leaks->backtraces, entry);
+#endif
 
-void* memtrack_realloc_array (void* ptr, size_t count, size_t size, const char* file, int line) {
-	memtrack_lock();
-	void* new_ptr = memtrack_realloc_array_without_lock(ptr, count, size, file, line);
-	memtrack_unlock();
-	return new_ptr;
-}
+#ifdef MEMTRACK_LEAK_SITES
+	if (leaks->sites == NULL) return;  /* 要約しないか、表の確保に失敗した */
+	if (leaks->used * 2 >= leaks->capacity && !memtrack_leaks_grow(leaks)) return;
 
+	const char* file;
+	int line;
+	memtrack_entry_alloc_site(entry, &file, &line);
 
-void* memtrack_recalloc_array (void* ptr, size_t count, size_t size, const char* file, int line) {
-	return memtrack_recalloc(ptr, count, size, file, line);
+	MemTrackLeakSite* site = memtrack_leak_site_slot(leaks->sites, leaks->capacity, file, line);
+	if (site->count == 0) {
+		site->file = file;
+		site->line = line;
+		leaks->used++;
+	}
+	site->count++;
+	site->bytes += entry->size;
+#endif
 }
 
 
-size_t memtrack_get_size_without_lock (void* ptr, const char* file, int line) {
-	if (ptr == NULL) {
-		fprintf(stderr, "Cannot return value because ptr is NULL.\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		memtrack_errfunc = "memtrack_get_size";
-		return 0;
+static void memtrack_leaks_print (MemTrackLeaks* leaks) {
+	if (leaks->count == 0) {
+#ifdef MEMTRACK_LEAK_SITES
+		free(leaks->sites);
+		leaks->sites = NULL;
+#endif
+#ifdef MEMTRACK_BACKTRACE
+		free(leaks->backtraces);
+		leaks->backtraces = NULL;
+#endif
+		return;
 	}
 
-	if (UNLIKELY(memtrack_entries == NULL)) {
-		init();
+	fprintf(stderr, "\nMemory not freed at exit!\nBlocks: %zu   Bytes: %zu\n", leaks->count, leaks->bytes);
 
-		fprintf(stderr, "No entry found to get size! The memory might not be tracked.\nFile: %s   Line: %d\n", file, line);
-		errno = EPERM;
-		memtrack_errfunc = "memtrack_get_size";
+#ifdef MEMTRACK_LEAK_SITES
+	if (leaks->sites != NULL) {
+		size_t used = 0;
+		for (size_t i = 0; i < leaks->capacity; i++) {
+			if (leaks->sites[i].count != 0)
+				leaks->sites[used++] = leaks->sites[i];
+		}
+		qsort(leaks->sites, used, sizeof(MemTrackLeakSite), memtrack_leak_site_compare);
 
-		return 0;
+		for (size_t i = 0; i < used; i++)
+			fprintf(stderr, "Blocks: %zu   Bytes: %zu   alloc File: %s   Line: %d\n", leaks->sites[i].count, leaks->sites[i].bytes, (leaks->sites[i].file != NULL) ? leaks->sites[i].file : "(unknown)", leaks->sites[i].line);
 	}
 
-	MemTrackEntry* entry = ht_get(memtrack_entries, (key_type)ptr);
-	if (entry == NULL) {
-		fprintf(stderr, "No entry found to get size! The memory might not be tracked.\nFile: %s   Line: %d\n", file, line);
-		memtrack_errfunc = "memtrack_get_size";
-		return 0;
+	free(leaks->sites);
+	leaks->sites = NULL;
+#endif
+
+#ifdef MEMTRACK_BACKTRACE
+	if (leaks->backtraces != NULL) {
+		fprintf(stderr, "\nMemory not freed at exit by backtrace\n");
+		memtrack_backtrace_usage_print(stderr, leaks->backtraces);
+		leaks->backtraces = NULL;
 	}
+#endif
 
-	return entry->size;
+#ifdef DEBUG
+	errno = EPERM;
+	memtrack_errfunc = "quit";
+#endif
 }
 
 
-size_t memtrack_get_size (void* ptr, const char* file, int line) {
-	memtrack_lock();
-	size_t size = memtrack_get_size_without_lock(ptr, file, line);
-	memtrack_unlock();
-	return size;
+/* 解放も表からの削除もせず、一度の走査で解放されていないブロックを数える */
+static void memtrack_table_leaks (MemTrackStore* table, MemTrackLeaks* leaks) {
+	for (size_t i = 0; i < table->used; i++) {
+		const MemTrackEntry* entry = memtrack_store_at(table, i);
+		if (entry == NULL || memtrack_entry_is_inherited(entry)) continue;
+#ifdef DEBUG
+		if (entry->is_freed) continue;
+#endif
+		memtrack_leaks_add(leaks, entry);
+	}
 }
 
 
-void memtrack_all_check (void) {
-	size_t memtrack_entries_arr_cnt;
-	MemTrackEntry** memtrack_entries_arr = (MemTrackEntry**)ht_all_get(memtrack_entries, &memtrack_entries_arr_cnt);
-	if (UNLIKELY(memtrack_entries_arr == NULL)) {
-		fprintf(stderr, "Failed to get all entries from memory tracking.\nFile: %s   Line: %d\n", __FILE__, __LINE__);
-		memtrack_errfunc = "memtrack_all_check";
+#ifdef MEMTRACK_HEADER
+static void memtrack_header_leaks (const MemTrackHeader* list, MemTrackLeaks* leaks) {
+	for (const MemTrackHeader* header = list; header != NULL; header = header->next) {
+		if (!memtrack_entry_is_inherited(&header->entry))
+			memtrack_leaks_add(leaks, &header->entry);
+	}
+}
+#endif
 
-	} else {
-		printf("\n");
-		for (size_t i = 0; i < memtrack_entries_arr_cnt; i++) {
-			if (UNLIKELY(memtrack_entries_arr[i] == NULL)) {
-				fprintf(stderr, "Entry is NULL!\nFile: %s   Line: %d\n", __FILE__, __LINE__);
-				errno = EPROTO;
-				memtrack_errfunc = "memtrack_all_check";
-			} else if (UNLIKELY(memtrack_entries_arr[i]->ptr == NULL)) {
-				fprintf(stderr, "Entry pointer is NULL!\nFile: %s   Line: %d\n", __FILE__, __LINE__);
-				errno = EPROTO;
-				memtrack_errfunc = "memtrack_all_check";
-			} else {
-#ifndef DEBUG
-				printf("\nAlready Freed: false\nPointer: %p   Size: %zu\nPlease use debug mode if you need more detailed information.\n", memtrack_entries_arr[i]->ptr, memtrack_entries_arr[i]->size);
-#else
-				if (memtrack_entries_arr[i]->is_freed) {
-					if (memtrack_entries_arr[i]->last_realloc_file != NULL)
-						printf("\nAlready Freed: true\nPointer: %p   Size: %zu\nfree File: %s   Line: %d\nalloc File: %s   Line: %d\nLast realloc File: %s   Line: %d\n", memtrack_entries_arr[i]->ptr, memtrack_entries_arr[i]->size, memtrack_entries_arr[i]->free_file, memtrack_entries_arr[i]->free_line, memtrack_entries_arr[i]->alloc_file, memtrack_entries_arr[i]->alloc_line, memtrack_entries_arr[i]->last_realloc_file, memtrack_entries_arr[i]->last_realloc_line);
-					else
-						printf("\nAlready Freed: true\nPointer: %p   Size: %zu\nfree File: %s   Line: %d\nalloc File: %s   Line: %d\n", memtrack_entries_arr[i]->ptr, memtrack_entries_arr[i]->size, memtrack_entries_arr[i]->free_file, memtrack_entries_arr[i]->free_line, memtrack_entries_arr[i]->alloc_file, memtrack_entries_arr[i]->alloc_line);
-				} else {
-					if (memtrack_entries_arr[i]->last_realloc_file != NULL)
-						printf("\nAlready Freed: false\nPointer: %p   Size: %zu\nalloc File: %s   Line: %d\nLast realloc File: %s   Line: %d\n", memtrack_entries_arr[i]->ptr, memtrack_entries_arr[i]->size, memtrack_entries_arr[i]->alloc_file, memtrack_entries_arr[i]->alloc_line, memtrack_entries_arr[i]->last_realloc_file, memtrack_entries_arr[i]->last_realloc_line);
-					else
-						printf("\nAlready Freed: false\nPointer: %p   Size: %zu\nalloc File: %s   Line: %d\n", memtrack_entries_arr[i]->ptr, memtrack_entries_arr[i]->size, memtrack_entries_arr[i]->alloc_file, memtrack_entries_arr[i]->alloc_line);
-				}
+
+/* MEMTRACK_QUIT_FAST と MEMTRACK_QUIT_SUMMARY の終了処理、ブロックと表は OS による回収に任せる */
+static void memtrack_quit_fast (bool summary) {
+	MemTrackLeaks leaks = { 0 };
+	leaks.summary = summary;
+#ifdef MEMTRACK_LEAK_SITES
+	if (summary)
+		memtrack_leaks_grow(&leaks);
+#endif
+#ifdef MEMTRACK_BACKTRACE
+	if (summary)
+		leaks.backtraces = memtrack_backtrace_usage_create("quit");
 #endif
-			}
-		}
-		if (!ht_all_release_arr(memtrack_entries_arr))
-			memtrack_errfunc = "memtrack_all_check";
 
-		printf("\n\n");
-	}
-}
+#ifndef MEMTRACK_SHARDED
+#ifdef MEMTRACK_HEADER
+	memtrack_header_leaks(memtrack_headers, &leaks);
+#endif
+	if (memtrack_entries != NULL)
+		memtrack_table_leaks(memtrack_entries, &leaks);
+#else
+	memtrack_lock_held = true;
 
+#ifdef MEMTRACK_THREAD_BUFFER
+	memtrack_buffers_flush_all();
+#endif
 
-static void quit (void) {
-	size_t memtrack_entries_arr_cnt;
-	MemTrackEntry** memtrack_entries_arr;
-	for (size_t i = 0; i < MEMTRACK_ENTRIES_TRIAL; i++) {
-		memtrack_entries_arr = (MemTrackEntry**)ht_all_get(memtrack_entries, &memtrack_entries_arr_cnt);
-		if (LIKELY(memtrack_entries_arr != NULL)) break;
+	for (size_t i = 0; i < MEMTRACK_SHARD_COUNT; i++) {
+#ifdef MEMTRACK_HEADER
+		memtrack_header_leaks(memtrack_shards[i].headers, &leaks);
+#endif
+		if (memtrack_shards[i].entries != NULL)
+			memtrack_table_leaks(memtrack_shards[i].entries, &leaks);
 	}
-	if (UNLIKELY(memtrack_entries_arr == NULL)) {
-		fprintf(stderr, "Failed to get all entries from memory tracking.\nFile: %s   Line: %d\n", __FILE__, __LINE__);
-		memtrack_errfunc = "quit";
 
-	} else {
-		for (size_t i = 0; i < memtrack_entries_arr_cnt; i++) {
-			if (UNLIKELY(memtrack_entries_arr[i] == NULL)) {
-				fprintf(stderr, "Entry is NULL!\nFile: %s   Line: %d\n", __FILE__, __LINE__);
-				errno = EPROTO;
-				memtrack_errfunc = "quit";
-			} else if (UNLIKELY(memtrack_entries_arr[i]->ptr == NULL)) {
-				fprintf(stderr, "Entry pointer is NULL!\nFile: %s   Line: %d\n", __FILE__, __LINE__);
-				errno = EPROTO;
-				memtrack_errfunc = "quit";
-			} else {
+	memtrack_lock_held = false;
+#endif
+
+	memtrack_leaks_print(&leaks);
+}
+
+
+/* 引き継いだブロックは解放も報告もしない、1 つずつ解放すると親プロセスと共有しているページが複製されるため */
+static void memtrack_table_quit (MemTrackStore* table) {
+	for (size_t i = 0; i < table->used; i++) {
+		MemTrackEntry* entry = memtrack_store_at(table, i);
+		if (entry == NULL || memtrack_entry_is_inherited(entry)) continue;
 #ifndef DEBUG
-				memtrack_free_without_lock(memtrack_entries_arr[i]->ptr, __FILE__, __LINE__);
+		memtrack_free_without_lock(entry->ptr, __FILE__, __LINE__);
 #else
-				if (UNLIKELY(!memtrack_entries_arr[i]->is_freed)) {
-					fprintf(stderr, "\nMemory not freed!\nPointer: %p   Size: %zu\nalloc File: %s   Line: %d\nLast realloc File: %s   Line: %d\n", memtrack_entries_arr[i]->ptr, memtrack_entries_arr[i]->size, memtrack_entries_arr[i]->alloc_file, memtrack_entries_arr[i]->alloc_line, memtrack_entries_arr[i]->last_realloc_file, memtrack_entries_arr[i]->last_realloc_line);
-					errno = EPERM;
+		if (UNLIKELY(!entry->is_freed)) {
+			memtrack_entry_report_leak(entry);
+			errno = EPERM;
 
-					memtrack_free_without_lock(memtrack_entries_arr[i]->ptr, __FILE__, __LINE__);
+			/* 隔離リングの追い出しでエントリが削除されないよう、エントリを介さず解放する */
+			free(entry->ptr);
 
-					memtrack_errfunc = "quit";
-				}
-#endif
-			}
-		}
-		if (!ht_all_release_arr(memtrack_entries_arr))
 			memtrack_errfunc = "quit";
+		}
+#endif
 	}
 #ifdef MAYBE_ERRNO_THREAD_LOCAL
 	int tmp_errno = errno;
 #endif
 	errno = 0;
 
-	ht_destroy(memtrack_entries);
+	memtrack_store_destroy(table);
 
 	if (UNLIKELY(errno != 0)) memtrack_errfunc = "quit";
 #ifdef MAYBE_ERRNO_THREAD_LOCAL
 	else errno = tmp_errno;
 #endif
+}
 
+
+/* MEMTRACK_QUIT_FREE の終了処理、ブロックを 1 つずつ解放して表を破棄する */
+static void memtrack_quit_free (void) {
+#ifndef MEMTRACK_SHARDED
+#ifdef MEMTRACK_HEADER
+	memtrack_header_quit(memtrack_headers);
+	memtrack_headers = NULL;
+#endif
+	memtrack_table_quit(memtrack_entries);
 	memtrack_entries = NULL;
+#ifdef DEBUG
+	memtrack_quarantine.count = 0;
+#endif
+#else
+	/* 非シャードモードと同様に終了処理ではロックを取らないため、ロック済みとして扱う */
+	memtrack_lock_held = true;
+
+#ifdef MEMTRACK_THREAD_BUFFER
+	memtrack_buffers_flush_all();
+#endif
+
+	for (size_t i = 0; i < MEMTRACK_SHARD_COUNT; i++) {
+#ifdef MEMTRACK_HEADER
+		memtrack_header_quit(memtrack_shards[i].headers);
+		memtrack_shards[i].headers = NULL;
+#endif
+		memtrack_table_quit(memtrack_shards[i].entries);
+		memtrack_shards[i].entries = NULL;
+#ifdef DEBUG
+		memtrack_quarantines[i].count = 0;
+#endif
+	}
+
+	memtrack_lock_held = false;
+#endif
+}
+
+
+static void quit (void) {
+	MEMTRACK_PRELOAD_ENTER();
+
+#ifdef MEMTRACK_REPORTER
+	memtrack_reporter_stop();  /* 解放中の表を報告スレッドが読まないよう、最初に止める */
+#endif
+
+#ifdef MEMTRACK_TRACE
+	memtrack_trace_quit();
+#endif
+
+	if (memtrack_quit_mode != MEMTRACK_QUIT_FREE)
+		memtrack_quit_fast(memtrack_quit_mode == MEMTRACK_QUIT_SUMMARY);
+	else
+		memtrack_quit_free();
+
+#ifdef MEMTRACK_DEFERRED_DIAG
+	memtrack_diag_flush();
+#endif
 
 	global_lock_quit();
+
+	MEMTRACK_PRELOAD_LEAVE();
 }
 
 
@@ -774,12 +6645,55 @@ void* realloc_array (void* ptr, size_t count, size_t size) {
 		return NULL;
 	}
 
-	void* ptr = realloc(ptr, count * size);
-	if (ptr == NULL) {
+	void* new_ptr = realloc(ptr, count * size);
+	if (new_ptr == NULL) {
 		errno = ENOMEM;
 		memtrack_errfunc = "realloc_array";
 	}
-	return ptr;
+	return new_ptr;
+}
+
+
+bool malloc_batch (size_t count, const size_t sizes[], void* ptrs[]) {
+	if (count == 0 || sizes == NULL || ptrs == NULL) {
+		errno = EINVAL;
+		memtrack_errfunc = "malloc_batch";
+		return false;
+	}
+
+	for (size_t i = 0; i < count; i++)
+		ptrs[i] = NULL;
+
+	for (size_t i = 0; i < count; i++) {
+		if (sizes[i] == 0) {
+			errno = EINVAL;
+			memtrack_errfunc = "malloc_batch";
+			return false;
+		}
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		ptrs[i] = malloc(sizes[i]);
+		if (ptrs[i] == NULL) {
+			errno = ENOMEM;
+			memtrack_errfunc = "malloc_batch";
+
+			for (size_t j = 0; j < i; j++) {
+				free(ptrs[j]);
+				ptrs[j] = NULL;
+			}
+			return false;
+		}
+	}
+	return true;
+}
+
+
+void free_batch (void* ptrs[], size_t count) {
+	if (ptrs == NULL) return;
+
+	for (size_t i = 0; i < count; i++)
+		free(ptrs[i]);
 }
 
 
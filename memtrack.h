@@ -57,9 +57,207 @@
  * In high-load environments or those with many threads, it is recommended to design
  * your application to minimize simultaneous access whenever possible.
  *
+ * The tracking table looks pointers up in an open-addressing index that starts with
+ * MEMTRACK_ENTRIES_COUNT slots (default 1024, per sub-table in sharded mode, must be a
+ * power of 2 not less than 16) and doubles whenever it is three quarters full. A
+ * program that knows it will keep many blocks alive can call memtrack_reserve once to
+ * grow the table up front instead.
+ *
+ * When the library itself is built with the MEMTRACK_SHARDED macro, the tracking table
+ * is split into MEMTRACK_SHARD_COUNT (default 16, must be a power of 2) sub-tables
+ * selected by a hash of the pointer, each protected by its own lock. In this mode the
+ * functions declared before memtrack_lock do not take the global lock, and the
+ * underlying malloc, calloc, realloc, and free are called outside of any lock.
+ * memtrack_lock and memtrack_unlock remain available and lock every sub-table, so code
+ * using the _without_lock functions keeps working unchanged. This mode requires C11 and
+ * POSIX threads.
+ *
+ * Building the library with the MEMTRACK_THREAD_BUFFER macro additionally gives each
+ * thread a small log of MEMTRACK_THREAD_BUFFER_SIZE (default 64) entries in front of the
+ * tracking table (this macro implies MEMTRACK_SHARDED). Allocations are recorded in the
+ * calling thread's log first, and a block freed by the same thread while it is still in
+ * the log never touches the shared table. Surviving entries are merged into the table in
+ * batches when the log fills, when the thread exits, when memtrack_all_check runs, at
+ * program exit, and whenever another thread looks up a pointer it cannot find.
+ *
+ * Building the library with the MEMTRACK_HEADER macro makes memtrack_malloc,
+ * memtrack_calloc, memtrack_realloc, and memtrack_aligned_alloc over-allocate and store
+ * the tracking entry in a small header right in front of the returned block, so
+ * memtrack_free and memtrack_get_size no longer search the tracking table. Such blocks
+ * are linked into an intrusive list that memtrack_all_check and the exit handler walk.
+ * Pointers registered with memtrack_entry_add are still kept in the table. In this mode
+ * every pointer passed to the library must come from the malloc family, because the
+ * word just before it is read to tell the two kinds apart. The companion libraries
+ * must be built with the same macro. This mode requires C11.
+ *
+ * Building the library with the MEMTRACK_SAMPLING macro records only about one
+ * allocation per memtrack_get_sample_interval() bytes allocated (default 512 KiB,
+ * chosen at random like tcmalloc's heap profiler) in the tracking table. Each recorded
+ * entry carries a weight, the estimated number of bytes it stands for, and
+ * memtrack_sampled_bytes returns the sum. Allocations that are not recorded only
+ * update a per-thread byte counter, and freeing them costs a single check of a small
+ * filter. Because unrecorded blocks have no entry, memtrack_get_size returns
+ * malloc_usable_size for them where glibc provides it (0 otherwise), and recalloc
+ * fails instead of guessing the old size. This mode requires C11 and cannot be
+ * combined with MEMTRACK_THREAD_BUFFER or MEMTRACK_HEADER.
+ *
+ * Building the library with the MEMTRACK_SITE_STATS macro keeps counters for each call
+ * site (the file and line passed to the library): live bytes, live blocks, total
+ * allocations, total bytes, and peak live bytes. They are updated with atomic operations
+ * and can be read at any time with memtrack_site_snapshot. A realloc moves the block to
+ * the site of the realloc call and counts as a new allocation there. Sites are told apart
+ * by the address of the file string, so pass __FILE__ as the macros do. Up to
+ * MEMTRACK_SITE_COUNT (default 4096, must be a power of 2) sites are kept separately. In
+ * sampling mode the counters are estimates built from the weights. This mode requires C11.
+ *
+ * Building the library and the calling code with the MEMTRACK_CALL_SITE macro makes the
+ * malloc, calloc, realloc, and free macros pass a single pointer to a static call site
+ * descriptor (one per macro expansion) to memtrack_malloc_at and friends instead of
+ * __FILE__ and __LINE__ (this needs GCC or Clang statement expressions; other compilers
+ * keep the two arguments). Call sites are registered in the same table as the site
+ * statistics, and in debug mode each entry stores three 32-bit site numbers instead of
+ * three file names and three line numbers. Locations of sites beyond MEMTRACK_SITE_COUNT
+ * are shown as (null). This mode requires C11.
+ *
+ * Building the library with the MEMTRACK_DEFERRED_DIAG macro stops the library and its
+ * companion libraries from writing error messages to stderr while holding a lock. Each
+ * message is stored as a fixed-size record in a lock-free queue of
+ * MEMTRACK_DIAG_RING_SIZE (default 256) records, and the queue is printed, with the
+ * pointer involved, when a library function returns without holding a lock, by
+ * memtrack_unlock, by memtrack_diag_flush, and at program exit. Each call site may queue
+ * at most MEMTRACK_DIAG_RATE_LIMIT (default 16) messages per second; messages over the
+ * limit or arriving while the queue is full are counted, and the count is reported by
+ * memtrack_diag_flush and at program exit. errno and memtrack_errfunc are still set
+ * immediately. This mode requires C11.
+ *
+ * Building the library with the MEMTRACK_TRACE macro adds memtrack_trace_start, which
+ * makes every allocation, reallocation, and free passed to the library (including
+ * memtrack_entry_add, memtrack_entry_update, and memtrack_entry_free) append a 56-byte
+ * record to a ring of records in a memory-mapped file: a timestamp, a thread number,
+ * the operation, the pointers, the size, and a call site number. The names of the call
+ * sites are written to the same file when they are first seen. Once the file is mapped,
+ * recording only writes to memory, and the file stays readable after a crash; the older
+ * records are overwritten when the ring wraps around. Recording stops when the exit
+ * handler starts. The file layout is described in memtrack_trace.h, and
+ * memtrack_trace_decode prints the timeline and the blocks alive at any point in time.
+ * This mode requires C11 and POSIX.
+ *
+ * Building the library with the MEMTRACK_HISTOGRAM macro counts the requested size of
+ * every allocation and reallocation passed to the library, and the time from the
+ * allocation of each block to its free, in log2-sized buckets. Each entry keeps its
+ * allocation time, which a realloc does not reset. The counters are kept per thread and
+ * summed when memtrack_histogram_get is called, and memtrack_all_check prints both
+ * histograms after the entries. In sampling mode only the recorded blocks are counted,
+ * each as the estimated number of blocks it stands for. This mode requires C11 and POSIX
+ * threads.
+ *
+ * Building the library with the MEMTRACK_REPORTER macro adds memtrack_reporter_start,
+ * which starts a thread that wakes at a fixed interval and publishes the tracked memory
+ * in the Prometheus text exposition format: live bytes and blocks, total allocations
+ * and bytes, allocations and bytes per second over the last interval, and the live
+ * bytes and blocks of the MEMTRACK_REPORTER_TOP_SITES (default 10) call sites holding
+ * the most memory. The text is written to a file, replaced atomically with rename so a
+ * scraper never reads a partial file, and/or passed to a callback. The values are read
+ * from the atomic counters of the site statistics, so the thread takes no lock of the
+ * library and never walks the tracking table. The reporter is stopped when the exit
+ * handler starts. This mode requires C11 and POSIX and the MEMTRACK_SITE_STATS macro.
+ *
+ * Building the library with the MEMTRACK_USABLE_SIZE macro also records, for each
+ * entry, the size the allocator actually made usable (malloc_usable_size, malloc_size,
+ * or _msize), and keeps the difference from the requested size (the slack) per call
+ * site. memtrack_slack_bytes returns the total, memtrack_all_check prints the usable
+ * size of each entry and the slack of each site, and the reporter publishes the total
+ * as memtrack_slack_bytes. A realloc that grows a block within its usable size only
+ * updates the entry and returns the same pointer without calling realloc; shrinking
+ * still calls realloc so the allocator can take the memory back. Every pointer
+ * passed to the library must come from the malloc family of the C library. This mode
+ * requires C11 and the MEMTRACK_SITE_STATS macro.
+ *
+ * Building the library with the MEMTRACK_BACKTRACE macro records a backtrace of up to
+ * MEMTRACK_BACKTRACE_DEPTH frames (default 16) for each new entry, using the unwinder
+ * of GCC and Clang (_Unwind_Backtrace). Identical backtraces are stored once in a
+ * table of MEMTRACK_BACKTRACE_COUNT backtraces (default 4096, a power of 2), and each
+ * entry only keeps a 32-bit id; backtraces that no longer fit are counted together as
+ * unknown. A realloc keeps the backtrace of the original allocation.
+ * Backtraces start at the caller of the public wrapper function, so the library's own
+ * frames are left out whatever the optimization level; MEMTRACK_BACKTRACE_SKIP more
+ * frames are dropped after them (default 0), e.g. for the caller's own allocation
+ * wrappers. Blocks registered with memtrack_entry_add directly (as the companion
+ * libraries do) still include the library frames below it. The backtrace is taken
+ * before the shard lock is acquired.
+ * memtrack_all_check groups the live blocks by backtrace, and so does the summary
+ * printed at exit in MEMTRACK_QUIT_SUMMARY mode. Frames are printed with the symbol
+ * and object names from dladdr where available (link with -ldl on older glibc, and
+ * with -rdynamic to see the names of functions in the executable). Combined with
+ * MEMTRACK_SAMPLING, only recorded allocations pay for the unwinding. This mode
+ * requires C11, thread-local storage, and GCC or Clang.
+ *
+ * Building the library with the MEMTRACK_THREAD_STATS macro also records in each entry
+ * the thread that allocated the block (and, in debug mode, the one that freed it),
+ * keeps live, peak, and total counters for each thread, and counts per call site the
+ * blocks freed by a thread other than the one that allocated them. These cross-thread
+ * frees defeat the per-thread caches of most allocators. Threads are numbered from 1
+ * in the order they first use the library, and the first MEMTRACK_THREAD_COUNT
+ * (default 256) are counted separately. memtrack_thread_snapshot reads the counters,
+ * and memtrack_all_check prints them. As with the site statistics, a realloc counts as
+ * a free and a new allocation by the calling thread. This mode requires C11 and the
+ * MEMTRACK_SITE_STATS macro.
+ *
+ * Building the library with the MEMTRACK_TAGS macro attributes blocks to categories
+ * such as a cache or the network buffers in addition to call sites. Tags are
+ * registered up front with memtrack_tag_register (at most MEMTRACK_TAG_COUNT, default
+ * 64) and pushed on a per-thread stack with memtrack_push_tag and memtrack_pop_tag, or
+ * around a block with MEMTRACK_TAG_SCOPE. Each new block is stamped with the tag on top
+ * of the stack of the allocating thread and keeps it across reallocs, and live, peak,
+ * and total counters are kept per tag. memtrack_tag_snapshot reads the counters, and
+ * memtrack_all_check prints them. Combined with MEMTRACK_BUDGET, tags can also be
+ * capped with memtrack_set_tag_budget. This mode requires C11 and the
+ * MEMTRACK_SITE_STATS macro.
+ *
+ * Building the library with the MEMTRACK_BUDGET macro enforces a cap on the bytes of
+ * all live tracked blocks (memtrack_set_budget) and optional caps on the live bytes of
+ * single call sites (memtrack_set_site_budget). An allocation, calloc, realloc, batch,
+ * aligned, or nd-array request that would exceed a cap fails with ENOMEM before the
+ * allocator is called, after the pressure function registered with
+ * memtrack_set_pressure_func, if any, has had one chance to free memory. The check
+ * is a few relaxed atomic loads and compares, so concurrent allocations can overshoot
+ * a cap by at most their own sizes. A realloc only needs room for the growth. This
+ * mode requires C11 and the MEMTRACK_SITE_STATS macro, and cannot be combined with
+ * MEMTRACK_SAMPLING.
+ *
+ * Building the library with the MEMTRACK_FORK_SAFE macro registers fork handlers with
+ * pthread_atfork. Every lock of the library is taken just before fork and released in
+ * both processes afterwards, so the child never inherits a lock held by a thread that
+ * does not exist there. Each entry is stamped with a generation, and by default the child
+ * starts a new one: the blocks inherited from the parent can still be freed and
+ * reallocated, but are left out of memtrack_all_check, the cursor, and the exit handler,
+ * which neither reports nor frees them. Nothing is deleted one by one, so the pages
+ * shared with the parent are not copied. memtrack_set_fork_discard(false) keeps
+ * the parent's entries in the child instead, and memtrack_new_generation starts a new
+ * generation at any time. The counters of the site, thread, and tag statistics and of the
+ * budgets still include the inherited blocks. In the child, the reporter is stopped,
+ * the trace is no longer recorded, and deferred messages queued by the parent are dropped
+ * (the parent prints them). fork must not be called between memtrack_lock and
+ * memtrack_unlock. This mode requires C11 and POSIX.
+ *
+ * "make preload" builds preload/libmemtrack_preload.so, which tracks a whole process
+ * without recompiling it when loaded with LD_PRELOAD: it replaces malloc, calloc,
+ * realloc, free, aligned_alloc, and posix_memalign, including the calls made by other
+ * libraries. It is built in sharded mode (sampling can be added with LIB_FEATURES) and
+ * cannot be combined with MEMTRACK_HEADER. The blocks are recorded under the name of
+ * the replaced function with line 0, and the exit handler uses MEMTRACK_QUIT_SUMMARY.
+ * See preload/memtrack_preload.c for details.
+ *
  * To enable debug mode, define DEBUG macro before including this file.
  *
- * This library depends on the mhashtable library.
+ * In debug mode, freed entries are kept so that double frees can be reported together
+ * with the location of the earlier free. Only the most recent MEMTRACK_QUARANTINE_SIZE
+ * (default 1024, per sub-table in sharded mode) freed entries are kept; older ones are
+ * evicted in FIFO order, so a double free of a block freed earlier than that is reported
+ * as an untracked pointer instead.
+ *
+ * This library only takes the MHT_CPP_C_BEGIN / MHT_CPP_C_END and LIKELY / UNLIKELY macros
+ * from mhashtable.h; it does not link against the mhashtable library.
  */
 
 #pragma once
@@ -76,6 +274,7 @@ MHT_CPP_C_BEGIN
 
 #include <stddef.h>
 #include <stdlib.h>
+#include <stdio.h>
 
 
 #if defined (__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L)
@@ -108,15 +307,40 @@ MHT_CPP_C_BEGIN
 #ifndef MEMTRACK_DISABLE
 
 
+#ifdef MEMTRACK_CALL_SITE
+/*
+ * MemTrackCallSite
+ * file: name of the calling file, usually specified with __FILE__
+ * line: line number of the caller, usually specified with __LINE__
+ * @note: MEMTRACK_CALL_SITE_HERE expands to a pointer to a static instance created once for each expansion
+ */
+typedef struct {
+	const char* file;
+	int line;
+} MemTrackCallSite;
+
+#if defined (__GNUC__) || defined (__clang__)
+	#define MEMTRACK_CALL_SITE_HERE (__extension__ ({ static const MemTrackCallSite memtrack_call_site = { __FILE__, __LINE__ }; &memtrack_call_site; }))
+#endif
+#endif
+
+
 /*
  * Replaces malloc, calloc, realloc, and free with memtrack_ versions.
  */
 #ifndef MEMTRACK_DISABLE_REPLACE_STANDARD_FUNC
+#ifdef MEMTRACK_CALL_SITE_HERE
+	#define malloc(size) memtrack_malloc_at((size), MEMTRACK_CALL_SITE_HERE)
+	#define calloc(count, size) memtrack_calloc_at((count), (size), MEMTRACK_CALL_SITE_HERE)
+	#define realloc(ptr, size) memtrack_realloc_at((ptr), (size), MEMTRACK_CALL_SITE_HERE)
+	#define free(ptr) memtrack_free_at((ptr), MEMTRACK_CALL_SITE_HERE)
+#else
 	#define malloc(size) memtrack_malloc((size), __FILE__, __LINE__)
 	#define calloc(count, size) memtrack_calloc((count), (size), __FILE__, __LINE__)
 	#define realloc(ptr, size) memtrack_realloc((ptr), (size), __FILE__, __LINE__)
 	#define free(ptr) memtrack_free((ptr), __FILE__, __LINE__)
 #endif
+#endif
 
 /*
  * The functions replaced by the following macros are specific to this library.
@@ -128,6 +352,8 @@ MHT_CPP_C_BEGIN
 #define realloc_array(ptr, count, size) memtrack_realloc_array((ptr), (count), (size), __FILE__, __LINE__)
 #define recalloc_array(ptr, count, size) memtrack_recalloc_array((ptr), (count), (size), __FILE__, __LINE__)
 #define get_size(ptr) memtrack_get_size((ptr), __FILE__, __LINE__)
+#define malloc_batch(count, sizes, ptrs) memtrack_malloc_batch((count), (sizes), (ptrs), __FILE__, __LINE__)
+#define free_batch(ptrs, count) memtrack_free_batch((ptrs), (count), __FILE__, __LINE__)
 
 
 
@@ -234,12 +460,577 @@ extern void* memtrack_recalloc_array (void* ptr, size_t count, size_t size, cons
  */
 extern size_t memtrack_get_size (void* ptr, const char* file, int line);
 
+/*
+ * memtrack_malloc_batch
+ * @param count: number of memory blocks to allocate, displays a message and returns false if count is 0
+ * @param sizes: array of count sizes in bytes, displays a message and returns false if NULL or if any size is 0
+ * @param ptrs: array of count elements to store the pointers to the allocated memory blocks in, displays a message and returns false if NULL
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true on success, false on failure
+ * @note: takes the lock once and registers all entries in one pass; on failure, no memory block is left allocated and every element of ptrs is set to NULL (unless ptrs itself is NULL)
+ */
+extern bool memtrack_malloc_batch (size_t count, const size_t sizes[], void* ptrs[], const char* file, int line);
+
+/*
+ * memtrack_free_batch
+ * @param ptrs: array of count pointers to the memory blocks to free, NULL elements are skipped; displays a message and does nothing if ptrs itself is NULL
+ * @param count: number of elements in ptrs, no action is taken if 0
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @note: takes the lock once and removes all entries in one pass, grouped by shard when the library is built with the MEMTRACK_SHARDED macro; the elements of ptrs are not modified
+ */
+extern void memtrack_free_batch (void* ptrs[], size_t count, const char* file, int line);
+
+/*
+ * memtrack_reserve
+ * @param count: number of entries expected to be added on top of the current ones, no action is taken if 0
+ * @note: grows the index of the tracking table and the storage of its entries ahead of time, so that adding count entries does not rehash or allocate; split evenly between the shards when the library is built with the MEMTRACK_SHARDED macro; a failure to grow is not reported, the table just grows later as usual
+ */
+extern void memtrack_reserve (size_t count);
+
 /*
  * memtrack_all_check
  * @note: use the printf function to output all information stored in the memory management hashtable during runtime
  */
 extern void memtrack_all_check (void);
 
+/*
+ * memtrack_all_check_to
+ * @param stream: stream to write the information to, displays a message and does nothing if NULL
+ * @note: writes the same output as memtrack_all_check to stream, without allocating memory for the list of entries
+ */
+extern void memtrack_all_check_to (FILE* stream);
+
+
+/*
+ * MemTrackEntryInfo
+ * ptr, size: the tracked memory block and its size in bytes
+ * weight: estimated number of bytes this entry stands for when the library is built with the MEMTRACK_SAMPLING macro, size otherwise
+ * alloc_file, alloc_line: where the block was allocated (debug mode only, NULL and 0 otherwise)
+ * last_realloc_file, last_realloc_line: where the block was last reallocated (debug mode only, NULL and 0 if never reallocated)
+ * free_file, free_line: where the block was freed (debug mode only, NULL and 0 if not freed)
+ * is_freed: true for a freed entry kept to detect double frees (debug mode only)
+ */
+typedef struct {
+	void* ptr;
+	size_t size;
+	size_t weight;
+	const char* alloc_file;
+	const char* last_realloc_file;
+	const char* free_file;
+	int alloc_line;
+	int last_realloc_line;
+	int free_line;
+	bool is_freed;
+} MemTrackEntryInfo;
+
+/*
+ * MemTrackCursor
+ * @note: position of an iteration over all entries, the members are internal and must not be modified
+ */
+typedef struct {
+	size_t table;
+	size_t position;
+	const void* header;
+	bool started;
+} MemTrackCursor;
+
+/*
+ * memtrack_cursor_init
+ * @param cursor: cursor to set to the first entry, displays a message and does nothing if NULL
+ * @note: the cursor is then passed to memtrack_cursor_next_without_lock
+ */
+extern void memtrack_cursor_init (MemTrackCursor* cursor);
+
+
+/*
+ * MemTrackSnapshotEntry
+ * ptr, size: a memory block alive when the snapshot was taken and its size in bytes
+ * file, line: where the block was allocated (debug mode or when the library is built with the MEMTRACK_SITE_STATS macro, NULL and 0 otherwise)
+ */
+typedef struct {
+	void* ptr;
+	size_t size;
+	const char* file;
+	int line;
+} MemTrackSnapshotEntry;
+
+/*
+ * MemTrackSnapshot
+ * entries: the blocks alive when the snapshot was taken, sorted by ascending address
+ * count: number of elements in entries
+ */
+typedef struct {
+	MemTrackSnapshotEntry* entries;
+	size_t count;
+} MemTrackSnapshot;
+
+/*
+ * MemTrackSiteDelta
+ * file, line: call site, as in MemTrackSnapshotEntry
+ * new_count, new_bytes: blocks allocated here that are alive in the later snapshot only, and their sizes
+ * freed_count, freed_bytes: blocks allocated here that are alive in the earlier snapshot only, and their sizes
+ * grown_bytes, shrunk_bytes: size changes of blocks allocated here that are alive in both snapshots
+ */
+typedef struct {
+	const char* file;
+	int line;
+	size_t new_count;
+	size_t new_bytes;
+	size_t freed_count;
+	size_t freed_bytes;
+	size_t grown_bytes;
+	size_t shrunk_bytes;
+} MemTrackSiteDelta;
+
+/*
+ * memtrack_snapshot
+ * @return: newly allocated snapshot of all blocks being tracked, or NULL on failure
+ * @note: the entries are copied a few thousand at a time, holding the lock of only one table for each batch, so the snapshot is not an atomic view of a program that keeps allocating; must not be called between memtrack_lock and memtrack_unlock; the snapshot is not tracked and must be released with memtrack_snapshot_free
+ */
+extern MemTrackSnapshot* memtrack_snapshot (void);
+
+/*
+ * memtrack_snapshot_free
+ * @param snapshot: snapshot returned by memtrack_snapshot, does nothing if NULL
+ */
+extern void memtrack_snapshot_free (MemTrackSnapshot* snapshot);
+
+/*
+ * memtrack_snapshot_diff
+ * @param before: earlier snapshot, displays a message and returns 0 if NULL
+ * @param after: later snapshot, displays a message and returns 0 if NULL
+ * @param deltas: array to store the changes per call site in, may be NULL only if capacity is 0
+ * @param capacity: number of elements in deltas
+ * @return: number of call sites whose blocks changed, which may be larger than capacity (only the first capacity are stored), or 0 on failure
+ * @note: the sites are sorted by descending net growth (new_bytes + grown_bytes - freed_bytes - shrunk_bytes); a block at the same address with a different call site counts as freed and new
+ */
+extern size_t memtrack_snapshot_diff (const MemTrackSnapshot* before, const MemTrackSnapshot* after, MemTrackSiteDelta* deltas, size_t capacity);
+
+
+/* values of mode for memtrack_set_quit_mode */
+#define MEMTRACK_QUIT_FREE 0     /* report the blocks not freed (in debug mode), free them one by one, and destroy the table */
+#define MEMTRACK_QUIT_FAST 1     /* report the blocks not freed in a single pass, then leave them and the table to the OS */
+#define MEMTRACK_QUIT_SUMMARY 2  /* like MEMTRACK_QUIT_FAST, but report only the number of blocks and bytes per call site */
+
+/*
+ * memtrack_set_quit_mode
+ * @param mode: MEMTRACK_QUIT_FREE (default), MEMTRACK_QUIT_FAST, or MEMTRACK_QUIT_SUMMARY, displays a message and does nothing otherwise
+ * @note: selects what the exit handler does with the blocks still alive; MEMTRACK_QUIT_FAST and MEMTRACK_QUIT_SUMMARY always print the total to stderr, and the call sites are known only in debug mode or when the library is built with the MEMTRACK_SITE_STATS macro
+ */
+extern void memtrack_set_quit_mode (int mode);
+
+
+#ifdef MEMTRACK_SAMPLING
+/*
+ * The following functions are only available when the library is built with the
+ * MEMTRACK_SAMPLING macro.
+ */
+
+/*
+ * memtrack_set_sample_interval
+ * @param interval: average number of bytes allocated between two recorded allocations, every allocation is recorded if 0 or 1
+ * @note: each thread switches to the new interval after its next recorded allocation
+ */
+extern void memtrack_set_sample_interval (size_t interval);
+
+/*
+ * memtrack_get_sample_interval
+ * @return: current average number of bytes allocated between two recorded allocations
+ */
+extern size_t memtrack_get_sample_interval (void);
+
+/*
+ * memtrack_sampled_bytes
+ * @return: estimated number of live bytes, the sum of the weights of all recorded entries
+ */
+extern size_t memtrack_sampled_bytes (void);
+#endif
+
+
+#ifdef MEMTRACK_SITE_STATS
+/*
+ * The following type and function are only available when the library is built with
+ * the MEMTRACK_SITE_STATS macro.
+ */
+
+/*
+ * MemTrackSiteStats
+ * file, line: call site, file is NULL for the entry that collects the sites which did not fit in the table
+ * live_bytes, live_count: bytes and number of blocks allocated here that are still alive
+ * total_count, total_bytes: number of allocations made here and the sum of their sizes
+ * peak_bytes: highest value live_bytes has reached
+ * slack_bytes: usable size minus requested size summed over the live blocks allocated here (0 unless the library is built with the MEMTRACK_USABLE_SIZE macro)
+ * cross_thread_frees: number of blocks allocated here that were freed by a thread other than the one that allocated them (0 unless the library is built with the MEMTRACK_THREAD_STATS macro)
+ */
+typedef struct {
+	const char* file;
+	int line;
+	size_t live_bytes;
+	size_t live_count;
+	size_t total_count;
+	size_t total_bytes;
+	size_t peak_bytes;
+	size_t slack_bytes;
+	size_t cross_thread_frees;
+} MemTrackSiteStats;
+
+/*
+ * memtrack_site_snapshot
+ * @param stats: array to store the statistics in, may be NULL only if capacity is 0
+ * @param capacity: number of elements in stats
+ * @return: number of call sites recorded so far, which may be larger than capacity (only the first capacity are stored)
+ * @note: does not take any lock, so the counters of a site being updated concurrently may be slightly out of step with each other
+ */
+extern size_t memtrack_site_snapshot (MemTrackSiteStats* stats, size_t capacity);
+#endif
+
+
+#ifdef MEMTRACK_USABLE_SIZE
+/*
+ * memtrack_slack_bytes
+ * @return: usable size minus requested size summed over all live blocks, in bytes
+ * @note: only available when the library is built with the MEMTRACK_USABLE_SIZE macro; does not take any lock
+ */
+extern size_t memtrack_slack_bytes (void);
+#endif
+
+
+#ifdef MEMTRACK_THREAD_STATS
+/*
+ * The following functions are only available when the library is built with the
+ * MEMTRACK_THREAD_STATS macro.
+ */
+
+/*
+ * MemTrackThreadStats
+ * thread: thread number as returned by memtrack_thread_id, MEMTRACK_THREAD_COUNT + 1 collects the threads that did not fit in the table
+ * live_bytes, live_count: bytes and number of blocks allocated by this thread that are still alive
+ * peak_bytes: highest value live_bytes has reached
+ * total_count, total_bytes: number of allocations made by this thread and the sum of their sizes
+ * freed_by_others: number of blocks allocated by this thread that another thread freed
+ * frees_of_others: number of blocks allocated by another thread that this thread freed
+ */
+typedef struct {
+	unsigned int thread;
+	size_t live_bytes;
+	size_t live_count;
+	size_t peak_bytes;
+	size_t total_count;
+	size_t total_bytes;
+	size_t freed_by_others;
+	size_t frees_of_others;
+} MemTrackThreadStats;
+
+/*
+ * memtrack_thread_id
+ * @return: number of the calling thread in the thread statistics, assigned from 1 in the order threads first use the library
+ * @note: numbers are never reused; threads numbered above MEMTRACK_THREAD_COUNT all share MEMTRACK_THREAD_COUNT + 1
+ */
+extern unsigned int memtrack_thread_id (void);
+
+/*
+ * memtrack_thread_snapshot
+ * @param stats: array to store the statistics in, may be NULL only if capacity is 0
+ * @param capacity: number of elements in stats
+ * @return: number of threads that have allocated or freed a block so far, which may be larger than capacity (only the first capacity are stored)
+ * @note: does not take any lock, so the counters of a thread being updated concurrently may be slightly out of step with each other
+ */
+extern size_t memtrack_thread_snapshot (MemTrackThreadStats* stats, size_t capacity);
+#endif
+
+
+#ifdef MEMTRACK_TAGS
+/*
+ * The following functions are only available when the library is built with the
+ * MEMTRACK_TAGS macro.
+ */
+
+/*
+ * MemTrackTagStats
+ * tag: tag number as returned by memtrack_tag_register, 0 collects the blocks allocated without a tag
+ * name: name given to memtrack_tag_register, NULL for tag 0
+ * live_bytes, live_count: bytes and number of blocks with this tag that are still alive
+ * peak_bytes: highest value live_bytes has reached
+ * total_count, total_bytes: number of allocations made with this tag and the sum of their sizes, a realloc counts as a new allocation
+ */
+typedef struct {
+	unsigned int tag;
+	const char* name;
+	size_t live_bytes;
+	size_t live_count;
+	size_t peak_bytes;
+	size_t total_count;
+	size_t total_bytes;
+} MemTrackTagStats;
+
+/*
+ * memtrack_tag_register
+ * @param name: name of the tag, the string must remain valid until the program exits
+ * @return: tag number from 1, the existing number if name is already registered, or 0 on failure (errno is set to ENOSPC if MEMTRACK_TAG_COUNT tags are already registered)
+ * @note: intended to be called during initialization; two threads registering the same name at the same time may get different numbers
+ */
+extern unsigned int memtrack_tag_register (const char* name);
+
+/*
+ * memtrack_push_tag
+ * @param tag: tag number to stamp on the blocks the calling thread allocates from now on, 0 for no tag
+ * @note: displays a message and keeps the current tag if tag is not registered or if the stack is deeper than MEMTRACK_TAG_DEPTH (default 16); every call must still be matched by memtrack_pop_tag
+ */
+extern void memtrack_push_tag (unsigned int tag);
+
+/*
+ * memtrack_pop_tag
+ * @note: restores the tag that was current before the matching memtrack_push_tag; displays a message if the stack is empty
+ */
+extern void memtrack_pop_tag (void);
+
+/*
+ * memtrack_current_tag
+ * @return: tag number stamped on the blocks the calling thread allocates, 0 for no tag
+ */
+extern unsigned int memtrack_current_tag (void);
+
+/*
+ * memtrack_tag_snapshot
+ * @param stats: array to store the statistics in, may be NULL only if capacity is 0
+ * @param capacity: number of elements in stats
+ * @return: number of registered tags, plus one if blocks were allocated without a tag, which may be larger than capacity (only the first capacity are stored)
+ * @note: does not take any lock, so the counters of a tag being updated concurrently may be slightly out of step with each other
+ */
+extern size_t memtrack_tag_snapshot (MemTrackTagStats* stats, size_t capacity);
+
+#define MEMTRACK_TAG_SCOPE_NAME_(line) memtrack_tag_scope_##line
+#define MEMTRACK_TAG_SCOPE_NAME(line) MEMTRACK_TAG_SCOPE_NAME_(line)
+
+/*
+ * MEMTRACK_TAG_SCOPE
+ * @param tag: tag number to push for the statement or block that follows
+ * @note: pops the tag when the statement or block completes; leaving it with break, goto, or return skips the pop
+ */
+#define MEMTRACK_TAG_SCOPE(tag) for (int MEMTRACK_TAG_SCOPE_NAME(__LINE__) = (memtrack_push_tag(tag), 1); MEMTRACK_TAG_SCOPE_NAME(__LINE__); MEMTRACK_TAG_SCOPE_NAME(__LINE__) = (memtrack_pop_tag(), 0))
+#endif
+
+
+#ifdef MEMTRACK_BUDGET
+/*
+ * The following functions are only available when the library is built with the
+ * MEMTRACK_BUDGET macro.
+ */
+
+/*
+ * MemTrackPressureFunc
+ * @param size: size of the allocation that would exceed a cap
+ * @param file, line: call site of the allocation
+ * @param arg: argument given to memtrack_set_pressure_func
+ * @note: called at most once per allocation, with the caps checked again afterwards; allocations made from inside the function are not passed to it again. Outside sharded mode the global lock is held, so blocks must be freed with memtrack_free_without_lock
+ */
+typedef void (*MemTrackPressureFunc) (size_t size, const char* file, int line, void* arg);
+
+/*
+ * memtrack_set_budget
+ * @param limit: maximum bytes of all live tracked blocks, 0 removes the cap
+ * @note: blocks already alive are not affected, only later allocations are checked
+ */
+extern void memtrack_set_budget (size_t limit);
+
+/*
+ * memtrack_set_site_budget
+ * @param file, line: call site to cap
+ * @param limit: maximum live bytes of the blocks allocated at this call site, 0 removes the cap
+ * @return: false if the site table is full (errno is set to ENOSPC)
+ */
+extern bool memtrack_set_site_budget (const char* file, int line, size_t limit);
+
+#ifdef MEMTRACK_TAGS
+/*
+ * memtrack_set_tag_budget
+ * @param tag: tag number as returned by memtrack_tag_register, 0 caps the blocks allocated without a tag
+ * @param limit: maximum live bytes of the blocks with this tag, 0 removes the cap
+ * @return: false if tag is not registered (errno is set to EINVAL)
+ * @note: only available when the library is also built with the MEMTRACK_TAGS macro
+ */
+extern bool memtrack_set_tag_budget (unsigned int tag, size_t limit);
+#endif
+
+/*
+ * memtrack_set_pressure_func
+ * @param func: function called when an allocation would exceed a cap, NULL to remove it
+ * @param arg: argument passed to func
+ * @note: func and arg are stored separately, so they should not be changed while other threads are allocating
+ */
+extern void memtrack_set_pressure_func (MemTrackPressureFunc func, void* arg);
+
+/*
+ * memtrack_budget_admit
+ * @param size: size about to be allocated
+ * @param file, line: call site the allocation will be recorded under
+ * @return: true if size fits in the caps, possibly after calling the pressure function; otherwise false (errno is set to ENOMEM)
+ * @note: used by the companion libraries before calling the allocator themselves; does not reserve anything
+ */
+extern bool memtrack_budget_admit (size_t size, const char* file, int line);
+
+/*
+ * memtrack_budget_used
+ * @return: bytes of all live tracked blocks counted against the global cap
+ */
+extern size_t memtrack_budget_used (void);
+#endif
+
+
+#ifdef MEMTRACK_DEFERRED_DIAG
+/*
+ * The following functions are only available when the library is built with the
+ * MEMTRACK_DEFERRED_DIAG macro.
+ */
+
+/*
+ * memtrack_diag_flush
+ * @note: prints all queued diagnostic messages and the number of messages dropped since the previous flush to stderr, must not be called between memtrack_lock and memtrack_unlock
+ */
+extern void memtrack_diag_flush (void);
+
+/*
+ * memtrack_diag_dropped_count
+ * @return: total number of messages dropped by the rate limit or because the queue was full
+ */
+extern size_t memtrack_diag_dropped_count (void);
+#endif
+
+
+#ifdef MEMTRACK_TRACE
+/*
+ * memtrack_trace_start
+ * @param path: the trace file to create, an existing file is overwritten
+ * @param record_count: number of records kept in the ring, rounded up to a power of 2 (0 means MEMTRACK_TRACE_RECORD_COUNT, default 65536)
+ * @return: true if recording has started, false on failure
+ * @note: the trace can be started only once per process, events before the call are not recorded
+ */
+extern bool memtrack_trace_start (const char* path, size_t record_count);
+#endif
+
+
+#ifdef MEMTRACK_HISTOGRAM
+/*
+ * The following type and function are only available when the library is built with
+ * the MEMTRACK_HISTOGRAM macro.
+ */
+
+#define MEMTRACK_HISTOGRAM_BUCKETS 65  /* bucket 0 counts 0, bucket i (1 to 64) counts values from 2^(i-1) to 2^i - 1 */
+
+/*
+ * MemTrackHistogram
+ * sizes: number of allocations and reallocations per requested size in bytes
+ * lifetimes: number of freed blocks per time from the allocation to the free in nanoseconds
+ */
+typedef struct {
+	size_t sizes[MEMTRACK_HISTOGRAM_BUCKETS];
+	size_t lifetimes[MEMTRACK_HISTOGRAM_BUCKETS];
+} MemTrackHistogram;
+
+/*
+ * memtrack_histogram_get
+ * @param histogram: where to store the sums over all threads, displays a message and does nothing if NULL
+ * @note: does not take the lock of the tracking table, counts being added concurrently may be missed
+ */
+extern void memtrack_histogram_get (MemTrackHistogram* histogram);
+#endif
+
+
+#ifdef MEMTRACK_REPORTER
+/*
+ * The following type and functions are only available when the library is built with
+ * the MEMTRACK_REPORTER macro.
+ */
+
+/*
+ * MemTrackReportFunc
+ * @param text: the metrics in the Prometheus text exposition format, valid only during the call
+ * @param length: length of text in bytes, not including the terminating NUL
+ * @param arg: the arg passed to memtrack_reporter_start
+ */
+typedef void (*MemTrackReportFunc)(const char* text, size_t length, void* arg);
+
+/*
+ * memtrack_reporter_start
+ * @param path: file to write the metrics to (path.tmp is used while writing), or NULL to only call func
+ * @param func: function called with the metrics from the reporter thread, or NULL to only write path
+ * @param arg: passed to func as is
+ * @param interval_ms: milliseconds between two reports, displays a message and returns false if 0
+ * @return: true if the reporter thread has started, false on failure
+ * @note: path and func must not both be NULL; fails with EBUSY if the reporter is already running
+ */
+extern bool memtrack_reporter_start (const char* path, MemTrackReportFunc func, void* arg, unsigned int interval_ms);
+
+/*
+ * memtrack_reporter_stop
+ * @note: stops the reporter thread and waits for it to finish, does nothing if it is not running; must not be called from func
+ */
+extern void memtrack_reporter_stop (void);
+#endif
+
+
+#ifdef MEMTRACK_FORK_SAFE
+/*
+ * The following functions are only available when the library is built with the
+ * MEMTRACK_FORK_SAFE macro.
+ */
+
+/*
+ * memtrack_set_fork_discard
+ * @param discard: true (the default) to start a new generation in the child after fork, false to keep reporting the parent's entries there
+ */
+extern void memtrack_set_fork_discard (bool discard);
+
+/*
+ * memtrack_new_generation
+ * @return: the new generation
+ * @note: the entries alive before the call are left out of reports and the exit handler from now on, but can still be freed and reallocated; a block allocated by another thread during the call may end up in either generation
+ */
+extern unsigned int memtrack_new_generation (void);
+
+/*
+ * memtrack_get_generation
+ * @return: the current generation, 0 until the first new generation is started
+ */
+extern unsigned int memtrack_get_generation (void);
+#endif
+
+
+#ifdef MEMTRACK_CALL_SITE
+/*
+ * The following functions are only available when the library is built with the
+ * MEMTRACK_CALL_SITE macro. They behave like the functions without _at, but take the
+ * caller's location as a single pointer to a MemTrackCallSite, which must stay valid
+ * until the program exits (usually specified with MEMTRACK_CALL_SITE_HERE).
+ */
+
+/*
+ * memtrack_malloc_at
+ * @note: this function is a wrapper for memtrack_malloc
+ */
+extern void* memtrack_malloc_at (size_t size, const MemTrackCallSite* site);
+
+/*
+ * memtrack_calloc_at
+ * @note: this function is a wrapper for memtrack_calloc
+ */
+extern void* memtrack_calloc_at (size_t count, size_t size, const MemTrackCallSite* site);
+
+/*
+ * memtrack_realloc_at
+ * @note: this function is a wrapper for memtrack_realloc
+ */
+extern void* memtrack_realloc_at (void* ptr, size_t size, const MemTrackCallSite* site);
+
+/*
+ * memtrack_free_at
+ * @note: this function is a wrapper for memtrack_free
+ */
+extern void memtrack_free_at (void* ptr, const MemTrackCallSite* site);
+#endif
+
 
 
 /*
@@ -297,6 +1088,55 @@ extern void memtrack_entry_update (void* old_ptr, void* new_ptr, size_t new_size
  */
 extern void memtrack_entry_free (void* ptr, const char* file, int line);
 
+/*
+ * memtrack_report
+ * @param message: description of the problem without a trailing newline, must stay valid until the program exits (usually a string literal)
+ * @param ptr: pointer the message is about, or NULL
+ * @param file: name of the file calling the wrapper function that calls this function
+ * @param line: line number of the point where the wrapper function calling this function is invoked
+ * @note: prints the message to stderr in the same format as the library's own messages, or queues it when the library is built with the MEMTRACK_DEFERRED_DIAG macro
+ */
+extern void memtrack_report (const char* message, const void* ptr, const char* file, int line);
+
+
+#ifdef MEMTRACK_HEADER
+/*
+ * The following functions are only available when the library is built with the
+ * MEMTRACK_HEADER macro, and are meant for wrappers that allocate blocks themselves.
+ */
+
+/*
+ * memtrack_header_prefix
+ * @param alignment: alignment required for the user block, a power of 2 (values smaller than alignof(max_align_t) are raised to it)
+ * @return: number of bytes to allocate in front of the user block, a multiple of the alignment
+ */
+extern size_t memtrack_header_prefix (size_t alignment);
+
+/*
+ * memtrack_header_attach
+ * @param base: pointer to a block of at least prefix + size bytes obtained from the malloc family, displays a message and returns NULL if NULL
+ * @param prefix: value returned by memtrack_header_prefix
+ * @param size: size of the user block, no value check is performed
+ * @param file: name of the file calling the wrapper function that calls this function
+ * @param line: line number of the point where the wrapper function calling this function is invoked
+ * @return: pointer to the user block (base + prefix), or NULL on failure
+ */
+extern void* memtrack_header_attach (void* base, size_t prefix, size_t size, const char* file, int line);
+
+/*
+ * memtrack_header_transfer
+ * @param old_ptr: pointer to the tracked memory block being replaced, it is freed by this function
+ * @param new_base: pointer to a block of at least prefix + size bytes obtained from the malloc family, must not be NULL
+ * @param prefix: value returned by memtrack_header_prefix
+ * @param size: size of the new user block, no value check is performed
+ * @param file: name of the file calling the wrapper function that calls this function
+ * @param line: line number of the point where the wrapper function calling this function is invoked
+ * @return: pointer to the new user block (new_base + prefix), or NULL on failure
+ * @note: the contents must be copied to new_base + prefix before calling this function
+ */
+extern void* memtrack_header_transfer (void* old_ptr, void* new_base, size_t prefix, size_t size, const char* file, int line);
+#endif
+
 
 /*
  * The following functions must not be used outside of a lock. When working outside the
@@ -382,6 +1222,100 @@ extern void* memtrack_realloc_array_without_lock (void* ptr, size_t count, size_
  */
 extern size_t memtrack_get_size_without_lock (void* ptr, const char* file, int line);
 
+/*
+ * memtrack_malloc_batch_without_lock
+ * @param count: number of memory blocks to allocate, displays a message and returns false if count is 0
+ * @param sizes: array of count sizes in bytes, displays a message and returns false if NULL or if any size is 0
+ * @param ptrs: array of count elements to store the pointers to the allocated memory blocks in, displays a message and returns false if NULL
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true on success, false on failure
+ * @note: on failure, no memory block is left allocated and every element of ptrs is set to NULL (unless ptrs itself is NULL)
+ */
+extern bool memtrack_malloc_batch_without_lock (size_t count, const size_t sizes[], void* ptrs[], const char* file, int line);
+
+/*
+ * memtrack_free_batch_without_lock
+ * @param ptrs: array of count pointers to the memory blocks to free, NULL elements are skipped; displays a message and does nothing if ptrs itself is NULL
+ * @param count: number of elements in ptrs, no action is taken if 0
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ */
+extern void memtrack_free_batch_without_lock (void* ptrs[], size_t count, const char* file, int line);
+
+/*
+ * MemTrackEntryHandle
+ * ptr: the memory block passed to memtrack_entry_acquire_without_lock
+ * size: size of the memory block in bytes recorded in its entry, 0 if no entry was found (the usable size of a block that was not sampled when the library is built with the MEMTRACK_SAMPLING macro)
+ * @note: the other members are internal and must not be modified; the handle must be passed to exactly one of memtrack_entry_commit_without_lock, memtrack_entry_release_without_lock, or memtrack_realloc_entry_without_lock before the lock is released
+ */
+typedef struct {
+	void* ptr;
+	size_t size;
+	void* entry;
+	int state;
+	long long storage[14];
+} MemTrackEntryHandle;
+
+/*
+ * memtrack_entry_acquire_without_lock
+ * @param ptr: pointer to the memory block whose entry is to be acquired, displays a message and returns false if NULL
+ * @param handle: handle to store the entry in, displays a message and returns false if NULL
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: true if the size of the memory block is known, false otherwise
+ * @note: looks up the entry once so that the size can be read and the entry updated without another lookup; when the library is built with the MEMTRACK_SHARDED or MEMTRACK_SAMPLING macro, the entry is removed from the table until the handle is committed or released
+ */
+extern bool memtrack_entry_acquire_without_lock (void* ptr, MemTrackEntryHandle* handle, const char* file, int line);
+
+/*
+ * memtrack_entry_commit_without_lock
+ * @param handle: handle filled by memtrack_entry_acquire_without_lock, displays a message and does nothing if NULL
+ * @param new_ptr: pointer to the memory after update, the value of handle->ptr is used if NULL
+ * @param new_size: size of the memory after update, no value check is performed
+ * @param file: name of the file calling the wrapper function that calls this function
+ * @param line: line number of the point where the wrapper function calling this function is invoked
+ * @note: same as memtrack_entry_update for handle->ptr, without looking up the entry again; a block allocated with a header cannot be moved with this function
+ */
+extern void memtrack_entry_commit_without_lock (MemTrackEntryHandle* handle, void* new_ptr, size_t new_size, const char* file, int line);
+
+/*
+ * memtrack_entry_release_without_lock
+ * @param handle: handle filled by memtrack_entry_acquire_without_lock, no action is taken if NULL
+ * @param file: name of the file calling the wrapper function that calls this function
+ * @param line: line number of the point where the wrapper function calling this function is invoked
+ * @note: gives up the handle and leaves the entry unchanged
+ */
+extern void memtrack_entry_release_without_lock (MemTrackEntryHandle* handle, const char* file, int line);
+
+/*
+ * memtrack_entry_handle_recorded
+ * @param handle: handle filled by memtrack_entry_acquire_without_lock, returns false if NULL
+ * @return: true if handle->size is the size recorded in an entry, false otherwise (including a block that was not sampled, whose handle->size is only its usable size)
+ */
+extern bool memtrack_entry_handle_recorded (const MemTrackEntryHandle* handle);
+
+/*
+ * memtrack_realloc_entry_without_lock
+ * @param handle: handle filled by memtrack_entry_acquire_without_lock, displays a message and returns NULL if NULL
+ * @param size: new size of the memory block in bytes, the memory block is freed and returns NULL if size is 0
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: pointer to reallocated memory block, or NULL on failure
+ * @note: same as memtrack_realloc_without_lock for handle->ptr, without looking up the entry again; the handle is used up even on failure
+ */
+extern void* memtrack_realloc_entry_without_lock (MemTrackEntryHandle* handle, size_t size, const char* file, int line);
+
+/*
+ * memtrack_cursor_next_without_lock
+ * @param cursor: cursor initialized with memtrack_cursor_init, displays a message and returns 0 if NULL
+ * @param infos: array to store the information of the next entries in, may be NULL only if capacity is 0
+ * @param capacity: number of elements in infos
+ * @return: number of entries stored, 0 once all entries have been returned
+ * @note: does not allocate memory; the lock must be held from the first call to the last, since entries added or removed in between may otherwise be skipped or returned twice
+ */
+extern size_t memtrack_cursor_next_without_lock (MemTrackCursor* cursor, MemTrackEntryInfo* infos, size_t capacity);
+
 
 #else  /* defined MEMTRACK_DISABLE */
 
@@ -418,6 +1352,23 @@ extern void* calloc_array (size_t count, size_t size);
  */
 extern void* realloc_array (void* ptr, size_t count, size_t size);
 
+/*
+ * malloc_batch
+ * @param count: number of memory blocks to allocate, returns false if count is 0
+ * @param sizes: array of count sizes in bytes, returns false if NULL or if any size is 0
+ * @param ptrs: array of count elements to store the pointers to the allocated memory blocks in, returns false if NULL
+ * @return: true on success, false on failure
+ * @note: on failure, no memory block is left allocated and every element of ptrs is set to NULL (unless ptrs itself is NULL)
+ */
+extern bool malloc_batch (size_t count, const size_t sizes[], void* ptrs[]);
+
+/*
+ * free_batch
+ * @param ptrs: array of count pointers to the memory blocks to free, NULL elements are skipped; no action is taken if ptrs itself is NULL
+ * @param count: number of elements in ptrs
+ */
+extern void free_batch (void* ptrs[], size_t count);
+
 
 #endif
 
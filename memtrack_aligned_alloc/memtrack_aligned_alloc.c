@@ -32,6 +32,9 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <stdint.h>
+#include <stdalign.h>
+#include <stdatomic.h>
 
 
 #if !defined (__STDC_VERSION__) || (__STDC_VERSION__ < 201112L)
@@ -51,10 +54,24 @@
 #ifndef MEMTRACK_DISABLE
 
 
+#undef malloc
+#undef calloc
+#undef realloc
 #undef free
 #undef aligned_alloc
 
 
+#if !defined (MEMTRACK_HEADER) && defined (__GLIBC__)
+	#include <malloc.h>  /* 確保済みの領域に収まるかを malloc_usable_size で調べる */
+#endif
+
+
+/* これ以上の大きさのブロックは realloc でページごと付け替えられることが多いため、配置が保たれることを期待して realloc を試す（実際に付け替えられたかは調べない） */
+#ifndef MEMTRACK_ALIGNED_LARGE_THRESHOLD
+	#define MEMTRACK_ALIGNED_LARGE_THRESHOLD (128 * 1024)
+#endif
+
+
 #ifdef __GNUC__
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-macros"
@@ -69,44 +86,65 @@
 #endif
 
 
-static void* memtrack_aligned_alloc_without_entry_add (size_t alignment, size_t size, const char* file, int line) {
+static bool memtrack_aligned_check (size_t alignment, size_t size, const char* file, int line) {
 	if (!ht_is_power_of_two(alignment)) {
-		fprintf(stderr, "Alignment must be a power of 2.\nFile: %s   Line: %d\n", file, line);
+		memtrack_report("Alignment must be a power of 2.", NULL, file, line);
 		memtrack_errfunc = "memtrack_aligned_alloc";
-		return NULL;
+		return false;
 	}
 
 	if (alignment < sizeof(void*)) {
-		fprintf(stderr, "Alignment must be greater than or equal to sizeof(void*).\nFile: %s   Line: %d\n", file, line);
+		memtrack_report("Alignment must be greater than or equal to sizeof(void*).", NULL, file, line);
 		errno = EINVAL;
 		memtrack_errfunc = "memtrack_aligned_alloc";
-		return NULL;
+		return false;
 	}
 
 	if (size == 0) {
-		fprintf(stderr, "No processing was done because size is zero.\nFile: %s   Line: %d\n", file, line);
+		memtrack_report("No processing was done because size is zero.", NULL, file, line);
 		errno = EINVAL;
 		memtrack_errfunc = "memtrack_aligned_alloc";
-		return NULL;
+		return false;
 	}
 
 	if (size < alignment) {
-		fprintf(stderr, "Size must be greater than or equal to alignment.\nFile: %s   Line: %d\n", file, line);
+		memtrack_report("Size must be greater than or equal to alignment.", NULL, file, line);
 		errno = EINVAL;
 		memtrack_errfunc = "memtrack_aligned_alloc";
-		return NULL;
+		return false;
 	}
 
 	if ((size % alignment) != 0) {
-		fprintf(stderr, "Size must be a multiple of alignment.\nFile: %s   Line: %d\n", file, line);
+		memtrack_report("Size must be a multiple of alignment.", NULL, file, line);
 		errno = EINVAL;
 		memtrack_errfunc = "memtrack_aligned_alloc";
-		return NULL;
+		return false;
 	}
 
+	return true;
+}
+
+
+/* MEMTRACK_HEADER 定義時は、ヘッダーの領域を含めたブロックの先頭を返す */
+static void* memtrack_aligned_alloc_without_entry_add (size_t alignment, size_t size, const char* file, int line) {
+	if (!memtrack_aligned_check(alignment, size, file, line)) return NULL;
+
+#ifndef MEMTRACK_HEADER
 	void* ptr = aligned_alloc(alignment, size);
+#else
+	/* ヘッダーの領域も alignment の倍数で確保し、ユーザー領域の配置を保つ */
+	size_t prefix = memtrack_header_prefix(alignment);
+	if (UNLIKELY(size > (SIZE_MAX - prefix))) {
+		memtrack_report("Memory allocation overflow.", NULL, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_aligned_alloc";
+		return NULL;
+	}
+
+	void* ptr = aligned_alloc(alignment, prefix + size);
+#endif
 	if (UNLIKELY(ptr == NULL)) {
-		fprintf(stderr, "Memory allocation failed.\nFile: %s   Line: %d\n", file, line);
+		memtrack_report("Memory allocation failed.", NULL, file, line);
 		errno = ENOMEM;
 		memtrack_errfunc = "memtrack_aligned_alloc";
 	}
@@ -115,6 +153,13 @@ static void* memtrack_aligned_alloc_without_entry_add (size_t alignment, size_t
 
 
 void* memtrack_aligned_alloc_without_lock (size_t alignment, size_t size, const char* file, int line) {
+#ifdef MEMTRACK_BUDGET
+	if (size != 0 && UNLIKELY(!memtrack_budget_admit(size, file, line))) {
+		memtrack_errfunc = "memtrack_aligned_alloc";
+		return NULL;
+	}
+#endif
+
 	void* ptr = memtrack_aligned_alloc_without_entry_add(alignment, size, file, line);
 
 	if (ptr != NULL) {
@@ -123,7 +168,11 @@ void* memtrack_aligned_alloc_without_lock (size_t alignment, size_t size, const
 #endif
 		errno = 0;
 
+#ifndef MEMTRACK_HEADER
 		memtrack_entry_add(ptr, size, file, line);
+#else
+		ptr = memtrack_header_attach(ptr, memtrack_header_prefix(alignment), size, file, line);
+#endif
 
 		if (UNLIKELY(errno != 0)) memtrack_errfunc = "memtrack_aligned_alloc";
 #ifdef MAYBE_ERRNO_THREAD_LOCAL
@@ -145,12 +194,12 @@ void* memtrack_aligned_alloc (size_t alignment, size_t size, const char* file, i
 
 void* memtrack_aligned_calloc_without_lock (size_t alignment, size_t count, size_t size, const char* file, int line) {
 	if (count == 0) {
-		fprintf(stderr, "No processing was done because the count is zero.\nFile: %s   Line: %d\n", file, line);
+		memtrack_report("No processing was done because the count is zero.", NULL, file, line);
 		errno = EINVAL;
 		memtrack_errfunc = "memtrack_aligned_calloc";
 		return NULL;
 	} else if (size > (SIZE_MAX / count)) {
-		fprintf(stderr, "Memory allocation overflow.\nFile: %s   Line: %d\n", file, line);
+		memtrack_report("Memory allocation overflow.", NULL, file, line);
 		errno = EINVAL;
 		memtrack_errfunc = "memtrack_aligned_calloc";
 		return NULL;
@@ -174,34 +223,38 @@ void* memtrack_aligned_calloc (size_t alignment, size_t count, size_t size, cons
 }
 
 
-void* memtrack_aligned_realloc_without_lock (void* ptr, size_t alignment, size_t size, const char* file, int line) {
-	if (ptr == NULL) {
-		void* new_ptr = memtrack_aligned_alloc_without_lock(alignment, size, file, line);
-		if (new_ptr == NULL)
-			memtrack_errfunc = "memtrack_aligned_realloc";
-		return new_ptr;
-	}
+/* 各経路を通った回数、ロックを取らずに読み書きする */
+static struct {
+	atomic_size_t in_place;
+	atomic_size_t realloc;
+	atomic_size_t large_realloc;
+	atomic_size_t copy;
+	atomic_size_t misaligned;
+} memtrack_aligned_stats;
 
-	if (size == 0) {
-		fprintf(stderr, "Undefined behavior because the size is zero, do not use anymore. The memory block will be freed and NULL will be returned.\nFile: %s   Line: %d\n", file, line);
-		errno = EINVAL;
-		memtrack_errfunc = "memtrack_aligned_realloc";
 
-		memtrack_free_without_lock(ptr, file, line);
-		return NULL;
-	}
+static inline bool memtrack_aligned_holds (const void* ptr, size_t alignment) {
+	return ((uintptr_t)ptr & (alignment - 1)) == 0;
+}
 
-	size_t old_size = memtrack_get_size_without_lock(ptr, __FILE__, __LINE__);
-	if (old_size == 0) {
-		memtrack_errfunc = "memtrack_aligned_realloc";
-		return NULL;
-	}
 
-	void* new_ptr = memtrack_aligned_alloc_without_entry_add(alignment, size, file, line);
-	if (new_ptr == NULL) {
-		memtrack_errfunc = "memtrack_aligned_realloc";
-		return NULL;
-	}
+#ifndef MEMTRACK_HEADER
+/* ブロックを動かさずに使える大きさ、調べられない環境では 0 を返す */
+static inline size_t memtrack_aligned_usable_size (void* ptr) {
+#ifdef __GLIBC__
+	return malloc_usable_size(ptr);
+#else
+	(void)ptr;
+	return 0;
+#endif
+}
+#endif
+
+
+/* handle で取得済みのブロックを配置を保って realloc する、引数の確認は呼び出し元で済ませておく */
+static void* memtrack_aligned_realloc_entry (MemTrackEntryHandle* handle, size_t alignment, size_t size, const char* file, int line) {
+	void* ptr = handle->ptr;
+	size_t old_size = handle->size;
 
 	size_t copy_size;
 	if (old_size < size)
@@ -209,6 +262,104 @@ void* memtrack_aligned_realloc_without_lock (void* ptr, size_t alignment, size_t
 	else
 		copy_size = size;
 
+#ifdef MEMTRACK_BUDGET
+	/* どの経路でも増える分だけを確かめる、realloc に任せる経路では memtrack.c でも同じ確認を行う */
+	if (old_size < size && UNLIKELY(!memtrack_budget_admit(size - old_size, file, line))) {
+		memtrack_entry_release_without_lock(handle, file, line);
+		memtrack_errfunc = "memtrack_aligned_realloc";
+		return NULL;
+	}
+#endif
+
+	void* new_ptr = NULL;  /* 写し直す先の揃ったブロック */
+
+	if (memtrack_aligned_holds(ptr, alignment)) {
+#ifndef MEMTRACK_HEADER
+		/* 縮小する場合と、確保済みの領域に収まる場合は動かさずにサイズだけを書き換える */
+		if (size <= old_size || size <= memtrack_aligned_usable_size(ptr)) {
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+			int tmp_errno = errno;
+#endif
+			errno = 0;
+
+			memtrack_entry_commit_without_lock(handle, ptr, size, file, line);
+
+			if (UNLIKELY(errno != 0)) memtrack_errfunc = "memtrack_aligned_realloc";
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+			else errno = tmp_errno;
+#endif
+			atomic_fetch_add_explicit(&memtrack_aligned_stats.in_place, 1, memory_order_relaxed);
+			return ptr;
+		}
+#endif
+
+		/*
+		 * 基本的な配置なら realloc の結果は必ず揃い、大きなブロックはページの付け替えで配置が保たれやすい
+		 * （ヘッダーモードでは縮小も realloc に任せる、ヘッダーは alignment の倍数なのでブロックの先頭の配置と同じになる）
+		 */
+#ifndef MEMTRACK_HEADER
+		bool try_realloc = (alignment <= alignof(max_align_t) || size >= MEMTRACK_ALIGNED_LARGE_THRESHOLD);
+#else
+		bool try_realloc = (size <= old_size || alignment <= alignof(max_align_t) || size >= MEMTRACK_ALIGNED_LARGE_THRESHOLD);
+#endif
+		if (try_realloc) {
+			/*
+			 * 配置が崩れた時点で元のブロックは realloc に解放されているため、写し直す先は realloc の前に確保しておく
+			 * 基本的な配置なら realloc の結果は必ず揃うので確保しない
+			 */
+			if (alignment > alignof(max_align_t)) {
+				new_ptr = memtrack_aligned_alloc_without_entry_add(alignment, size, file, line);
+				if (new_ptr == NULL) {
+					memtrack_entry_release_without_lock(handle, file, line);
+					memtrack_errfunc = "memtrack_aligned_realloc";
+					return NULL;
+				}
+			}
+
+			void* moved_ptr = memtrack_realloc_entry_without_lock(handle, size, file, line);
+			if (UNLIKELY(moved_ptr == NULL)) {  /* 元のブロックとエントリは有効なまま */
+				free(new_ptr);
+				memtrack_errfunc = "memtrack_aligned_realloc";
+				return NULL;
+			}
+
+			if (LIKELY(memtrack_aligned_holds(moved_ptr, alignment))) {
+				free(new_ptr);
+				if (alignment > alignof(max_align_t) && size >= MEMTRACK_ALIGNED_LARGE_THRESHOLD)
+					atomic_fetch_add_explicit(&memtrack_aligned_stats.large_realloc, 1, memory_order_relaxed);
+				else
+					atomic_fetch_add_explicit(&memtrack_aligned_stats.realloc, 1, memory_order_relaxed);
+				return moved_ptr;
+			}
+
+			/* 配置が崩れた場合は、移動先のブロックから揃ったブロックへ写し直す */
+			atomic_fetch_add_explicit(&memtrack_aligned_stats.misaligned, 1, memory_order_relaxed);
+			ptr = moved_ptr;
+			memtrack_entry_acquire_without_lock(ptr, handle, __FILE__, __LINE__);  /* 移動先のエントリを取得し直す */
+		}
+	}
+
+	if (new_ptr == NULL) {
+		new_ptr = memtrack_aligned_alloc_without_entry_add(alignment, size, file, line);
+		if (new_ptr == NULL) {
+			memtrack_entry_release_without_lock(handle, file, line);
+			memtrack_errfunc = "memtrack_aligned_realloc";
+			return NULL;
+		}
+	}
+	atomic_fetch_add_explicit(&memtrack_aligned_stats.copy, 1, memory_order_relaxed);
+
+#ifdef MEMTRACK_HEADER
+	memtrack_entry_release_without_lock(handle, file, line);  /* 移し替えは memtrack_header_transfer が ptr から行う */
+
+	size_t prefix = memtrack_header_prefix(alignment);
+	memcpy((char*)new_ptr + prefix, ptr, copy_size);
+
+	new_ptr = memtrack_header_transfer(ptr, new_ptr, prefix, size, file, line);
+	if (UNLIKELY(new_ptr == NULL))
+		memtrack_errfunc = "memtrack_aligned_realloc";
+	return new_ptr;
+#else
 	memcpy(new_ptr, ptr, copy_size);
 
 #ifdef MAYBE_ERRNO_THREAD_LOCAL
@@ -216,14 +367,51 @@ void* memtrack_aligned_realloc_without_lock (void* ptr, size_t alignment, size_t
 #endif
 	errno = 0;
 
-	memtrack_entry_update(ptr, new_ptr, size, file, line);
+	memtrack_entry_commit_without_lock(handle, new_ptr, size, file, line);
 
 	if (UNLIKELY(errno != 0)) memtrack_errfunc = "memtrack_aligned_realloc";
 #ifdef MAYBE_ERRNO_THREAD_LOCAL
 	else errno = tmp_errno;
 #endif
 
-	free(ptr); /* By design, ptr will always be different from new_ptr. */
+	free(ptr); /* The copy path always allocates a new block, so ptr differs from new_ptr here. */
+	return new_ptr;
+#endif
+}
+
+
+void* memtrack_aligned_realloc_without_lock (void* ptr, size_t alignment, size_t size, const char* file, int line) {
+	if (ptr == NULL) {
+		void* new_ptr = memtrack_aligned_alloc_without_lock(alignment, size, file, line);
+		if (new_ptr == NULL)
+			memtrack_errfunc = "memtrack_aligned_realloc";
+		return new_ptr;
+	}
+
+	if (size == 0) {
+		memtrack_report("Undefined behavior because the size is zero, do not use anymore. The memory block will be freed and NULL will be returned.", ptr, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_aligned_realloc";
+
+		memtrack_free_without_lock(ptr, file, line);
+		return NULL;
+	}
+
+	if (!memtrack_aligned_check(alignment, size, file, line)) {
+		memtrack_errfunc = "memtrack_aligned_realloc";
+		return NULL;
+	}
+
+	MemTrackEntryHandle handle;
+	if (!memtrack_entry_acquire_without_lock(ptr, &handle, __FILE__, __LINE__) || handle.size == 0) {
+		memtrack_entry_release_without_lock(&handle, file, line);
+		memtrack_errfunc = "memtrack_aligned_realloc";
+		return NULL;
+	}
+
+	void* new_ptr = memtrack_aligned_realloc_entry(&handle, alignment, size, file, line);
+	if (new_ptr == NULL)
+		memtrack_errfunc = "memtrack_aligned_realloc";
 	return new_ptr;
 }
 
@@ -244,19 +432,55 @@ void* memtrack_aligned_recalloc_without_lock (void* ptr, size_t alignment, size_
 		return new_ptr;
 	}
 
-	size_t old_size = memtrack_get_size_without_lock(ptr, __FILE__, __LINE__);
-	if (old_size == 0) {
+	if (count == 0)
+		memtrack_report("Undefined behavior because the count is zero, do not use anymore. The memory block will be freed and NULL will be returned.", ptr, file, line);
+
+	if (size == 0)
+		memtrack_report("Undefined behavior because the size is zero, do not use anymore. The memory block will be freed and NULL will be returned.", ptr, file, line);
+
+	if (count == 0 || size == 0) {
+		errno = EINVAL;
 		memtrack_errfunc = "memtrack_aligned_recalloc";
+
+		memtrack_free_without_lock(ptr, file, line);
 		return NULL;
 	}
 
-	void* new_ptr = memtrack_aligned_realloc_array_without_lock(ptr, alignment, count, size, file, line);
-	if (new_ptr == NULL) {
+	if (size > (SIZE_MAX / count)) {
+		memtrack_report("Memory allocation overflow.", ptr, file, line);
+		errno = EINVAL;
 		memtrack_errfunc = "memtrack_aligned_recalloc";
 		return NULL;
 	}
 
 	size_t new_size = count * size;
+	if (!memtrack_aligned_check(alignment, new_size, file, line)) {
+		memtrack_errfunc = "memtrack_aligned_recalloc";
+		return NULL;
+	}
+
+	/* 元のサイズの取得から付け直しまで同じハンドルを使い、エントリを探すのを 1 回で済ませる */
+	MemTrackEntryHandle handle;
+	if (!memtrack_entry_acquire_without_lock(ptr, &handle, __FILE__, __LINE__) || handle.size == 0) {
+		memtrack_entry_release_without_lock(&handle, file, line);
+		memtrack_errfunc = "memtrack_aligned_recalloc";
+		return NULL;
+	}
+	if (!memtrack_entry_handle_recorded(&handle)) {  /* 記録されていないブロックの handle.size は実際に使用できるサイズで、要求されたサイズが分からない */
+		memtrack_report("Cannot zero-fill a memory block that was not sampled.", ptr, file, line);
+		errno = EPERM;
+		memtrack_entry_release_without_lock(&handle, file, line);
+		memtrack_errfunc = "memtrack_aligned_recalloc";
+		return NULL;
+	}
+	size_t old_size = handle.size;
+
+	void* new_ptr = memtrack_aligned_realloc_entry(&handle, alignment, new_size, file, line);
+	if (new_ptr == NULL) {
+		memtrack_errfunc = "memtrack_aligned_recalloc";
+		return NULL;
+	}
+
 	if (old_size < new_size)
 		memset((char*)new_ptr + old_size, 0, new_size - old_size);
 	return new_ptr;
@@ -273,12 +497,12 @@ void* memtrack_aligned_recalloc (void* ptr, size_t alignment, size_t count, size
 
 void* memtrack_aligned_alloc_array_without_lock (size_t alignment, size_t count, size_t size, const char* file, int line) {
 	if (count == 0) {
-		fprintf(stderr, "No processing was done because the count is zero.\nFile: %s   Line: %d\n", file, line);
+		memtrack_report("No processing was done because the count is zero.", NULL, file, line);
 		errno = EINVAL;
 		memtrack_errfunc = "memtrack_aligned_alloc_array";
 		return NULL;
 	} else if (size > (SIZE_MAX / count)) {
-		fprintf(stderr, "Memory allocation overflow.\nFile: %s   Line: %d\n", file, line);
+		memtrack_report("Memory allocation overflow.", NULL, file, line);
 		errno = EINVAL;
 		memtrack_errfunc = "memtrack_aligned_alloc_array";
 		return NULL;
@@ -306,14 +530,14 @@ void* memtrack_aligned_calloc_array (size_t alignment, size_t count, size_t size
 
 void* memtrack_aligned_realloc_array_without_lock (void* ptr, size_t alignment, size_t count, size_t size, const char* file, int line) {
 	if (count == 0) {
-		fprintf(stderr, "Undefined behavior because the count is zero, do not use anymore. The memory block will be freed and NULL will be returned.\nFile: %s   Line: %d\n", file, line);
+		memtrack_report("Undefined behavior because the count is zero, do not use anymore. The memory block will be freed and NULL will be returned.", ptr, file, line);
 		errno = EINVAL;
 		memtrack_errfunc = "memtrack_aligned_realloc_array";
 
 		memtrack_free_without_lock(ptr, file, line);
 		return NULL;
 	} else if (size > (SIZE_MAX / count)) {
-		fprintf(stderr, "Memory allocation overflow.\nFile: %s   Line: %d\n", file, line);
+		memtrack_report("Memory allocation overflow.", ptr, file, line);
 		errno = EINVAL;
 		memtrack_errfunc = "memtrack_aligned_realloc_array";
 		return NULL;
@@ -339,6 +563,22 @@ void* memtrack_aligned_recalloc_array (void* ptr, size_t alignment, size_t count
 }
 
 
+void memtrack_aligned_realloc_stats (MemTrackAlignedReallocStats* stats) {
+	if (UNLIKELY(stats == NULL)) {
+		memtrack_report("stats is null!", NULL, __FILE__, __LINE__);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_aligned_realloc_stats";
+		return;
+	}
+
+	stats->in_place = atomic_load_explicit(&memtrack_aligned_stats.in_place, memory_order_relaxed);
+	stats->realloc = atomic_load_explicit(&memtrack_aligned_stats.realloc, memory_order_relaxed);
+	stats->large_realloc = atomic_load_explicit(&memtrack_aligned_stats.large_realloc, memory_order_relaxed);
+	stats->copy = atomic_load_explicit(&memtrack_aligned_stats.copy, memory_order_relaxed);
+	stats->misaligned = atomic_load_explicit(&memtrack_aligned_stats.misaligned, memory_order_relaxed);
+}
+
+
 #else  /* defined MEMTRACK_DISABLE */
 
 
@@ -101,7 +101,8 @@ extern void* memtrack_aligned_calloc (size_t alignment, size_t count, size_t siz
  * @param size: new size of the memory block in bytes, displays a message and returns NULL if size is 0 or not a multiple of alignment
  * @param file: name of the calling file, usually specified with __FILE__
  * @param line: line number of the caller, usually specified with __LINE__
- * @return: pointer to reallocated memory block, or NULL on failure
+ * @return: pointer to reallocated memory block, or NULL on failure (ptr is then left valid and unchanged)
+ * @note: for alignments above alignof(max_align_t), the block that the contents are copied to if realloc loses the alignment is allocated before realloc is tried and freed again if it is not needed
  */
 extern void* memtrack_aligned_realloc (void* ptr, size_t alignment, size_t size, const char* file, int line);
 
@@ -114,7 +115,7 @@ extern void* memtrack_aligned_realloc (void* ptr, size_t alignment, size_t size,
  * @param file: name of the calling file, usually specified with __FILE__
  * @param line: line number of the caller, usually specified with __LINE__
  * @return: pointer to reallocated memory block, or NULL on failure
- * @note: newly allocated memory beyond the original size is zero-initialized, displays a message and returns NULL if count * size is not a multiple of alignment
+ * @note: newly allocated memory beyond the original size is zero-initialized, displays a message and returns NULL if count * size is not a multiple of alignment or if the block was not sampled (MEMTRACK_SAMPLING)
  */
 extern void* memtrack_aligned_recalloc (void* ptr, size_t alignment, size_t count, size_t size, const char* file, int line);
 
@@ -169,6 +170,30 @@ extern void* memtrack_aligned_realloc_array (void* ptr, size_t alignment, size_t
 extern void* memtrack_aligned_recalloc_array (void* ptr, size_t alignment, size_t count, size_t size, const char* file, int line);
 
 
+/*
+ * MemTrackAlignedReallocStats
+ * in_place: resizes that kept the block where it was without calling realloc (shrinking, or growing within the space malloc_usable_size reports on glibc)
+ * realloc: resizes done by realloc whose result still had the alignment
+ * large_realloc: like realloc, for alignments above alignof(max_align_t) and sizes of at least MEMTRACK_ALIGNED_LARGE_THRESHOLD (default 128 KiB), where the alignment is expected to survive because the C library usually remaps pages of such blocks; this is a classification by size and alignment, whether the pages were actually remapped is not detected
+ * copy: resizes that allocated a new aligned block and copied the contents
+ * misaligned: realloc results that lost the alignment and had to be copied as well (also counted in copy)
+ */
+typedef struct {
+	size_t in_place;
+	size_t realloc;
+	size_t large_realloc;
+	size_t copy;
+	size_t misaligned;
+} MemTrackAlignedReallocStats;
+
+/*
+ * memtrack_aligned_realloc_stats
+ * @param stats: where to store the number of times memtrack_aligned_realloc and its variants took each path, displays a message and does nothing if NULL
+ * @note: the paths are tried in this order, a new block is allocated and the contents copied only as the last resort; in MEMTRACK_HEADER builds the in_place path is not used
+ */
+extern void memtrack_aligned_realloc_stats (MemTrackAlignedReallocStats* stats);
+
+
 
 /*
  * You must not use functions declared before this comment within the lock/unlock block.
@@ -35,11 +35,14 @@
 #include "memtrack_alloc_nd_array.h"
 
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
 
 
 #undef malloc
 #undef calloc
+#undef realloc
+#undef free
 #undef alloc_nd_array
 #undef calloc_nd_array
 
@@ -75,14 +78,21 @@ static void* calloc_wrapper (size_t size) {
 void* memtrack_alloc_nd_array_without_lock (const size_t sizes[], size_t dims, size_t elem_size, const char* file, int line) {
 	size_t size_ptrs, size_padding, total_elements;
 	if (!calculate_nd_array_size(sizes, dims, elem_size, &size_ptrs, &size_padding, &total_elements)) {
-		fprintf(stderr, "Invalid parameters for nd-array allocation.\nFile: %s   Line: %d\n", file, line);
+		memtrack_report("Invalid parameters for nd-array allocation.", NULL, file, line);
 		memtrack_errfunc = "memtrack_alloc_nd_array";
 		return NULL;
 	}
 
+#ifdef MEMTRACK_BUDGET
+	if (UNLIKELY(!memtrack_budget_admit(size_ptrs + size_padding + (total_elements * elem_size), file, line))) {
+		memtrack_errfunc = "memtrack_alloc_nd_array";
+		return NULL;
+	}
+#endif
+
 	void* ptr = allocate_and_initialize_nd_array(sizes, dims, elem_size, size_ptrs, size_padding, total_elements, malloc);
 	if (UNLIKELY(ptr == NULL)) {
-		fprintf(stderr, "Memory allocation failed.\nFile: %s   Line: %d\n", file, line);
+		memtrack_report("Memory allocation failed.", NULL, file, line);
 		memtrack_errfunc = "memtrack_alloc_nd_array";
 		return NULL;
 	}
@@ -114,14 +124,21 @@ void* memtrack_alloc_nd_array (const size_t sizes[], size_t dims, size_t elem_si
 void* memtrack_calloc_nd_array_without_lock (const size_t sizes[], size_t dims, size_t elem_size, const char* file, int line) {
 	size_t size_ptrs, size_padding, total_elements;
 	if (!calculate_nd_array_size(sizes, dims, elem_size, &size_ptrs, &size_padding, &total_elements)) {
-		fprintf(stderr, "Invalid parameters for nd-array allocation.\nFile: %s   Line: %d\n", file, line);
+		memtrack_report("Invalid parameters for nd-array allocation.", NULL, file, line);
+		memtrack_errfunc = "memtrack_calloc_nd_array";
+		return NULL;
+	}
+
+#ifdef MEMTRACK_BUDGET
+	if (UNLIKELY(!memtrack_budget_admit(size_ptrs + size_padding + (total_elements * elem_size), file, line))) {
 		memtrack_errfunc = "memtrack_calloc_nd_array";
 		return NULL;
 	}
+#endif
 
 	void* ptr = allocate_and_initialize_nd_array(sizes, dims, elem_size, size_ptrs, size_padding, total_elements, calloc_wrapper);
 	if (UNLIKELY(ptr == NULL)) {
-		fprintf(stderr, "Memory allocation failed.\nFile: %s   Line: %d\n", file, line);
+		memtrack_report("Memory allocation failed.", NULL, file, line);
 		memtrack_errfunc = "memtrack_calloc_nd_array";
 		return NULL;
 	}
@@ -150,6 +167,281 @@ void* memtrack_calloc_nd_array (const size_t sizes[], size_t dims, size_t elem_s
 }
 
 
+/*
+ * allocate_and_initialize_nd_array と同じ並びでポインタ表を block に作り直す、各段の表は前の段の直後に続く
+ * 最後の段は data から row バイトごとに最後の次元の各行を指す
+ */
+static void link_nd_array (void* block, const size_t sizes[], size_t dims, char* data, size_t row) {
+	if (dims < 2) return;
+
+	void** level = block;
+	size_t count = sizes[0];
+	for (size_t k = 0; k + 2 < dims; k++) {
+		void** next = level + count;
+		for (size_t j = 0; j < count; j++)
+			level[j] = next + (j * sizes[k + 1]);
+		level = next;
+		count *= sizes[k + 1];
+	}
+
+	for (size_t j = 0; j < count; j++)
+		level[j] = data + (j * row);
+}
+
+
+/* 元の配列と新しい配列の両方に含まれる要素を、最後の次元の 1 行ずつ写す */
+static void copy_nd_array (char* dst, const char* src, const size_t new_sizes[], const size_t old_sizes[], size_t dims, size_t elem_size) {
+	size_t rows = 1;
+	for (size_t k = 0; k + 1 < dims; k++)
+		rows *= (new_sizes[k] < old_sizes[k]) ? new_sizes[k] : old_sizes[k];
+
+	size_t new_row = new_sizes[dims - 1] * elem_size;
+	size_t old_row = old_sizes[dims - 1] * elem_size;
+	size_t copy_row = (new_row < old_row) ? new_row : old_row;
+
+	for (size_t r = 0; r < rows; r++) {
+		/* r を共通部分の添字に分解し、それぞれの配列での行番号に直す */
+		size_t rest = r, new_index = 0, old_index = 0, new_stride = 1, old_stride = 1;
+		for (size_t k = dims - 1; k-- > 0;) {
+			size_t common = (new_sizes[k] < old_sizes[k]) ? new_sizes[k] : old_sizes[k];
+			size_t index = rest % common;
+			rest /= common;
+			new_index += index * new_stride;
+			old_index += index * old_stride;
+			new_stride *= new_sizes[k];
+			old_stride *= old_sizes[k];
+		}
+		memcpy(dst + (new_index * new_row), src + (old_index * old_row), copy_row);
+	}
+}
+
+
+/*
+ * 最初の次元だけが変わる場合は要素の並びが先頭から保たれるため、memtrack_realloc_entry_without_lock で realloc した同じブロックの中で要素の領域を移して表を作り直す
+ * それ以外は新しいブロックに共通部分の要素を一度に写す、どちらもエントリの更新は 1 回で済ませる
+ */
+void* memtrack_realloc_nd_array_without_lock (void* array, const size_t old_sizes[], const size_t new_sizes[], size_t dims, size_t elem_size, const char* file, int line) {
+	if (array == NULL) {
+		void* ptr = memtrack_alloc_nd_array_without_lock(new_sizes, dims, elem_size, file, line);
+		if (ptr == NULL)
+			memtrack_errfunc = "memtrack_realloc_nd_array";
+		return ptr;
+	}
+
+	size_t old_ptrs, old_padding, old_elements;
+	size_t new_ptrs, new_padding, new_elements;
+	if (old_sizes == NULL || !calculate_nd_array_size(old_sizes, dims, elem_size, &old_ptrs, &old_padding, &old_elements)
+			|| !calculate_nd_array_size(new_sizes, dims, elem_size, &new_ptrs, &new_padding, &new_elements)) {
+		memtrack_report("Invalid parameters for nd-array allocation.", array, file, line);
+		memtrack_errfunc = "memtrack_realloc_nd_array";
+		return NULL;
+	}
+	size_t old_size = old_ptrs + old_padding + (old_elements * elem_size);
+	size_t new_size = new_ptrs + new_padding + (new_elements * elem_size);
+
+	MemTrackEntryHandle handle;
+	if (!memtrack_entry_acquire_without_lock(array, &handle, __FILE__, __LINE__) || handle.size < old_size) {
+		if (handle.size != 0)
+			memtrack_report("old_sizes do not match the size of the nd-array.", array, file, line);
+		errno = EINVAL;
+		memtrack_entry_release_without_lock(&handle, file, line);
+		memtrack_errfunc = "memtrack_realloc_nd_array";
+		return NULL;
+	}
+
+	bool same_rows = true;
+	for (size_t k = 1; k < dims; k++) {
+		if (old_sizes[k] != new_sizes[k]) {
+			same_rows = false;
+			break;
+		}
+	}
+
+	if (same_rows) {
+		/* ブロックの realloc とエントリの付け直し（上限の確認とトレースの記録を含む）は memtrack_realloc_entry_without_lock に任せ、ここでは要素の領域だけを移す */
+		size_t copy_size = ((new_elements < old_elements) ? new_elements : old_elements) * elem_size;
+		void* new_ptr;
+
+		if (new_size <= old_size) {
+			/* 縮小は先に要素を詰めてから realloc する、失敗しても元のブロックとエントリのまま使える */
+			memmove((char*)array + new_ptrs + new_padding, (char*)array + old_ptrs + old_padding, copy_size);
+			new_ptr = memtrack_realloc_entry_without_lock(&handle, new_size, file, line);
+			if (UNLIKELY(new_ptr == NULL)) {
+				memtrack_errfunc = "memtrack_realloc_nd_array";
+				new_ptr = array;
+			}
+		} else {
+			new_ptr = memtrack_realloc_entry_without_lock(&handle, new_size, file, line);
+			if (UNLIKELY(new_ptr == NULL)) {  /* 元のブロックとエントリは有効なまま */
+				memtrack_errfunc = "memtrack_realloc_nd_array";
+				return NULL;
+			}
+			memmove((char*)new_ptr + new_ptrs + new_padding, (char*)new_ptr + old_ptrs + old_padding, copy_size);
+		}
+
+		link_nd_array(new_ptr, new_sizes, dims, (char*)new_ptr + new_ptrs + new_padding, new_sizes[dims - 1] * elem_size);
+		return new_ptr;
+	}
+
+#ifdef MEMTRACK_BUDGET
+	if (old_size < new_size && UNLIKELY(!memtrack_budget_admit(new_size - old_size, file, line))) {
+		memtrack_entry_release_without_lock(&handle, file, line);
+		memtrack_errfunc = "memtrack_realloc_nd_array";
+		return NULL;
+	}
+#endif
+
+	void* new_ptr = malloc(new_size);
+	if (UNLIKELY(new_ptr == NULL)) {
+		memtrack_report("Memory allocation failed.", array, file, line);
+		errno = ENOMEM;
+		memtrack_entry_release_without_lock(&handle, file, line);
+		memtrack_errfunc = "memtrack_realloc_nd_array";
+		return NULL;
+	}
+	copy_nd_array((char*)new_ptr + new_ptrs + new_padding, (const char*)array + old_ptrs + old_padding, new_sizes, old_sizes, dims, elem_size);
+
+	link_nd_array(new_ptr, new_sizes, dims, (char*)new_ptr + new_ptrs + new_padding, new_sizes[dims - 1] * elem_size);
+
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+	int tmp_errno = errno;
+#endif
+	errno = 0;
+
+	memtrack_entry_commit_without_lock(&handle, new_ptr, new_size, file, line);
+
+	if (UNLIKELY(errno != 0)) memtrack_errfunc = "memtrack_realloc_nd_array";
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+	else errno = tmp_errno;
+#endif
+
+	free(array);  /* エントリを移した後で元のブロックを解放する */
+	return new_ptr;
+}
+
+
+void* memtrack_realloc_nd_array (void* array, const size_t old_sizes[], const size_t new_sizes[], size_t dims, size_t elem_size, const char* file, int line) {
+	memtrack_lock();
+	void* new_ptr = memtrack_realloc_nd_array_without_lock(array, old_sizes, new_sizes, dims, elem_size, file, line);
+	memtrack_unlock();
+	return new_ptr;
+}
+
+
+#if defined (__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L)
+
+
+/*
+ * 要素の領域をポインタ表の後の alignment の倍数の位置から始め、pad_rows なら各行も alignment の倍数の間隔で並べる
+ * aligned_alloc の制約に合わせてブロック全体も alignment の倍数にする、溢れる場合は false を返す
+ */
+static bool calculate_aligned_nd_array_layout (const size_t sizes[], size_t dims, size_t elem_size, size_t size_ptrs, size_t total_elements, size_t alignment, bool pad_rows, size_t* data_offset, size_t* stride, size_t* size) {
+	size_t rows = total_elements / sizes[dims - 1];
+
+	size_t row = sizes[dims - 1] * elem_size;  /* total_elements * elem_size が収まっているので溢れない */
+	*stride = row;
+	if (pad_rows && row % alignment != 0) {
+		if (UNLIKELY(row > SIZE_MAX - alignment)) return false;
+		*stride = (row + alignment - 1) & ~(alignment - 1);
+	}
+
+	if (UNLIKELY(size_ptrs > SIZE_MAX - alignment)) return false;
+	*data_offset = (size_ptrs + alignment - 1) & ~(alignment - 1);
+
+	if (UNLIKELY(*stride > (SIZE_MAX - *data_offset - alignment) / rows)) return false;
+	*size = (*data_offset + (rows * *stride) + alignment - 1) & ~(alignment - 1);
+	return true;
+}
+
+
+static void* aligned_nd_array_without_lock (const size_t sizes[], size_t dims, size_t elem_size, size_t alignment, bool pad_rows, bool zero, const char* file, int line, const char* errfunc) {
+	if (!ht_is_power_of_two(alignment) || alignment < sizeof(void*)) {
+		memtrack_report("Alignment must be a power of 2 greater than or equal to sizeof(void*).", NULL, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = errfunc;
+		return NULL;
+	}
+
+	size_t size_ptrs, size_padding, total_elements;
+	if (!calculate_nd_array_size(sizes, dims, elem_size, &size_ptrs, &size_padding, &total_elements)) {
+		memtrack_report("Invalid parameters for nd-array allocation.", NULL, file, line);
+		memtrack_errfunc = errfunc;
+		return NULL;
+	}
+
+	(void)size_padding;  /* 要素の領域の位置は alignment から求め直す */
+
+	size_t data_offset, stride, size;
+	if (!calculate_aligned_nd_array_layout(sizes, dims, elem_size, size_ptrs, total_elements, alignment, pad_rows, &data_offset, &stride, &size)) {
+		memtrack_report("Memory allocation overflow.", NULL, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = errfunc;
+		return NULL;
+	}
+
+#ifdef MEMTRACK_BUDGET
+	if (UNLIKELY(!memtrack_budget_admit(size, file, line))) {
+		memtrack_errfunc = errfunc;
+		return NULL;
+	}
+#endif
+
+	char* ptr = aligned_alloc(alignment, size);
+	if (UNLIKELY(ptr == NULL)) {
+		memtrack_report("Memory allocation failed.", NULL, file, line);
+		errno = ENOMEM;
+		memtrack_errfunc = errfunc;
+		return NULL;
+	}
+	if (zero) memset(ptr + data_offset, 0, size - data_offset);
+
+	link_nd_array(ptr, sizes, dims, ptr + data_offset, stride);
+
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+	int tmp_errno = errno;
+#endif
+	errno = 0;
+
+	memtrack_entry_add(ptr, size, file, line);
+
+	if (UNLIKELY(errno != 0)) memtrack_errfunc = errfunc;
+#ifdef MAYBE_ERRNO_THREAD_LOCAL
+	else errno = tmp_errno;
+#endif
+
+	return ptr;
+}
+
+
+void* memtrack_aligned_alloc_nd_array_without_lock (const size_t sizes[], size_t dims, size_t elem_size, size_t alignment, bool pad_rows, const char* file, int line) {
+	return aligned_nd_array_without_lock(sizes, dims, elem_size, alignment, pad_rows, false, file, line, "memtrack_aligned_alloc_nd_array");
+}
+
+
+void* memtrack_aligned_alloc_nd_array (const size_t sizes[], size_t dims, size_t elem_size, size_t alignment, bool pad_rows, const char* file, int line) {
+	memtrack_lock();
+	void* ptr = memtrack_aligned_alloc_nd_array_without_lock(sizes, dims, elem_size, alignment, pad_rows, file, line);
+	memtrack_unlock();
+	return ptr;
+}
+
+
+void* memtrack_aligned_calloc_nd_array_without_lock (const size_t sizes[], size_t dims, size_t elem_size, size_t alignment, bool pad_rows, const char* file, int line) {
+	return aligned_nd_array_without_lock(sizes, dims, elem_size, alignment, pad_rows, true, file, line, "memtrack_aligned_calloc_nd_array");
+}
+
+
+void* memtrack_aligned_calloc_nd_array (const size_t sizes[], size_t dims, size_t elem_size, size_t alignment, bool pad_rows, const char* file, int line) {
+	memtrack_lock();
+	void* ptr = memtrack_aligned_calloc_nd_array_without_lock(sizes, dims, elem_size, alignment, pad_rows, file, line);
+	memtrack_unlock();
+	return ptr;
+}
+
+
+#endif
+
+
 void memtrack_free_nd_array (void* array, const char* file, int line) {
 #ifdef MAYBE_ERRNO_THREAD_LOCAL
 	int tmp_errno = errno;
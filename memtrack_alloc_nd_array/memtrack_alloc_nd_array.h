@@ -85,6 +85,50 @@ extern void* memtrack_alloc_nd_array (const size_t* sizes, size_t dims, size_t e
  */
 extern void* memtrack_calloc_nd_array (const size_t* sizes, size_t dims, size_t elem_size, const char* file, int line);
 
+/*
+ * memtrack_realloc_nd_array
+ * @param array: pointer to the multi-dimensional array allocated by alloc_nd_array or calloc_nd_array, behaves like memtrack_alloc_nd_array with new_sizes if NULL
+ * @param old_sizes: sizes the array currently has for each dimension (must have length equal to dims)
+ * @param new_sizes: new sizes for each dimension (must have length equal to dims)
+ * @param dims: number of array dimensions, must be the same as when the array was allocated
+ * @param elem_size: size of each element in bytes, must be the same as when the array was allocated
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: pointer to the resized multi-dimensional array, or NULL on failure (the original array is left unchanged)
+ * @note: The elements whose indices are valid in both shapes keep their values, and the new elements are uninitialized. When only the first dimension changes, the block is resized with a single realloc and the elements are moved within it; otherwise they are copied to a new block once. In both cases the pointer table is rebuilt and the entry is updated once. There is no replacement macro because alloc_nd_array has no realloc counterpart.
+ */
+extern void* memtrack_realloc_nd_array (void* array, const size_t* old_sizes, const size_t* new_sizes, size_t dims, size_t elem_size, const char* file, int line);
+
+#if defined (__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L)
+/*
+ * memtrack_aligned_alloc_nd_array
+ * @param sizes: array containing sizes for each dimension (must have length equal to dims)
+ * @param dims: number of array dimensions (designed for 2+ dimensions but supports 1D arrays)
+ * @param elem_size: size of each element in bytes (e.g., sizeof(int), sizeof(double), etc.)
+ * @param alignment: alignment of the first element in bytes, must be a power of 2 greater than or equal to sizeof(void*)
+ * @param pad_rows: if true, each row of the innermost dimension also starts on an alignment boundary (the row stride is rounded up to a multiple of alignment)
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: pointer to the multi-dimensional array or NULL on failure
+ * @note: The pointer table, the padding, and the elements are allocated as a single tracked block with aligned_alloc, which must be freed with free() or free_nd_array. With pad_rows, the elements are no longer contiguous, so index through the pointer table rather than from the first element. The block must not be resized with memtrack_realloc_nd_array. The returned memory is uninitialized. Only available in C11 or higher.
+ */
+extern void* memtrack_aligned_alloc_nd_array (const size_t* sizes, size_t dims, size_t elem_size, size_t alignment, bool pad_rows, const char* file, int line);
+
+/*
+ * memtrack_aligned_calloc_nd_array
+ * @param sizes: array containing sizes for each dimension (must have length equal to dims)
+ * @param dims: number of array dimensions (designed for 2+ dimensions but supports 1D arrays)
+ * @param elem_size: size of each element in bytes (e.g., sizeof(int), sizeof(double), etc.)
+ * @param alignment: alignment of the first element in bytes, must be a power of 2 greater than or equal to sizeof(void*)
+ * @param pad_rows: if true, each row of the innermost dimension also starts on an alignment boundary (the row stride is rounded up to a multiple of alignment)
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: pointer to the multi-dimensional array or NULL on failure
+ * @note: same as memtrack_aligned_alloc_nd_array, except that the elements and the row padding are zero-initialized
+ */
+extern void* memtrack_aligned_calloc_nd_array (const size_t* sizes, size_t dims, size_t elem_size, size_t alignment, bool pad_rows, const char* file, int line);
+#endif
+
 /*
  * memtrack_free_nd_array
  * @param array: pointer to the multi-dimensional array allocated by alloc_nd_array or calloc_nd_array
@@ -130,6 +174,50 @@ extern void* memtrack_alloc_nd_array_without_lock (const size_t* sizes, size_t d
  */
 extern void* memtrack_calloc_nd_array_without_lock (const size_t* sizes, size_t dims, size_t elem_size, const char* file, int line);
 
+/*
+ * memtrack_realloc_nd_array_without_lock
+ * @param array: pointer to the multi-dimensional array allocated by alloc_nd_array or calloc_nd_array, behaves like memtrack_alloc_nd_array_without_lock with new_sizes if NULL
+ * @param old_sizes: sizes the array currently has for each dimension (must have length equal to dims)
+ * @param new_sizes: new sizes for each dimension (must have length equal to dims)
+ * @param dims: number of array dimensions, must be the same as when the array was allocated
+ * @param elem_size: size of each element in bytes, must be the same as when the array was allocated
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: pointer to the resized multidimensional array, or NULL on failure (the original array is left unchanged)
+ * @note: same as memtrack_realloc_nd_array, see there for how the elements are moved
+ */
+extern void* memtrack_realloc_nd_array_without_lock (void* array, const size_t* old_sizes, const size_t* new_sizes, size_t dims, size_t elem_size, const char* file, int line);
+
+#if defined (__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L)
+/*
+ * memtrack_aligned_alloc_nd_array_without_lock
+ * @param sizes: array containing sizes for each dimension (must have length equal to dims)
+ * @param dims: number of array dimensions (designed for 2+ dimensions but supports 1D arrays)
+ * @param elem_size: size of each element in bytes (e.g., sizeof(int), sizeof(double), etc.)
+ * @param alignment: alignment of the first element in bytes, must be a power of 2 greater than or equal to sizeof(void*)
+ * @param pad_rows: if true, each row of the innermost dimension also starts on an alignment boundary
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: pointer to the multidimensional array or NULL on failure
+ * @note: same as memtrack_aligned_alloc_nd_array
+ */
+extern void* memtrack_aligned_alloc_nd_array_without_lock (const size_t* sizes, size_t dims, size_t elem_size, size_t alignment, bool pad_rows, const char* file, int line);
+
+/*
+ * memtrack_aligned_calloc_nd_array_without_lock
+ * @param sizes: array containing sizes for each dimension (must have length equal to dims)
+ * @param dims: number of array dimensions (designed for 2+ dimensions but supports 1D arrays)
+ * @param elem_size: size of each element in bytes (e.g., sizeof(int), sizeof(double), etc.)
+ * @param alignment: alignment of the first element in bytes, must be a power of 2 greater than or equal to sizeof(void*)
+ * @param pad_rows: if true, each row of the innermost dimension also starts on an alignment boundary
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: pointer to the multidimensional array or NULL on failure
+ * @note: same as memtrack_aligned_calloc_nd_array
+ */
+extern void* memtrack_aligned_calloc_nd_array_without_lock (const size_t* sizes, size_t dims, size_t elem_size, size_t alignment, bool pad_rows, const char* file, int line);
+#endif
+
 
 MHT_CPP_C_END
 
@@ -0,0 +1,317 @@
+/*
+ * memtrack_arena.c -- implementation part of a library that adds bump-pointer
+ *                     arenas to the management target of memtrack.h
+ * version 0.9.3, June 15, 2025
+ *
+ * License: zlib License
+ *
+ * Copyright (c) 2025 Kazushi Yamasaki
+ *
+ * This software is provided ‘as-is’, without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source
+ * distribution.
+ */
+
+#include "memtrack_arena.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdalign.h>
+
+
+#if !defined (__STDC_VERSION__) || (__STDC_VERSION__ < 201112L)
+	#error "This program requires C11 or higher."
+#endif
+
+
+#ifndef MEMTRACK_DISABLE
+#undef malloc
+#undef free
+#endif
+
+
+/* チャンクの既定のデータ部のバイト数 */
+#ifndef MEMTRACK_ARENA_CHUNK_SIZE
+	#define MEMTRACK_ARENA_CHUNK_SIZE (64 * 1024)
+#endif
+
+
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-macros"
+
+	#define LIKELY(x)   __builtin_expect(!!(x), 1)
+	#define UNLIKELY(x) __builtin_expect(!!(x), 0)
+
+#pragma GCC diagnostic pop
+#else
+	#define LIKELY(x)   (x)
+	#define UNLIKELY(x) (x)
+#endif
+
+
+/* チャンクの先頭に置くヘッダー、データ部は MEMTRACK_ARENA_CHUNK_HEADER バイト目から始まる */
+typedef struct MemTrackArenaChunk {
+	struct MemTrackArenaChunk* next;  /* 1 つ前に確保したチャンク */
+	size_t size;  /* データ部のバイト数 */
+} MemTrackArenaChunk;
+
+#define MEMTRACK_ARENA_ALIGNMENT    (alignof(max_align_t))
+#define MEMTRACK_ARENA_CHUNK_HEADER ((sizeof(MemTrackArenaChunk) + MEMTRACK_ARENA_ALIGNMENT - 1) & ~(MEMTRACK_ARENA_ALIGNMENT - 1))
+
+
+struct MemTrackArena {
+	MemTrackArenaChunk* chunks;  /* 最後に確保したチャンク、ここから切り出す */
+	unsigned char* cursor;  /* 次に切り出す位置 */
+	unsigned char* end;  /* 最後に確保したチャンクのデータ部の終端 */
+	size_t chunk_size;
+	const char* file;  /* チャンクを記録する呼び出し元（作成した場所） */
+	int line;
+	MemTrackArenaStats stats;
+};
+
+
+/* memtrack で記録する場合は file と line を呼び出し元として記録する */
+static inline void* memtrack_arena_block_alloc (size_t size, const char* file, int line) {
+#ifndef MEMTRACK_DISABLE
+	return memtrack_malloc(size, file, line);
+#else
+	(void)file;
+	(void)line;
+	return malloc(size);
+#endif
+}
+
+static inline void memtrack_arena_block_free (void* ptr, const char* file, int line) {
+#ifndef MEMTRACK_DISABLE
+	memtrack_free(ptr, file, line);
+#else
+	(void)file;
+	(void)line;
+	free(ptr);
+#endif
+}
+
+
+static inline unsigned char* memtrack_arena_chunk_data (MemTrackArenaChunk* chunk) {
+	return (unsigned char*)chunk + MEMTRACK_ARENA_CHUNK_HEADER;
+}
+
+
+/* データ部が少なくとも size バイトのチャンクを確保して、以降はそこから切り出す */
+static bool memtrack_arena_grow (MemTrackArena* arena, size_t size) {
+	if (size < arena->chunk_size) size = arena->chunk_size;
+
+	MemTrackArenaChunk* chunk = memtrack_arena_block_alloc(MEMTRACK_ARENA_CHUNK_HEADER + size, arena->file, arena->line);
+	if (UNLIKELY(chunk == NULL)) return false;
+
+	chunk->next = arena->chunks;
+	chunk->size = size;
+	arena->chunks = chunk;
+	arena->cursor = memtrack_arena_chunk_data(chunk);
+	arena->end = arena->cursor + size;
+
+	arena->stats.chunk_count++;
+	arena->stats.chunk_bytes += size;
+	if (arena->stats.chunk_count > arena->stats.peak_chunk_count)
+		arena->stats.peak_chunk_count = arena->stats.chunk_count;
+	return true;
+}
+
+
+static MemTrackArena* memtrack_arena_create_at (size_t chunk_size, const char* file, int line) {
+	if (chunk_size == 0) chunk_size = MEMTRACK_ARENA_CHUNK_SIZE;
+
+	if (UNLIKELY(chunk_size > (SIZE_MAX - MEMTRACK_ARENA_CHUNK_HEADER - MEMTRACK_ARENA_ALIGNMENT))) {
+#ifndef MEMTRACK_DISABLE
+		memtrack_report("Memory allocation overflow.", NULL, file, line);
+#endif
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_arena_create";
+		return NULL;
+	}
+
+	MemTrackArena* arena = memtrack_arena_block_alloc(sizeof(MemTrackArena), file, line);
+	if (UNLIKELY(arena == NULL)) {
+		memtrack_errfunc = "memtrack_arena_create";
+		return NULL;
+	}
+
+	*arena = (MemTrackArena){ .chunk_size = chunk_size, .file = file, .line = line };
+	return arena;
+}
+
+
+static void* memtrack_arena_alloc_at (MemTrackArena* arena, size_t size, const char* file, int line) {
+	if (UNLIKELY(arena == NULL)) {
+#ifndef MEMTRACK_DISABLE
+		memtrack_report("arena is null!", NULL, file, line);
+#endif
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_arena_alloc";
+		return NULL;
+	}
+
+	if (size == 0) {
+#ifndef MEMTRACK_DISABLE
+		memtrack_report("No processing was done because the size is zero.", NULL, file, line);
+#endif
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_arena_alloc";
+		return NULL;
+	}
+
+	if (UNLIKELY(size > (SIZE_MAX - MEMTRACK_ARENA_CHUNK_HEADER - MEMTRACK_ARENA_ALIGNMENT))) {
+#ifndef MEMTRACK_DISABLE
+		memtrack_report("Memory allocation overflow.", NULL, file, line);
+#endif
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_arena_alloc";
+		return NULL;
+	}
+#ifdef MEMTRACK_DISABLE
+	(void)file;
+	(void)line;
+#endif
+
+	size_t rounded = (size + MEMTRACK_ARENA_ALIGNMENT - 1) & ~(MEMTRACK_ARENA_ALIGNMENT - 1);
+	if ((size_t)(arena->end - arena->cursor) < rounded) {
+		/* 残りの領域は捨てて新しいチャンクに移る、大きな要求には専用のチャンクを確保する */
+		if (UNLIKELY(!memtrack_arena_grow(arena, rounded))) {
+			memtrack_errfunc = "memtrack_arena_alloc";
+			return NULL;
+		}
+	}
+
+	void* ptr = arena->cursor;
+	arena->cursor += rounded;
+
+	arena->stats.bytes_used += size;
+	arena->stats.alloc_count++;
+	if (arena->stats.bytes_used > arena->stats.peak_bytes_used)
+		arena->stats.peak_bytes_used = arena->stats.bytes_used;
+	return ptr;
+}
+
+
+/* 最初に確保したチャンクだけを残す（一覧の末尾にある） */
+static void memtrack_arena_reset_at (MemTrackArena* arena, const char* file, int line) {
+	if (arena == NULL || arena->chunks == NULL) return;
+
+	MemTrackArenaChunk* chunk = arena->chunks;
+	while (chunk->next != NULL) {
+		MemTrackArenaChunk* next = chunk->next;
+		memtrack_arena_block_free(chunk, file, line);
+		chunk = next;
+	}
+
+	arena->chunks = chunk;
+	arena->cursor = memtrack_arena_chunk_data(chunk);
+	arena->end = arena->cursor + chunk->size;
+
+	arena->stats.bytes_used = 0;
+	arena->stats.alloc_count = 0;
+	arena->stats.chunk_count = 1;
+	arena->stats.chunk_bytes = chunk->size;
+}
+
+
+static void memtrack_arena_destroy_at (MemTrackArena* arena, const char* file, int line) {
+	if (arena == NULL) return;
+
+	MemTrackArenaChunk* chunk = arena->chunks;
+	while (chunk != NULL) {
+		MemTrackArenaChunk* next = chunk->next;
+		memtrack_arena_block_free(chunk, file, line);
+		chunk = next;
+	}
+	memtrack_arena_block_free(arena, file, line);
+}
+
+
+static void memtrack_arena_stats_at (const MemTrackArena* arena, MemTrackArenaStats* stats) {
+	if (UNLIKELY(arena == NULL || stats == NULL)) {
+#ifndef MEMTRACK_DISABLE
+		memtrack_report("arena or stats is null!", NULL, __FILE__, __LINE__);
+#endif
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_arena_stats";
+		return;
+	}
+
+	*stats = arena->stats;
+}
+
+
+#ifndef MEMTRACK_DISABLE
+
+
+MemTrackArena* memtrack_arena_create (size_t chunk_size, const char* file, int line) {
+	return memtrack_arena_create_at(chunk_size, file, line);
+}
+
+
+void* memtrack_arena_alloc (MemTrackArena* arena, size_t size, const char* file, int line) {
+	return memtrack_arena_alloc_at(arena, size, file, line);
+}
+
+
+void memtrack_arena_reset (MemTrackArena* arena, const char* file, int line) {
+	memtrack_arena_reset_at(arena, file, line);
+}
+
+
+void memtrack_arena_destroy (MemTrackArena* arena, const char* file, int line) {
+	memtrack_arena_destroy_at(arena, file, line);
+}
+
+
+void memtrack_arena_stats (const MemTrackArena* arena, MemTrackArenaStats* stats) {
+	memtrack_arena_stats_at(arena, stats);
+}
+
+
+#else  /* defined MEMTRACK_DISABLE */
+
+
+MemTrackArena* arena_create (size_t chunk_size) {
+	return memtrack_arena_create_at(chunk_size, NULL, 0);
+}
+
+
+void* arena_alloc (MemTrackArena* arena, size_t size) {
+	return memtrack_arena_alloc_at(arena, size, NULL, 0);
+}
+
+
+void arena_reset (MemTrackArena* arena) {
+	memtrack_arena_reset_at(arena, NULL, 0);
+}
+
+
+void arena_destroy (MemTrackArena* arena) {
+	memtrack_arena_destroy_at(arena, NULL, 0);
+}
+
+
+void arena_stats (const MemTrackArena* arena, MemTrackArenaStats* stats) {
+	memtrack_arena_stats_at(arena, stats);
+}
+
+
+#endif
@@ -0,0 +1,185 @@
+/*
+ * memtrack_arena.h -- interface of a library that adds bump-pointer arenas to the
+ *                     management target of memtrack.h
+ * version 0.9.3, June 15, 2025
+ *
+ * License: zlib License
+ *
+ * Copyright (c) 2025 Kazushi Yamasaki
+ *
+ * This software is provided ‘as-is’, without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source
+ * distribution.
+ *
+ *
+ *
+ * IMPORTANT:
+ * This library relies on the functionality of memtrack.h. Please use it with caution
+ * after reading the IMPORTANT section in memtrack.h.
+ *
+ * Only the chunks backing an arena are tracked by memtrack, as ordinary entries
+ * recorded at the place where the arena was created. Memory returned by arena_alloc
+ * is only counted in the statistics of the arena, and must not be passed to free,
+ * realloc or get_size; it is released all at once by arena_reset or arena_destroy.
+ *
+ * An arena is not thread-safe. Use a separate arena for each thread, or protect it
+ * with a lock of your own.
+ */
+
+#pragma once
+
+#ifndef MEMTRACK_ARENA_H
+#define MEMTRACK_ARENA_H
+
+
+#include "memtrack.h"
+
+
+MHT_CPP_C_BEGIN
+
+
+/* MemTrackArena is opaque, create it with arena_create and release it with arena_destroy */
+typedef struct MemTrackArena MemTrackArena;
+
+/*
+ * MemTrackArenaStats
+ * bytes_used: bytes requested from the arena since it was created or last reset
+ * peak_bytes_used: largest value bytes_used has reached since the arena was created
+ * alloc_count: number of allocations from the arena since it was created or last reset
+ * chunk_count: number of chunks currently held by the arena
+ * peak_chunk_count: largest value chunk_count has reached since the arena was created
+ * chunk_bytes: total size in bytes of the chunks currently held by the arena
+ */
+typedef struct {
+	size_t bytes_used;
+	size_t peak_bytes_used;
+	size_t alloc_count;
+	size_t chunk_count;
+	size_t peak_chunk_count;
+	size_t chunk_bytes;
+} MemTrackArenaStats;
+
+
+#ifndef MEMTRACK_DISABLE
+
+
+/*
+ * The functions replaced by the following macros are specific to this library.
+ * It is recommended not to remove them unless a conflict occurs.
+ */
+#define arena_create(chunk_size) memtrack_arena_create((chunk_size), __FILE__, __LINE__)
+#define arena_alloc(arena, size) memtrack_arena_alloc((arena), (size), __FILE__, __LINE__)
+#define arena_reset(arena) memtrack_arena_reset((arena), __FILE__, __LINE__)
+#define arena_destroy(arena) memtrack_arena_destroy((arena), __FILE__, __LINE__)
+#define arena_stats(arena, stats) memtrack_arena_stats((arena), (stats))
+
+
+
+/*
+ * memtrack_arena_create
+ * @param chunk_size: size in bytes of each chunk the arena allocates, MEMTRACK_ARENA_CHUNK_SIZE (default 64 KiB) is used if 0
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: pointer to the new arena, or NULL on failure
+ * @note: the arena and all of its chunks are recorded with file and line, so a leaked arena is reported where it was created; the first chunk is allocated on the first call to memtrack_arena_alloc
+ */
+extern MemTrackArena* memtrack_arena_create (size_t chunk_size, const char* file, int line);
+
+/*
+ * memtrack_arena_alloc
+ * @param arena: arena to allocate from, displays a message and returns NULL if NULL
+ * @param size: size of memory to allocate, displays a message and returns NULL if size is 0
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: pointer to allocated memory aligned to alignof(max_align_t), or NULL on failure
+ * @note: only advances a pointer unless the current chunk is full; a request larger than the chunk size gets a chunk of its own
+ */
+extern void* memtrack_arena_alloc (MemTrackArena* arena, size_t size, const char* file, int line);
+
+/*
+ * memtrack_arena_reset
+ * @param arena: arena to reset, no action is taken if NULL
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @note: releases everything allocated from the arena at once; the first chunk is kept for reuse and the others are freed; peak_bytes_used and peak_chunk_count are kept
+ */
+extern void memtrack_arena_reset (MemTrackArena* arena, const char* file, int line);
+
+/*
+ * memtrack_arena_destroy
+ * @param arena: arena to destroy, no action is taken if NULL
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @note: frees all chunks and the arena itself
+ */
+extern void memtrack_arena_destroy (MemTrackArena* arena, const char* file, int line);
+
+/*
+ * memtrack_arena_stats
+ * @param arena: arena whose statistics are to be retrieved, displays a message and does nothing if NULL
+ * @param stats: where to store the statistics, displays a message and does nothing if NULL
+ */
+extern void memtrack_arena_stats (const MemTrackArena* arena, MemTrackArenaStats* stats);
+
+
+#else  /* defined MEMTRACK_DISABLE */
+
+
+/*
+ * arena_create
+ * @param chunk_size: size in bytes of each chunk the arena allocates, MEMTRACK_ARENA_CHUNK_SIZE (default 64 KiB) is used if 0
+ * @return: pointer to the new arena, or NULL on failure
+ */
+extern MemTrackArena* arena_create (size_t chunk_size);
+
+/*
+ * arena_alloc
+ * @param arena: arena to allocate from, returns NULL if NULL
+ * @param size: size of memory to allocate, returns NULL if size is 0
+ * @return: pointer to allocated memory aligned to alignof(max_align_t), or NULL on failure
+ */
+extern void* arena_alloc (MemTrackArena* arena, size_t size);
+
+/*
+ * arena_reset
+ * @param arena: arena to reset, no action is taken if NULL
+ * @note: the first chunk is kept for reuse and the others are freed
+ */
+extern void arena_reset (MemTrackArena* arena);
+
+/*
+ * arena_destroy
+ * @param arena: arena to destroy, no action is taken if NULL
+ */
+extern void arena_destroy (MemTrackArena* arena);
+
+/*
+ * arena_stats
+ * @param arena: arena whose statistics are to be retrieved, does nothing if NULL
+ * @param stats: where to store the statistics, does nothing if NULL
+ */
+extern void arena_stats (const MemTrackArena* arena, MemTrackArenaStats* stats);
+
+
+#endif
+
+
+MHT_CPP_C_END
+
+
+#endif
@@ -31,6 +31,7 @@
 #include "memtrack_filetrack_strndup.h"
 
 #include <string.h>
+#include <stdint.h>
 #include <errno.h>
 
 
@@ -39,18 +40,6 @@
 #endif
 
 
-#undef filetrack_strndup
-
-
-#if defined (__unix__) || defined (__linux__) || defined (__APPLE__)
-	#include <unistd.h>
-#endif
-
-#if (defined (__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L)) || defined (_POSIX_VERSION) || defined (__linux__) || defined (__FreeBSD__) || defined (__NetBSD__) || defined (__OpenBSD__) || defined (__DragonFly__)
-	#define MAYBE_ERRNO_THREAD_LOCAL
-#endif
-
-
 #ifdef __GNUC__
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-macros"
@@ -65,35 +54,131 @@
 #endif
 
 
-char* memtrack_filetrack_strndup_without_lock (const char* string, size_t max_bytes, const char* file, int line) {
-	char* result = filetrack_strndup(string, max_bytes);
+/*
+ * 複製先の確保、locked が true なら呼び出し元が memtrack_lock を保持している
+ * 保持していない場合は memtrack_malloc を使い、長さの計算と複製はどのロックも保持せずに行う
+ */
+static inline void* duplicate_alloc (size_t size, bool locked, const char* file, int line) {
+	return locked ? memtrack_malloc_without_lock(size, file, line) : memtrack_malloc(size, file, line);
+}
+
+
+/* length + 1 バイトを確保して記録し、string の先頭 length バイトと終端の NUL を書き込む */
+static char* duplicate_string (const char* string, size_t length, bool locked, const char* file, int line, const char* errfunc) {
+	if (UNLIKELY(length == SIZE_MAX)) {
+		memtrack_report("Memory allocation overflow.", NULL, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = errfunc;
+		return NULL;
+	}
+
+	char* result = duplicate_alloc(length + 1, locked, file, line);
 	if (UNLIKELY(result == NULL)) {
-		fprintf(stderr, "Failed to duplicate string.\nFile: %s   Line: %d\n", file, line);
-		memtrack_errfunc = "memtrack_filetrack_strndup";
+		memtrack_errfunc = errfunc;
 		return NULL;
 	}
 
-	size_t size = (strlen(result) + 1);
+	memcpy(result, string, length);
+	result[length] = '\0';
+	return result;
+}
 
-#ifdef MAYBE_ERRNO_THREAD_LOCAL
-	int tmp_errno = errno;
-#endif
-	errno = 0;
 
-	memtrack_entry_add(result, size, file, line);
+/* memchr は一致した位置で読むのを止めるため、max_bytes より短い文字列の終端を越えて読むことはない */
+static char* strndup_length_at (const char* string, size_t max_bytes, size_t* length, bool locked, const char* file, int line, const char* errfunc) {
+	if (UNLIKELY(string == NULL)) {
+		memtrack_report("string is null! No processing was done!", NULL, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = errfunc;
+		return NULL;
+	}
 
-	if (UNLIKELY(errno != 0)) memtrack_errfunc = "memtrack_filetrack_strndup";
-#ifdef MAYBE_ERRNO_THREAD_LOCAL
-	else errno = tmp_errno;
-#endif
+	const char* end = memchr(string, '\0', max_bytes);
+	size_t count = (end != NULL) ? (size_t)(end - string) : max_bytes;
 
+	char* result = duplicate_string(string, count, locked, file, line, errfunc);
+	if (result != NULL && length != NULL) *length = count;
 	return result;
 }
 
 
-char* memtrack_filetrack_strndup (const char* string, size_t max_bytes, const char* file, int line) {
-	memtrack_lock();
-	char* result = memtrack_filetrack_strndup_without_lock(string, max_bytes, file, line);
-	memtrack_unlock();
+static char* strdup_at (const char* string, bool locked, const char* file, int line) {
+	if (UNLIKELY(string == NULL)) {
+		memtrack_report("string is null! No processing was done!", NULL, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_strdup";
+		return NULL;
+	}
+
+	return duplicate_string(string, strlen(string), locked, file, line, "memtrack_strdup");
+}
+
+
+static void* memdup_at (const void* ptr, size_t size, bool locked, const char* file, int line) {
+	if (UNLIKELY(ptr == NULL)) {
+		memtrack_report("ptr is null! No processing was done!", NULL, file, line);
+		errno = EINVAL;
+		memtrack_errfunc = "memtrack_memdup";
+		return NULL;
+	}
+
+	void* result = duplicate_alloc(size, locked, file, line);
+	if (UNLIKELY(result == NULL)) {
+		memtrack_errfunc = "memtrack_memdup";
+		return NULL;
+	}
+
+	memcpy(result, ptr, size);
 	return result;
 }
+
+
+char* memtrack_strndup_length_without_lock (const char* string, size_t max_bytes, size_t* length, const char* file, int line) {
+	return strndup_length_at(string, max_bytes, length, true, file, line, "memtrack_strndup_length");
+}
+
+
+char* memtrack_strndup_length (const char* string, size_t max_bytes, size_t* length, const char* file, int line) {
+	return strndup_length_at(string, max_bytes, length, false, file, line, "memtrack_strndup_length");
+}
+
+
+char* memtrack_strndup_without_lock (const char* string, size_t max_bytes, const char* file, int line) {
+	return strndup_length_at(string, max_bytes, NULL, true, file, line, "memtrack_strndup");
+}
+
+
+char* memtrack_strndup (const char* string, size_t max_bytes, const char* file, int line) {
+	return strndup_length_at(string, max_bytes, NULL, false, file, line, "memtrack_strndup");
+}
+
+
+char* memtrack_strdup_without_lock (const char* string, const char* file, int line) {
+	return strdup_at(string, true, file, line);
+}
+
+
+char* memtrack_strdup (const char* string, const char* file, int line) {
+	return strdup_at(string, false, file, line);
+}
+
+
+void* memtrack_memdup_without_lock (const void* ptr, size_t size, const char* file, int line) {
+	return memdup_at(ptr, size, true, file, line);
+}
+
+
+void* memtrack_memdup (const void* ptr, size_t size, const char* file, int line) {
+	return memdup_at(ptr, size, false, file, line);
+}
+
+
+/* filetrack_strndup と同じく先頭 max_bytes バイトまでを複製する、失敗の表示は中の処理で済んでいるため繰り返さない */
+char* memtrack_filetrack_strndup_without_lock (const char* string, size_t max_bytes, const char* file, int line) {
+	return strndup_length_at(string, max_bytes, NULL, true, file, line, "memtrack_filetrack_strndup");
+}
+
+
+char* memtrack_filetrack_strndup (const char* string, size_t max_bytes, const char* file, int line) {
+	return strndup_length_at(string, max_bytes, NULL, false, file, line, "memtrack_filetrack_strndup");
+}
@@ -42,7 +42,9 @@
 #ifndef MEMTRACK_DISABLE
 
 
-#include "filetrack.h"
+#ifndef MEMTRACK_DISABLE_REPLACE_FILETRACK_FUNC
+	#include "filetrack.h"  /* only so that its declaration of filetrack_strndup is read before the replacement macro below is defined */
+#endif
 #include "memtrack.h"
 
 
@@ -64,10 +66,54 @@ MHT_CPP_C_BEGIN
  * @param string: the string to duplicate
  * @param max_bytes: the maximum number of bytes to copy from the string
  * @return: a newly allocated string that is a duplicate of the input string, or NULL on failure
- * @note: the strings duplicated by this function must be freed with free()
+ * @note: the strings duplicated by this function must be freed with free(); same as memtrack_strndup apart from the function name recorded in memtrack_errfunc on failure
  */
 extern char* memtrack_filetrack_strndup (const char* string, size_t max_bytes, const char* file, int line);
 
+/*
+ * memtrack_strndup_length
+ * @param string: the string to duplicate, displays a message and returns NULL if NULL
+ * @param max_bytes: the maximum number of bytes to copy from the string
+ * @param length: where to store the length of the duplicate (not counting the terminating null byte), may be NULL
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: a newly allocated, null-terminated copy of the first max_bytes bytes of string at most, or NULL on failure
+ * @note: the string is scanned once with memchr, which never reads past the terminating null byte, and copied once outside any lock; the block is allocated with memtrack_malloc and recorded with the size already known. The strings duplicated by this function must be freed with free()
+ */
+extern char* memtrack_strndup_length (const char* string, size_t max_bytes, size_t* length, const char* file, int line);
+
+/*
+ * memtrack_strndup
+ * @param string: the string to duplicate, displays a message and returns NULL if NULL
+ * @param max_bytes: the maximum number of bytes to copy from the string
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: a newly allocated, null-terminated copy of the first max_bytes bytes of string at most, or NULL on failure
+ * @note: same as memtrack_strndup_length without storing the length
+ */
+extern char* memtrack_strndup (const char* string, size_t max_bytes, const char* file, int line);
+
+/*
+ * memtrack_strdup
+ * @param string: the string to duplicate, displays a message and returns NULL if NULL
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: a newly allocated copy of string, or NULL on failure
+ * @note: the strings duplicated by this function must be freed with free()
+ */
+extern char* memtrack_strdup (const char* string, const char* file, int line);
+
+/*
+ * memtrack_memdup
+ * @param ptr: the memory to duplicate, displays a message and returns NULL if NULL
+ * @param size: number of bytes to copy, displays a message and returns NULL if 0
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: a newly allocated copy of the first size bytes of ptr, or NULL on failure
+ * @note: the memory duplicated by this function must be freed with free()
+ */
+extern void* memtrack_memdup (const void* ptr, size_t size, const char* file, int line);
+
 
 /*
  * You must not use functions declared before this comment within the lock/unlock block.
@@ -89,6 +135,50 @@ extern char* memtrack_filetrack_strndup (const char* string, size_t max_bytes, c
  */
 extern char* memtrack_filetrack_strndup_without_lock (const char* string, size_t max_bytes, const char* file, int line);
 
+/*
+ * memtrack_strndup_length_without_lock
+ * @param string: the string to duplicate, displays a message and returns NULL if NULL
+ * @param max_bytes: the maximum number of bytes to copy from the string
+ * @param length: where to store the length of the duplicate (not counting the terminating null byte), may be NULL
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: a newly allocated, null-terminated copy of the first max_bytes bytes of string at most, or NULL on failure
+ * @note: same as memtrack_strndup_length
+ */
+extern char* memtrack_strndup_length_without_lock (const char* string, size_t max_bytes, size_t* length, const char* file, int line);
+
+/*
+ * memtrack_strndup_without_lock
+ * @param string: the string to duplicate, displays a message and returns NULL if NULL
+ * @param max_bytes: the maximum number of bytes to copy from the string
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: a newly allocated, null-terminated copy of the first max_bytes bytes of string at most, or NULL on failure
+ * @note: same as memtrack_strndup
+ */
+extern char* memtrack_strndup_without_lock (const char* string, size_t max_bytes, const char* file, int line);
+
+/*
+ * memtrack_strdup_without_lock
+ * @param string: the string to duplicate, displays a message and returns NULL if NULL
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: a newly allocated copy of string, or NULL on failure
+ * @note: same as memtrack_strdup
+ */
+extern char* memtrack_strdup_without_lock (const char* string, const char* file, int line);
+
+/*
+ * memtrack_memdup_without_lock
+ * @param ptr: the memory to duplicate, displays a message and returns NULL if NULL
+ * @param size: number of bytes to copy, displays a message and returns NULL if 0
+ * @param file: name of the calling file, usually specified with __FILE__
+ * @param line: line number of the caller, usually specified with __LINE__
+ * @return: a newly allocated copy of the first size bytes of ptr, or NULL on failure
+ * @note: same as memtrack_memdup
+ */
+extern void* memtrack_memdup_without_lock (const void* ptr, size_t size, const char* file, int line);
+
 
 MHT_CPP_C_END
 
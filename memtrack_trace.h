@@ -0,0 +1,158 @@
+/*
+ * memtrack_trace.h -- layout of the binary allocation trace file written by memtrack
+ *                     when it is built with the MEMTRACK_TRACE macro
+ * version 0.9.3, June 15, 2025
+ *
+ * License: zlib License
+ *
+ * Copyright (c) 2025 Kazushi Yamasaki
+ *
+ * This software is provided ‘as-is’, without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source
+ * distribution.
+ *
+ *
+ *
+ * Note:
+ * A trace file consists of a MemTrackTraceHeader, site_count MemTrackTraceSite slots
+ * starting at site_offset, and record_count MemTrackTraceRecord slots starting at
+ * record_offset. The records form a ring: the record reserved at position pos (counted
+ * from 0 since the trace was started) is stored in slot pos % record_count, and next is
+ * the number of positions reserved so far. A record is complete only when its seq
+ * equals its position + 1, so records that were being written when the process died,
+ * or that have been overwritten by a later lap, can be told apart.
+ *
+ * The file is written through a shared memory mapping in the byte order and pointer
+ * width of the traced process, and must be decoded on a machine of the same kind.
+ *
+ * This header requires C11.
+ */
+
+#pragma once
+
+#ifndef MEMTRACK_TRACE_H
+#define MEMTRACK_TRACE_H
+
+
+#if !defined (__STDC_VERSION__) || (__STDC_VERSION__ < 201112L)
+	#error "memtrack_trace.h requires C11 or higher."
+#endif
+
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define MEMTRACK_TRACE_MAGIC 0x3145434152544D4DULL  /* "MMTRACE1" in little-endian order */
+#define MEMTRACK_TRACE_VERSION 1
+
+#define MEMTRACK_TRACE_FILE_SIZE 120  /* bytes kept for a file name, including the terminating NUL */
+
+/* op of MemTrackTraceRecord */
+#define MEMTRACK_TRACE_ADD 1     /* ptr of size bytes started to be tracked */
+#define MEMTRACK_TRACE_UPDATE 2  /* old_ptr was resized to size bytes and is now ptr (ptr == old_ptr with the previous size when the realloc failed) */
+#define MEMTRACK_TRACE_FREE 3    /* ptr was freed (size is 0) */
+
+/* state of MemTrackTraceSite */
+#define MEMTRACK_TRACE_SITE_EMPTY 0
+#define MEMTRACK_TRACE_SITE_WRITING 1
+#define MEMTRACK_TRACE_SITE_READY 2
+
+/* flags of MemTrackTraceHeader */
+#define MEMTRACK_TRACE_EXITED 1u  /* the traced process reached its exit handler */
+
+
+/*
+ * MemTrackTraceHeader
+ * magic: MEMTRACK_TRACE_MAGIC
+ * version: MEMTRACK_TRACE_VERSION
+ * record_size: sizeof(MemTrackTraceRecord) of the writer
+ * site_size: sizeof(MemTrackTraceSite) of the writer
+ * flags: combination of MEMTRACK_TRACE_EXITED
+ * record_count: number of record slots, always a power of 2
+ * site_count: number of site slots, the last one stands for every site that did not fit
+ * site_offset: byte offset of the first site slot
+ * record_offset: byte offset of the first record slot
+ * start_realtime: CLOCK_REALTIME in nanoseconds when the trace was started
+ * start_monotonic: CLOCK_MONOTONIC in nanoseconds when the trace was started
+ * next: number of record positions reserved so far
+ */
+typedef struct {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t site_size;
+	_Atomic uint32_t flags;
+	uint64_t record_count;
+	uint64_t site_count;
+	uint64_t site_offset;
+	uint64_t record_offset;
+	uint64_t start_realtime;
+	uint64_t start_monotonic;
+	_Atomic uint64_t next;
+} MemTrackTraceHeader;
+
+
+/*
+ * MemTrackTraceSite
+ * state: MEMTRACK_TRACE_SITE_READY once line and file are written
+ * line: line number of the call site
+ * file: name of the calling file, truncated from the front if it does not fit
+ */
+typedef struct {
+	_Atomic uint32_t state;
+	int32_t line;
+	char file[MEMTRACK_TRACE_FILE_SIZE];
+} MemTrackTraceSite;
+
+
+/*
+ * MemTrackTraceRecord
+ * seq: position of this record + 1 once it is complete, 0 while it is being written
+ * time: CLOCK_MONOTONIC in nanoseconds
+ * ptr: the pointer added, the new pointer of an update, or the pointer freed
+ * old_ptr: the pointer before an update, 0 otherwise
+ * size: the size after an add or an update, 0 for a free
+ * thread: number given to the calling thread in the order of its first record, from 1
+ * site: index + 1 of the site slot of the caller, 0 if unknown
+ * op: MEMTRACK_TRACE_ADD, MEMTRACK_TRACE_UPDATE, or MEMTRACK_TRACE_FREE
+ */
+typedef struct {
+	_Atomic uint64_t seq;
+	uint64_t time;
+	uint64_t ptr;
+	uint64_t old_ptr;
+	uint64_t size;
+	uint32_t thread;
+	uint32_t site;
+	uint32_t op;
+	uint32_t reserved;
+} MemTrackTraceRecord;
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
@@ -0,0 +1,390 @@
+/*
+ * memtrack_trace_decode.c -- decoder for the binary allocation trace files written by
+ *                            memtrack built with the MEMTRACK_TRACE macro
+ * version 0.9.3, June 15, 2025
+ *
+ * License: zlib License
+ *
+ * Copyright (c) 2025 Kazushi Yamasaki
+ *
+ * This software is provided ‘as-is’, without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source
+ * distribution.
+ *
+ *
+ *
+ * Usage:
+ *     memtrack_trace_decode [-l] [-t seconds] trace_file
+ *
+ * Without -l, the records still held in the ring are printed in the order they were
+ * reserved. With -l, the blocks alive at the end of the trace are printed instead,
+ * oldest first. -t limits both to the records up to the given number of seconds
+ * (with up to 9 decimal places) since the trace was started.
+ *
+ * Only the records left in the ring are known, so after the ring has wrapped around,
+ * blocks allocated before the oldest record are missing from the live set, and updates
+ * and frees of such blocks are counted as unmatched.
+ */
+
+#include "memtrack_trace.h"
+#include "mhashtable.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+#define NANOSECONDS_PER_SECOND 1000000000ULL
+#define LIVE_TABLE_SIZE 1024
+
+
+/* 読み込んだトレースファイル */
+typedef struct {
+	MemTrackTraceHeader* header;
+	MemTrackTraceSite* sites;
+	MemTrackTraceRecord* records;
+	size_t length;
+} TraceFile;
+
+
+static void usage (const char* name) {
+	fprintf(stderr, "Usage: %s [-l] [-t seconds] trace_file\n", name);
+}
+
+
+/* "秒[.小数部]" をナノ秒に変換する */
+static bool parse_time (const char* text, uint64_t* result) {
+	uint64_t seconds = 0;
+	uint64_t nanoseconds = 0;
+	const char* p = text;
+
+	if (*p < '0' || *p > '9') return false;
+	for (; *p >= '0' && *p <= '9'; p++) {
+		if (seconds > (UINT64_MAX / NANOSECONDS_PER_SECOND) / 10) return false;
+		seconds = seconds * 10 + (uint64_t)(*p - '0');
+	}
+
+	if (*p == '.') {
+		uint64_t scale = NANOSECONDS_PER_SECOND / 10;
+		for (p++; *p >= '0' && *p <= '9'; p++) {
+			nanoseconds += (uint64_t)(*p - '0') * scale;  /* 10 桁目以降は切り捨てる */
+			scale /= 10;
+		}
+	}
+	if (*p != '\0') return false;
+
+	*result = seconds * NANOSECONDS_PER_SECOND + nanoseconds;
+	return true;
+}
+
+
+static bool trace_open (const char* path, TraceFile* trace) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		fprintf(stderr, "Failed to get the size of %s: %s\n", path, strerror(errno));
+		close(fd);
+		return false;
+	}
+	if (st.st_size < (off_t)sizeof(MemTrackTraceHeader)) {
+		fprintf(stderr, "%s is not a memtrack trace file.\n", path);
+		close(fd);
+		return false;
+	}
+
+	size_t length = (size_t)st.st_size;
+	void* map = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+	int tmp_errno = errno;
+	close(fd);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "Failed to map %s: %s\n", path, strerror(tmp_errno));
+		return false;
+	}
+
+	MemTrackTraceHeader* header = (MemTrackTraceHeader*)map;  /* 読み取り専用でマップしているため書き込まないこと */
+	if (header->magic != MEMTRACK_TRACE_MAGIC) {
+		fprintf(stderr, "%s is not a memtrack trace file.\n", path);
+		munmap(map, length);
+		return false;
+	}
+	if (header->version != MEMTRACK_TRACE_VERSION || header->record_size != sizeof(MemTrackTraceRecord) || header->site_size != sizeof(MemTrackTraceSite)) {
+		fprintf(stderr, "%s was written by an incompatible version or on a different kind of machine.\n", path);
+		munmap(map, length);
+		return false;
+	}
+
+	/* ヘッダーの値を信用する前に、各領域がファイルに収まっているかを確かめる */
+	uint64_t count = header->record_count;
+	bool valid = count != 0 && (count & (count - 1)) == 0 && header->site_count != 0 &&
+			header->site_offset >= sizeof(MemTrackTraceHeader) && header->site_offset % _Alignof(MemTrackTraceSite) == 0 &&
+			header->record_offset % _Alignof(MemTrackTraceRecord) == 0 &&
+			header->site_count <= (length - header->site_offset) / sizeof(MemTrackTraceSite) &&
+			header->record_offset >= header->site_offset + header->site_count * sizeof(MemTrackTraceSite) &&
+			header->record_offset <= length && count <= (length - header->record_offset) / sizeof(MemTrackTraceRecord);
+	if (!valid) {
+		fprintf(stderr, "%s is broken.\n", path);
+		munmap(map, length);
+		return false;
+	}
+
+	trace->header = header;
+	trace->sites = (MemTrackTraceSite*)(void*)((char*)map + header->site_offset);
+	trace->records = (MemTrackTraceRecord*)(void*)((char*)map + header->record_offset);
+	trace->length = length;
+	return true;
+}
+
+
+static void trace_close (TraceFile* trace) {
+	munmap(trace->header, trace->length);
+	trace->header = NULL;
+}
+
+
+/* リングに残っている完成した記録を予約順に集める、書き込み途中や上書き済みの記録は数えるだけ */
+static MemTrackTraceRecord* trace_collect (const TraceFile* trace, uint64_t until, bool limited, size_t* count, uint64_t* incomplete) {
+	MemTrackTraceHeader* header = trace->header;
+	uint64_t next = atomic_load_explicit(&header->next, memory_order_acquire);
+	uint64_t first = (next > header->record_count) ? next - header->record_count : 0;
+
+	MemTrackTraceRecord* records = malloc(sizeof(MemTrackTraceRecord) * (size_t)(next - first + 1));
+	if (records == NULL) {
+		fprintf(stderr, "Memory allocation failed.\n");
+		return NULL;
+	}
+
+	size_t n = 0;
+	*incomplete = 0;
+	for (uint64_t pos = first; pos < next; pos++) {
+		MemTrackTraceRecord* record = &trace->records[pos & (header->record_count - 1)];
+		if (atomic_load_explicit(&record->seq, memory_order_acquire) != pos + 1) {
+			(*incomplete)++;
+			continue;
+		}
+
+		memcpy(&records[n], record, sizeof(MemTrackTraceRecord));
+		if (limited && records[n].time - header->start_monotonic > until) continue;
+		n++;
+	}
+
+	*count = n;
+	return records;
+}
+
+
+static void print_site (const TraceFile* trace, uint32_t site) {
+	if (site == 0 || site > trace->header->site_count) {
+		printf("(unknown)");
+		return;
+	}
+
+	MemTrackTraceSite* slot = &trace->sites[site - 1];
+	if (atomic_load_explicit(&slot->state, memory_order_acquire) != MEMTRACK_TRACE_SITE_READY) {
+		printf("(site %u)", site);
+		return;
+	}
+
+	char file[MEMTRACK_TRACE_FILE_SIZE];
+	memcpy(file, slot->file, sizeof(file));
+	file[sizeof(file) - 1] = '\0';
+	printf("%s:%d", file, slot->line);
+}
+
+
+static void print_time (const TraceFile* trace, uint64_t time) {
+	uint64_t elapsed = time - trace->header->start_monotonic;
+	printf("%llu.%09llu", (unsigned long long)(elapsed / NANOSECONDS_PER_SECOND), (unsigned long long)(elapsed % NANOSECONDS_PER_SECOND));
+}
+
+
+static void print_summary (const TraceFile* trace, size_t count, uint64_t incomplete) {
+	MemTrackTraceHeader* header = trace->header;
+
+	char started[64] = "(unknown)";
+	time_t seconds = (time_t)(header->start_realtime / NANOSECONDS_PER_SECOND);
+	struct tm tm;
+	if (gmtime_r(&seconds, &tm) != NULL) strftime(started, sizeof(started), "%Y-%m-%d %H:%M:%S UTC", &tm);
+
+	uint64_t next = atomic_load_explicit(&header->next, memory_order_acquire);
+	uint32_t flags = atomic_load_explicit(&header->flags, memory_order_acquire);
+
+	printf("Started: %s\n", started);
+	printf("Records: %llu written, %llu kept in the ring, %zu decoded, %llu incomplete\n", (unsigned long long)next, (unsigned long long)header->record_count, count, (unsigned long long)incomplete);
+	printf("Ended: %s\n\n", (flags & MEMTRACK_TRACE_EXITED) ? "at exit" : "without reaching exit (crashed or still running)");
+}
+
+
+static void print_timeline (const TraceFile* trace, const MemTrackTraceRecord* records, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		const MemTrackTraceRecord* record = &records[i];
+		print_time(trace, record->time);
+		printf("  T%-4u ", record->thread);
+
+		switch (record->op) {
+			case MEMTRACK_TRACE_ADD:
+				printf("add     0x%llx  %llu bytes  ", (unsigned long long)record->ptr, (unsigned long long)record->size);
+				break;
+			case MEMTRACK_TRACE_UPDATE:
+				printf("update  0x%llx -> 0x%llx  %llu bytes  ", (unsigned long long)record->old_ptr, (unsigned long long)record->ptr, (unsigned long long)record->size);
+				break;
+			case MEMTRACK_TRACE_FREE:
+				printf("free    0x%llx  ", (unsigned long long)record->ptr);
+				break;
+			default:
+				printf("op %u  0x%llx  ", record->op, (unsigned long long)record->ptr);
+				break;
+		}
+
+		print_site(trace, record->site);
+		putchar('\n');
+	}
+}
+
+
+static int compare_time (const void* a, const void* b) {
+	const MemTrackTraceRecord* ra = *(const MemTrackTraceRecord* const*)a;
+	const MemTrackTraceRecord* rb = *(const MemTrackTraceRecord* const*)b;
+	if (ra->time != rb->time) return (ra->time < rb->time) ? -1 : 1;
+	return (ra->seq < rb->seq) ? -1 : (ra->seq > rb->seq);
+}
+
+
+/* 記録を順に適用して、最後の時点で生存しているブロックの一覧を作る */
+static bool print_live (const TraceFile* trace, const MemTrackTraceRecord* records, size_t count) {
+	HashTable* live = ht_create(LIVE_TABLE_SIZE);
+	if (live == NULL) {
+		fprintf(stderr, "Failed to create a hash table.\n");
+		return false;
+	}
+
+	size_t unmatched = 0;
+	for (size_t i = 0; i < count; i++) {
+		const MemTrackTraceRecord* record = &records[i];
+		switch (record->op) {
+			case MEMTRACK_TRACE_UPDATE:
+				if (!ht_delete(live, (key_type)record->old_ptr)) unmatched++;
+				/* fall through */
+			case MEMTRACK_TRACE_ADD:
+				if (!ht_set(live, (key_type)record->ptr, record, sizeof(MemTrackTraceRecord))) {
+					fprintf(stderr, "Failed to add an entry to the hash table.\n");
+					ht_destroy(live);
+					return false;
+				}
+				break;
+			case MEMTRACK_TRACE_FREE:
+				if (!ht_delete(live, (key_type)record->ptr)) unmatched++;
+				break;
+			default:
+				break;
+		}
+	}
+
+	size_t live_count = 0;
+	MemTrackTraceRecord** blocks = (MemTrackTraceRecord**)ht_all_get(live, &live_count);
+	if (blocks == NULL && live_count != 0) {
+		fprintf(stderr, "Failed to get all entries from the hash table.\n");
+		ht_destroy(live);
+		return false;
+	}
+
+	if (live_count != 0) qsort(blocks, live_count, sizeof(MemTrackTraceRecord*), compare_time);
+
+	unsigned long long live_bytes = 0;
+	for (size_t i = 0; i < live_count; i++) {
+		const MemTrackTraceRecord* record = blocks[i];
+		live_bytes += record->size;
+
+		printf("0x%llx  %llu bytes  T%u  since ", (unsigned long long)record->ptr, (unsigned long long)record->size, record->thread);
+		print_time(trace, record->time);
+		printf("  ");
+		print_site(trace, record->site);
+		putchar('\n');
+	}
+	printf("\n%zu blocks alive, %llu bytes in total\n", live_count, live_bytes);
+	if (unmatched != 0)
+		printf("%zu updates or frees of blocks that are not in the ring\n", unmatched);
+
+	if (blocks != NULL) ht_all_release_arr(blocks);
+	ht_destroy(live);
+	return true;
+}
+
+
+int main (int argc, char** argv) {
+	bool list_live = false;
+	bool limited = false;
+	uint64_t until = 0;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "lt:")) != -1) {
+		switch (opt) {
+			case 'l':
+				list_live = true;
+				break;
+			case 't':
+				if (!parse_time(optarg, &until)) {
+					fprintf(stderr, "Invalid time: %s\n", optarg);
+					return EXIT_FAILURE;
+				}
+				limited = true;
+				break;
+			default:
+				usage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	if (optind + 1 != argc) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	TraceFile trace;
+	if (!trace_open(argv[optind], &trace)) return EXIT_FAILURE;
+
+	size_t count;
+	uint64_t incomplete;
+	MemTrackTraceRecord* records = trace_collect(&trace, until, limited, &count, &incomplete);
+	if (records == NULL) {
+		trace_close(&trace);
+		return EXIT_FAILURE;
+	}
+
+	print_summary(&trace, count, incomplete);
+
+	bool ok = true;
+	if (list_live)
+		ok = print_live(&trace, records, count);
+	else
+		print_timeline(&trace, records, count);
+
+	free(records);
+	trace_close(&trace);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,372 @@
+/*
+ * memtrack_preload.c -- LD_PRELOAD interposer that sends every malloc, calloc,
+ *                       realloc, free, aligned_alloc and posix_memalign of a process
+ *                       into memtrack
+ * version 0.9.3, June 15, 2025
+ *
+ * License: zlib License
+ *
+ * Copyright (c) 2025 Kazushi Yamasaki
+ *
+ * This software is provided ‘as-is’, without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source
+ * distribution.
+ *
+ *
+ *
+ * Usage:
+ *     make preload [LIB_MODE=debug] [LIB_FEATURES="..."]
+ *     LD_PRELOAD=./preload/libmemtrack_preload.so program [args...]
+ *
+ * The shared library is built by "make preload" from memtrack.c and this file with
+ * the same LIB_MODE and LIB_FEATURES as the library, and MEMTRACK_SHARDED is always
+ * enabled, so no call ever takes the global lock (add 'sampling' to LIB_FEATURES to
+ * record only a part of the allocations). MEMTRACK_HEADER cannot be used because the
+ * process may free blocks that memtrack never saw.
+ *
+ * Every allocation made by the program and by the libraries it uses, including the C
+ * library itself, is recorded. The call sites are not known, so the blocks are
+ * recorded under the name of the replaced function (such as "(LD_PRELOAD malloc)")
+ * with line 0, and the statistics per call site become statistics per function. The
+ * exit handler runs in MEMTRACK_QUIT_SUMMARY mode, because the blocks still alive may
+ * be used by other exit handlers; it prints the blocks left at exit instead of
+ * freeing them.
+ *
+ * Calls made while memtrack itself is running on the same thread (for example a
+ * message printed by the library) go straight to the C library and are not recorded.
+ * Calls made before the functions of the C library have been looked up are served
+ * from a static buffer of MEMTRACK_PRELOAD_BOOTSTRAP_SIZE (default 64 KiB) bytes,
+ * which is never returned to the C library.
+ */
+
+#define _GNU_SOURCE  /* RTLD_NEXT */
+
+/* 標準関数を定義するため、memtrack.h のマクロでは置き換えない */
+#define MEMTRACK_DISABLE_REPLACE_STANDARD_FUNC
+
+#include "memtrack_preload.h"
+#include "memtrack.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <dlfcn.h>
+
+
+#if !defined (__STDC_VERSION__) || (__STDC_VERSION__ < 201112L)
+	#error "This program requires C11 or higher."
+#endif
+
+#ifdef MEMTRACK_DISABLE
+	#error "The interposer records allocations and cannot be built with MEMTRACK_DISABLE."
+#endif
+
+#ifndef MEMTRACK_PRELOAD
+	#error "The interposer must be built together with memtrack.c compiled with MEMTRACK_PRELOAD."
+#endif
+
+
+/* C の関数を探し終えるまでに使う静的な領域のバイト数 */
+#ifndef MEMTRACK_PRELOAD_BOOTSTRAP_SIZE
+	#define MEMTRACK_PRELOAD_BOOTSTRAP_SIZE (64 * 1024)
+#endif
+
+
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-macros"
+
+	#define LIKELY(x)   __builtin_expect(!!(x), 1)
+	#define UNLIKELY(x) __builtin_expect(!!(x), 0)
+
+#pragma GCC diagnostic pop
+#else
+	#define LIKELY(x)   (x)
+	#define UNLIKELY(x) (x)
+#endif
+
+
+#define MEMTRACK_PRELOAD_ALIGNMENT (alignof(max_align_t))
+
+/* 置き換えた関数の名前を呼び出し元として記録する、呼び出し元はファイル名のアドレスで区別される */
+static const char memtrack_preload_malloc_site[] = "(LD_PRELOAD malloc)";
+static const char memtrack_preload_calloc_site[] = "(LD_PRELOAD calloc)";
+static const char memtrack_preload_realloc_site[] = "(LD_PRELOAD realloc)";
+static const char memtrack_preload_free_site[] = "(LD_PRELOAD free)";
+static const char memtrack_preload_aligned_alloc_site[] = "(LD_PRELOAD aligned_alloc)";
+static const char memtrack_preload_posix_memalign_site[] = "(LD_PRELOAD posix_memalign)";
+
+
+/* 置き換える前の関数 */
+static void* (*memtrack_preload_malloc_func) (size_t size) = NULL;
+static void* (*memtrack_preload_calloc_func) (size_t count, size_t size) = NULL;
+static void* (*memtrack_preload_realloc_func) (void* ptr, size_t size) = NULL;
+static void (*memtrack_preload_free_func) (void* ptr) = NULL;
+static void* (*memtrack_preload_aligned_alloc_func) (size_t alignment, size_t size) = NULL;
+static int (*memtrack_preload_posix_memalign_func) (void** memptr, size_t alignment, size_t size) = NULL;
+
+#define MEMTRACK_PRELOAD_UNRESOLVED 0
+#define MEMTRACK_PRELOAD_RESOLVING 1
+#define MEMTRACK_PRELOAD_READY 2
+
+static atomic_int memtrack_preload_state = MEMTRACK_PRELOAD_UNRESOLVED;
+
+/* 0 でなければ、このスレッドは memtrack の中から呼び出している */
+static THREAD_LOCAL unsigned int memtrack_preload_depth = 0;
+
+
+/* 各ブロックの直前に要求されたバイト数を置き、解放されても再利用しない（静的な領域なので 0 で初期化済み） */
+static alignas(max_align_t) unsigned char memtrack_preload_bootstrap[MEMTRACK_PRELOAD_BOOTSTRAP_SIZE];
+static atomic_size_t memtrack_preload_bootstrap_used = 0;
+
+
+static void* memtrack_preload_bootstrap_alloc (size_t size) {
+	if (UNLIKELY(size > (MEMTRACK_PRELOAD_BOOTSTRAP_SIZE - MEMTRACK_PRELOAD_ALIGNMENT))) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	size_t needed = MEMTRACK_PRELOAD_ALIGNMENT + ((size + MEMTRACK_PRELOAD_ALIGNMENT - 1) & ~(MEMTRACK_PRELOAD_ALIGNMENT - 1));
+	size_t offset = atomic_fetch_add_explicit(&memtrack_preload_bootstrap_used, needed, memory_order_relaxed);
+	if (UNLIKELY(offset > (MEMTRACK_PRELOAD_BOOTSTRAP_SIZE - needed))) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	unsigned char* block = memtrack_preload_bootstrap + offset;
+	memcpy(block, &size, sizeof(size_t));
+	return block + MEMTRACK_PRELOAD_ALIGNMENT;
+}
+
+
+static inline bool memtrack_preload_is_bootstrap (const void* ptr) {
+	uintptr_t address = (uintptr_t)ptr;
+	uintptr_t begin = (uintptr_t)memtrack_preload_bootstrap;
+	return (address >= begin) && (address < begin + MEMTRACK_PRELOAD_BOOTSTRAP_SIZE);
+}
+
+
+static inline size_t memtrack_preload_bootstrap_size (const void* ptr) {
+	size_t size;
+	memcpy(&size, (const unsigned char*)ptr - MEMTRACK_PRELOAD_ALIGNMENT, sizeof(size_t));
+	return size;
+}
+
+
+/*
+ * C の関数を一度だけ探す、dlsym の中で確保された領域は静的な領域から切り出す
+ * memtrack の初期化と終了処理の登録も、ここで記録しない呼び出しとして済ませる
+ */
+static bool memtrack_preload_resolve (void) {
+	int expected = MEMTRACK_PRELOAD_UNRESOLVED;
+	if (!atomic_compare_exchange_strong_explicit(&memtrack_preload_state, &expected, MEMTRACK_PRELOAD_RESOLVING, memory_order_acq_rel, memory_order_acquire))
+		return (expected == MEMTRACK_PRELOAD_READY);  /* 他のスレッドが探している間は静的な領域を使う */
+
+	memtrack_preload_malloc_func = (void* (*) (size_t))dlsym(RTLD_NEXT, "malloc");
+	memtrack_preload_calloc_func = (void* (*) (size_t, size_t))dlsym(RTLD_NEXT, "calloc");
+	memtrack_preload_realloc_func = (void* (*) (void*, size_t))dlsym(RTLD_NEXT, "realloc");
+	memtrack_preload_free_func = (void (*) (void*))dlsym(RTLD_NEXT, "free");
+	memtrack_preload_aligned_alloc_func = (void* (*) (size_t, size_t))dlsym(RTLD_NEXT, "aligned_alloc");
+	memtrack_preload_posix_memalign_func = (int (*) (void**, size_t, size_t))dlsym(RTLD_NEXT, "posix_memalign");
+
+	if (UNLIKELY(memtrack_preload_malloc_func == NULL || memtrack_preload_calloc_func == NULL ||
+			memtrack_preload_realloc_func == NULL || memtrack_preload_free_func == NULL ||
+			memtrack_preload_aligned_alloc_func == NULL || memtrack_preload_posix_memalign_func == NULL)) {
+		static const char message[] = "memtrack_preload: failed to find the allocator of the C library.\n";
+		(void)!write(2, message, sizeof(message) - 1);  /* stdio は確保を伴う可能性がある */
+		abort();
+	}
+
+	atomic_store_explicit(&memtrack_preload_state, MEMTRACK_PRELOAD_READY, memory_order_release);
+
+	memtrack_preload_depth++;
+	memtrack_set_quit_mode(MEMTRACK_QUIT_SUMMARY);
+	memtrack_preload_depth--;
+	return true;
+}
+
+
+static inline bool memtrack_preload_ready (void) {
+	if (LIKELY(atomic_load_explicit(&memtrack_preload_state, memory_order_acquire) == MEMTRACK_PRELOAD_READY))
+		return true;
+	return memtrack_preload_resolve();
+}
+
+
+/*
+ * 静的な領域のブロックを realloc する、元のブロックはそのまま残す
+ * 公開している malloc を呼び返すと -fanalyzer が確保の重複を追えずリークと誤検知するため、確保先を直接選ぶ
+ */
+static void* memtrack_preload_bootstrap_realloc (void* ptr, size_t size) {
+	void* new_ptr;
+	if (UNLIKELY(!memtrack_preload_ready())) {
+		new_ptr = memtrack_preload_bootstrap_alloc(size);
+	} else {
+		new_ptr = memtrack_preload_malloc_func(size);
+		if (new_ptr != NULL && memtrack_preload_depth == 0) {
+			memtrack_preload_depth++;
+			memtrack_entry_add(new_ptr, size, memtrack_preload_realloc_site, 0);
+			memtrack_preload_depth--;
+		}
+	}
+
+	if (new_ptr != NULL) {
+		size_t old_size = memtrack_preload_bootstrap_size(ptr);
+		memcpy(new_ptr, ptr, (old_size < size) ? old_size : size);
+	}
+	return new_ptr;
+}
+
+
+void* memtrack_preload_real_malloc (size_t size) {
+	return memtrack_preload_malloc_func(size);
+}
+
+
+void* memtrack_preload_real_calloc (size_t count, size_t size) {
+	return memtrack_preload_calloc_func(count, size);
+}
+
+
+void* memtrack_preload_real_realloc (void* ptr, size_t size) {
+	return memtrack_preload_realloc_func(ptr, size);
+}
+
+
+void memtrack_preload_real_free (void* ptr) {
+	memtrack_preload_free_func(ptr);
+}
+
+
+void memtrack_preload_enter (void) {
+	memtrack_preload_depth++;
+}
+
+
+void memtrack_preload_leave (void) {
+	memtrack_preload_depth--;
+}
+
+
+void* malloc (size_t size) {
+	if (UNLIKELY(!memtrack_preload_ready())) return memtrack_preload_bootstrap_alloc(size);
+	if (memtrack_preload_depth != 0) return memtrack_preload_malloc_func(size);
+
+	memtrack_preload_depth++;
+	void* ptr = memtrack_malloc((size != 0) ? size : 1, memtrack_preload_malloc_site, 0);  /* malloc(0) も解放できる固有のポインタを返す */
+	memtrack_preload_depth--;
+	return ptr;
+}
+
+
+void* calloc (size_t count, size_t size) {
+	if (UNLIKELY(!memtrack_preload_ready())) {
+		if (UNLIKELY(count != 0 && size > (SIZE_MAX / count))) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		return memtrack_preload_bootstrap_alloc(count * size);
+	}
+	if (memtrack_preload_depth != 0) return memtrack_preload_calloc_func(count, size);
+
+	if (count == 0 || size == 0) {
+		count = 1;
+		size = 1;
+	}
+
+	memtrack_preload_depth++;
+	void* ptr = memtrack_calloc(count, size, memtrack_preload_calloc_site, 0);
+	memtrack_preload_depth--;
+	return ptr;
+}
+
+
+void* realloc (void* ptr, size_t size) {
+	if (UNLIKELY(memtrack_preload_is_bootstrap(ptr))) {
+		if (size == 0) return NULL;
+		return memtrack_preload_bootstrap_realloc(ptr, size);
+	}
+	if (UNLIKELY(!memtrack_preload_ready())) {
+		if (ptr != NULL) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		return memtrack_preload_bootstrap_alloc(size);
+	}
+	if (memtrack_preload_depth != 0) return memtrack_preload_realloc_func(ptr, size);
+
+	memtrack_preload_depth++;
+	void* new_ptr;
+	if (size == 0 && ptr != NULL) {  /* C ライブラリと同じく解放して NULL を返す */
+		memtrack_free(ptr, memtrack_preload_realloc_site, 0);
+		new_ptr = NULL;
+	} else {
+		new_ptr = memtrack_realloc(ptr, (size != 0) ? size : 1, memtrack_preload_realloc_site, 0);
+	}
+	memtrack_preload_depth--;
+	return new_ptr;
+}
+
+
+void free (void* ptr) {
+	if (ptr == NULL || UNLIKELY(memtrack_preload_is_bootstrap(ptr))) return;
+	if (UNLIKELY(!memtrack_preload_ready())) return;  /* 探し終える前に C ライブラリから確保されたブロックはない */
+	if (memtrack_preload_depth != 0) {
+		memtrack_preload_free_func(ptr);
+		return;
+	}
+
+	memtrack_preload_depth++;
+	memtrack_free(ptr, memtrack_preload_free_site, 0);
+	memtrack_preload_depth--;
+}
+
+
+void* aligned_alloc (size_t alignment, size_t size) {
+	if (UNLIKELY(!memtrack_preload_ready())) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	if (memtrack_preload_depth != 0) return memtrack_preload_aligned_alloc_func(alignment, size);
+
+	void* ptr = memtrack_preload_aligned_alloc_func(alignment, (size != 0) ? size : alignment);
+	if (ptr != NULL) {
+		memtrack_preload_depth++;
+		memtrack_entry_add(ptr, size, memtrack_preload_aligned_alloc_site, 0);
+		memtrack_preload_depth--;
+	}
+	return ptr;
+}
+
+
+int posix_memalign (void** memptr, size_t alignment, size_t size) {
+	if (UNLIKELY(!memtrack_preload_ready())) return ENOMEM;
+	if (memtrack_preload_depth != 0) return memtrack_preload_posix_memalign_func(memptr, alignment, size);
+
+	int result = memtrack_preload_posix_memalign_func(memptr, alignment, (size != 0) ? size : alignment);
+	if (result == 0) {
+		memtrack_preload_depth++;
+		memtrack_entry_add(*memptr, size, memtrack_preload_posix_memalign_site, 0);
+		memtrack_preload_depth--;
+	}
+	return result;
+}
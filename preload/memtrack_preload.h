@@ -0,0 +1,63 @@
+/*
+ * memtrack_preload.h -- functions shared between memtrack.c and the LD_PRELOAD
+ *                       interposer when the library is built with MEMTRACK_PRELOAD
+ * version 0.9.3, June 15, 2025
+ *
+ * License: zlib License
+ *
+ * Copyright (c) 2025 Kazushi Yamasaki
+ *
+ * This software is provided ‘as-is’, without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgment in the product documentation would be
+ * appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source
+ * distribution.
+ *
+ *
+ *
+ * These functions call the allocator that the interposer replaced. memtrack.c uses
+ * them instead of malloc, calloc, realloc and free, so that both its own memory and
+ * the blocks it tracks come from the C library and never pass through the
+ * interposer again. memtrack.c also marks the code that runs outside any call to the
+ * interposer (the exit handler, thread exit handlers, and the reporter thread), so
+ * that the allocations made there by the C library are not tracked either.
+ */
+
+#pragma once
+
+#ifndef MEMTRACK_PRELOAD_H
+#define MEMTRACK_PRELOAD_H
+
+
+#include <stddef.h>
+
+
+extern void* memtrack_preload_real_malloc (size_t size);
+
+extern void* memtrack_preload_real_calloc (size_t count, size_t size);
+
+extern void* memtrack_preload_real_realloc (void* ptr, size_t size);
+
+extern void memtrack_preload_real_free (void* ptr);
+
+
+/* between memtrack_preload_enter and memtrack_preload_leave, the allocations of the calling thread go straight to the C library */
+extern void memtrack_preload_enter (void);
+
+extern void memtrack_preload_leave (void);
+
+
+#endif